@@ -0,0 +1,110 @@
+#ifndef CONTENT_INDEX_H
+#define CONTENT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "ff.h"
+#include "storage.h"
+
+// =========================================================================
+// == Content Index
+// == Maps the SHA-256 of files uploaded over FTP or HTTP to where they
+// == were stored, so a client can ask whether the device already has a
+// == picture before sending it. The hash is computed while the upload
+// == streams through, never by reading the file back.
+// ==
+// == The index is an append-only file in FrameFi's data directory:
+// ==
+// ==   <sha256 hex><TAB><size><TAB><FAT date and time><TAB><path>
+// ==
+// == Only the first four bytes of each hash and the line's offset are
+// == kept in RAM. A lookup reads the candidate lines back and checks that
+// == the file is still there with the same size and timestamp, so files
+// == changed or removed by any route simply stop matching.
+// == Every call must hold the FAT lock.
+// =========================================================================
+
+// --- Set to 0 to build without hashing uploads ---
+#ifndef CONTENT_INDEX_ENABLED
+  #define CONTENT_INDEX_ENABLED 1
+#endif
+
+// --- Where the index is kept, relative to the card root ---
+#ifndef CONTENT_INDEX_PATH
+  #define CONTENT_INDEX_PATH STORAGE_DATA_DIR "/hashes.tsv"
+#endif
+
+// --- Lines kept before the file is compacted; each costs 8 bytes of RAM ---
+#ifndef CONTENT_INDEX_MAX_ENTRIES
+  #define CONTENT_INDEX_MAX_ENTRIES 4096
+#endif
+
+#define CONTENT_HASH_SIZE 32
+#define CONTENT_HASH_HEX_SIZE (CONTENT_HASH_SIZE * 2 + 1)
+
+class ContentIndex {
+public:
+  ContentIndex();
+
+  /**
+   * @brief Records that the file at path holds content with the given hash.
+   */
+  bool record(const char* path, const uint8_t* sha256);
+
+  /**
+   * @brief Finds a file with the given content. Fills path and size and returns true on a hit.
+   */
+  bool find(const uint8_t* sha256, char* path, size_t pathSize, uint32_t* size);
+
+  /**
+   * @brief Drops what is in RAM; the file is read again on next use. Call after the host had the card.
+   */
+  void reset();
+
+  /**
+   * @brief Returns the number of lines in the index file.
+   */
+  uint32_t entryCount() const { return slots.size(); }
+
+private:
+  struct Slot {
+    uint32_t key;     // First four bytes of the hash
+    uint32_t offset;  // Start of the line in the index file
+  };
+
+  struct Entry {
+    uint8_t sha256[CONTENT_HASH_SIZE];
+    uint32_t size;
+    uint32_t stamp;
+    char path[FF_MAX_LFN + 1];
+  };
+
+  bool ensureLoaded();
+  bool readEntry(FIL* file, uint32_t offset, Entry& entry);
+  bool isCurrent(const Entry& entry);
+  bool compact();
+  bool appendLine(const char* line, size_t length);
+
+  std::vector<Slot> slots;
+  uint32_t fileSize;  // Length of the index file, where the next line goes
+  bool loaded;
+  Entry scratch;      // Shared by lookups to keep the stack small
+  char line[FF_MAX_LFN + 96];
+};
+
+/**
+ * @brief Writes a hash as lowercase hex; out must hold CONTENT_HASH_HEX_SIZE bytes.
+ */
+void formatContentHash(const uint8_t* sha256, char* out);
+
+/**
+ * @brief Parses a 64 character hex hash. Returns false if it is malformed.
+ */
+bool parseContentHash(const char* hex, uint8_t* sha256);
+
+extern ContentIndex contentIndex;
+
+#endif // CONTENT_INDEX_H
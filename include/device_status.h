@@ -0,0 +1,103 @@
+#ifndef DEVICE_STATUS_H
+#define DEVICE_STATUS_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// =========================================================================
+// == Device Status
+// == One versioned DeviceInfo snapshot shared by the HTTP API, MQTT and
+// == the display. A background task refreshes it when asked and on a
+// == slow timer; readers copy it without taking a lock (seqlock), so a
+// == status request never waits on the card or the network stack.
+// =========================================================================
+
+// --- Data Structure for Device Information ---
+struct DeviceInfo {
+  // Mode and Display
+  const char* modeString;
+  bool isInMscMode;
+  const char* displayStatus;
+  bool isDisplayOn;
+  int displayOrientation;
+
+  // Network
+  char ipAddress[16];
+  char macAddress[18];
+
+  // SD Card
+  int fileCount;
+  uint64_t totalSize;
+  uint64_t usedSize;
+  uint64_t freeSize;
+
+  // MQTT
+  int mqttState;
+  bool mqttConnected;
+  bool isMqttEnabled;
+
+  // LED
+  const char* ledColor;
+  int ledBrightness;
+};
+
+// --- Refresh period for state nobody reports, like Wi-Fi and MQTT links ---
+#ifndef STATUS_REFRESH_MS
+  #define STATUS_REFRESH_MS 5000
+#endif
+
+// --- Core the refresh task runs on ---
+#ifndef STATUS_TASK_CORE
+  #define STATUS_TASK_CORE 0
+#endif
+
+class DeviceStatus {
+public:
+  typedef void (*Collector)(DeviceInfo& info);
+
+  DeviceStatus();
+
+  /**
+   * @brief Takes a first snapshot and starts the refresh task.
+   */
+  bool begin(Collector collector);
+
+  /**
+   * @brief Collects and publishes a snapshot on the calling task.
+   */
+  void refresh();
+
+  /**
+   * @brief Asks the refresh task for a new snapshot without waiting for it.
+   */
+  void requestRefresh();
+
+  /**
+   * @brief Copies the latest snapshot and returns its version.
+   */
+  uint32_t read(DeviceInfo& info) const;
+
+  /**
+   * @brief Returns a number that changes whenever the snapshot contents change.
+   */
+  uint32_t version() const { return contentVersion; }
+
+private:
+  static void taskEntry(void* arg);
+  void runTask();
+  void publish(const DeviceInfo& info);
+
+  Collector collect;
+  DeviceInfo snapshot;
+  volatile uint32_t sequence;        // odd while the snapshot is being written
+  volatile uint32_t contentVersion;  // bumped only when the contents differ
+  SemaphoreHandle_t writerMutex;     // refresh() and the task may both publish
+  TaskHandle_t task;
+};
+
+extern DeviceStatus deviceStatus;
+
+#endif // DEVICE_STATUS_H
@@ -0,0 +1,189 @@
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "ff.h"
+
+// =========================================================================
+// == File Batch
+// == A list of delete, rename and mkdir operations run as one job on the
+// == storage task, so clearing out an album costs one HTTP request instead
+// == of an FTP round trip per file:
+// ==   - The job runs a few operations per hold of the FAT lock, so FTP
+// ==     and uploads keep moving while a long batch is in progress.
+// ==   - Each operation gets its own FatFs result; one failure does not
+// ==     stop the rest.
+// ==   - The file index is updated once, when the job finishes.
+// == Only one job exists at a time. Its results stay readable until the
+// == next job is prepared.
+// =========================================================================
+
+// --- Most operations accepted in one job ---
+#ifndef FILE_BATCH_MAX_OPS
+  #define FILE_BATCH_MAX_OPS 1000
+#endif
+
+// --- Largest request body accepted by POST /files/batch ---
+#ifndef FILE_BATCH_MAX_BODY
+  #define FILE_BATCH_MAX_BODY (64 * 1024)
+#endif
+
+// --- How often the progress of a running job is published over MQTT ---
+#ifndef FILE_BATCH_PROGRESS_MS
+  #define FILE_BATCH_PROGRESS_MS 1000
+#endif
+
+// --- Operations run per hold of the FAT lock ---
+#ifndef FILE_BATCH_STEP
+  #define FILE_BATCH_STEP 8
+#endif
+
+enum BatchOpType : uint8_t {
+  BATCH_DELETE,  // Delete a file or an empty directory
+  BATCH_RENAME,  // Rename or move a file or directory
+  BATCH_MKDIR,   // Create a directory and any missing parents
+};
+
+enum BatchState : uint8_t {
+  BATCH_IDLE,     // No job yet
+  BATCH_PENDING,  // Operations are being added
+  BATCH_RUNNING,  // The storage task is working through the job
+  BATCH_DONE,     // Every operation has a result
+};
+
+class FileBatch {
+public:
+  FileBatch();
+
+  /**
+   * @brief Drops the previous job and starts collecting a new one. Fails while a job is running.
+   */
+  bool prepare(size_t count);
+
+  /**
+   * @brief Appends an operation; to is only used by renames. Returns false if a path is unsafe.
+   */
+  bool add(BatchOpType type, const char* path, const char* to);
+
+  /**
+   * @brief Hands the collected operations to the storage task and returns the job id.
+   */
+  uint32_t start();
+
+  /**
+   * @brief Drops a job that was prepared but not started.
+   */
+  void cancel();
+
+  /**
+   * @brief Runs the next few operations. Called by the storage task while a job is running.
+   */
+  void runStep();
+
+  /**
+   * @brief Returns true while the storage task has work to do.
+   */
+  bool isRunning() const { return state == BATCH_RUNNING; }
+
+  /**
+   * @brief Returns the state of the current job.
+   */
+  BatchState currentState() const { return state; }
+
+  /**
+   * @brief Returns the id of the current job, or 0 if there is none.
+   */
+  uint32_t id() const { return jobId; }
+
+  /**
+   * @brief Returns the number of operations in the job.
+   */
+  uint32_t total() const { return ops.size(); }
+
+  /**
+   * @brief Returns the number of operations that have a result.
+   */
+  uint32_t done() const { return completed; }
+
+  /**
+   * @brief Returns the number of operations that failed so far.
+   */
+  uint32_t failed() const { return failures; }
+
+  /**
+   * @brief Returns a counter that changes whenever the job makes progress.
+   */
+  uint32_t version() const { return progress; }
+
+  /**
+   * @brief Returns the elapsed run time of the job in milliseconds.
+   */
+  uint32_t elapsedMs() const;
+
+  /**
+   * @brief Accessors for finished operations; index must be below done().
+   */
+  BatchOpType opType(size_t index) const { return (BatchOpType)ops[index].type; }
+  const char* opPath(size_t index) const { return &names[ops[index].path]; }
+  const char* opTarget(size_t index) const { return &names[ops[index].to]; }
+  FRESULT opResult(size_t index) const { return (FRESULT)ops[index].result; }
+
+private:
+  struct Op {
+    uint32_t path;  // Offset of the path in names
+    uint32_t to;    // Offset of the rename target in names
+    uint8_t type;
+    uint8_t result;
+  };
+
+  FRESULT runOp(const Op& op);
+  FRESULT makeDirectories(const char* path);
+  uint32_t addName(const char* name);
+  void finish();
+
+  std::vector<Op> ops;
+  std::vector<char> names;  // NUL separated paths as the client sent them
+  volatile BatchState state;
+  volatile uint32_t completed;
+  volatile uint32_t progress;
+  uint32_t failures;
+  uint32_t jobId;
+  uint32_t startMs;
+  uint32_t endMs;
+
+  // --- Index changes gathered while running, applied once at the end ---
+  uint32_t deletedFiles;
+  uint64_t deletedBytes;
+  bool pathsChanged;
+
+  char fullPath[FF_MAX_LFN + 8];
+  char fullTarget[FF_MAX_LFN + 8];
+};
+
+/**
+ * @brief Looks up an operation by its API name ("delete", "rename" or "mkdir").
+ */
+bool batchOpFromName(const char* name, BatchOpType& type);
+
+/**
+ * @brief Returns the API name of an operation.
+ */
+const char* batchOpName(BatchOpType type);
+
+/**
+ * @brief Returns the API name of a job state.
+ */
+const char* batchStateName(BatchState state);
+
+/**
+ * @brief Returns a short name for an operation's result, as used by the API.
+ */
+const char* batchResultName(FRESULT result);
+
+extern FileBatch fileBatch;
+
+#endif // FILE_BATCH_H
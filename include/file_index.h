@@ -0,0 +1,141 @@
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ff.h"
+
+// =========================================================================
+// == File Index
+// == Keeps the file count and total file size of the card so status calls
+// == don't have to walk the whole directory tree. The index is built once
+// == per mount by scanning with FatFs and then kept current:
+// ==   - FTP and HTTP uploads report each change incrementally.
+// ==   - In MSC mode the host writes raw sectors, so the index remembers
+// ==     which sectors hold directory entries and is only invalidated when
+// ==     the host writes one of them.
+// == Every change bumps a generation counter so caches built from the
+// == card (such as the manifest) can tell when they are out of date.
+// == FrameFi's own data directory is left out of the counts.
+// == A rebuild takes the FAT lock itself, one directory or batch of
+// == entries at a time, so transfers and mode switches are never held up
+// == for a whole scan; a change made in between leaves the index stale.
+// =========================================================================
+
+// --- Maximum number of directory sector ranges tracked for MSC invalidation ---
+#ifndef FILE_INDEX_MAX_RANGES
+  #define FILE_INDEX_MAX_RANGES 256
+#endif
+
+// --- Deepest directory level scanned ---
+#ifndef FILE_INDEX_MAX_DEPTH
+  #define FILE_INDEX_MAX_DEPTH 16
+#endif
+
+// --- Directory entries read per hold of the FAT lock ---
+#ifndef FILE_INDEX_BATCH
+  #define FILE_INDEX_BATCH 64
+#endif
+
+// --- FatFs logical drive holding the card ---
+#ifndef FILE_INDEX_DRIVE
+  #define FILE_INDEX_DRIVE "0:"
+#endif
+
+class FileIndex {
+public:
+  FileIndex();
+
+  /**
+   * @brief Scans the card and rebuilds the index and the directory sector map. The caller must not hold the FAT lock.
+   */
+  bool rebuild();
+
+  /**
+   * @brief Marks the index as stale so the next ensureValid() rescans.
+   */
+  void invalidate() {
+    valid = false;
+    changes++;
+  }
+
+  /**
+   * @brief Rebuilds the index if it is stale.
+   */
+  bool ensureValid() { return valid || rebuild(); }
+
+  /**
+   * @brief Returns true if the counts reflect the card.
+   */
+  bool isValid() const { return valid; }
+
+  /**
+   * @brief Records a file that was created or rewritten.
+   */
+  void fileStored(bool existed, uint32_t oldSize, uint32_t newSize);
+
+  /**
+   * @brief Records a file that was deleted.
+   */
+  void fileDeleted(uint32_t size);
+
+  /**
+   * @brief Records several deleted files at once, such as the result of a batch job.
+   */
+  void filesDeleted(uint32_t count, uint64_t size);
+
+  /**
+   * @brief Records a change that leaves the counts alone, such as a rename or a new directory.
+   */
+  void notePathChange() { changes++; }
+
+  /**
+   * @brief Invalidates the index if a raw sector write touches directory data.
+   */
+  void noteSectorWrite(uint32_t lba, uint32_t count);
+
+  /**
+   * @brief Returns the number of files on the card.
+   */
+  uint32_t fileCount() const { return files; }
+
+  /**
+   * @brief Returns the combined size of all files in bytes.
+   */
+  uint64_t totalBytes() const { return bytes; }
+
+  /**
+   * @brief Returns a counter that changes whenever the card's contents may have changed.
+   */
+  uint32_t generation() const { return changes; }
+
+private:
+  struct Range {
+    uint32_t lba;
+    uint32_t count;
+  };
+
+  bool scanDirectory(char* path, size_t length, uint8_t depth);
+  void addRange(uint32_t lba, uint32_t count);
+  void addCluster(uint32_t cluster);
+  void sortRanges();
+  bool touches(uint32_t lba, uint32_t count) const;
+
+  volatile bool valid;
+  volatile bool rebuilding;
+  volatile bool changedDuringRebuild;
+  volatile uint32_t changes;
+  bool watchAll;  // too many ranges to track; any write invalidates
+  uint32_t files;
+  uint64_t bytes;
+  Range ranges[FILE_INDEX_MAX_RANGES];
+  uint16_t rangeCount;
+  FATFS* volume;   // drive being scanned
+  FILINFO entry;   // shared by all scan levels to keep the stack small
+  char scanPath[FF_MAX_LFN * 2 + 4];
+};
+
+extern FileIndex fileIndex;
+
+#endif // FILE_INDEX_H
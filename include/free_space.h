@@ -0,0 +1,133 @@
+#ifndef FREE_SPACE_H
+#define FREE_SPACE_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ff.h"
+#include "sector_cache.h"
+#include "storage.h"
+
+// =========================================================================
+// == Free Space
+// == Keeps the free space of the card at hand so status calls never walk
+// == the allocation table:
+// ==   - The count FatFs read from FSINFO at mount is trusted.
+// ==   - FTP and HTTP writes and deletes go through FatFs, which keeps
+// ==     that count up to date cluster by cluster; it is picked up here.
+// ==   - Only a USB host write to the allocation table makes the count
+// ==     stale. A background task then counts the table again, many
+// ==     sectors per read, once the host has been quiet for a moment.
+// ==     Through the FAT layer the lock is only held for one read at a
+// ==     time; a count that sees the table change starts over later.
+// =========================================================================
+
+// --- How long host writes must have stopped before counting again ---
+#ifndef FREE_SPACE_SETTLE_MS
+  #define FREE_SPACE_SETTLE_MS 2000
+#endif
+
+// --- How often the task looks for a stale count ---
+#ifndef FREE_SPACE_CHECK_MS
+  #define FREE_SPACE_CHECK_MS 1000
+#endif
+
+// --- Sectors of the allocation table read at a time ---
+#ifndef FREE_SPACE_READ_SECTORS
+  #define FREE_SPACE_READ_SECTORS 32
+#endif
+
+// --- Core the free space task runs on ---
+#ifndef FREE_SPACE_TASK_CORE
+  #define FREE_SPACE_TASK_CORE 0
+#endif
+
+struct FreeSpaceStats {
+  uint32_t counts;       // Times the allocation table was counted
+  uint32_t lastCountMs;  // Time the last count took
+};
+
+class FreeSpaceTracker {
+public:
+  FreeSpaceTracker();
+
+  /**
+   * @brief Takes the count FatFs holds and starts the background task.
+   * Reads of the allocation table go through device.
+   */
+  bool begin(const BlockDevice& device);
+
+  /**
+   * @brief Returns the size and free space of the card. Never touches the card.
+   * Returns false until the free space is known.
+   */
+  bool read(uint64_t& totalBytes, uint64_t& freeBytes);
+
+  /**
+   * @brief Picks up the count FatFs keeps. Call with the FAT lock held.
+   */
+  void sample();
+
+  /**
+   * @brief Records a USB host write; writes to the allocation table make the count stale.
+   */
+  void noteHostWrite(uint32_t lba, uint32_t count);
+
+  /**
+   * @brief Hands the known count to the freshly claimed volume. Call with the FAT lock held,
+   * after storage.claimForFat().
+   */
+  void volumeClaimed();
+
+  /**
+   * @brief Returns true if no host write has happened since the count was taken.
+   */
+  bool isExact() const { return known && hostWrites == countedWrites; }
+
+  /**
+   * @brief Returns the counting counters.
+   */
+  const FreeSpaceStats& stats() const { return counters; }
+
+private:
+  // --- What a count through the FAT layer must find unchanged from run to run ---
+  struct VolumeMark {
+    FATFS* fs;
+    WORD mount;
+    DWORD freeClusters;
+    DWORD lastCluster;
+    uint32_t generation;
+  };
+
+  static void taskEntry(void* arg);
+  void runTask();
+  bool loadGeometry(const FATFS* fs);
+  bool markVolume(VolumeMark& mark) const;
+  bool volumeUnchanged(const VolumeMark& mark) const;
+  bool count(bool fatLayer);
+  uint32_t countFree(const uint8_t* data, uint32_t bytes, uint32_t& entry) const;
+
+  BlockDevice dev;
+  TaskHandle_t task;
+  FreeSpaceStats counters;
+  volatile bool known;
+  volatile uint32_t freeClusters;
+  volatile uint32_t hostWrites;        // Host writes to the allocation table
+  volatile uint32_t lastHostWriteMs;
+  uint32_t countedWrites;              // Host writes the count already covers
+
+  // --- Geometry of the volume, as FatFs mounted it ---
+  uint8_t fsType;
+  uint16_t sectorBytes;
+  uint32_t clusterBytes;
+  uint32_t totalClusters;
+  uint32_t tableStart;                 // First sector of the FAT, or of the exFAT allocation bitmap
+  uint32_t tableSectors;
+  uint32_t tableEntries;               // FAT entries, or bitmap bits
+};
+
+extern FreeSpaceTracker freeSpace;
+
+#endif // FREE_SPACE_H
@@ -0,0 +1,69 @@
+#ifndef HTTP_FILES_H
+#define HTTP_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// =========================================================================
+// == HTTP File Helpers
+// == Range, ETag and content type handling for the endpoints that serve
+// == files from the card. Kept free of the web server so the parsing has
+// == no dependency on a request object.
+// =========================================================================
+
+// --- Reads are trimmed to end on this boundary so the next one starts aligned ---
+#ifndef HTTP_FILES_ALIGN
+  #define HTTP_FILES_ALIGN 512
+#endif
+
+// --- Room for a quoted "size-mtime" ETag ---
+#define HTTP_FILES_ETAG_SIZE 24
+
+struct ByteRange {
+  uint32_t start;
+  uint32_t length;
+};
+
+enum RangeResult {
+  RANGE_NONE,          // No usable Range header; send the whole file
+  RANGE_OK,            // range holds the requested bytes
+  RANGE_UNSATISFIABLE  // The range starts past the end of the file
+};
+
+/**
+ * @brief Parses a single "bytes=" Range header against a file of the given size.
+ */
+RangeResult parseRange(const char* header, uint32_t size, ByteRange& range);
+
+/**
+ * @brief Writes a quoted ETag built from the file size and modification time.
+ */
+void formatEtag(char* out, size_t outSize, uint32_t size, time_t mtime);
+
+/**
+ * @brief Returns true if an If-None-Match header matches the ETag.
+ */
+bool etagMatches(const char* header, const char* etag);
+
+/**
+ * @brief Returns the MIME type for a path based on its extension.
+ */
+const char* contentTypeFor(const char* path);
+
+/**
+ * @brief Shortens a read so that it ends on an HTTP_FILES_ALIGN boundary when it can.
+ */
+size_t alignedReadLength(uint32_t position, size_t length);
+
+/**
+ * @brief Returns true if the path is absolute and has no ".." segments.
+ */
+bool isSafePath(const char* path);
+
+/**
+ * @brief Percent-encodes a path for use in a URL, keeping the slashes. Returns false if out is too small.
+ */
+bool urlEncodePath(const char* path, char* out, size_t outSize);
+
+#endif // HTTP_FILES_H
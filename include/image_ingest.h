@@ -0,0 +1,171 @@
+#ifndef IMAGE_INGEST_H
+#define IMAGE_INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "ff.h"
+#include "storage.h"
+
+// =========================================================================
+// == Image Ingest
+// == Optionally shrinks JPEGs uploaded over FTP or HTTP to the frame's
+// == own resolution, so the card holds pictures the frame can show
+// == instead of 12 MP camera originals:
+// ==   - A task on the other core decodes the upload a row of MCUs at a
+// ==     time, letting the decoder do the coarse 1/2, 1/4 or 1/8 step.
+// ==   - The remaining step (always under 2:1) is a box filter that writes
+// ==     straight into two bands of encoder input, 16 rows each.
+// ==   - Each finished band is encoded to a new JPEG through an upload
+// ==     writer, which replaces the original only once it is complete.
+// ==   - The EXIF orientation is carried over, so portrait photos stay
+// ==     upright.
+// == The FAT lock is only held for each read and write, so transfers keep
+// == moving while a picture is converted. Files that fit already, are not
+// == baseline JPEGs or arrive while the queue is full are left as they are.
+// =========================================================================
+
+// --- Set to 0 to build without the ingest stage ---
+#ifndef IMAGE_INGEST_ENABLED
+  #define IMAGE_INGEST_ENABLED 1
+#endif
+
+// --- Defaults until changed through POST /ingest ---
+#ifndef INGEST_DEFAULT_WIDTH
+  #define INGEST_DEFAULT_WIDTH 1024
+#endif
+#ifndef INGEST_DEFAULT_HEIGHT
+  #define INGEST_DEFAULT_HEIGHT 600
+#endif
+#ifndef INGEST_DEFAULT_QUALITY
+  #define INGEST_DEFAULT_QUALITY 85
+#endif
+
+// --- Largest target accepted; bounds the band buffers ---
+#ifndef INGEST_MAX_DIMENSION
+  #define INGEST_MAX_DIMENSION 2048
+#endif
+
+// --- Where originals are moved when they are kept, relative to the card root ---
+#ifndef INGEST_ORIGINALS_DIR
+  #define INGEST_ORIGINALS_DIR STORAGE_DATA_DIR "/originals"
+#endif
+
+// --- Uploads waiting to be converted ---
+#ifndef INGEST_QUEUE_LENGTH
+  #define INGEST_QUEUE_LENGTH 8
+#endif
+
+// --- Core the ingest task runs on (HTTP, FTP and MQTT run on core 1) ---
+#ifndef INGEST_TASK_CORE
+  #define INGEST_TASK_CORE 0
+#endif
+
+// --- Rows in an encoder band; 4:2:0 MCUs are 16 pixels square ---
+#define INGEST_BAND_ROWS 16
+
+struct IngestConfig {
+  bool enabled;
+  uint16_t width;         // Largest width a picture is stored at
+  uint16_t height;        // Largest height a picture is stored at
+  uint8_t quality;        // 1-100, mapped onto the encoder's four levels
+  bool keepOriginals;     // Move originals to INGEST_ORIGINALS_DIR instead of deleting them
+};
+
+// --- Counters exposed through GET /ingest ---
+struct IngestStats {
+  uint32_t converted;     // Pictures replaced by a smaller copy
+  uint32_t skipped;       // Pictures left alone: small enough, progressive or not a JPEG
+  uint32_t failed;        // Conversions that could not finish; the original stays
+  uint32_t dropped;       // Uploads not queued because the queue was full
+  uint64_t bytesIn;       // Size of the converted originals
+  uint64_t bytesOut;      // Size of the copies that replaced them
+  uint32_t busyMs;        // Time spent converting
+  uint32_t lastMs;        // Time the last conversion took
+};
+
+class ImageIngest {
+public:
+  ImageIngest();
+
+  /**
+   * @brief Starts the ingest task.
+   */
+  bool begin();
+
+  /**
+   * @brief Replaces the configuration. Returns false if a value is out of range.
+   */
+  bool configure(const IngestConfig& newConfig);
+
+  /**
+   * @brief Returns the configuration in use.
+   */
+  const IngestConfig& config() const { return settings; }
+
+  /**
+   * @brief Queues a stored upload for conversion if it is a JPEG and ingest is on. Never blocks.
+   * sha256 is the hash of the upload if it is known; it is re-recorded for the smaller copy.
+   */
+  void submit(const char* path, const uint8_t* sha256);
+
+  /**
+   * @brief Returns the number of uploads waiting, including the one being converted.
+   */
+  uint32_t pending() const;
+
+  /**
+   * @brief Returns the ingest counters.
+   */
+  const IngestStats& stats() const { return counters; }
+
+private:
+  struct Job {
+    char path[FF_MAX_LFN + 1];
+    uint8_t sha256[32];
+    bool hashed;
+  };
+
+  enum Outcome : uint8_t { INGEST_CONVERTED, INGEST_SKIPPED, INGEST_FAILED };
+
+  static void taskEntry(void* arg);
+  static int drawCallback(struct jpeg_draw_tag* draw);
+  void runTask();
+  Outcome convert(const Job& job);
+  bool setupResize(int width, int height, uint8_t orientation, int& scale);
+  bool allocateBuffers();
+  void drawBlock(const uint16_t* pixels, int x, int y, int width, int height);
+  bool finishRows(int sourceRowEnd);
+  bool encodeBand();
+  bool replaceOriginal(const Job& job, const FILINFO& original, uint32_t& newSize);
+  void releaseBuffers();
+
+  IngestConfig settings;
+  IngestStats counters;
+  TaskHandle_t task;
+  QueueHandle_t queue;
+  volatile bool busy;
+
+  // --- State of the conversion in progress ---
+  struct Work;            // Decoder, encoder and output file, on the heap while converting
+  Work* work;
+  uint16_t* bands;        // Two bands of RGB565 encoder input, paddedWidth wide
+  uint16_t* columnMap;    // Output column of each decoded column
+  uint16_t carry[INGEST_BAND_ROWS];  // Left half of a column pair split across draw blocks
+  int sourceWidth;        // Decoded (already prescaled) size
+  int sourceHeight;
+  int outWidth;
+  int outHeight;
+  int paddedWidth;
+  int rowsDone;           // Output rows complete and copied into their band
+  int nextBand;           // Next band to encode
+  bool encodeFailed;
+};
+
+extern ImageIngest imageIngest;
+
+#endif // IMAGE_INGEST_H
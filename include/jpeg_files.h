@@ -0,0 +1,75 @@
+#ifndef JPEG_FILES_H
+#define JPEG_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "JPEGDEC.h" // https://github.com/bitbank2/JPEGDEC
+#include "JPEGENC.h" // https://github.com/bitbank2/JPEGENC
+#include "ff.h"
+#include "upload_writer.h"
+
+// =========================================================================
+// == JPEG Files
+// == Connects the JPEGDEC decoder and the JPEGENC encoder to the card for
+// == the tasks that convert pictures in the background:
+// ==   - Each file callback takes the FAT lock for that call only, so
+// ==     transfers keep moving while a picture is read or written.
+// ==   - Output goes through an upload writer, so a new file only shows
+// ==     up once it is complete.
+// ==   - The EXIF orientation of the source can be carried over.
+// == The name handed to a codec's open() is the first member of the file
+// == below, so the open callback finds its file without any shared state.
+// =========================================================================
+
+struct JpegSource {
+  char path[FF_MAX_LFN + 8];  // With the drive; must stay first
+  FIL file;
+  bool open;
+};
+
+struct JpegTarget {
+  char path[FF_MAX_LFN + 8];  // Relative to the card root; must stay first
+  UploadWriter writer;
+  uint8_t orientation;        // EXIF orientation to write after the JFIF header, or 0
+  bool started;               // The header has gone out
+  bool failed;
+};
+
+/**
+ * @brief Returns true for paths ending in .jpg or .jpeg.
+ */
+bool isJpegPath(const char* path);
+
+/**
+ * @brief Opens the JPEG at drivePath for decoding. Returns false if it cannot be read.
+ */
+bool openJpegSource(JPEGDEC& decoder, JpegSource& source, const char* drivePath, JPEG_DRAW_CALLBACK* draw);
+
+/**
+ * @brief Starts a new file at path and opens the encoder on it. Returns false if the card refused it.
+ */
+bool openJpegTarget(JPEGENC& encoder, JpegTarget& target, const char* path, uint8_t orientation);
+
+/**
+ * @brief Renames a complete target over its path, or deletes it. Call with the FAT lock held.
+ */
+bool finishJpegTarget(JpegTarget& target, bool complete);
+
+/**
+ * @brief Creates every missing parent directory of drivePath, a path that includes the drive.
+ * Call with the FAT lock held.
+ */
+void makeParentDirectories(char* drivePath);
+
+/**
+ * @brief Maps a 1-100 quality onto the encoder's four levels.
+ */
+uint8_t jpegEncoderQuality(uint8_t quality);
+
+/**
+ * @brief Allocates a pixel buffer, from PSRAM when the board has it.
+ */
+void* allocatePixelBuffer(size_t size);
+
+#endif // JPEG_FILES_H
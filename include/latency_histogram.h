@@ -0,0 +1,68 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+// =========================================================================
+// == Latency Histogram
+// == Fixed-size, allocation-free histogram of durations in microseconds.
+// == Bucket i counts samples below LATENCY_FIRST_BUCKET_US << i; the last
+// == bucket takes everything longer.
+// =========================================================================
+
+// --- Upper bound of the first bucket ---
+#ifndef LATENCY_FIRST_BUCKET_US
+  #define LATENCY_FIRST_BUCKET_US 128
+#endif
+
+// --- Number of buckets; each one doubles the bound of the previous ---
+#ifndef LATENCY_BUCKETS
+  #define LATENCY_BUCKETS 14
+#endif
+
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  /**
+   * @brief Adds one sample.
+   */
+  void record(uint32_t micros);
+
+  /**
+   * @brief Clears all samples.
+   */
+  void reset();
+
+  /**
+   * @brief Returns the number of samples recorded.
+   */
+  uint32_t count() const { return samples; }
+
+  /**
+   * @brief Returns the longest sample recorded.
+   */
+  uint32_t max() const { return longest; }
+
+  /**
+   * @brief Returns the sample count of a bucket.
+   */
+  uint32_t bucketCount(uint8_t bucket) const { return buckets[bucket]; }
+
+  /**
+   * @brief Returns the exclusive upper bound of a bucket, or 0 for the open-ended last one.
+   */
+  static uint32_t bucketLimit(uint8_t bucket);
+
+  /**
+   * @brief Returns the upper bound of the bucket holding the given percentile.
+   */
+  uint32_t percentile(uint8_t percent) const;
+
+private:
+  uint32_t buckets[LATENCY_BUCKETS];
+  uint32_t samples;
+  uint32_t longest;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,127 @@
+#ifndef LIST_CACHE_H
+#define LIST_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SimpleFTPServer.h>
+
+#include "ff.h"
+#include "storage.h"
+
+// =========================================================================
+// == List Cache
+// == Keeps the LIST and MLSD output of recently listed directories as
+// == files in FrameFi's data directory, so a client that lists the same
+// == folders again (lftp mirror, a sync tool) gets each one back in a few
+// == large reads instead of a walk of thousands of entries:
+// ==
+// ==   LIST /2025  ->  /.framefi/lists/3.lst
+// ==
+// == A listing is stored while it is first sent and is only served again
+// == while the file index generation is the one it was built at, so any
+// == change to the card (FTP, HTTP, batch jobs, the USB host) drops every
+// == stored listing at once. FAT does not update a directory's timestamp
+// == when its entries change, so the generation is the only safe key.
+// == The least recently used listing makes room for a new one. Runs on the
+// == network task with the FAT lock held, like the FTP server itself.
+// =========================================================================
+
+// --- Set to 0 to list every directory from the card ---
+#ifndef LIST_CACHE_ENABLED
+  #define LIST_CACHE_ENABLED 1
+#endif
+
+// --- Where stored listings are kept, relative to the card root ---
+#ifndef LIST_CACHE_DIR
+  #define LIST_CACHE_DIR STORAGE_DATA_DIR "/lists"
+#endif
+
+// --- Listings kept at once ---
+#ifndef LIST_CACHE_ENTRIES
+  #define LIST_CACHE_ENTRIES 16
+#endif
+
+// --- Smaller directories are listed from the card; walking them is cheap ---
+#ifndef LIST_CACHE_MIN_ENTRIES
+  #define LIST_CACHE_MIN_ENTRIES 64
+#endif
+
+struct ListCacheStats {
+  uint32_t hits;       // Listings sent from a stored copy
+  uint32_t misses;     // Listings walked on the card
+  uint32_t stored;     // Listings stored for next time
+  uint32_t evictions;  // Stored listings dropped to make room
+};
+
+class ListCache : public FtpListCache {
+public:
+  ListCache();
+
+  /**
+   * @brief Starts a listing. Returns true if a stored copy is current and will be read.
+   */
+  bool open(uint8_t session, char kind, const char* path, uint16_t* entries) override;
+
+  /**
+   * @brief Reads the next part of a stored listing. Returns 0 at its end and -1 on an error.
+   */
+  int32_t read(uint8_t session, uint8_t* buf, uint32_t size) override;
+
+  /**
+   * @brief Stores the next part of a listing that is being walked.
+   */
+  void append(uint8_t session, const uint8_t* data, uint32_t size, uint16_t entries) override;
+
+  /**
+   * @brief Ends a listing; a complete walk becomes the stored copy.
+   */
+  void close(uint8_t session, bool complete, uint16_t entries) override;
+
+  /**
+   * @brief Returns the hit and miss counters.
+   */
+  const ListCacheStats& stats() const { return counters; }
+
+private:
+  enum EntryState : uint8_t {
+    ENTRY_EMPTY,
+    ENTRY_WRITING,  // Being stored by a session
+    ENTRY_VALID,
+  };
+
+  struct Entry {
+    EntryState state;
+    char kind;             // 'L' for LIST and NLST, 'M' for MLSD
+    uint8_t readers;       // Sessions sending this copy
+    uint16_t entries;
+    uint32_t generation;   // File index generation the listing was walked at
+    uint32_t lastUsed;     // Use counter, for least recently used eviction
+    char path[FTP_CWD_SIZE];
+  };
+
+  struct Session {
+    int8_t entry;          // Entry being read or written, or -1
+    bool reading;          // Sending a stored copy
+    bool writing;          // Walking the card; the output may be stored
+    bool failed;           // The walk will not be stored
+    char kind;
+    uint32_t generation;   // File index generation when the walk started
+    FIL* file;             // Stored copy being read or written
+    char path[FTP_CWD_SIZE];
+  };
+
+  int8_t find(char kind, const char* path) const;
+  int8_t claim(char kind, const char* path);
+  void filePath(int8_t entry, char* out, size_t size) const;
+  void release(uint8_t session);
+
+  Entry table[LIST_CACHE_ENTRIES];
+  Session sessions[FTP_MAX_SESSIONS];
+  uint32_t useCounter;
+  ListCacheStats counters;
+};
+
+extern ListCache listCache;
+
+#endif // LIST_CACHE_H
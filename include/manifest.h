@@ -0,0 +1,85 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "storage.h"
+
+// =========================================================================
+// == Manifest
+// == A tab separated listing of every file on the card, kept as a file in
+// == FrameFi's data directory so a sync client can plan its work from one
+// == download instead of listing every directory over FTP:
+// ==
+// ==   # path<TAB>size<TAB>mtime
+// ==   /2025/beach.jpg<TAB>482113<TAB>1727054496
+// ==
+// == A background task rebuilds it once the file index generation has
+// == stopped changing for a moment, so a burst of uploads costs one scan.
+// =========================================================================
+
+// --- Where the manifest is kept, relative to the card root ---
+#ifndef MANIFEST_PATH
+  #define MANIFEST_PATH STORAGE_DATA_DIR "/manifest.tsv"
+#endif
+
+// --- How long the card must be quiet before rebuilding ---
+#ifndef MANIFEST_SETTLE_MS
+  #define MANIFEST_SETTLE_MS 2000
+#endif
+
+// --- Seconds a client is told to wait while the manifest is stale ---
+#ifndef MANIFEST_RETRY_AFTER_S
+  #define MANIFEST_RETRY_AFTER_S 3
+#endif
+
+// --- How often the task checks for changes ---
+#ifndef MANIFEST_CHECK_MS
+  #define MANIFEST_CHECK_MS 1000
+#endif
+
+// --- Directory entries read per hold of the FAT lock ---
+#ifndef MANIFEST_BATCH
+  #define MANIFEST_BATCH 64
+#endif
+
+// --- Core the manifest task runs on ---
+#ifndef MANIFEST_TASK_CORE
+  #define MANIFEST_TASK_CORE 0
+#endif
+
+class Manifest {
+public:
+  Manifest();
+
+  /**
+   * @brief Starts the background task that keeps the manifest current.
+   */
+  bool begin();
+
+  /**
+   * @brief Wakes the task to check for changes now. Safe from any task.
+   */
+  void requestRebuild();
+
+  /**
+   * @brief Returns true if the manifest file matches the card.
+   */
+  bool isCurrent() const;
+
+private:
+  static void taskEntry(void* arg);
+  void runTask();
+  bool rebuild();
+
+  TaskHandle_t task;
+  volatile bool built;
+  volatile uint32_t builtGeneration;
+};
+
+extern Manifest manifest;
+
+#endif // MANIFEST_H
@@ -0,0 +1,112 @@
+#ifndef MQTT_PUBLISHER_H
+#define MQTT_PUBLISHER_H
+
+#include <stdint.h>
+
+#include "device_status.h"
+
+// =========================================================================
+// == MQTT Publisher
+// == Publishes the status snapshot as one retained topic per attribute:
+// ==
+// ==   frame-fi/mode                 msc
+// ==   frame-fi/sd_card/file_count   412
+// ==   frame-fi/led/color            green
+// ==
+// == Every change to the snapshot is an event; events that arrive close
+// == together are coalesced, and only attributes whose value differs from
+// == what the broker already holds are sent. Nothing is sent on a timer.
+// == After a (re)connect every attribute is sent once, as the device may
+// == have changed while it was offline.
+// =========================================================================
+
+// --- Prefix of every attribute topic ---
+#ifndef MQTT_TOPIC_PREFIX
+  #define MQTT_TOPIC_PREFIX "frame-fi/"
+#endif
+
+// --- Quiet time after a change before the changes are sent ---
+#ifndef MQTT_DEBOUNCE_MS
+  #define MQTT_DEBOUNCE_MS 250
+#endif
+
+// --- Longest a change waits while changes keep coming ---
+#ifndef MQTT_DEBOUNCE_MAX_MS
+  #define MQTT_DEBOUNCE_MAX_MS 1000
+#endif
+
+// --- Also keep the combined frame-fi/state JSON, sent when one of its fields changes ---
+#ifndef MQTT_STATE_JSON_ENABLED
+  #define MQTT_STATE_JSON_ENABLED 1
+#endif
+
+// --- Longest attribute value, including the terminator ---
+#define MQTT_VALUE_SIZE 24
+
+struct MqttPublisherStats {
+  uint32_t flushes;    // Coalesced bursts sent
+  uint32_t messages;   // Messages sent
+  uint32_t bytes;      // Payload bytes sent
+};
+
+class MqttPublisher {
+public:
+  // --- Sends one message; returns false if it could not be sent ---
+  typedef bool (*Sender)(const char* topic, const char* payload, bool retain);
+
+  MqttPublisher();
+
+  /**
+   * @brief Sets the function that sends a message. Call once at setup.
+   */
+  void begin(Sender sender);
+
+  /**
+   * @brief Sends every attribute on the next poll; call after connecting to the broker.
+   */
+  void resync();
+
+  /**
+   * @brief Sends the attributes that changed once a burst of changes has settled. Runs on the network task.
+   */
+  void poll(uint32_t now);
+
+  /**
+   * @brief Returns the publishing counters.
+   */
+  const MqttPublisherStats& stats() const { return counters; }
+
+private:
+  enum Attribute : uint8_t {
+    ATTR_MODE,
+    ATTR_DISPLAY_STATUS,
+    ATTR_DISPLAY_ORIENTATION,
+    ATTR_IP_ADDRESS,
+    ATTR_FILE_COUNT,
+    ATTR_TOTAL_SIZE,
+    ATTR_USED_SIZE,
+    ATTR_FREE_SIZE,
+    ATTR_LED_COLOR,
+    ATTR_LED_BRIGHTNESS,
+    ATTR_COUNT
+  };
+
+  void format(Attribute attribute, const DeviceInfo& info, char* out) const;
+  bool send(const char* topic, const char* payload);
+  bool sendState(const DeviceInfo& info);
+
+  Sender sender;
+  uint32_t seenVersion;    // Snapshot version the pending burst started from
+  uint32_t firstChangeMs;  // When the pending burst started
+  uint32_t lastChangeMs;   // When the snapshot last changed
+  bool pending;            // Changes wait to be sent
+  bool flushNow;           // Send without waiting for the burst to settle
+  bool stateStale;         // frame-fi/state differs from what the broker holds
+  uint16_t known;          // Attributes the broker holds, one bit each
+  char sent[ATTR_COUNT][MQTT_VALUE_SIZE];  // What the broker holds
+  MqttPublisherStats counters;
+};
+
+extern MqttPublisher mqttPublisher;
+
+#endif // MQTT_PUBLISHER_H
@@ -0,0 +1,136 @@
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sector_cache.h"
+
+// =========================================================================
+// == Read-Ahead
+// == Detects sequential MSC read streams and prefetches the sectors that
+// == follow on the other core, so the next USB request is served from RAM
+// == instead of waiting on the card.
+// ==
+// == It wraps the raw card as a BlockDevice and sits beneath the sector
+// == cache; writes pass through and drop any overlapping prefetched data.
+// =========================================================================
+
+// --- Number of prefetch buffers in the ring ---
+#ifndef READ_AHEAD_BUFFERS
+  #define READ_AHEAD_BUFFERS 3
+#endif
+
+// --- Sectors held by each prefetch buffer (512 bytes each) ---
+#ifndef READ_AHEAD_BUFFER_SECTORS
+  #define READ_AHEAD_BUFFER_SECTORS 32
+#endif
+
+// --- Consecutive sequential requests needed before prefetching starts ---
+#ifndef READ_AHEAD_TRIGGER
+  #define READ_AHEAD_TRIGGER 2
+#endif
+
+// --- Core the prefetch task runs on (the Arduino loop runs on core 1) ---
+#ifndef READ_AHEAD_CORE
+  #define READ_AHEAD_CORE 0
+#endif
+
+// --- Counters exposed for diagnostics ---
+struct ReadAheadStats {
+  uint32_t hits;        // sectors served from prefetch buffers
+  uint32_t misses;      // sectors read from the device on demand
+  uint32_t prefetched;  // sectors read ahead of time
+  uint32_t dropped;     // prefetched sectors discarded before use
+};
+
+class ReadAhead {
+public:
+  ReadAhead();
+
+  /**
+   * @brief Attaches to a device using caller-owned, DMA-capable buffer memory.
+   */
+  bool begin(const BlockDevice& device, uint16_t sectorSize, uint32_t sectorCount,
+             uint8_t* bufferMemory, uint8_t count, uint16_t sectorsPerBuffer);
+
+  /**
+   * @brief Waits for any prefetch in flight and detaches from the device.
+   */
+  void end();
+
+  /**
+   * @brief Reads sectors, serving prefetched data where available.
+   */
+  bool read(uint32_t lba, uint32_t count, uint8_t* dst);
+
+  /**
+   * @brief Writes sectors through to the device, dropping stale prefetches.
+   */
+  bool write(uint32_t lba, uint32_t count, const uint8_t* src);
+
+  /**
+   * @brief Returns a BlockDevice that routes through this read-ahead.
+   */
+  BlockDevice asBlockDevice();
+
+  /**
+   * @brief Returns true once begin() has succeeded.
+   */
+  bool isAttached() const { return attached; }
+
+  /**
+   * @brief Returns the number of sectors currently being read ahead.
+   */
+  uint32_t windowSectors() const { return (uint32_t)window * bufferSectors; }
+
+  /**
+   * @brief Returns the percentage of sectors served from prefetch buffers.
+   */
+  float hitRate() const;
+
+  /**
+   * @brief Returns the read-ahead counters.
+   */
+  const ReadAheadStats& stats() const { return counters; }
+
+private:
+  enum BufferState : uint8_t { EMPTY, QUEUED, LOADING, READY };
+
+  struct Buffer {
+    uint8_t* data;
+    uint32_t lba;
+    uint16_t count;
+    volatile BufferState state;
+    bool stale;  // overwritten while loading; discard when the load completes
+  };
+
+  static void taskEntry(void* arg);
+  static bool deviceRead(void* context, uint32_t lba, uint32_t count, uint8_t* dst);
+  static bool deviceWrite(void* context, uint32_t lba, uint32_t count, const uint8_t* src);
+  void runTask();
+  int findBuffer(uint32_t lba) const;
+  void release(Buffer& buffer);
+  void schedule(uint32_t nextLba);
+
+  BlockDevice dev;
+  uint16_t sectorBytes;
+  uint32_t totalSectors;
+  uint8_t bufferCount;
+  uint16_t bufferSectors;
+  Buffer buffers[READ_AHEAD_BUFFERS];
+  volatile bool attached;
+
+  uint32_t streamEnd;   // LBA following the last request
+  uint32_t streamRun;   // consecutive sequential requests
+  uint8_t window;       // buffers to keep ahead of the stream
+
+  SemaphoreHandle_t stateMutex;   // guards buffer bookkeeping
+  SemaphoreHandle_t deviceMutex;  // serialises access to the card
+  TaskHandle_t task;
+  ReadAheadStats counters;
+};
+
+#endif // READ_AHEAD_H
@@ -0,0 +1,133 @@
+#ifndef SECTOR_CACHE_H
+#define SECTOR_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// =========================================================================
+// == Sector Cache
+// == LBA-indexed write-back cache that sits between the USB MSC callbacks
+// == and the SD card. Small writes are absorbed in RAM and flushed later as
+// == sorted, coalesced multi-block commands.
+// ==
+// == The cache never touches hardware directly; it talks to a BlockDevice,
+// == so it can run on the host against a file-backed device.
+// =========================================================================
+
+// --- Number of sectors held by the cache (512 bytes each) ---
+#ifndef MSC_CACHE_SECTORS
+  #define MSC_CACHE_SECTORS 128
+#endif
+
+// --- Largest run written to the card in a single command ---
+#ifndef MSC_CACHE_MAX_RUN_SECTORS
+  #define MSC_CACHE_MAX_RUN_SECTORS 32
+#endif
+
+// --- Flush dirty sectors after this much write inactivity ---
+#ifndef MSC_CACHE_FLUSH_MS
+  #define MSC_CACHE_FLUSH_MS 1000
+#endif
+
+// --- Writes at least this long bypass the cache ---
+#ifndef MSC_CACHE_BYPASS_SECTORS
+  #define MSC_CACHE_BYPASS_SECTORS 64
+#endif
+
+// --- Block device interface used by the cache ---
+struct BlockDevice {
+  void* context;
+  bool (*read)(void* context, uint32_t lba, uint32_t count, uint8_t* dst);
+  bool (*write)(void* context, uint32_t lba, uint32_t count, const uint8_t* src);
+};
+
+// --- Counters exposed for diagnostics ---
+struct SectorCacheStats {
+  uint32_t readHits;        // sectors served from the cache
+  uint32_t readMisses;      // sectors read from the device
+  uint32_t writesAbsorbed;  // sectors written into the cache
+  uint32_t writesBypassed;  // sectors written straight through
+  uint32_t flushes;         // number of flush passes
+  uint32_t deviceWrites;    // write commands issued while flushing
+  uint32_t sectorsFlushed;  // sectors written while flushing
+};
+
+class SectorCache {
+public:
+  SectorCache();
+
+  /**
+   * @brief Attaches the cache to a device using caller-owned memory.
+   */
+  bool begin(const BlockDevice& device, uint16_t sectorSize, uint16_t slotCount,
+             uint8_t* slotMemory, uint8_t* stagingBuffer, uint16_t stagingSectors);
+
+  /**
+   * @brief Flushes and detaches the cache.
+   */
+  bool end();
+
+  /**
+   * @brief Reads sectors, serving cached copies where present.
+   */
+  bool read(uint32_t lba, uint32_t count, uint8_t* dst);
+
+  /**
+   * @brief Writes sectors into the cache, flushing when it fills up.
+   */
+  bool write(uint32_t lba, uint32_t count, const uint8_t* src, uint32_t nowMs);
+
+  /**
+   * @brief Writes all dirty sectors back to the device.
+   */
+  bool flush();
+
+  /**
+   * @brief Flushes if dirty data has been idle for at least idleMs.
+   */
+  bool flushIfIdle(uint32_t nowMs, uint32_t idleMs);
+
+  /**
+   * @brief Drops every cached sector without writing it back.
+   */
+  void invalidate();
+
+  /**
+   * @brief Returns true if the cache holds data not yet on the device.
+   */
+  bool isDirty() const { return dirtyCount > 0; }
+
+  /**
+   * @brief Returns true once begin() has succeeded.
+   */
+  bool isAttached() const { return slots != nullptr; }
+
+  /**
+   * @brief Returns the cache counters.
+   */
+  const SectorCacheStats& stats() const { return counters; }
+
+private:
+  int findSlot(uint32_t lba, uint16_t* position) const;
+  int insertSlot(uint32_t lba, uint16_t position);
+  void removeAt(uint16_t position);
+  bool writeRun(uint16_t first, uint16_t length);
+
+  BlockDevice dev;
+  uint16_t sectorBytes;
+  uint16_t capacity;
+  uint16_t used;
+  uint16_t dirtyCount;
+  uint16_t stagingCapacity;
+  uint8_t* slots;           // capacity * sectorBytes of sector data
+  uint8_t* staging;         // DMA-capable buffer used to gather runs
+  uint32_t* slotLba;        // LBA held by each slot
+  bool* slotDirty;          // dirty flag for each slot
+  uint16_t* order;          // slot indices sorted by LBA
+  uint16_t* freeList;       // unused slot indices
+  uint16_t freeCount;
+  uint32_t lastWriteMs;
+  SectorCacheStats counters;
+};
+
+#endif // SECTOR_CACHE_H
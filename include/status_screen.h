@@ -0,0 +1,106 @@
+#ifndef STATUS_SCREEN_H
+#define STATUS_SCREEN_H
+
+#include <stdint.h>
+
+#include "TFT_eSPI.h" // https://github.com/Bodmer/TFT_eSPI
+
+// =========================================================================
+// == Status Screen
+// == The mode screen as a handful of widgets: header, mode with the MQTT
+// == dot, IP, MAC, the storage lines and the capacity bar. Each render
+// == compares every widget with what the panel already shows and only
+// == redraws the ones that changed:
+// ==   - A widget is drawn into an off-screen sprite the size of one
+// ==     line, so the panel never shows a cleared area.
+// ==   - Sprites are pushed with DMA; the next widget is drawn while the
+// ==     previous one is still going out.
+// == While a transfer runs, the capacity bar shows its progress instead.
+// == Screens drawn straight onto the panel must call invalidate().
+// =========================================================================
+
+// --- Height of a widget line in landscape; portrait puts label and value on two lines ---
+#define STATUS_LINE_HEIGHT 12
+
+// --- Bytes per pixel the bar moves for a transfer of unknown size, as a power of two ---
+#ifndef STATUS_TRANSFER_STEP_SHIFT
+  #define STATUS_TRANSFER_STEP_SHIFT 16
+#endif
+
+struct StatusView {
+  const char* mode;
+  uint16_t headerColor;
+  const char* ip;
+  const char* mac;
+  int files;
+  int totalSizeMB;
+  float freeSizeMB;
+  bool mqttShown;
+  bool mqttConnected;
+  bool transferActive;      // The bar shows a transfer instead of the card's capacity
+  int8_t transferPercent;   // Progress of the transfer, -1 if its size is unknown
+  uint32_t transferBytes;   // Moves the bar along while the size is unknown
+};
+
+struct StatusScreenStats {
+  uint32_t frames;     // Renders that pushed at least one widget
+  uint32_t widgets;    // Widgets pushed
+  uint32_t pixels;     // Pixels pushed
+};
+
+class StatusScreen {
+public:
+  StatusScreen();
+
+  /**
+   * @brief Sets up the sprites and DMA for the panel's current rotation.
+   */
+  bool begin(TFT_eSPI& display);
+
+  /**
+   * @brief Marks every widget for redrawing; call after drawing on the panel directly.
+   */
+  void invalidate() { valid = false; }
+
+  /**
+   * @brief Redraws the widgets that differ from what the panel shows. Returns the number pushed.
+   */
+  uint8_t render(const StatusView& view);
+
+  /**
+   * @brief Returns the rendering counters.
+   */
+  const StatusScreenStats& stats() const { return counters; }
+
+private:
+  enum Widget : uint8_t { WIDGET_HEADER, WIDGET_MODE, WIDGET_IP, WIDGET_MAC, WIDGET_FILES, WIDGET_SIZE, WIDGET_USED, WIDGET_BAR, WIDGET_COUNT };
+
+  struct Region {
+    int16_t x, y, w, h;
+  };
+
+  void layout();
+  void describe(Widget widget, const StatusView& view, char* out, size_t size) const;
+  void draw(Widget widget, const StatusView& view, TFT_eSprite& sprite);
+  void drawBarSlice(TFT_eSprite& sprite, int top, int height);
+  void barFill(const StatusView& view);
+  void push(TFT_eSprite& sprite, const Region& region);
+
+  TFT_eSPI* tft;
+  TFT_eSprite* lines[2];  // One is drawn while the other goes out
+  TFT_eSprite* bar;
+  uint8_t nextLine;
+  bool landscape;
+  bool dma;
+  bool valid;
+  int barStart;           // Where the filled part of the bar starts, in pixels
+  int barFilled;          // Length of the filled part in pixels
+  uint16_t barColor;
+  Region regions[WIDGET_COUNT];
+  char shown[WIDGET_COUNT][40];  // What each widget shows, as last drawn
+  StatusScreenStats counters;
+};
+
+extern StatusScreen statusScreen;
+
+#endif // STATUS_SCREEN_H
@@ -0,0 +1,97 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+
+#include <FS.h>
+#include "ff.h"
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// =========================================================================
+// == Storage
+// == Owns the SD card for the whole uptime. The card is identified and
+// == the FAT volume is mounted once at boot; mode switches only decide who
+// == may touch the blocks:
+// ==   - MSC mode: the USB host owns the blocks, the FAT layer stays idle.
+// ==   - FTP mode: the FAT layer owns the blocks through `sdFs`.
+// == When the FAT layer takes the card back it drops whatever FatFs had
+// == cached, since the host may have changed anything underneath it.
+// =========================================================================
+
+// --- VFS path the FAT volume is mounted on ---
+#ifndef STORAGE_MOUNT_POINT
+  #define STORAGE_MOUNT_POINT "/sdcard"
+#endif
+
+// --- FatFs logical drive holding the card ---
+#ifndef STORAGE_FAT_DRIVE
+  #define STORAGE_FAT_DRIVE "0:"
+#endif
+
+// --- FrameFi's own files (manifest, thumbnails); hidden from listings and counts ---
+#ifndef STORAGE_DATA_DIR
+  #define STORAGE_DATA_DIR "/.framefi"
+#endif
+
+// --- Files open at once: two per FTP session plus HTTP uploads ---
+#ifndef STORAGE_MAX_FILES
+  #define STORAGE_MAX_FILES 12
+#endif
+
+class StorageManager {
+public:
+  StorageManager();
+
+  /**
+   * @brief Initializes the card and mounts the FAT volume. Only the first call does any work.
+   */
+  esp_err_t begin();
+
+  /**
+   * @brief Returns true once the card is initialized and mounted.
+   */
+  bool isMounted() const { return card != nullptr; }
+
+  /**
+   * @brief Returns the card for raw sector access.
+   */
+  sdmmc_card_t* sdCard() const { return card; }
+
+  /**
+   * @brief Returns the FatFs object of the volume.
+   */
+  FATFS* fatVolume() const { return volume; }
+
+  /**
+   * @brief Hands the blocks to the USB host; the FAT layer must have no open files.
+   */
+  void releaseToHost();
+
+  /**
+   * @brief Takes the blocks back for the FAT layer, discarding stale FatFs state.
+   */
+  bool claimForFat();
+
+  /**
+   * @brief Returns true while the FAT layer owns the blocks.
+   */
+  bool fatOwnsCard() const { return fatOwned; }
+
+private:
+  sdmmc_card_t* card;
+  FATFS* volume;
+  volatile bool fatOwned;
+};
+
+extern StorageManager storage;
+
+// --- Arduino file system bound to the shared mount; used by FTP and HTTP ---
+extern fs::FS sdFs;
+
+// --- Held while the FAT layer is in use or changing hands; created by storage.begin() ---
+extern SemaphoreHandle_t fatMutex;
+
+#endif // STORAGE_H
@@ -0,0 +1,206 @@
+#ifndef THUMBNAIL_CACHE_H
+#define THUMBNAIL_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "ff.h"
+#include "storage.h"
+
+// =========================================================================
+// == Thumbnail Cache
+// == Small previews of the JPEGs on the card for a web gallery, kept in
+// == FrameFi's data directory under the picture's own path:
+// ==
+// ==   /2025/beach.jpg  ->  /.framefi/thumbs/2025/beach.jpg
+// ==
+// == A task at the lowest priority fills the cache a picture at a time:
+// ==   - Uploads are queued as they finish.
+// ==   - After the USB host ejects the card, the next walk of the card
+// ==     builds what is missing and removes thumbnails of deleted files.
+// ==   - A thumbnail carries its picture's timestamp, so a picture that
+// ==     changed is simply rebuilt.
+// == The task keeps out of the way of transfers: it waits until FTP and
+// == HTTP have been quiet for a moment, lets the ingest stage go first and
+// == pauses between rows of a picture as soon as a transfer starts.
+// =========================================================================
+
+// --- Set to 0 to build without thumbnails ---
+#ifndef THUMBNAILS_ENABLED
+  #define THUMBNAILS_ENABLED 1
+#endif
+
+// --- Where thumbnails are kept, relative to the card root ---
+#ifndef THUMB_DIR
+  #define THUMB_DIR STORAGE_DATA_DIR "/thumbs"
+#endif
+
+// --- Thumbnails fit a square of this many pixels ---
+#ifndef THUMB_SIZE
+  #define THUMB_SIZE 160
+#endif
+
+// --- 1-100, mapped onto the encoder's four levels ---
+#ifndef THUMB_QUALITY
+  #define THUMB_QUALITY 70
+#endif
+
+// --- Uploads and gallery requests waiting for a thumbnail ---
+#ifndef THUMB_QUEUE_LENGTH
+  #define THUMB_QUEUE_LENGTH 16
+#endif
+
+// --- How long transfers must have stopped before the task works ---
+#ifndef THUMB_QUIET_MS
+  #define THUMB_QUIET_MS 1500
+#endif
+
+// --- How often a waiting task looks again ---
+#ifndef THUMB_CHECK_MS
+  #define THUMB_CHECK_MS 250
+#endif
+
+// --- Seconds a browser may keep a thumbnail without asking again ---
+#ifndef THUMB_CACHE_MAX_AGE_S
+  #define THUMB_CACHE_MAX_AGE_S 2592000
+#endif
+
+// --- Seconds a client is told to wait for a thumbnail that is being built ---
+#ifndef THUMB_RETRY_AFTER_S
+  #define THUMB_RETRY_AFTER_S 2
+#endif
+
+// --- Pictures whose thumbnail could not be built, remembered so clients are not asked to wait ---
+#ifndef THUMB_FAILED_SLOTS
+  #define THUMB_FAILED_SLOTS 16
+#endif
+
+// --- Directory entries read per hold of the FAT lock during a walk ---
+#ifndef THUMB_WALK_BATCH
+  #define THUMB_WALK_BATCH 32
+#endif
+
+// --- Core the thumbnail task runs on (HTTP, FTP and MQTT run on core 1) ---
+#ifndef THUMB_TASK_CORE
+  #define THUMB_TASK_CORE 0
+#endif
+
+// --- Rows in an encoder band; 4:2:0 MCUs are 16 pixels square ---
+#define THUMB_BAND_ROWS 16
+
+enum ThumbnailState : uint8_t {
+  THUMB_READY,     // The thumbnail is current
+  THUMB_PENDING,   // It is queued or being built
+  THUMB_FAILED,    // The picture could not be read as a JPEG
+  THUMB_MISSING,   // There is no such picture
+};
+
+struct ThumbnailStats {
+  uint32_t built;     // Thumbnails written
+  uint32_t failed;    // Pictures that could not be converted
+  uint32_t removed;   // Thumbnails of deleted pictures removed by a walk
+  uint32_t busyMs;    // Time spent building, pauses for transfers included
+};
+
+class ThumbnailCache {
+public:
+  ThumbnailCache();
+
+  /**
+   * @brief Starts the thumbnail task and walks the card once.
+   */
+  bool begin();
+
+  /**
+   * @brief Queues a stored upload for a thumbnail. Never blocks.
+   */
+  void submit(const char* path);
+
+  /**
+   * @brief Walks the whole card at the next quiet moment. Call after the USB host had it.
+   */
+  void rescan();
+
+  /**
+   * @brief Marks the card busy with a transfer; the task waits until it has been quiet for a moment.
+   */
+  void noteTransfer();
+
+  /**
+   * @brief Writes the thumbnail path of a picture, relative to the card root. Returns false if it has none.
+   */
+  bool thumbnailPath(const char* path, char* out, size_t size) const;
+
+  /**
+   * @brief Returns the state of a picture's thumbnail, queueing it first in line if it is out of date.
+   * Call with the FAT lock held.
+   */
+  ThumbnailState lookup(const char* path);
+
+  /**
+   * @brief Returns the number of pictures queued, including the one being built.
+   */
+  uint32_t pending() const;
+
+  /**
+   * @brief Returns the thumbnail counters.
+   */
+  const ThumbnailStats& stats() const { return counters; }
+
+private:
+  struct Job {
+    char path[FF_MAX_LFN + 1];
+  };
+
+  enum Outcome : uint8_t { THUMB_BUILT, THUMB_CURRENT, THUMB_UNREADABLE, THUMB_INTERRUPTED };
+
+  static void taskEntry(void* arg);
+  static int drawCallback(struct jpeg_draw_tag* draw);
+  void runTask();
+  bool waitForQuiet(bool forIngest);
+  void drainQueue();
+  void process(const char* path);
+  bool walk(const char* root, bool pruning);
+  bool isCurrent(const FILINFO& picture, const char* thumbDrivePath);
+  Outcome build(const char* path);
+  bool setupResize(int width, int height, int& scale);
+  bool allocateBuffers();
+  bool addBlock(const uint16_t* pixels, int x, int y, int width, int height);
+  bool finishRows(int outRowEnd);
+  bool encodeBand(int rows);
+  void releaseBuffers();
+  void rememberFailure(const char* path);
+  bool hasFailed(const char* path) const;
+
+  ThumbnailStats counters;
+  TaskHandle_t task;
+  QueueHandle_t queue;
+  volatile bool scanRequested;
+  volatile bool busy;
+  volatile uint32_t lastTransferMs;
+  uint32_t failedKeys[THUMB_FAILED_SLOTS];  // Hashes of paths that failed, oldest overwritten first
+  uint8_t nextFailedSlot;
+
+  // --- State of the thumbnail in progress ---
+  struct Work;            // Decoder, encoder and output file, on the heap while building
+  Work* work;
+  uint16_t* band;         // One band of RGB565 encoder input, paddedWidth wide
+  uint16_t* sums;         // Red, green and blue sums of the output rows still open
+  uint8_t* columnSpan;    // Decoded columns folded into each output column
+  int sourceWidth;        // Decoded (already prescaled) size
+  int sourceHeight;
+  int outWidth;
+  int outHeight;
+  int paddedWidth;
+  int rowsDone;           // Output rows averaged into the band
+  int rowsOpen;           // Output rows whose sums are cleared
+  int lastDrawY;          // Top of the row of MCUs seen last
+};
+
+extern ThumbnailCache thumbnailCache;
+
+#endif // THUMBNAIL_CACHE_H
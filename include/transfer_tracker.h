@@ -0,0 +1,155 @@
+#ifndef TRANSFER_TRACKER_H
+#define TRANSFER_TRACKER_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// =========================================================================
+// == Transfer Tracker
+// == Progress of the FTP and HTTP transfers in flight and the last few
+// == that finished: bytes moved, instantaneous and average throughput and
+// == the time left when the size is known.
+// ==   - progress() is called for every chunk and only stores the byte
+// ==     count; rates are worked out at most every TRANSFER_SAMPLE_MS.
+// ==   - Readers copy a consistent snapshot under a lock the chunk path
+// ==     only takes when it samples.
+// =========================================================================
+
+// --- Transfers tracked at once; more are not tracked ---
+#ifndef TRANSFER_SLOTS
+  #define TRANSFER_SLOTS 4
+#endif
+
+// --- Finished transfers kept for GET /transfers ---
+#ifndef TRANSFER_RECENT
+  #define TRANSFER_RECENT 4
+#endif
+
+// --- How often the throughput of a running transfer is sampled ---
+#ifndef TRANSFER_SAMPLE_MS
+  #define TRANSFER_SAMPLE_MS 250
+#endif
+
+// --- How often the progress of running transfers is published over MQTT ---
+#ifndef TRANSFER_PUBLISH_MS
+  #define TRANSFER_PUBLISH_MS 1000
+#endif
+
+// --- Longest stored file name, including the terminator; longer paths keep their end ---
+#define TRANSFER_NAME_SIZE 64
+
+enum TransferSource : uint8_t {
+  TRANSFER_FTP,
+  TRANSFER_HTTP,
+};
+
+enum TransferDirection : uint8_t {
+  TRANSFER_UPLOAD,
+  TRANSFER_DOWNLOAD,
+};
+
+enum TransferState : uint8_t {
+  TRANSFER_RUNNING,
+  TRANSFER_DONE,
+  TRANSFER_FAILED,
+};
+
+struct TransferStatus {
+  char name[TRANSFER_NAME_SIZE];
+  TransferSource source;
+  TransferDirection direction;
+  TransferState state;
+  uint32_t bytes;       // Bytes moved so far
+  uint32_t total;       // Bytes the transfer will move, 0 if unknown
+  uint32_t elapsedMs;
+  uint32_t rateBps;     // Throughput over the last samples
+  uint32_t averageBps;  // Throughput since the start
+  int32_t etaS;         // Seconds left, -1 if unknown
+  int8_t percent;       // 0-100, -1 if the size is unknown
+};
+
+class TransferTracker {
+public:
+  TransferTracker();
+
+  /**
+   * @brief Creates the lock. Call once before the first transfer.
+   */
+  bool begin();
+
+  /**
+   * @brief Starts tracking a transfer. Returns its slot, or -1 if every slot is taken.
+   */
+  int8_t start(TransferSource source, TransferDirection direction, const char* name, uint32_t total);
+
+  /**
+   * @brief Records the bytes a transfer has moved so far. Cheap enough to call for every chunk.
+   */
+  void progress(int8_t slot, uint32_t bytes);
+
+  /**
+   * @brief Ends a transfer and keeps it with the recent ones.
+   */
+  void finish(int8_t slot, bool ok);
+
+  /**
+   * @brief Copies the running transfers into out. Returns how many were copied.
+   */
+  uint8_t active(TransferStatus* out, uint8_t max);
+
+  /**
+   * @brief Copies the finished transfers into out, newest first. Returns how many were copied.
+   */
+  uint8_t recent(TransferStatus* out, uint8_t max);
+
+  /**
+   * @brief Returns a number that changes on every start, sample and finish.
+   */
+  uint32_t version() const { return changes; }
+
+  /**
+   * @brief Returns a number that changes whenever a transfer finishes.
+   */
+  uint32_t finishedCount() const { return finished; }
+
+private:
+  struct Slot {
+    bool used;
+    TransferStatus status;
+    uint32_t startMs;
+    uint32_t sampleMs;
+    uint32_t sampleBytes;
+    volatile uint32_t bytes;  // Written for every chunk without the lock
+  };
+
+  void update(Slot& slot, uint32_t now);
+
+  Slot slots[TRANSFER_SLOTS];
+  TransferStatus done[TRANSFER_RECENT];
+  uint8_t doneCount;
+  uint8_t doneNext;
+  SemaphoreHandle_t mutex;
+  volatile uint32_t changes;
+  volatile uint32_t finished;
+};
+
+/**
+ * @brief Returns the API name of a transfer source.
+ */
+const char* transferSourceName(TransferSource source);
+
+/**
+ * @brief Returns the API name of a transfer direction.
+ */
+const char* transferDirectionName(TransferDirection direction);
+
+/**
+ * @brief Returns the API name of a transfer state.
+ */
+const char* transferStateName(TransferState state);
+
+extern TransferTracker transferTracker;
+
+#endif // TRANSFER_TRACKER_H
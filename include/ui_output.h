@@ -0,0 +1,163 @@
+#ifndef UI_OUTPUT_H
+#define UI_OUTPUT_H
+
+#include <stdint.h>
+
+#include <FastLED.h>
+
+#include "driver/spi_master.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+// =========================================================================
+// == UI Output
+// == One low priority task owns the status LED and the display. Protocol
+// == handlers, mode switches and the button only post a message and move
+// == on:
+// ==   - LED changes are coalesced; the task sends the APA102 frame as a
+// ==     DMA transaction on its own SPI bus instead of bit-banging it.
+// ==   - Transfer activity blinks the LED dark for a moment, rate limited
+// ==     before anything is queued.
+// ==   - Screens are drawn by a handler the application attaches, and the
+// ==     status screen is brought up to date between messages.
+// == The time the task spends on output is counted for diagnostics.
+// =========================================================================
+
+// --- Minimum time between two activity blinks ---
+#ifndef ACTIVITY_BLINK_INTERVAL_MS
+  #define ACTIVITY_BLINK_INTERVAL_MS 150
+#endif
+
+// --- How long the LED stays dark during a blink ---
+#ifndef ACTIVITY_BLINK_OFF_MS
+  #define ACTIVITY_BLINK_OFF_MS 50
+#endif
+
+// --- Messages waiting for the task; more are dropped ---
+#ifndef UI_OUTPUT_QUEUE_LENGTH
+  #define UI_OUTPUT_QUEUE_LENGTH 8
+#endif
+
+// --- How often the status screen is brought up to date ---
+#ifndef UI_OUTPUT_POLL_MS
+  #define UI_OUTPUT_POLL_MS 10
+#endif
+
+// --- Core the output task runs on ---
+#ifndef UI_OUTPUT_TASK_CORE
+  #define UI_OUTPUT_TASK_CORE 0
+#endif
+
+// --- SPI bus for the LED; the display has the other one (USE_HSPI_PORT) ---
+#ifndef UI_LED_SPI_HOST
+  #define UI_LED_SPI_HOST SPI2_HOST
+#endif
+
+// --- APA102 clock ---
+#ifndef UI_LED_SPI_HZ
+  #define UI_LED_SPI_HZ 4000000
+#endif
+
+enum UiOutputKind : uint8_t {
+  UI_OUTPUT_LEDS,    // The LED buffer changed
+  UI_OUTPUT_BLINK,   // Transfer activity
+  UI_OUTPUT_SCREEN,  // Draw an application screen
+};
+
+struct UiOutputMessage {
+  UiOutputKind kind;
+  uint8_t screen;
+};
+
+struct UiOutputStats {
+  uint64_t busyUs;      // Time spent on output since boot
+  uint32_t ledFrames;   // Frames sent to the LED
+  uint32_t screens;     // Application screens drawn
+  uint32_t dropped;     // Messages lost to a full queue
+};
+
+// --- Draws an application screen; runs on the output task ---
+typedef void (*UiScreenHandler)(uint8_t screen);
+
+// --- Brings the status screen up to date; runs on the output task ---
+typedef void (*UiPollHandler)();
+
+class UiOutput {
+public:
+  UiOutput();
+
+  /**
+   * @brief Sets up the LED bus and starts the output task. leds must live for the whole uptime.
+   */
+  bool begin(const CRGB* leds, uint8_t count);
+
+  /**
+   * @brief Hands the display to the output task; call once the display is set up.
+   */
+  void attachScreen(UiScreenHandler show, UiPollHandler poll);
+
+  /**
+   * @brief Queues the LED buffer for sending. Never blocks.
+   */
+  void showLeds();
+
+  /**
+   * @brief Queues an activity blink. Never blocks; blinks closer than the interval are dropped.
+   */
+  void blink();
+
+  /**
+   * @brief Queues an application screen for drawing. Never blocks.
+   */
+  void showScreen(uint8_t screen);
+
+  /**
+   * @brief Waits up to timeoutMs for every queued message to be handled. Returns false on timeout.
+   */
+  bool waitIdle(uint32_t timeoutMs);
+
+  /**
+   * @brief Returns the output task, for stack diagnostics.
+   */
+  TaskHandle_t taskHandle() const { return task; }
+
+  /**
+   * @brief Returns the output counters.
+   */
+  const UiOutputStats& stats() const { return counters; }
+
+private:
+  static void taskEntry(void* arg);
+  void runTask();
+  void post(UiOutputKind kind, uint8_t screen);
+  bool beginSpi();
+  void pushLeds(bool dark);
+
+  const CRGB* leds;
+  uint8_t ledCount;
+  QueueHandle_t queue;
+  TaskHandle_t task;
+  volatile UiScreenHandler showHandler;
+  volatile UiPollHandler pollHandler;
+  volatile bool ledsQueued;     // A LED message is already waiting
+  volatile bool working;        // The task is handling a message
+  volatile uint32_t lastBlinkMs;
+  UiOutputStats counters;
+
+  // --- APA102 over SPI ---
+  spi_device_handle_t ledDevice;
+  spi_transaction_t ledTransaction;
+  uint8_t* ledFrame;            // DMA-capable start frame, LED frames and end frame
+  uint16_t ledFrameBytes;
+  bool ledPending;              // ledTransaction is still queued
+};
+
+/**
+ * @brief Queues the LED buffer for the output task; safe to call from any task.
+ */
+void showLeds();
+
+extern UiOutput uiOutput;
+
+#endif // UI_OUTPUT_H
@@ -0,0 +1,127 @@
+#ifndef UPLOAD_WRITER_H
+#define UPLOAD_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ff.h"
+#include "mbedtls/sha256.h"
+
+// =========================================================================
+// == Upload Writer
+// == Streams an HTTP upload to the card through FatFs:
+// ==   - Data goes to "<name>.part" so an interrupted upload never shows
+// ==     up as a broken picture.
+// ==   - When the size is known up front the clusters are allocated in one
+// ==     go, which keeps the file contiguous.
+// ==   - Network chunks are gathered into whole-cluster blocks so every
+// ==     write to the card starts and ends on a cluster boundary.
+// ==   - commit() trims the file to what was written and renames it over
+// ==     the target.
+// ==   - Optionally the SHA-256 of the data is computed on the way through,
+// ==     so the content index never has to read the file back.
+// == The caller serializes access to the FAT layer. Once the card has been
+// == handed to the USB host an open upload is forgotten without touching
+// == FatFs; the temp file is left for the host or the next mount to see.
+// =========================================================================
+
+// --- Target size of the write-coalescing block; rounded to whole clusters ---
+#ifndef UPLOAD_BLOCK_SIZE
+  #define UPLOAD_BLOCK_SIZE (32 * 1024)
+#endif
+
+// --- Suffix of the file an upload is written to until it completes ---
+#ifndef UPLOAD_PART_SUFFIX
+  #define UPLOAD_PART_SUFFIX ".part"
+#endif
+
+class UploadWriter {
+public:
+  UploadWriter();
+  ~UploadWriter();
+
+  /**
+   * @brief Creates the temp file next to path and preallocates expectedSize bytes if non-zero.
+   */
+  FRESULT begin(const char* path, uint32_t expectedSize, bool hashContent = false);
+
+  /**
+   * @brief Buffers data and writes every full block to the card.
+   */
+  FRESULT write(const uint8_t* data, size_t length);
+
+  /**
+   * @brief Writes what is left, trims the file and renames it over the target.
+   */
+  FRESULT commit();
+
+  /**
+   * @brief Closes and deletes the temp file.
+   */
+  void abort();
+
+  /**
+   * @brief Forgets the temp file without touching the card. For when FatFs no longer owns it.
+   */
+  void discard();
+
+  /**
+   * @brief Aborts every open upload. Call before the card is handed to the USB host.
+   */
+  static void abortAll();
+
+  /**
+   * @brief Returns true between a successful begin() and commit() or abort().
+   */
+  bool isOpen() const { return open; }
+
+  /**
+   * @brief Returns true if the target existed before the upload.
+   */
+  bool targetExisted() const { return existed; }
+
+  /**
+   * @brief Returns the size of the target before the upload.
+   */
+  uint32_t targetOldSize() const { return oldSize; }
+
+  /**
+   * @brief Returns the path being written, relative to the card root.
+   */
+  const char* targetPath() const;
+
+  /**
+   * @brief Returns the number of bytes accepted so far.
+   */
+  uint32_t size() const { return written + fill; }
+
+  /**
+   * @brief Returns the SHA-256 of the committed file, or nullptr if it was not hashed.
+   */
+  const uint8_t* digest() const { return hashed ? sha256 : nullptr; }
+
+private:
+  FRESULT flush();
+  void link();
+  void unlink();
+
+  static UploadWriter* first;  // Open uploads, for abortAll()
+  UploadWriter* next;
+
+  FIL file;
+  bool open;
+  bool existed;
+  uint32_t oldSize;
+  uint8_t* block;
+  size_t blockSize;
+  size_t fill;
+  uint32_t written;
+  mbedtls_sha256_context hash;
+  bool hashing;
+  bool hashed;
+  uint8_t sha256[32];
+  char path[FF_MAX_LFN + 8];
+  char partPath[FF_MAX_LFN + 8 + sizeof(UPLOAD_PART_SUFFIX)];
+};
+
+#endif // UPLOAD_WRITER_H
@@ -14,7 +14,7 @@
  *   CDUP, CWD, PWD, QUIT, NOOP
  *   MODE, PASV, PORT, STRU, TYPE
  *   ABOR, DELE, LIST, NLST, MLST, MLSD
- *   APPE, RETR, STOR
+ *   APPE, RETR, STOR, REST
  *   MKD,  RMD
  *   RNTO, RNFR
  *   MDTM, MFMT
@@ -48,18 +48,24 @@
  */
 
 #include <FtpServer.h>
+#if defined(ESP32)
+  #include <esp_heap_caps.h>
+#endif
 
 FtpServer::FtpServer( uint16_t _cmdPort, uint16_t _pasvPort )
-         : ftpServer( _cmdPort ), dataServer( _pasvPort )
+         : ftpServer( _cmdPort )
 {
   cmdPort = _cmdPort;
-  pasvPort = _pasvPort;
 
-  millisDelay = 0;
-  nbMatch = 0;
-  iCL = 0;
+  // Each session gets its own passive port so data channels never collide
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+    sessions[ i ] = new FtpSession( this, i, _cmdPort, _pasvPort + i );
+}
 
-  iniVariables();
+FtpServer::~FtpServer()
+{
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+    delete sessions[ i ];
 }
 
 void FtpServer::begin( const char * _user, const char * _pass, const char * _welcomeMessage )
@@ -74,6 +80,120 @@ void FtpServer::begin( const char * _user, const char * _pass, const char * _wel
   #if (defined(ESP8266) && (FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_ASYNC || FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266 || FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_242)) || defined(ARDUINO_ARCH_RP2040) || FTP_SERVER_NETWORK_TYPE_SELECTED == NETWORK_SEEED_RTL8720DN
   ftpServer.setNoDelay( true );
   #endif
+
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+    sessions[ i ]->begin( _user, _pass, _welcomeMessage, anonymousConnection );
+}
+
+void FtpServer::begin( const char * _welcomeMessage ) {
+	this->anonymousConnection = true;
+	this->begin( "anonymous", "anonymous", _welcomeMessage);
+}
+
+void FtpServer::end()
+{
+    for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+      sessions[ i ]->end();
+
+#if FTP_SERVER_NETWORK_TYPE == NETWORK_ESP32 // && !defined(ARDUINO_ARCH_RP2040)
+    ftpServer.end();
+#endif
+
+    DEBUG_PRINTLN(F("Stop server!"));
+
+    if (_callback) {
+  	  _callback(FTP_DISCONNECT, sessions[ 0 ]->free(), sessions[ 0 ]->capacity());
+    }
+}
+void FtpServer::setLocalIp(IPAddress localIp)
+{
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+    sessions[ i ]->setLocalIp( localIp );
+}
+void FtpServer::credentials( const char * _user, const char * _pass )
+{
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+    sessions[ i ]->credentials( _user, _pass );
+}
+
+// Accept a pending connection and hand it to an idle session, or turn it away
+void FtpServer::acceptClient()
+{
+  FTP_CLIENT_NETWORK_CLASS newClient;
+#if (FTP_SERVER_NETWORK_TYPE == NETWORK_WiFiNINA)
+  byte status;
+  newClient = ftpServer.available(&status);
+#elif (defined(ESP8266) && (FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_ASYNC || FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266 || FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_242))
+  if( ! ftpServer.hasClient())
+    return;
+  newClient = ftpServer.available();
+#else
+  newClient = ftpServer.accept();
+#endif
+  if( ! newClient.connected())
+    return;
+
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+  {
+    if( sessions[ i ]->isIdle())
+    {
+      DEBUG_PRINT( F(" Client assigned to session ") ); DEBUG_PRINTLN( i );
+      sessions[ i ]->attach( newClient );
+      return;
+    }
+  }
+
+  DEBUG_PRINTLN( F(" No free session, refusing client") );
+  newClient.println( F("421 Too many connections, try again later") );
+  newClient.stop();
+}
+
+uint8_t FtpServer::handleFTP()
+{
+  acceptClient();
+
+  // Service every session once per call; report the first busy one
+  uint8_t status = 0;
+  bool reported = false;
+  for( uint8_t i = 0; i < FTP_MAX_SESSIONS; i ++ )
+  {
+    uint8_t sessionStatus = sessions[ i ]->handleFTP();
+    if( ! reported && ( i == 0 || ! sessions[ i ]->isIdle()))
+    {
+      status = sessionStatus;
+      reported = ! sessions[ i ]->isIdle();
+    }
+  }
+  return status;
+}
+
+FtpSession::FtpSession( FtpServer * _server, uint8_t _index, uint16_t _cmdPort, uint16_t _pasvPort )
+         : dataServer( _pasvPort )
+{
+  server = _server;
+  index = _index;
+  transferName[ 0 ] = 0;
+  transferSize = 0;
+  listStored = false;
+  cmdPort = _cmdPort;
+  pasvPort = _pasvPort;
+#if defined(ESP32)
+  buf = NULL;
+  storeHashing = false;
+  mbedtls_sha256_init( &storeHash );
+#endif
+
+  millisDelay = 0;
+  nbMatch = 0;
+  iCL = 0;
+  cmdStage = FTP_Stop;
+
+  iniVariables();
+}
+
+void FtpSession::begin( const char * _user, const char * _pass, const char * _welcomeMessage, bool _anonymous )
+{
+  this->anonymousConnection = _anonymous;
 //  localIp = _localIP == FTP_NULLIP() || (uint32_t) _localIP == 0 ? NET_CLASS.localIP() : _localIP ;
   localIp = NET_CLASS.localIP(); //_localIP == FTP_NULLIP() || (uint32_t) _localIP == 0 ? NET_CLASS.localIP() : _localIP ;
 //  strcpy( user, FTP_USER );
@@ -100,37 +220,30 @@ void FtpServer::begin( const char * _user, const char * _pass, const char * _wel
   iniVariables();
 }
 
-void FtpServer::begin( const char * _welcomeMessage ) {
-	this->anonymousConnection = true;
-	this->begin( "anonymous", "anonymous", _welcomeMessage);
-}
-
-void FtpServer::end()
+void FtpSession::end()
 {
     if(client.connected()) {
         disconnectClient();
     }
 
 #if FTP_SERVER_NETWORK_TYPE == NETWORK_ESP32 // && !defined(ARDUINO_ARCH_RP2040)
-    ftpServer.end();
     dataServer.end();
 #endif
 
-    DEBUG_PRINTLN(F("Stop server!"));
-
-    if (FtpServer::_callback) {
-  	  FtpServer::_callback(FTP_DISCONNECT, free(), capacity());
-    }
-
+    // A listing cut off here still has to hand its cache file back
+    if( transferStage == FTP_List || transferStage == FTP_Nlst || transferStage == FTP_Mlsd )
+      endList( false );
     cmdStage = FTP_Init;
     transferStage = FTP_Close;
     dataConn = FTP_NoConn;
+
+    releaseBuffer();
 }
-void FtpServer::setLocalIp(IPAddress localIp)
+void FtpSession::setLocalIp(IPAddress localIp)
 {
 	this->localIp = localIp;
 }
-void FtpServer::credentials( const char * _user, const char * _pass )
+void FtpSession::credentials( const char * _user, const char * _pass )
 {
   if( strlen( _user ) > 0 && strlen( _user ) < FTP_CRED_SIZE )
 //    strcpy( user, _user );
@@ -140,7 +253,16 @@ void FtpServer::credentials( const char * _user, const char * _pass )
 	  this->pass = _pass;
 }
 
-void FtpServer::iniVariables()
+// Take over a control connection accepted by the server
+void FtpSession::attach( FTP_CLIENT_NETWORK_CLASS & _client )
+{
+  client = _client;
+  clientConnected();
+  millisEndConnection = millis() + 1000L * FTP_AUTH_TIME_OUT; // wait client id for 10 s.
+  cmdStage = FTP_User;
+}
+
+void FtpSession::iniVariables()
 {
   // Default for data port
   dataPort = FTP_DATA_PORT_DFLT;
@@ -152,10 +274,11 @@ void FtpServer::iniVariables()
   strcpy( cwdName, "/" );
 
   rnfrCmd = false;
+  restartPos = 0;
   transferStage = FTP_Close;
 }
 
-uint8_t FtpServer::handleFTP() {
+uint8_t FtpSession::handleFTP() {
 #ifdef FTP_ADDITIONAL_DEBUG
 //    int8_t data0 = data.status();
 	ftpTransfer transferStage0 = transferStage;
@@ -177,49 +300,11 @@ uint8_t FtpServer::handleFTP() {
 			DEBUG_PRINTLN(cmdPort);
 
 			cmdStage = FTP_Client;
-		} else if (cmdStage == FTP_Client) {    // Ftp server idle
-#if (FTP_SERVER_NETWORK_TYPE == NETWORK_WiFiNINA)
-//			if (client && !client.connected()) {
-//				client.stop();
-//				DEBUG_PRINTLN(F("CLIENT STOP!!"));
-//			}
-			byte status;
-			client = ftpServer.available(&status);
-			/*
-			 *   CLOSED      = 0,
-  LISTEN      = 1,
-  SYN_SENT    = 2,
-  SYN_RCVD    = 3,
-  ESTABLISHED = 4,
-  FIN_WAIT_1  = 5,
-  FIN_WAIT_2  = 6,
-  CLOSE_WAIT  = 7,
-  CLOSING     = 8,
-  LAST_ACK    = 9,
-  TIME_WAIT   = 10
-			 *
-			 */
-//			DEBUG_PRINTLN(status);
-#elif (defined(ESP8266) && (FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_ASYNC || FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266 || FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_242))
-
-		  if( ftpServer.hasClient())
-		  {
-		    client.stop();
-		    client = ftpServer.available();
-		  }
-#else
+		} else if (cmdStage == FTP_Client) {    // Ftp session idle, waiting for the server to attach a client
 			if (client && !client.connected()) {
 				client.stop();
 				DEBUG_PRINTLN(F("CLIENT STOP!!"));
 			}
-			client = ftpServer.accept();
-#endif
-			if (client.connected())             // A client connected
-			{
-				clientConnected();
-				millisEndConnection = millis() + 1000L * FTP_AUTH_TIME_OUT; // wait client id for 10 s.
-				cmdStage = FTP_User;
-			}
 		} else if (readChar() > 0)             // got response
 				{
 			processCommand();
@@ -230,8 +315,8 @@ uint8_t FtpServer::handleFTP() {
 			else
 				millisEndConnection = millis() + 1000L * FTP_TIME_OUT;
 		} else if (!client.connected()) {
-			if (FtpServer::_callback) {
-			  FtpServer::_callback(FTP_DISCONNECT, free(), capacity());
+			if (server->_callback) {
+			  server->_callback(FTP_DISCONNECT, free(), capacity());
 			}
 
 			cmdStage = FTP_Init;
@@ -244,8 +329,8 @@ uint8_t FtpServer::handleFTP() {
 		} else if (transferStage == FTP_Store) // Store data
 		{
 			if (!doStore()) {
-		    	  if (FtpServer::_callback) {
-		    		  FtpServer::_callback(FTP_FREE_SPACE_CHANGE, free(), capacity());
+		    	  if (server->_callback) {
+		    		  server->_callback(FTP_FREE_SPACE_CHANGE, free(), capacity());
 		    	  }
 
 				transferStage = FTP_Close;
@@ -269,6 +354,11 @@ uint8_t FtpServer::handleFTP() {
 			cmdStage = FTP_Stop;
 		}
 
+		// Idle sessions do not keep a transfer buffer
+		if (transferStage == FTP_Close) {
+			releaseBuffer();
+		}
+
 #ifdef FTP_ADDITIONAL_DEBUG
 		if (cmdStage != cmdStage0 || transferStage != transferStage0
 				|| dataConn != dataConn0) {
@@ -291,28 +381,28 @@ uint8_t FtpServer::handleFTP() {
 	return cmdStage | (transferStage << 3) | (dataConn << 6);
 }
 
-void FtpServer::clientConnected()
+void FtpSession::clientConnected()
 {
   DEBUG_PRINTLN( F(" Client connected!") );
   client.print  (F("220--- ")); client.print(welcomeMessage); client.println(F(" ---"));
   client.println(F("    --   By Renzo Mischianti   --"));
   client.print  (F("220 --   Version ")); client.print(FTP_SERVER_VERSION); client.println(F("   --"));
   iCL = 0;
-  if (FtpServer::_callback) {
-	  FtpServer::_callback(FTP_CONNECT, free(), capacity());
+  if (server->_callback) {
+	  server->_callback(FTP_CONNECT, free(), capacity());
   }
 
 }
 
-void FtpServer::disconnectClient()
+void FtpSession::disconnectClient()
 {
 	DEBUG_PRINTLN( F(" Disconnecting client") );
 
   abortTransfer();
   client.println(F("221 Goodbye") );
 
-  if (FtpServer::_callback) {
-	  FtpServer::_callback(FTP_DISCONNECT, free(), capacity());
+  if (server->_callback) {
+	  server->_callback(FTP_DISCONNECT, free(), capacity());
   }
 
   if( client ) {
@@ -322,7 +412,7 @@ void FtpServer::disconnectClient()
   }
 }
 
-bool FtpServer::processCommand()
+bool FtpSession::processCommand()
 {
   ///////////////////////////////////////
   //                                   //
@@ -334,6 +424,10 @@ bool FtpServer::processCommand()
   DEBUG_PRINT("Command is: ");
   DEBUG_PRINTLN(command);
 
+  // A REST offset only applies to the command that immediately follows it
+  uint32_t restartOffset = restartPos;
+  restartPos = 0;
+
   //
   //  USER - User Identity 
   //
@@ -402,6 +496,7 @@ bool FtpServer::processCommand()
 	client.println(F(" UTF8") );
 #endif
     client.println(F(" SIZE") );
+    client.println(F(" REST STREAM") );
     client.println(F(" SITE FREE") );
     client.println(F("211 End.") );
   }
@@ -652,9 +747,13 @@ bool FtpServer::processCommand()
   {
     char path[ FTP_CWD_SIZE ];
     if( haveParameter() && makeExistsPath( path )) {
+      uint32_t size = pathSize( path );
       if( remove( path )) {
-    	  if (FtpServer::_callback) {
-    		  FtpServer::_callback(FTP_FREE_SPACE_CHANGE, free(), capacity());
+    	  if (server->_fileCallback) {
+    		  server->_fileCallback(FTP_FILE_DELETED, path, size, 0);
+    	  }
+    	  if (server->_callback) {
+    		  server->_callback(FTP_FREE_SPACE_CHANGE, free(), capacity());
     	  }
 
         client.print( F("250 Deleted ") ); client.println( parameter );
@@ -673,11 +772,17 @@ bool FtpServer::processCommand()
 	DEBUG_PRINT("List of file!!");
 
     if( dataConnect()){
-      if( openDir( & dir ))
+      // NLST sends the same lines as LIST, so they share the stored copy
+      char kind = CommandIs( "MLSD" ) ? 'M' : 'L';
+      nbMatch = 0;
+      allocateBuffer();                   // without one the listing is sent line by line
+      listStored = buf && server->_listCache && server->_listCache->open( index, kind, cwdName, & nbMatch );
+      if( listStored || openDir( & dir ))
       {
     	DEBUG_PRINT("Dir opened!!");
 
-        nbMatch = 0;
+        if( ! listStored )
+          listOut.begin( & data, buf, FTP_BUF_SIZE, server->_listCache, index, & nbMatch );
         if( CommandIs( "LIST" ))
           transferStage = FTP_List;
         else if( CommandIs( "NLST" ))
@@ -687,6 +792,8 @@ bool FtpServer::processCommand()
       }
       else {
     	  DEBUG_PRINT("List Data stop!!");
+    	  if( server->_listCache )
+    	    server->_listCache->close( index, false, 0 );
     	  data.stop();
       }
     }
@@ -723,6 +830,22 @@ bool FtpServer::processCommand()
     }
   }
   //
+  //  REST - Restart transfer at an offset (stream mode)
+  //
+  else if( CommandIs( "REST" ))
+  {
+    char * end = NULL;
+    unsigned long offset = parameter != NULL ? strtoul( parameter, &end, 10 ) : 0;
+    if( parameter == NULL || end == parameter || *end != 0 ) {
+      client.println( F("501 Invalid REST parameter") );
+    } else
+    {
+      restartPos = offset;
+      client.print( F("350 Restarting at ") ); client.print( offset );
+      client.println( F(". Send STORE or RETRIEVE") );
+    }
+  }
+  //
   //  NOOP
   //
   else if( CommandIs( "NOOP" )) {
@@ -736,7 +859,7 @@ bool FtpServer::processCommand()
 	client.println(F("      CDUP, CWD, PWD, QUIT, NOOP") );
 	client.println(F("      MODE, PASV, PORT, STRU, TYPE") );
 	client.println(F("      ABOR, DELE, LIST, NLST, MLST, MLSD") );
-	client.println(F("      APPE, RETR, STOR") );
+	client.println(F("      APPE, RETR, STOR, REST") );
 	client.println(F("      MKD,  RMD") );
 	client.println(F("      RNTO, RNFR") );
 	client.println(F("      MDTM, MFMT") );
@@ -751,19 +874,30 @@ bool FtpServer::processCommand()
   {
     char path[ FTP_CWD_SIZE ];
     if( haveParameter() && makeExistsPath( path )) {
-      if( ! openFile( path, FTP_FILE_READ )) {
+      if( ! allocateBuffer()) {
+        client.println( F("451 Not enough memory") );
+      } else if( ! openFile( path, FTP_FILE_READ )) {
         client.print( F("450 Can't open ") ); client.print( parameter );
+      } else if( restartOffset > fileSize( file ) || ! file.seek( restartOffset )) {
+        file.close();
+        client.println( F("554 Invalid REST parameter") );
       } else if( dataConnect( false ))
       {
     	  DEBUG_PRINT( F(" Sending ") ); DEBUG_PRINT( parameter ); DEBUG_PRINT( F(" size ") ); DEBUG_PRINTLN( long( fileSize( file ))  );
+    	  DEBUG_PRINT( F(" from offset ") ); DEBUG_PRINTLN( restartOffset );
 
-		  if (FtpServer::_transferCallback) {
-			  FtpServer::_transferCallback(FTP_DOWNLOAD_START, parameter,  long( fileSize( file )));
+		  strcpy( transferName, path );
+		  transferSize = fileSize( file ) - restartOffset;
+		  if (server->_transferCallback) {
+			  server->_transferCallback(FTP_DOWNLOAD_START, parameter,  long( fileSize( file )));
+		  }
+		  if (server->_transferProgressCallback) {
+			  server->_transferProgressCallback(index, FTP_DOWNLOAD_START, 0, transferSize);
 		  }
 
 
         client.print( F("150-Connected to port ") ); client.println( dataPort );
-        client.print( F("150 ") ); client.print( long( fileSize( file )) ); client.println( F(" bytes to download") );
+        client.print( F("150 ") ); client.print( long( fileSize( file ) - restartOffset )); client.println( F(" bytes to download") );
         millisBeginTrans = millis();
         bytesTransfered = 0;
         transferStage = FTP_Retrieve;
@@ -780,7 +914,25 @@ bool FtpServer::processCommand()
     if( haveParameter() && makePath( path ))
     {
       bool open;
-      if( exists( path )) {
+      // Before the open, so a full heap never truncates the file
+      if( ! allocateBuffer()) {
+        client.println( F("451 Not enough memory") );
+        return true;
+      }
+      strcpy( storeName, path );
+      storeExisted = exists( path );
+      storeOldSize = storeExisted ? pathSize( path ) : 0;
+      storeOffset = CommandIs( "APPE" ) ? storeOldSize : 0;
+      if( restartOffset > 0 ) {
+        // Resume: keep what is already there and continue writing at the offset
+        if( ! storeExisted || restartOffset > storeOldSize ) {
+          client.println( F("554 Invalid REST parameter") );
+          return true;
+        }
+        DEBUG_PRINT(F("RESUME FILE AT ")); DEBUG_PRINTLN(restartOffset);
+        open = openFile( path, FTP_FILE_WRITE_RESUME ) && file.seek( restartOffset );
+        storeOffset = restartOffset;
+      } else if( storeExisted ) {
     	  DEBUG_PRINTLN(F("APPEND FILE!!"));
         open = openFile( path, ( CommandIs( "APPE" ) ? FTP_FILE_WRITE_APPEND : FTP_FILE_WRITE_CREATE ));
       } else {
@@ -793,10 +945,16 @@ bool FtpServer::processCommand()
 
       DEBUG_PRINT(F("open/create "));
       DEBUG_PRINTLN(open);
+      if( open )
+        startStoreHash();                 // only once there is a file to hash into
       if( ! open ){
+        file.close();                     // the resume seek may have failed on an open file
     	  client.print( F("451 Can't open/create ") ); client.println( parameter );
-      }else if( ! dataConnect()) // && !data.available())
+      }else if( ! dataConnect()) { // && !data.available())
         file.close();
+        bytesTransfered = 0;
+        notifyStored();
+      }
       else
       {
     	  DEBUG_PRINT( F(" Receiving ") ); DEBUG_PRINTLN( parameter );
@@ -805,9 +963,13 @@ bool FtpServer::processCommand()
         bytesTransfered = 0;
         transferStage = FTP_Store;
 
-		  if (FtpServer::_transferCallback) {
-
-			  FtpServer::_transferCallback(FTP_UPLOAD_START, parameter, bytesTransfered);
+		  strcpy( transferName, path );
+		  transferSize = 0;
+		  if (server->_transferCallback) {
+			  server->_transferCallback(FTP_UPLOAD_START, parameter, bytesTransfered);
+		  }
+		  if (server->_transferProgressCallback) {
+			  server->_transferProgressCallback(index, FTP_UPLOAD_START, 0, transferSize);
 		  }
 
       }
@@ -829,6 +991,9 @@ bool FtpServer::processCommand()
 
 #if STORAGE_TYPE != STORAGE_SPIFFS
         if( makeDir( path )) {
+        	if (server->_fileCallback) {
+        		server->_fileCallback(FTP_DIR_CREATED, path, 0, 0);
+        	}
         	client.print( F("257 \"") ); client.print( parameter ); client.print( F("\"") ); client.println( F(" created") );
         } else {
 #endif
@@ -850,6 +1015,10 @@ bool FtpServer::processCommand()
       {
     	  DEBUG_PRINT( F(" Deleting ") ); DEBUG_PRINTLN( path );
 
+    	  if (server->_fileCallback) {
+    		  server->_fileCallback(FTP_DIR_DELETED, path, 0, 0);
+    	  }
+
     	  client.print( F("250 \"") ); client.print( parameter ); client.println( F("\" deleted") );
       }
       else {
@@ -901,8 +1070,13 @@ bool FtpServer::processCommand()
 //          {
         	  DEBUG_PRINT( F(" Renaming ") ); DEBUG_PRINT( rnfrName ); DEBUG_PRINT( F(" to ") ); DEBUG_PRINTLN( path );
 
-            if( rename( rnfrName, path ))
+            if( rename( rnfrName, path )) {
+              if (server->_fileCallback) {
+                uint32_t size = pathSize( path );
+                server->_fileCallback(FTP_FILE_RENAMED, path, size, size);
+              }
               client.println(F("250 File successfully renamed or moved") );
+            }
             else
               fail = true;
 //          }
@@ -1012,7 +1186,7 @@ bool FtpServer::processCommand()
   return true;
 }
 
-int FtpServer::dataConnect( bool out150 )
+int FtpSession::dataConnect( bool out150 )
 {
   if( ! data.connected()) {
     if( dataConn == FTP_Pasive )
@@ -1055,7 +1229,7 @@ int FtpServer::dataConnect( bool out150 )
 
 }
 
-bool FtpServer::dataConnected()
+bool FtpSession::dataConnected()
 {
   if( data.connected())
     return true;
@@ -1065,7 +1239,7 @@ bool FtpServer::dataConnected()
   return false;
 }
  
-bool FtpServer::openDir( FTP_DIR * pdir )
+bool FtpSession::openDir( FTP_DIR * pdir )
 {
   bool openD;
 #if (STORAGE_TYPE == STORAGE_LITTLEFS && (defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)))
@@ -1148,81 +1322,127 @@ bool FtpServer::openDir( FTP_DIR * pdir )
   return openD;
 }
 
-bool FtpServer::doRetrieve()
+bool FtpSession::doRetrieve()
 {
   if( ! dataConnected())
   {
+    notifyTransfer( FTP_TRANSFER_ERROR, bytesTransfered );
     file.close();
     return false;
   }
-  int16_t nb = file.read( buf, FTP_BUF_SIZE );
-  if( nb > 0 )
+  if( ! buf )
   {
+    // One reply only: closeTransfer() would add a 226 and report a success
+    client.println(F("451 Not enough memory") );
+    notifyTransfer( FTP_TRANSFER_ERROR, bytesTransfered );
+    file.close();
+    data.stop();
+    return false;
+  }
+
+  // Keep streaming until the file ends or the time slice runs out, so one
+  // transfer fills the link without starving the rest of loop()
+  uint32_t sliceEnd = millis() + FTP_TRANSFER_SLICE_MS;
+  bool more = true;
+  do
+  {
+    int32_t nb = file.read( buf, FTP_BUF_SIZE );
+    if( nb <= 0 )
+    {
+      more = false;                     // end of file
+      break;
+    }
+
     data.write( buf, nb );
     DEBUG_PRINT(F("NB --> "));
     DEBUG_PRINTLN(nb);
     bytesTransfered += nb;
 
-	  if (FtpServer::_transferCallback) {
-		  FtpServer::_transferCallback(FTP_DOWNLOAD, getFileName(&file).c_str(), bytesTransfered);
-	  }
+	  notifyTransfer( FTP_DOWNLOAD, bytesTransfered );
 
 // RoSchmi
-#if STORAGE_TYPE != STORAGE_SEEED_SD
-    return true;
+#if STORAGE_TYPE == STORAGE_SEEED_SD
+    more = false;
 #endif
-  }
+  } while( more && (int32_t) ( sliceEnd - millis()) > 0 );
+
+  if( more )
+    return true;
   closeTransfer();
   return false;
 }
 
-bool FtpServer::doStore()
+bool FtpSession::doStore()
 {
-  int16_t na = data.available();
-  if( na == 0 ) {
-	  DEBUG_PRINTLN("NO DATA AVAILABLE!");
+  if( ! buf )
+  {
+    // One reply only: closeTransfer() would add a 226 and report a success
+    client.println(F("451 Not enough memory") );
+    notifyTransfer( FTP_TRANSFER_ERROR, bytesTransfered );
+    file.close();
+    data.stop();
+    return false;
+  }
+
+  // Drain the data socket until it runs dry or the time slice runs out
+  uint32_t sliceEnd = millis() + FTP_TRANSFER_SLICE_MS;
+  do
+  {
+    int32_t na = data.available();
+    if( na == 0 ) {
+	    DEBUG_PRINTLN("NO DATA AVAILABLE!");
 #if FTP_SERVER_NETWORK_TYPE_SELECTED == NETWORK_SEEED_RTL8720DN
-	  data.stop();
+	    data.stop();
 #endif
-    if( data.connected()) {
-      return true;
-    } else
-    {
-      closeTransfer();
-      return false;
+      if( data.connected()) {
+        return true;
+      } else
+      {
+        closeTransfer();
+        return false;
+      }
     }
-  }
 
-  if( na > FTP_BUF_SIZE ) {
-    na = FTP_BUF_SIZE;
-  }
-  int16_t nb = data.read((uint8_t *) buf, na );
-  int16_t rc = 0;
-  if( nb > 0 )
-  {
-	    DEBUG_PRINT("NB -> ");
-	    DEBUG_PRINTLN(nb);
+    if( na > FTP_BUF_SIZE ) {
+      na = FTP_BUF_SIZE;
+    }
+    int32_t nb = data.read((uint8_t *) buf, na );
+    if( nb <= 0 )
+      return true;
+
+	  DEBUG_PRINT("NB -> ");
+	  DEBUG_PRINTLN(nb);
 
-    rc = file.write( buf, nb );
+    int32_t rc = file.write( buf, nb );
     DEBUG_PRINT("RC -> ");
     DEBUG_PRINTLN(rc);
     bytesTransfered += nb;
+#if defined(ESP32)
+    if( storeHashing ) {
+      if( rc == nb )
+        mbedtls_sha256_update_ret( &storeHash, buf, nb );
+      else
+        storeHashing = false;
+    }
+#endif
 
-	  if (FtpServer::_transferCallback) {
+	  notifyTransfer( FTP_UPLOAD, bytesTransfered );
 
-		  FtpServer::_transferCallback(FTP_UPLOAD, getFileName(&file).c_str(), bytesTransfered);
-	  }
-  }
-  if( nb < 0 || rc == nb  ) {
-    return true;
-  }
-  client.println(F("552 Probably insufficient storage space") );
-  file.close();
-  data.stop();
-  return false;
+    if( rc != nb ) {
+      client.println(F("552 Probably insufficient storage space") );
+      // Only what reached the file counts towards its new size
+      bytesTransfered -= nb - ( rc > 0 ? rc : 0 );
+      notifyTransfer( FTP_TRANSFER_ERROR, bytesTransfered );
+      file.close();
+      notifyStored();
+      data.stop();
+      return false;
+    }
+  } while( (int32_t) ( sliceEnd - millis()) > 0 );
+  return true;
 }
 
-void generateFileLine(FTP_CLIENT_NETWORK_CLASS* data, bool isDirectory, const char* fn, long fz, const char* time, const char* user, bool writeFilename = true) {
+void generateFileLine(Print* data, bool isDirectory, const char* fn, long fz, const char* time, const char* user, bool writeFilename = true) {
 	if( isDirectory ) {
 		//			  data.print( F("+/,\t") );
 		//			  DEBUG_PRINT(F("+/,\t"));
@@ -1326,20 +1546,38 @@ String makeDateTimeStrList(time_t ft, bool dateContracted = false)
 }
 
 // https://files.stairways.com/other/ftp-list-specs-info.txt
-void generateFileLine(FTP_CLIENT_NETWORK_CLASS* data, bool isDirectory, const char* fn, long fz, time_t time, const char* user, bool writeFilename = true) {
+void generateFileLine(Print* data, bool isDirectory, const char* fn, long fz, time_t time, const char* user, bool writeFilename = true) {
 	generateFileLine(data, isDirectory, fn, fz, makeDateTimeStrList(time).c_str(), user, writeFilename);
 }
 #endif
 
-bool FtpServer::doList()
+bool FtpSession::doList()
 {
   if( ! dataConnected())
   {
-#if STORAGE_TYPE != STORAGE_SPIFFS && STORAGE_TYPE != STORAGE_LITTLEFS && STORAGE_TYPE != STORAGE_SEEED_SD
-    dir.close();
-#endif
+    endList( false );
     return false;
   }
+  if( listStored )
+    return sendStoredList();
+
+  // List entries until the directory ends or the time slice runs out, instead
+  // of one entry per call
+  uint32_t sliceEnd = millis() + FTP_TRANSFER_SLICE_MS;
+  do
+  {
+    if( ! listEntry())
+    {
+      endList( true );
+      return false;
+    }
+  } while( (int32_t) ( sliceEnd - millis()) > 0 );
+  return true;
+}
+
+// Writes the LIST line of the next directory entry; returns false at the end
+bool FtpSession::listEntry()
+{
 #if STORAGE_TYPE == STORAGE_SPIFFS
 	#if ESP8266
 	  if( dir.next())
@@ -1367,7 +1605,7 @@ bool FtpServer::doList()
 	  long fz = long( dir.fileSize());
 	  if (fn[0]=='/') { fn.remove(0, fn.lastIndexOf("/")+1); }
 	  time_t time = dir.fileTime();
-	  generateFileLine(&data, false, fn.c_str(), fz, time, this->user);
+	  generateFileLine(&listOut, false, fn.c_str(), fz, time, this->user);
 #else
 	  long fz = long( fileDir.size());
 	  const char* fnC = fileDir.name();
@@ -1379,7 +1617,7 @@ bool FtpServer::doList()
 	  }
 
 	  time_t time = fileDir.getLastWrite();
-	  generateFileLine(&data, false, fn, fz, time, this->user);
+	  generateFileLine(&listOut, false, fn, fz, time, this->user);
 
 #endif
 
@@ -1432,12 +1670,12 @@ bool FtpServer::doList()
 	#endif
 	#if defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
 		time_t time = dir.fileTime();
-		generateFileLine(&data, dir.isDirectory(), fn, fz, time, this->user);
+		generateFileLine(&listOut, dir.isDirectory(), fn, fz, time, this->user);
 	#elif ESP32
 		time_t time = fileDir.getLastWrite();
-		generateFileLine(&data, fileDir.isDirectory(), fn, fz, time, this->user);
+		generateFileLine(&listOut, fileDir.isDirectory(), fn, fz, time, this->user);
 	#else
-		generateFileLine(&data, fileDir.isDirectory(), fn, fz, "Jan 01 00:00", this->user);
+		generateFileLine(&listOut, fileDir.isDirectory(), fn, fz, "Jan 01 00:00", this->user);
 	#endif
     nbMatch ++;
     return true;
@@ -1452,10 +1690,11 @@ bool FtpServer::doList()
 //		data.print( F(",\t") );
 //		data.println( fileDir.name() );
 
-		String fn = fileDir.name();
-		if (fn[0]=='/') { fn.remove(0, fn.lastIndexOf("/")+1); }
+		const char* fn = fileDir.name();
+		const char* slash = strrchr( fn, '/' );
+		if( slash ) { fn = slash + 1; }
 
-		generateFileLine(&data, fileDir.isDirectory(), fn.c_str(), long( fileDir.size()), "Jan 01 00:00", this->user);
+		generateFileLine(&listOut, fileDir.isDirectory(), fn, long( fileDir.size()), "Jan 01 00:00", this->user);
 
 		nbMatch ++;
 		return true;
@@ -1474,7 +1713,7 @@ bool FtpServer::doList()
 		String fn = dir.fileName();
 		if (fn[0]=='/') { fn.remove(0, fn.lastIndexOf("/")+1); }
 
-	generateFileLine(&data, dir.isDir(), fn.c_str(), long( dir.fileSize()), "Jan 01 00:00", this->user);
+	generateFileLine(&listOut, dir.isDir(), fn.c_str(), long( dir.fileSize()), "Jan 01 00:00", this->user);
 
     nbMatch ++;
     return true;
@@ -1488,35 +1727,46 @@ bool FtpServer::doList()
 //    	data.print( F("+r,s") ); data.print( long( fileSize( file )) ); data.print( F(",\t") );
 //    }
 
-	generateFileLine(&data, file.isDir(), "", long( fileSize( file )), "Jan 01 00:00", this->user, false);
+	generateFileLine(&listOut, file.isDir(), "", long( fileSize( file )), "Jan 01 00:00", this->user, false);
 
-    file.printName( & data );
-    data.println();
+    file.printName( & listOut );
+    listOut.println();
     file.close();
     nbMatch ++;
     return true;
   }
 #endif
-  client.print( F("226 ") ); client.print( nbMatch ); client.println( F(" matches total") );
-#if STORAGE_TYPE != STORAGE_SPIFFS && STORAGE_TYPE != STORAGE_LITTLEFS && STORAGE_TYPE != STORAGE_SEEED_SD
-  dir.close();
-#endif
-  data.stop();
   return false;
 }
 
-bool FtpServer::doMlsd()
+bool FtpSession::doMlsd()
 {
   if( ! dataConnected())
   {
-#if STORAGE_TYPE != STORAGE_SPIFFS && STORAGE_TYPE != STORAGE_LITTLEFS && STORAGE_TYPE != STORAGE_SEEED_SD
-  dir.close();
-#endif
+    endList( false );
   	DEBUG_PRINTLN(F("Not connected!!"));
     return false;
   }
   DEBUG_PRINTLN(F("Connected!!"));
+  if( listStored )
+    return sendStoredList();
+
+  uint32_t sliceEnd = millis() + FTP_TRANSFER_SLICE_MS;
+  do
+  {
+    if( ! mlsdEntry())
+    {
+      endList( true );
+      DEBUG_PRINTLN(F("All file read!!"));
+      return false;
+    }
+  } while( (int32_t) ( sliceEnd - millis()) > 0 );
+  return true;
+}
 
+// Writes the MLSD fact line of the next directory entry; returns false at the end
+bool FtpSession::mlsdEntry()
+{
 #if STORAGE_TYPE == STORAGE_SPIFFS
 	  DEBUG_PRINTLN("DIR MLSD ");
 	#if ESP8266
@@ -1554,12 +1804,12 @@ bool FtpServer::doMlsd()
 		long fz = fileDir.size();
 	#endif
 
-		data.print( F("Type=") );
+		listOut.print( F("Type=") );
 
-		data.print( F("file") );
-		data.print( F(";Modify=") ); data.print(dtStr);// data.print( makeDateTimeStr( dtStr, time, time) );
-		data.print( F(";Size=") ); data.print( fz );
-		data.print( F("; ") ); data.println( fn );
+		listOut.print( F("file") );
+		listOut.print( F(";Modify=") ); listOut.print(dtStr);// data.print( makeDateTimeStr( dtStr, time, time) );
+		listOut.print( F(";Size=") ); listOut.print( fz );
+		listOut.print( F("; ") ); listOut.println( fn );
 
 		DEBUG_PRINT( F("Type=") );
 		DEBUG_PRINT( F("file") );
@@ -1626,12 +1876,12 @@ bool FtpServer::doMlsd()
 		long fz = fileDir.size();
 	#endif
 
-		data.print( F("Type=") );
+		listOut.print( F("Type=") );
 
-		data.print( ( fileDir.isDirectory() ? F("dir") : F("file")) );
-		data.print( F(";Modify=") ); data.print(dtStr);// data.print( makeDateTimeStr( dtStr, time, time) );
-		data.print( F(";Size=") ); data.print( fz );
-		data.print( F("; ") ); data.println( fn );
+		listOut.print( ( fileDir.isDirectory() ? F("dir") : F("file")) );
+		listOut.print( F(";Modify=") ); listOut.print(dtStr);// data.print( makeDateTimeStr( dtStr, time, time) );
+		listOut.print( F(";Size=") ); listOut.print( fz );
+		listOut.print( F("; ") ); listOut.println( fn );
 
 		DEBUG_PRINT( F("Type=") );
 		DEBUG_PRINT( ( fileDir.isDirectory() ? F("dir") : F("file")) );
@@ -1662,23 +1912,19 @@ bool FtpServer::doMlsd()
 
 
 //		long fz = dir.fileSize();
-		String fn = fileDir.name();
-
-//#ifdef ESP32
-		fn.remove(0, fn.lastIndexOf("/")+1);
-//#else if !defined(ESP8266)
-//		fn.remove(0, 1);
-//#endif
+		const char* fn = fileDir.name();
+		const char* slash = strrchr( fn, '/' );
+		if( slash ) { fn = slash + 1; }
 
 
 		long fz = fileDir.size();
 
-		data.print( F("Type=") );
+		listOut.print( F("Type=") );
 
-		data.print( ( fileDir.isDirectory() ? F("dir") : F("file")) );
-		data.print( F(";Modify=") ); data.print(dtStr);// data.print( makeDateTimeStr( dtStr, time, time) );
-		data.print( F(";Size=") ); data.print( fz );
-		data.print( F("; ") ); data.println( fn );
+		listOut.print( ( fileDir.isDirectory() ? F("dir") : F("file")) );
+		listOut.print( F(";Modify=") ); listOut.print(dtStr);// data.print( makeDateTimeStr( dtStr, time, time) );
+		listOut.print( F(";Size=") ); listOut.print( fz );
+		listOut.print( F("; ") ); listOut.println( fn );
 
 		DEBUG_PRINT( F("Type=") );
 		DEBUG_PRINT( ( fileDir.isDirectory() ? F("dir") : F("file")) );
@@ -1695,10 +1941,10 @@ bool FtpServer::doMlsd()
   if( dir.nextFile())
   {
     char dtStr[ 15 ];
-    data.print( F("Type=") ); data.print( ( dir.isDir() ? F("dir") : F("file")) );
-    data.print( F(";Modify=") ); data.print( makeDateTimeStr( dtStr, dir.fileModDate(), dir.fileModTime()) );
-    data.print( F(";Size=") ); data.print( long( dir.fileSize()) );
-    data.print( F("; ") ); data.println( dir.fileName() );
+    listOut.print( F("Type=") ); listOut.print( ( dir.isDir() ? F("dir") : F("file")) );
+    listOut.print( F(";Modify=") ); listOut.print( makeDateTimeStr( dtStr, dir.fileModDate(), dir.fileModTime()) );
+    listOut.print( F(";Size=") ); listOut.print( long( dir.fileSize()) );
+    listOut.print( F("; ") ); listOut.println( dir.fileName() );
     nbMatch ++;
     return true;
   }
@@ -1712,11 +1958,11 @@ bool FtpServer::doMlsd()
     DEBUG_PRINTLN(gfmt);
     if( gfmt )
     {
-		  data.print( F("Type=") ); data.print( ( file.isDir() ? F("dir") : F("file")) );
-		  data.print( F(";Modify=") ); data.print( makeDateTimeStr( dtStr, filelwd, filelwt ) );
-		  data.print( F(";Size=") ); data.print( long( fileSize( file )) ); data.print( F("; ") );
-		  file.printName( & data );
-		  data.println();
+		  listOut.print( F("Type=") ); listOut.print( ( file.isDir() ? F("dir") : F("file")) );
+		  listOut.print( F(";Modify=") ); listOut.print( makeDateTimeStr( dtStr, filelwd, filelwt ) );
+		  listOut.print( F(";Size=") ); listOut.print( long( fileSize( file )) ); listOut.print( F("; ") );
+		  file.printName( & listOut );
+		  listOut.println();
 
 		  DEBUG_PRINT( F("Type=") ); DEBUG_PRINT( ( file.isDir() ? F("dir") : F("file")) );
 		  DEBUG_PRINT( F(";Modify=") ); DEBUG_PRINT( makeDateTimeStr( dtStr, filelwd, filelwt ) );
@@ -1729,29 +1975,121 @@ bool FtpServer::doMlsd()
     return gfmt;
   }
 #endif
-  client.println(F("226-options: -a -l") );
-  client.print( F("226 ") ); client.print( nbMatch ); client.println( F(" matches total") );
-#if STORAGE_TYPE != STORAGE_SPIFFS && STORAGE_TYPE != STORAGE_LITTLEFS && STORAGE_TYPE != STORAGE_SEEED_SD && STORAGE_TYPE != STORAGE_SEEED_SD
+  return false;
+}
+
+// Sends a listing kept by the listing cache in buffer-sized writes
+bool FtpSession::sendStoredList()
+{
+  uint32_t sliceEnd = millis() + FTP_TRANSFER_SLICE_MS;
+  do
+  {
+    int32_t nb = server->_listCache->read( index, buf, FTP_BUF_SIZE );
+    if( nb < 0 )
+    {
+      client.println( F("451 Can't read the listing") );
+      endList( false );
+      data.stop();
+      return false;
+    }
+    if( nb == 0 )
+    {
+      endList( true );
+      return false;
+    }
+    data.write( buf, nb );
+  } while( (int32_t) ( sliceEnd - millis()) > 0 );
+  return true;
+}
+
+// Ends a LIST/NLST/MLSD: sends what is left and the match count if it ran to the
+// end, and hands the listing back to the cache
+void FtpSession::endList( bool complete )
+{
+  if( complete )
+  {
+    if( ! listStored )
+      listOut.send();
+    if( transferStage == FTP_Mlsd )
+      client.println(F("226-options: -a -l") );
+    client.print( F("226 ") ); client.print( nbMatch ); client.println( F(" matches total") );
+  }
+  if( server->_listCache )
+    server->_listCache->close( index, complete, nbMatch );
+#if STORAGE_TYPE != STORAGE_SPIFFS && STORAGE_TYPE != STORAGE_LITTLEFS && STORAGE_TYPE != STORAGE_SEEED_SD
+  if( ! listStored )
     dir.close();
 #endif
-  data.stop();
-  DEBUG_PRINTLN(F("All file read!!"));
-  return false;
+  listStored = false;
+  if( complete )
+    data.stop();
+}
+
+void FtpListWriter::begin( FTP_CLIENT_NETWORK_CLASS * _out, uint8_t * _buf, uint32_t _size,
+                           FtpListCache * _cache, uint8_t _session, const uint16_t * _entries )
+{
+  out = _out;
+  buf = _buf;
+  size = _buf ? _size : 0;
+  used = 0;
+  cache = _cache;
+  session = _session;
+  entries = _entries;
+}
+
+size_t FtpListWriter::write( uint8_t c )
+{
+  return write( & c, 1 );
+}
+
+size_t FtpListWriter::write( const uint8_t * data, size_t length )
+{
+  if( ! size )
+    return out->write( data, length );
+  size_t left = length;
+  while( left > 0 )
+  {
+    if( used == size )
+      send();
+    uint32_t n = size - used < left ? size - used : left;
+    memcpy( buf + used, data, n );
+    used += n;
+    data += n;
+    left -= n;
+  }
+  return length;
+}
+
+void FtpListWriter::send()
+{
+  if( used == 0 )
+    return;
+  out->write( buf, used );
+  if( cache )
+    cache->append( session, buf, used, * entries );
+  used = 0;
 }
 
-void FtpServer::closeTransfer()
+// Reports a transfer to the callbacks; the name is the one saved at the start, so
+// no String is built per chunk
+void FtpSession::notifyTransfer( FtpTransferOperation operation, uint32_t transferred )
+{
+  if( server->_transferCallback )
+    server->_transferCallback( operation, transferName, transferred );
+  if( server->_transferProgressCallback )
+    server->_transferProgressCallback( index, operation, transferred, transferSize );
+}
+
+void FtpSession::closeTransfer()
 {
   uint32_t deltaT = (int32_t) ( millis() - millisBeginTrans );
+  // Every started transfer ends with STOP or ERROR, empty ones included
+  notifyTransfer( FTP_TRANSFER_STOP, bytesTransfered );
   if( deltaT > 0 && bytesTransfered > 0 )
   {
 	  DEBUG_PRINT( F(" Transfer completed in ") ); DEBUG_PRINT( deltaT ); DEBUG_PRINTLN( F(" ms, ") );
 	  DEBUG_PRINT( bytesTransfered / deltaT ); DEBUG_PRINTLN( F(" kbytes/s") );
 
-	  if (FtpServer::_transferCallback) {
-		  FtpServer::_transferCallback(FTP_TRANSFER_STOP, getFileName(&file).c_str(), bytesTransfered);
-	  }
-
-
     client.println(F("226-File successfully transferred") );
     client.print( F("226 ") ); client.print( deltaT ); client.print( F(" ms, ") );
     client.print( bytesTransfered / deltaT ); client.println( F(" kbytes/s") );
@@ -1760,18 +2098,22 @@ void FtpServer::closeTransfer()
     client.println(F("226 File successfully transferred") );
   
   file.close();
+  if( transferStage == FTP_Store )
+    notifyStored();
   data.stop();
 }
 
-void FtpServer::abortTransfer()
+void FtpSession::abortTransfer()
 {
   if( transferStage != FTP_Close )
   {
-	  if (FtpServer::_transferCallback) {
-		  FtpServer::_transferCallback(FTP_TRANSFER_ERROR, getFileName(&file).c_str(), bytesTransfered);
-	  }
+	  notifyTransfer( FTP_TRANSFER_ERROR, bytesTransfered );
 
+	  if( transferStage == FTP_List || transferStage == FTP_Nlst || transferStage == FTP_Mlsd )
+	    endList( false );
 	  file.close();
+	  if( transferStage == FTP_Store )
+	    notifyStored();
 #if STORAGE_TYPE != STORAGE_SPIFFS && STORAGE_TYPE != STORAGE_LITTLEFS && STORAGE_TYPE != STORAGE_SEEED_SD
     dir.close();
 #endif
@@ -1784,6 +2126,80 @@ void FtpServer::abortTransfer()
   data.stop(); 
 }
 
+// Take the transfer buffer for a transfer that is starting; false if there is no memory
+bool FtpSession::allocateBuffer()
+{
+#if defined(ESP32)
+  // Card DMA goes straight into internal RAM; PSRAM only if that is exhausted
+  if( ! buf )
+    buf = (uint8_t *) heap_caps_aligned_alloc( 4, FTP_BUF_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA );
+  if( ! buf )
+    buf = (uint8_t *) heap_caps_aligned_alloc( 4, FTP_BUF_SIZE, MALLOC_CAP_SPIRAM );
+  if( ! buf )
+    DEBUG_PRINTLN( F("No memory for the transfer buffer!") );
+  return buf != NULL;
+#else
+  return true;
+#endif
+}
+
+// Hand the transfer buffer back once the session has nothing to send or receive
+void FtpSession::releaseBuffer()
+{
+#if defined(ESP32)
+  if( buf ) {
+    heap_caps_free( buf );
+    buf = NULL;
+  }
+#endif
+}
+
+// Start hashing a STOR/APPE that writes the file from its first byte
+void FtpSession::startStoreHash()
+{
+#if defined(ESP32)
+  storeHashing = server->_storeHashCallback && storeOffset == 0;
+  if( storeHashing )
+    mbedtls_sha256_starts_ret( &storeHash, 0 );
+#endif
+}
+
+// Report the result of a STOR/APPE, including a partial one, to the file callback
+void FtpSession::notifyStored()
+{
+#if defined(ESP32)
+  // The file holds exactly the bytes hashed, even if the transfer was cut short
+  if( storeHashing ) {
+    uint8_t sha256[ 32 ];
+    storeHashing = false;
+    if( mbedtls_sha256_finish_ret( &storeHash, sha256 ) == 0 && server->_storeHashCallback )
+      server->_storeHashCallback( storeName, sha256 );
+  }
+#endif
+  if( ! server->_fileCallback )
+    return;
+  uint32_t newSize = storeOffset + bytesTransfered;
+  if( newSize < storeOldSize && storeOffset > 0 )
+    newSize = storeOldSize;           // resumed inside the file; the tail is kept
+  server->_fileCallback( storeExisted ? FTP_FILE_CHANGED : FTP_FILE_CREATED,
+                            storeName, storeOldSize, newSize );
+}
+
+// Return the size of a file without disturbing the file used for transfers
+uint32_t FtpSession::pathSize( const char * path )
+{
+#if (STORAGE_TYPE == STORAGE_SD || STORAGE_TYPE == STORAGE_SD_MMC) && defined(ESP32)
+  FTP_FILE f = STORAGE_MANAGER.open( path, "r" );
+  if( ! f )
+    return 0;
+  uint32_t size = f.isDirectory() ? 0 : f.size();
+  f.close();
+  return size;
+#else
+  return 0;
+#endif
+}
+
 // Read a char from client connected to ftp server
 //
 //  update cmdLine and command buffers, iCL and parameter pointers
@@ -1794,7 +2210,7 @@ void FtpServer::abortTransfer()
 //     0 if empty line received
 //    length of cmdLine (positive) if no empty line received 
 
-int8_t FtpServer::readChar()
+int8_t FtpSession::readChar()
 {
   int8_t rc = -1;
 
@@ -1859,7 +2275,7 @@ int8_t FtpServer::readChar()
   return rc;
 }
 
-bool FtpServer::haveParameter()
+bool FtpSession::haveParameter()
 {
   if( parameter != NULL && strlen( parameter ) > 0 )
     return true;
@@ -1950,7 +2366,7 @@ int utf8_strlen(const String& str)
 // return:
 //    true, if done
 
-bool FtpServer::makePath( char * fullName, char * param )
+bool FtpSession::makePath( char * fullName, char * param )
 {
   if( param == NULL )
     param = parameter;
@@ -2010,7 +2426,7 @@ bool FtpServer::makePath( char * fullName, char * param )
   return true;
 }
 
-bool FtpServer::makeExistsPath( char * path, char * param )
+bool FtpSession::makeExistsPath( char * path, char * param )
 {
   if( ! makePath( path, param ))
     return false;
@@ -2047,7 +2463,7 @@ bool FtpServer::makeExistsPath( char * path, char * param )
 // Date/time are expressed as a 14 digits long string
 //   terminated by a space and followed by name of file
 
-uint8_t FtpServer::getDateTime( char * dt, uint16_t * pyear, uint8_t * pmonth, uint8_t * pday,
+uint8_t FtpSession::getDateTime( char * dt, uint16_t * pyear, uint8_t * pmonth, uint8_t * pday,
                                 uint8_t * phour, uint8_t * pminute, uint8_t * psecond )
 {
   uint8_t i;
@@ -2096,7 +2512,7 @@ uint8_t FtpServer::getDateTime( char * dt, uint16_t * pyear, uint8_t * pmonth, u
 // return:
 //    pointer to tstr
 
-char * FtpServer::makeDateTimeStr( char * tstr, uint16_t date, uint16_t time )
+char * FtpSession::makeDateTimeStr( char * tstr, uint16_t date, uint16_t time )
 {
   sprintf( tstr, "%04u%02u%02u%02u%02u%02u",
            (( date & 0xFE00 ) >> 9 ) + 1980, ( date & 0x01E0 ) >> 5, date & 0x001F,
@@ -2105,7 +2521,7 @@ char * FtpServer::makeDateTimeStr( char * tstr, uint16_t date, uint16_t time )
 }
 
 
-uint32_t FtpServer::fileSize( FTP_FILE & file ) {
+uint32_t FtpSession::fileSize( FTP_FILE & file ) {
 #if (STORAGE_TYPE == STORAGE_SDFAT2 || STORAGE_TYPE == STORAGE_SPIFFS || STORAGE_TYPE == STORAGE_LITTLEFS || STORAGE_TYPE == STORAGE_FFAT || STORAGE_TYPE == STORAGE_SD || STORAGE_TYPE == STORAGE_SD_MMC || STORAGE_TYPE == STORAGE_SEEED_SD)
 	return file.size();
 #else
@@ -2114,7 +2530,7 @@ uint32_t FtpServer::fileSize( FTP_FILE & file ) {
 }
 
 #if (STORAGE_TYPE == STORAGE_SEEED_SD)
-  bool FtpServer::openFile( char path[ FTP_CWD_SIZE ], int readTypeInt ){
+  bool FtpSession::openFile( char path[ FTP_CWD_SIZE ], int readTypeInt ){
 		DEBUG_PRINT(F("File to open ") );
 		DEBUG_PRINT( path );
 		DEBUG_PRINT(F(" readType ") );
@@ -2136,7 +2552,7 @@ uint32_t FtpServer::fileSize( FTP_FILE & file ) {
 		}
 }
 #elif ((STORAGE_TYPE == STORAGE_SD || STORAGE_TYPE == STORAGE_SD_MMC) && defined(ESP8266))// FTP_SERVER_NETWORK_TYPE_SELECTED == NETWORK_ESP8266_242)
-  bool FtpServer::openFile( char path[ FTP_CWD_SIZE ], int readTypeInt ){
+  bool FtpSession::openFile( char path[ FTP_CWD_SIZE ], int readTypeInt ){
 		DEBUG_PRINT(F("File to open ") );
 		DEBUG_PRINT( path );
 		DEBUG_PRINT(F(" readType ") );
@@ -2158,7 +2574,7 @@ uint32_t FtpServer::fileSize( FTP_FILE & file ) {
 		}
 }
 #elif (STORAGE_TYPE == STORAGE_SPIFFS || STORAGE_TYPE == STORAGE_LITTLEFS || STORAGE_TYPE == STORAGE_FFAT )
-  bool FtpServer::openFile( const char * path, const char * readType ) {
+  bool FtpSession::openFile( const char * path, const char * readType ) {
   		DEBUG_PRINT(F("File to open ") );
   		DEBUG_PRINT( path );
   		DEBUG_PRINT(F(" readType ") );
@@ -2173,7 +2589,7 @@ uint32_t FtpServer::fileSize( FTP_FILE & file ) {
   		}
   }
 #elif STORAGE_TYPE <= STORAGE_SDFAT2 || STORAGE_TYPE == STORAGE_SPIFM || ((STORAGE_TYPE == STORAGE_SD || STORAGE_TYPE == STORAGE_SD_MMC) && ARDUINO_ARCH_SAMD)
-  bool FtpServer::openFile( char path[ FTP_CWD_SIZE ], int readTypeInt ){
+  bool FtpSession::openFile( char path[ FTP_CWD_SIZE ], int readTypeInt ){
 		DEBUG_PRINT(F("File to open ") );
 		DEBUG_PRINT( path );
 		DEBUG_PRINT(F(" readType ") );
@@ -2190,10 +2606,10 @@ uint32_t FtpServer::fileSize( FTP_FILE & file ) {
 }
 
 #else
-  bool FtpServer::openFile( char path[ FTP_CWD_SIZE ], const char * readType ) {
+  bool FtpSession::openFile( char path[ FTP_CWD_SIZE ], const char * readType ) {
   	return openFile( (const char*) path, readType );
   }
-  bool FtpServer::openFile( const char * path, const char * readType ) {
+  bool FtpSession::openFile( const char * path, const char * readType ) {
   		DEBUG_PRINT(F("File to open ") );
   		DEBUG_PRINT( path );
   		DEBUG_PRINT(F(" readType ") );
@@ -2217,7 +2633,7 @@ uint32_t FtpServer::fileSize( FTP_FILE & file ) {
 #endif
 
 // Return true if path points to a directory
-bool FtpServer::isDir( char * path )
+bool FtpSession::isDir( char * path )
 {
 #if (STORAGE_TYPE == STORAGE_LITTLEFS && (defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)))
 	  FTP_DIR dir;
@@ -2273,7 +2689,7 @@ bool FtpServer::isDir( char * path )
 #endif
 }
 
-bool FtpServer::timeStamp( char * path, uint16_t year, uint8_t month, uint8_t day,
+bool FtpSession::timeStamp( char * path, uint16_t year, uint8_t month, uint8_t day,
                            uint8_t hour, uint8_t minute, uint8_t second )
 {
 #if STORAGE_TYPE == STORAGE_SPIFFS || STORAGE_TYPE == STORAGE_LITTLEFS  || STORAGE_TYPE == STORAGE_FFAT || STORAGE_TYPE == STORAGE_SD || STORAGE_TYPE == STORAGE_SD_MMC || STORAGE_TYPE == STORAGE_SEEED_SD
@@ -2298,7 +2714,7 @@ bool FtpServer::timeStamp( char * path, uint16_t year, uint8_t month, uint8_t da
 #endif
 }
                         
-bool FtpServer::getFileModTime( char * path, uint16_t * pdate, uint16_t * ptime )
+bool FtpSession::getFileModTime( char * path, uint16_t * pdate, uint16_t * ptime )
 {
 #if STORAGE_TYPE == STORAGE_FATFS
   return STORAGE_MANAGER.getFileModTime( path, pdate, ptime );
@@ -2318,7 +2734,7 @@ bool FtpServer::getFileModTime( char * path, uint16_t * pdate, uint16_t * ptime
 // Assume SD library is SdFat (or family) and file is open
                         
 #if STORAGE_TYPE != STORAGE_FATFS
-bool FtpServer::getFileModTime( uint16_t * pdate, uint16_t * ptime )
+bool FtpSession::getFileModTime( uint16_t * pdate, uint16_t * ptime )
 {
 #if STORAGE_TYPE == STORAGE_SPIFFS || STORAGE_TYPE == STORAGE_LITTLEFS || STORAGE_TYPE == STORAGE_FFAT
 	#if defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
@@ -2342,7 +2758,7 @@ bool FtpServer::getFileModTime( uint16_t * pdate, uint16_t * ptime )
 #endif
 
 #if (STORAGE_TYPE == STORAGE_SD || STORAGE_TYPE == STORAGE_SD_MMC) && !defined(ESP32)
-  bool     FtpServer::rename( const char * path, const char * newpath ){
+  bool     FtpSession::rename( const char * path, const char * newpath ){
 
 		FTP_FILE myFileIn = STORAGE_MANAGER.open(path, FILE_READ);
 		FTP_FILE myFileOut = STORAGE_MANAGER.open(newpath, FILE_WRITE);
@@ -109,6 +109,7 @@
 
 	#elif defined(ESP32)
 		#include <WiFi.h>
+		#include "mbedtls/sha256.h"
 		//#include <WiFiClientSecure.h>
 
 		#define FTP_CLIENT_NETWORK_CLASS WiFiClient
@@ -279,12 +280,14 @@
 	#define FTP_FILE_READ_WRITE "w+"
 	#define FTP_FILE_WRITE_APPEND "a+"
 	#define FTP_FILE_WRITE_CREATE "w+"
+	#define FTP_FILE_WRITE_RESUME "r+"
 #else
 	#define FTP_FILE_READ "r"
 	#define FTP_FILE_READ_ONLY "r"
 	#define FTP_FILE_READ_WRITE "w"
 	#define FTP_FILE_WRITE_APPEND "a"
 	#define FTP_FILE_WRITE_CREATE "w"
+	#define FTP_FILE_WRITE_RESUME "r+"
 #endif
 
 	#define STORAGE_MANAGER SPIFFS
@@ -304,6 +307,7 @@
 		#define FTP_FILE_READ_WRITE "w"
 		#define FTP_FILE_WRITE_APPEND "a"
 		#define FTP_FILE_WRITE_CREATE "w"
+		#define FTP_FILE_WRITE_RESUME "r+"
 
 	#define FILENAME_LENGTH 255
 #elif(STORAGE_TYPE == STORAGE_LITTLEFS)
@@ -318,6 +322,7 @@
 		#define FTP_FILE_READ_WRITE "w+"
 		#define FTP_FILE_WRITE_APPEND "a+"
 		#define FTP_FILE_WRITE_CREATE "w+"
+		#define FTP_FILE_WRITE_RESUME "r+"
 	#else
 #ifdef ESP32
 	#if ESP_ARDUINO_VERSION_MAJOR >= 2
@@ -340,6 +345,7 @@
 		#define FTP_FILE_READ_WRITE "w"
 		#define FTP_FILE_WRITE_APPEND "a"
 		#define FTP_FILE_WRITE_CREATE "w"
+		#define FTP_FILE_WRITE_RESUME "r+"
 	#endif
 	#ifdef ESP8266
 		#define FILENAME_LENGTH 32
@@ -349,9 +355,17 @@
 #elif(STORAGE_TYPE == STORAGE_SD)
 	// #include <SPI.h>
 	// #include <SD.h>
+#ifdef FTP_STORAGE_MANAGER
+	// Serve an fs::FS the application has already mounted
+	#include <FS.h>
+
+	#define STORAGE_MANAGER FTP_STORAGE_MANAGER
+	extern fs::FS STORAGE_MANAGER;
+#else
 	#include <SD_MMC.h>
 
 	#define STORAGE_MANAGER SD_MMC
+#endif
   	#define FTP_FILE File
   	#define FTP_DIR File
 
@@ -360,9 +374,12 @@
 #ifdef ESP32
 	#define FTP_FILE_READ_WRITE FILE_WRITE
 	#define FTP_FILE_WRITE_APPEND FILE_APPEND
+	// FILE_WRITE is "w" on ESP32 and would truncate the part to be resumed
+	#define FTP_FILE_WRITE_RESUME "r+"
 #else
 	#define FTP_FILE_READ_WRITE FILE_WRITE
 	#define FTP_FILE_WRITE_APPEND FILE_WRITE
+	#define FTP_FILE_WRITE_RESUME FILE_WRITE
 #endif
 	#define FTP_FILE_WRITE_CREATE FILE_WRITE
 
@@ -381,9 +398,12 @@
 #ifdef ESP32
 	#define FTP_FILE_READ_WRITE FILE_WRITE
 	#define FTP_FILE_WRITE_APPEND FILE_APPEND
+	// FILE_WRITE is "w" on ESP32 and would truncate the part to be resumed
+	#define FTP_FILE_WRITE_RESUME "r+"
 #else
 	#define FTP_FILE_READ_WRITE FILE_WRITE
 	#define FTP_FILE_WRITE_APPEND FILE_WRITE
+	#define FTP_FILE_WRITE_RESUME FILE_WRITE
 #endif
 	#define FTP_FILE_WRITE_CREATE FILE_WRITE
 
@@ -407,6 +427,8 @@
 	#define FTP_FILE_READ_WRITE FILE_WRITE
 	#define FTP_FILE_WRITE_APPEND FILE_APPEND
 	#define FTP_FILE_WRITE_CREATE FILE_WRITE
+	// Seeed_FS opens with an integer mode and FILE_WRITE does not truncate
+	#define FTP_FILE_WRITE_RESUME FILE_WRITE
 
 	#define FILENAME_LENGTH 255
 
@@ -424,6 +446,7 @@
 	#define FTP_FILE_READ_WRITE O_RDWR
 	#define FTP_FILE_WRITE_APPEND O_WRITE | O_APPEND
 	#define FTP_FILE_WRITE_CREATE O_WRITE | O_CREAT
+	#define FTP_FILE_WRITE_RESUME O_WRITE
 	#define FILENAME_LENGTH 255
 
 #elif (STORAGE_TYPE == STORAGE_SDFAT2)
@@ -440,6 +463,7 @@
 	#define FTP_FILE_READ_WRITE O_RDWR
 	#define FTP_FILE_WRITE_APPEND O_WRITE | O_APPEND
 	#define FTP_FILE_WRITE_CREATE O_WRITE | O_CREAT
+	#define FTP_FILE_WRITE_RESUME O_WRITE
 	#define FILENAME_LENGTH 255
 #elif (STORAGE_TYPE == STORAGE_SPIFM)
 	#include <SdFat.h>
@@ -456,6 +480,7 @@
 	#define FTP_FILE_READ_WRITE FILE_WRITE
 	#define FTP_FILE_WRITE_APPEND FILE_WRITE
 	#define FTP_FILE_WRITE_CREATE FILE_WRITE
+	#define FTP_FILE_WRITE_RESUME FILE_WRITE
 	#define FILENAME_LENGTH 255
 #elif (STORAGE_TYPE == STORAGE_FATFS)
 	#include <FatFs.h>
@@ -476,6 +501,7 @@
 	#define FTP_FILE_READ_WRITE O_RDWR
 	#define FTP_FILE_WRITE_APPEND O_WRITE | O_APPEND
 	#define FTP_FILE_WRITE_CREATE O_WRITE | O_CREAT
+	#define FTP_FILE_WRITE_RESUME O_WRITE
 	#define FILENAME_LENGTH 255
 #endif
 
@@ -547,32 +573,77 @@ enum FtpTransferOperation {
 	  FTP_UPLOAD_ERROR = 5
 };
 
-class FtpServer
+enum FtpFileOperation {
+	  FTP_FILE_CREATED,
+	  FTP_FILE_CHANGED,
+	  FTP_FILE_DELETED,
+	  FTP_FILE_RENAMED,
+	  FTP_DIR_CREATED,
+	  FTP_DIR_DELETED
+};
+
+class FtpServer;
+
+// Optional store of formatted directory listings, so a folder that has not
+// changed is sent from one file instead of being walked entry by entry.
+// Set with FtpServer::setListCache(); a session has one listing at a time
+class FtpListCache
 {
 public:
-  FtpServer( uint16_t _cmdPort = FTP_CMD_PORT, uint16_t _pasvPort = FTP_DATA_PORT_PASV );
+  virtual ~FtpListCache() {}
+
+  // Starts a listing of path; returns true, with its entry count, if a stored copy will be read
+  virtual bool    open( uint8_t session, char kind, const char * path, uint16_t * entries ) = 0;
+  // Reads the next part of the stored copy; returns 0 at its end and -1 on an error
+  virtual int32_t read( uint8_t session, uint8_t * buf, uint32_t size ) = 0;
+  // Keeps the next part of a listing that is being walked; entries is the count so far
+  virtual void    append( uint8_t session, const uint8_t * data, uint32_t size, uint16_t entries ) = 0;
+  // Ends the listing; complete is false if it was cut short
+  virtual void    close( uint8_t session, bool complete, uint16_t entries ) = 0;
+};
 
-  void    begin( const char * _user, const char * _pass, const char * welcomeMessage = "Welcome to Simply FTP server" );
-  void    begin( const char * welcomeMessage = "Welcome to Simply FTP server" );
+// Gathers listing lines in the session buffer and sends them in large writes,
+// handing each write to the listing cache as well
+class FtpListWriter : public Print
+{
+public:
+  FtpListWriter() : out( NULL ), buf( NULL ), size( 0 ), used( 0 ), cache( NULL ), session( 0 ), entries( NULL ) {}
+
+  void   begin( FTP_CLIENT_NETWORK_CLASS * _out, uint8_t * _buf, uint32_t _size,
+                FtpListCache * _cache, uint8_t _session, const uint16_t * _entries );
+  size_t write( uint8_t c );
+  size_t write( const uint8_t * data, size_t length );
+  using  Print::write;
+  void   send();                      // sends what is gathered so far
+
+private:
+  FTP_CLIENT_NETWORK_CLASS * out;
+  uint8_t *      buf;
+  uint32_t       size;
+  uint32_t       used;
+  FtpListCache * cache;
+  uint8_t        session;
+  const uint16_t * entries;           // entries listed so far
+};
 
+// One control connection with its own data channel, buffers and state machine
+class FtpSession
+{
+public:
+  FtpSession( FtpServer * _server, uint8_t _index, uint16_t _cmdPort, uint16_t _pasvPort );
+
+  void    begin( const char * _user, const char * _pass, const char * _welcomeMessage, bool _anonymous );
   void 	  end();
   void 	  setLocalIp(IPAddress localIp);
   void    credentials( const char * _user, const char * _pass );
+  void    attach( FTP_CLIENT_NETWORK_CLASS & _client );
+  bool    isIdle() { return cmdStage == FTP_Client; };
   uint8_t handleFTP();
 
-	void setCallback(void (*_callbackParam)(FtpOperation ftpOperation, unsigned int freeSpace, unsigned int totalSpace) )
-	{
-		_callback = _callbackParam;
-	}
-
-	void setTransferCallback(void (*_transferCallbackParam)(FtpTransferOperation ftpOperation, const char* name, unsigned int transferredSize) )
-	{
-		_transferCallback = _transferCallbackParam;
-	}
-
 private:
-  void (*_callback)(FtpOperation ftpOperation, unsigned int freeSpace, unsigned int totalSpace){};
-  void (*_transferCallback)(FtpTransferOperation ftpOperation, const char* name, unsigned int transferredSize){};
+  friend class FtpServer;
+
+  FtpServer * server;
 
   void    iniVariables();
   void    clientConnected();
@@ -585,8 +656,18 @@ private:
   bool    doStore();
   bool    doList();
   bool    doMlsd();
+  bool    listEntry();
+  bool    mlsdEntry();
+  bool    sendStoredList();
+  void    endList( bool complete );
   void    closeTransfer();
   void    abortTransfer();
+  void    notifyStored();
+  void    notifyTransfer( FtpTransferOperation operation, uint32_t transferred );
+  void    startStoreHash();
+  bool    allocateBuffer();
+  void    releaseBuffer();
+  uint32_t pathSize( const char * path );
   bool    makePath( char * fullName, char * param = NULL );
   bool    makeExistsPath( char * path, char * param = NULL );
   bool    openDir( FTP_DIR * pdir );
@@ -602,19 +683,6 @@ private:
 #endif
   int8_t  readChar();
 
-  const String getFileName(FTP_FILE *file){
-	#if STORAGE_TYPE <= STORAGE_SDFAT2
-	  int max_characters = 100;
-	  char f_name[max_characters];
-	  file->getName(f_name, sizeof(f_name));
-	  String filename = String(f_name);
-	    return filename;
-	#elif STORAGE_TYPE == STORAGE_FATFS
-	  return String(file->fileName());
-	#else
-	  return String(file->name());
-	#endif
-  }
   bool     exists( const char * path ) {
 #if STORAGE_TYPE == STORAGE_SPIFFS || (STORAGE_TYPE == STORAGE_SD && FTP_SERVER_NETWORK_TYPE == NETWORK_ESP8266_242)
 	  if (strcmp(path, "/") == 0) return true;
@@ -724,7 +792,6 @@ private:
 
   IPAddress   localIp;                // IP address of server as seen by clients
   IPAddress   dataIp;                 // IP address of client for data
-  FTP_SERVER_NETWORK_SERVER_CLASS  ftpServer;
   FTP_SERVER_NETWORK_SERVER_CLASS  dataServer;
 
 
@@ -733,6 +800,8 @@ private:
 
   FTP_FILE     file;
   FTP_DIR      dir;
+  FtpListWriter listOut;              // LIST/MLSD output of a directory being walked
+  bool     listStored;                // the listing is sent from the listing cache
 
   ftpCmd      cmdStage;               // stage of ftp command connection
   ftpTransfer transferStage;          // stage of data connection
@@ -740,17 +809,33 @@ private:
 
   bool anonymousConnection = false;
 
+#if defined(ESP32)
+  uint8_t * buf;                      // data buffer, held only while a transfer runs
+#else
   uint8_t  __attribute__((aligned(4))) // need to be aligned to 32bit for Esp8266 SPIClass::transferBytes()
            buf[ FTP_BUF_SIZE ];       // data buffer for transfers
+#endif
   char     cmdLine[ FTP_CMD_SIZE ];   // where to store incoming char from client
   char     cwdName[ FTP_CWD_SIZE ];   // name of current directory
   char     rnfrName[ FTP_CWD_SIZE ];  // name of file for RNFR command
+  char     storeName[ FTP_CWD_SIZE ]; // name of file being stored by STOR/APPE
+  char     transferName[ FTP_CWD_SIZE ]; // path of the file being sent or received
+  uint32_t transferSize;              // bytes the transfer will move, 0 if unknown
+  bool     storeExisted;              // file existed before STOR/APPE
+  uint32_t storeOffset;               // position where STOR/APPE started writing
+  uint32_t restartPos;                // offset set by REST for the next transfer
+  uint32_t storeOldSize;              // size of file before STOR/APPE
+#if defined(ESP32)
+  mbedtls_sha256_context storeHash;   // SHA-256 of the data received by a STOR from offset 0
+  bool     storeHashing;              // storeHash covers the whole file being stored
+#endif
   const char *   user;     // user name
   const char *   pass;     // password
   char     command[ 5 ];              // command sent by client
   bool     rnfrCmd;                   // previous command was RNFR
   char *   parameter;                 // point to begin of parameters sent by client
   const char *   welcomeMessage;
+  uint8_t  index;                     // position in FtpServer::sessions
   uint16_t cmdPort,
            pasvPort,
            dataPort;
@@ -763,4 +848,82 @@ private:
            bytesTransfered;           //
 };
 
+// Listens on the command port and hands each connection to an idle session
+class FtpServer
+{
+public:
+  FtpServer( uint16_t _cmdPort = FTP_CMD_PORT, uint16_t _pasvPort = FTP_DATA_PORT_PASV );
+  ~FtpServer();
+
+  void    begin( const char * _user, const char * _pass, const char * welcomeMessage = "Welcome to Simply FTP server" );
+  void    begin( const char * welcomeMessage = "Welcome to Simply FTP server" );
+
+  void 	  end();
+  void 	  setLocalIp(IPAddress localIp);
+  void    credentials( const char * _user, const char * _pass );
+  uint8_t handleFTP();
+
+	void setCallback(void (*_callbackParam)(FtpOperation ftpOperation, unsigned int freeSpace, unsigned int totalSpace) )
+	{
+		_callback = _callbackParam;
+	}
+
+	void setTransferCallback(void (*_transferCallbackParam)(FtpTransferOperation ftpOperation, const char* name, unsigned int transferredSize) )
+	{
+		_transferCallback = _transferCallbackParam;
+	}
+
+	// Called when a transfer starts, for every chunk and when it ends; integers only, so it
+	// is cheap per chunk. size is what the transfer will move, 0 if unknown (STOR/APPE)
+	void setTransferProgressCallback(void (*_transferProgressCallbackParam)(uint8_t session, FtpTransferOperation ftpOperation, uint32_t transferredSize, uint32_t size) )
+	{
+		_transferProgressCallback = _transferProgressCallbackParam;
+	}
+
+	// Path of the file a session is transferring, valid from its *_START callback on
+	const char * transferPath( uint8_t session ) const
+	{
+		return session < FTP_MAX_SESSIONS ? sessions[ session ]->transferName : "";
+	}
+
+	// Called after a command changed the file system; sizes are in bytes
+	void setFileCallback(void (*_fileCallbackParam)(FtpFileOperation fileOperation, const char* path, uint32_t oldSize, uint32_t newSize) )
+	{
+		_fileCallback = _fileCallbackParam;
+	}
+
+	// Keeps LIST/NLST/MLSD output so unchanged directories are not walked again
+	void setListCache( FtpListCache * _listCacheParam )
+	{
+		_listCache = _listCacheParam;
+	}
+
+#if defined(ESP32)
+	// Called after a STOR wrote a whole file, with the SHA-256 of its contents
+	void setStoreHashCallback(void (*_storeHashCallbackParam)(const char* path, const uint8_t* sha256) )
+	{
+		_storeHashCallback = _storeHashCallbackParam;
+	}
+#endif
+
+private:
+  friend class FtpSession;
+
+  void (*_callback)(FtpOperation ftpOperation, unsigned int freeSpace, unsigned int totalSpace){};
+  void (*_transferCallback)(FtpTransferOperation ftpOperation, const char* name, unsigned int transferredSize){};
+  void (*_transferProgressCallback)(uint8_t session, FtpTransferOperation ftpOperation, uint32_t transferredSize, uint32_t size){};
+  void (*_fileCallback)(FtpFileOperation fileOperation, const char* path, uint32_t oldSize, uint32_t newSize){};
+  FtpListCache * _listCache = NULL;
+#if defined(ESP32)
+  void (*_storeHashCallback)(const char* path, const uint8_t* sha256){};
+#endif
+
+  void    acceptClient();
+
+  FTP_SERVER_NETWORK_SERVER_CLASS  ftpServer;
+  FtpSession * sessions[ FTP_MAX_SESSIONS ];
+  uint16_t cmdPort;
+  bool anonymousConnection = false;
+};
+
 #endif // FTP_SERVER_H
@@ -128,8 +128,30 @@ https://github.com/arduino-libraries/Ethernet/issues/88
 // Transfer speed depends of this value
 // Best value depends on many factors: SD card, client side OS, ... 
 // But it can be reduced to 512 if memory usage is critical.
+// On ESP32 the buffer is allocated per session in begin(), preferring
+// DMA-capable internal RAM and falling back to PSRAM.
 #ifndef FTP_BUF_SIZE
-	#define FTP_BUF_SIZE 1024 //2048 //1024 // 512
+	#if defined(ESP32)
+		#define FTP_BUF_SIZE 16384
+	#else
+		#define FTP_BUF_SIZE 1024 //2048 //1024 // 512
+	#endif
+#endif
+
+// Longest time (in milliseconds) a single handleFTP() call keeps moving data
+// for one transfer before returning to the caller's loop()
+#ifndef FTP_TRANSFER_SLICE_MS
+	#define FTP_TRANSFER_SLICE_MS 20
+#endif
+
+// Number of clients served at the same time. Each session has its own
+// transfer buffer and uses passive port FTP_DATA_PORT_PASV + session index.
+#ifndef FTP_MAX_SESSIONS
+	#if defined(ESP32)
+		#define FTP_MAX_SESSIONS 4
+	#else
+		#define FTP_MAX_SESSIONS 1
+	#endif
 #endif
 
 #endif // FTP_SERVER_CONFIG_H
@@ -0,0 +1,527 @@
+#!/usr/bin/env bash
+################################################################################
+#
+# benchmark.sh
+# ----------------
+# Measures FrameFi transfer throughput so changes to the storage path can be
+# compared before and after.
+#
+#   msc <file>   Bulk-read a large file from the mounted USB MSC volume.
+#   ftp [MiB]    Upload and download a generated file over FTP (default 8 MiB).
+#   upload [MiB] Upload and download a generated file over HTTP (default 8 MiB).
+#   http [count] Time status requests while an FTP upload runs (default 200).
+#   load [clients] [count]
+#                Hammer the status endpoints from parallel clients (default 8 x 100)
+#                and check every reply keeps its JSON contract.
+#   batch [count] Create and delete entries with two batch jobs (default 500).
+#   ingest <jpeg> [count]
+#                Upload a large JPEG repeatedly with the ingest stage on and
+#                report how many pictures per second the device converts
+#                (default 10).
+#
+# @author Nicholas Wilde, 0xb299a622
+# @date 17 Oct 2026
+# @version 0.1.0
+#
+################################################################################
+
+# Options
+set -e
+set -o pipefail
+
+# These are constants
+RED=$(tput setaf 1)
+GREEN=$(tput setaf 2)
+YELLOW=$(tput setaf 3)
+BLUE=$(tput setaf 4)
+RESET=$(tput sgr0)
+readonly RED GREEN YELLOW BLUE RESET
+
+BLOCK_SIZE="1M"
+readonly BLOCK_SIZE
+
+DEFAULT_FTP_SIZE_MB=8
+readonly DEFAULT_FTP_SIZE_MB
+
+BENCHMARK_FILE_NAME="benchmark_ftp_file.bin"
+readonly BENCHMARK_FILE_NAME
+
+DEFAULT_HTTP_REQUESTS=200
+readonly DEFAULT_HTTP_REQUESTS
+
+DEFAULT_LOAD_CLIENTS=8
+DEFAULT_LOAD_REQUESTS=100
+readonly DEFAULT_LOAD_CLIENTS DEFAULT_LOAD_REQUESTS
+
+DEFAULT_BATCH_COUNT=500
+readonly DEFAULT_BATCH_COUNT
+
+DEFAULT_INGEST_COUNT=10
+readonly DEFAULT_INGEST_COUNT
+
+# Log function for standardized output
+function log() {
+  local TYPE="$1"
+  local MESSAGE="$2"
+  local COLOR=""
+  local EMOJI=""
+
+  case "$TYPE" in
+    "INFO") COLOR="${BLUE}"; EMOJI="";;
+    "WARN") COLOR="${YELLOW}"; EMOJI="⚠️ ";;
+    "ERRO") COLOR="${RED}"; EMOJI="❌ ";;
+    "SUCCESS") COLOR="${BLUE}"; EMOJI="✅ "; TYPE="INFO";;
+    *) COLOR="${RESET}";;
+  esac
+
+  echo "${COLOR}${TYPE}${RESET}[$(date +'%Y-%m-%d %H:%M:%S')] ${EMOJI}${MESSAGE}"
+}
+
+function usage() {
+  echo "Usage: $0 msc <file-on-msc-volume>"
+  echo "       $0 ftp [size-in-MiB]"
+  echo "       $0 upload [size-in-MiB]"
+  echo "       $0 http [request-count]"
+  echo "       $0 load [clients] [requests-per-client]"
+  echo "       $0 batch [entry-count]"
+  echo "       $0 ingest <jpeg-file> [image-count]"
+}
+
+# Check for dependencies
+function check_dependencies() {
+  log "INFO" "Checking dependencies..."
+  for CMD in curl jq dd; do
+    if ! command -v "${CMD}" &> /dev/null; then
+      log "ERRO" "${CMD} could not be found. Please install it."
+      exit 1
+    fi
+  done
+  log "SUCCESS" "Dependencies checked."
+}
+
+function load_vars() {
+  local ENV_FILE="$(dirname "$0")/.env"
+
+  if [ ! -f "${ENV_FILE}" ]; then
+    log "ERRO" "Environment file not found: ${ENV_FILE}"
+    log "ERRO" "Please create it from .env.tmpl and ensure FTP_HOST, FTP_USER, FTP_PASSWORD are set."
+    exit 1
+  fi
+
+  source "${ENV_FILE}"
+
+  if [ -z "${FTP_HOST}" ] || [ -z "${FTP_USER}" ] || [ -z "${FTP_PASSWORD}" ]; then
+    log "ERRO" "FTP_HOST, FTP_USER, or FTP_PASSWORD not set in ${ENV_FILE}"
+    exit 1
+  fi
+}
+
+# Build the curl authentication arguments
+function auth_args() {
+  if [ -n "${WEB_SERVER_USER}" ]; then
+    echo "-u ${WEB_SERVER_USER}:${WEB_SERVER_PASSWORD}"
+  fi
+}
+
+# Prints throughput in MB/s given a byte count and elapsed nanoseconds
+function print_rate() {
+  local BYTES="$1"
+  local ELAPSED_NS="$2"
+  awk -v b="${BYTES}" -v ns="${ELAPSED_NS}" 'BEGIN { printf "%.2f", (b / 1048576) / (ns / 1000000000) }'
+}
+
+# Returns the current time in nanoseconds
+function now_ns() {
+  if date +%s%N | grep -q 'N'; then
+    # --- macOS date has no %N ---
+    python3 -c 'import time; print(time.time_ns())'
+  else
+    date +%s%N
+  fi
+}
+
+# Bulk-read a file from the MSC volume, bypassing the host page cache
+function benchmark_msc() {
+  local FILE="$1"
+  if [ -z "${FILE}" ] || [ ! -f "${FILE}" ]; then
+    log "ERRO" "File not found: ${FILE}"
+    usage
+    exit 1
+  fi
+
+  local SIZE
+  SIZE=$(wc -c < "${FILE}" | tr -d ' ')
+  log "INFO" "Reading ${FILE} (${SIZE} bytes)..."
+
+  local DD_FLAGS=""
+  if [ "$(uname)" == "Linux" ]; then
+    DD_FLAGS="iflag=direct"
+  else
+    # --- No O_DIRECT on macOS; flush the unified buffer cache instead ---
+    log "WARN" "Purging the buffer cache; you may be asked for your password."
+    sudo purge
+  fi
+
+  local START END
+  START=$(now_ns)
+  dd if="${FILE}" of=/dev/null bs="${BLOCK_SIZE}" ${DD_FLAGS} 2> /dev/null
+  END=$(now_ns)
+
+  log "SUCCESS" "MSC read: $(print_rate "${SIZE}" $((END - START))) MB/s"
+
+  local STATUS
+  if STATUS=$(curl -s --fail --connect-timeout 5 $(auth_args) "http://${FTP_HOST}/"); then
+    log "INFO" "Read-ahead hit rate: $(echo "${STATUS}" | jq -r '.msc.read_ahead.hit_rate')%"
+    log "INFO" "Read-ahead window: $(echo "${STATUS}" | jq -r '.msc.read_ahead.window_sectors') sectors"
+  else
+    log "WARN" "Could not fetch read-ahead stats from ${FTP_HOST}."
+  fi
+}
+
+# Runs an lftp command against the device
+function run_lftp() {
+  lftp -c "
+  set ftp:ssl-allow no;
+  set xfer:clobber true;
+  open -u "${FTP_USER}","${FTP_PASSWORD}" "${FTP_HOST}";
+  $1
+  "
+}
+
+# Upload and download a generated file, reporting throughput for each direction
+function benchmark_ftp() {
+  local SIZE_MB="${1:-${DEFAULT_FTP_SIZE_MB}}"
+  if ! command -v lftp &> /dev/null; then
+    log "ERRO" "lftp could not be found. Please install it."
+    exit 1
+  fi
+
+  local WORK_DIR
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "${WORK_DIR}"' EXIT
+
+  log "INFO" "Generating ${SIZE_MB} MiB test file..."
+  dd if=/dev/urandom of="${WORK_DIR}/${BENCHMARK_FILE_NAME}" bs="${BLOCK_SIZE}" count="${SIZE_MB}" 2> /dev/null
+  local SIZE=$((SIZE_MB * 1048576))
+
+  local START END
+  log "INFO" "Uploading to ${FTP_HOST}..."
+  START=$(now_ns)
+  run_lftp "put -O / \"${WORK_DIR}/${BENCHMARK_FILE_NAME}\";"
+  END=$(now_ns)
+  log "SUCCESS" "FTP upload: $(print_rate "${SIZE}" $((END - START))) MB/s"
+
+  log "INFO" "Downloading from ${FTP_HOST}..."
+  START=$(now_ns)
+  run_lftp "get -o \"${WORK_DIR}/download.bin\" \"/${BENCHMARK_FILE_NAME}\";"
+  END=$(now_ns)
+  log "SUCCESS" "FTP download: $(print_rate "${SIZE}" $((END - START))) MB/s"
+
+  if ! cmp -s "${WORK_DIR}/${BENCHMARK_FILE_NAME}" "${WORK_DIR}/download.bin"; then
+    log "ERRO" "Downloaded file does not match the uploaded file."
+    exit 1
+  fi
+
+  run_lftp "rm \"/${BENCHMARK_FILE_NAME}\";"
+  log "SUCCESS" "Removed ${BENCHMARK_FILE_NAME} from the device."
+}
+
+# Upload and download a generated file over the web API, reporting throughput for each direction
+function benchmark_upload() {
+  local SIZE_MB="${1:-${DEFAULT_FTP_SIZE_MB}}"
+
+  local WORK_DIR
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "${WORK_DIR}"' EXIT
+
+  log "INFO" "Generating ${SIZE_MB} MiB test file..."
+  dd if=/dev/urandom of="${WORK_DIR}/${BENCHMARK_FILE_NAME}" bs="${BLOCK_SIZE}" count="${SIZE_MB}" 2> /dev/null
+  local SIZE=$((SIZE_MB * 1048576))
+
+  local START END RESPONSE
+  log "INFO" "Uploading to ${FTP_HOST}..."
+  START=$(now_ns)
+  RESPONSE=$(curl -s $(auth_args) -F "file=@${WORK_DIR}/${BENCHMARK_FILE_NAME};filename=${BENCHMARK_FILE_NAME}" "http://${FTP_HOST}/upload")
+  END=$(now_ns)
+  if [ "$(echo "${RESPONSE}" | jq -r '.status')" != "success" ]; then
+    log "ERRO" "Upload failed: $(echo "${RESPONSE}" | jq -r '.message')"
+    exit 1
+  fi
+  log "SUCCESS" "HTTP upload: $(print_rate "${SIZE}" $((END - START))) MB/s"
+
+  log "INFO" "Downloading from ${FTP_HOST}..."
+  START=$(now_ns)
+  curl -s --fail $(auth_args) -o "${WORK_DIR}/download.bin" "http://${FTP_HOST}/files/${BENCHMARK_FILE_NAME}"
+  END=$(now_ns)
+  log "SUCCESS" "HTTP download: $(print_rate "${SIZE}" $((END - START))) MB/s"
+
+  if ! cmp -s "${WORK_DIR}/${BENCHMARK_FILE_NAME}" "${WORK_DIR}/download.bin"; then
+    log "ERRO" "Downloaded file does not match the uploaded file."
+    exit 1
+  fi
+
+  if command -v lftp &> /dev/null; then
+    run_lftp "rm \"/${BENCHMARK_FILE_NAME}\";"
+    log "SUCCESS" "Removed ${BENCHMARK_FILE_NAME} from the device."
+  else
+    log "WARN" "lftp not found; remove ${BENCHMARK_FILE_NAME} from the device by hand."
+  fi
+}
+
+# Times a series of status requests and prints p50/p99/max in milliseconds
+function time_requests() {
+  local COUNT="$1"
+  local LABEL="$2"
+  local TIMES_FILE="$3"
+
+  : > "${TIMES_FILE}"
+  for ((i = 0; i < COUNT; i++)); do
+    curl -s -o /dev/null --connect-timeout 5 -w '%{time_total}\n' $(auth_args) "http://${FTP_HOST}/" >> "${TIMES_FILE}" || true
+  done
+
+  print_percentiles "${LABEL}" "${TIMES_FILE}"
+}
+
+# Prints p50/p99/max in milliseconds for a file of curl time_total values
+function print_percentiles() {
+  local LABEL="$1"
+  local TIMES_FILE="$2"
+
+  sort -n "${TIMES_FILE}" | awk -v label="${LABEL}" '
+    { t[NR] = $1 * 1000 }
+    END {
+      if (NR == 0) { print label ": no responses"; exit }
+      p50 = t[int((NR - 1) * 0.50) + 1]
+      p99 = t[int((NR - 1) * 0.99) + 1]
+      printf "%s: p50 %.1f ms, p99 %.1f ms, max %.1f ms (%d requests)\n", label, p50, p99, t[NR], NR
+    }'
+}
+
+# Measure HTTP latency idle and during a large FTP upload
+function benchmark_http() {
+  local COUNT="${1:-${DEFAULT_HTTP_REQUESTS}}"
+  if ! command -v lftp &> /dev/null; then
+    log "ERRO" "lftp could not be found. Please install it."
+    exit 1
+  fi
+
+  local WORK_DIR
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "${WORK_DIR}"' EXIT
+
+  log "INFO" "Timing ${COUNT} requests with the device idle..."
+  log "SUCCESS" "$(time_requests "${COUNT}" "Idle" "${WORK_DIR}/idle.txt")"
+
+  log "INFO" "Generating $((DEFAULT_FTP_SIZE_MB * 4)) MiB upload..."
+  dd if=/dev/urandom of="${WORK_DIR}/${BENCHMARK_FILE_NAME}" bs="${BLOCK_SIZE}" count=$((DEFAULT_FTP_SIZE_MB * 4)) 2> /dev/null
+
+  log "INFO" "Timing ${COUNT} requests during the FTP upload..."
+  run_lftp "put -O / \"${WORK_DIR}/${BENCHMARK_FILE_NAME}\";" &
+  local FTP_PID=$!
+  log "SUCCESS" "$(time_requests "${COUNT}" "During FTP" "${WORK_DIR}/busy.txt")"
+  if kill -0 "${FTP_PID}" 2> /dev/null; then
+    log "INFO" "Waiting for the upload to finish..."
+  else
+    log "WARN" "The upload finished before all requests were sent; try a larger count."
+  fi
+  wait "${FTP_PID}"
+  run_lftp "rm \"/${BENCHMARK_FILE_NAME}\";"
+
+  local DIAGNOSTICS
+  if DIAGNOSTICS=$(curl -s --fail --connect-timeout 5 $(auth_args) "http://${FTP_HOST}/diagnostics"); then
+    log "INFO" "Device handler latency: $(echo "${DIAGNOSTICS}" | jq -r '.http_latency_us | "p50 \(.p50) us, p99 \(.p99) us, max \(.max) us"')"
+    log "INFO" "Device network loop: $(echo "${DIAGNOSTICS}" | jq -r '.network_loop_us | "p50 \(.p50) us, p99 \(.p99) us, max \(.max) us"')"
+  else
+    log "WARN" "Could not fetch diagnostics from ${FTP_HOST}."
+  fi
+}
+
+# Runs one load test client; prints "ok <time>" or "fail <time>" per request
+function load_client() {
+  local CLIENT="$1"
+  local COUNT="$2"
+  local BODY="$3"
+  local ENDPOINTS=(
+    "/mode/ftp:.status and .mode"
+    "/display/status:.status and .display_status"
+    "/mqtt/status:.status and (.mqtt_enabled | type == \"boolean\") and (.mqtt_connected | type == \"boolean\") and (.mqtt_state | type == \"number\")"
+    "/led/status:.status and .color and .state and (.brightness | type == \"number\")"
+    "/led/brightness:.status and (.brightness | type == \"number\")"
+  )
+
+  local i ENTRY ENDPOINT CONTRACT TIME
+  for ((i = 0; i < COUNT; i++)); do
+    ENTRY="${ENDPOINTS[$(((CLIENT + i) % ${#ENDPOINTS[@]}))]}"
+    ENDPOINT="${ENTRY%%:*}"
+    CONTRACT="${ENTRY#*:}"
+    if TIME=$(curl -s --fail --connect-timeout 5 -o "${BODY}" -w '%{time_total}' $(auth_args) "http://${FTP_HOST}${ENDPOINT}") \
+      && jq -e "${CONTRACT}" "${BODY}" &> /dev/null; then
+      echo "ok ${TIME}"
+    else
+      echo "fail ${TIME:-0} ${ENDPOINT}"
+    fi
+  done
+}
+
+# Serve many concurrent clients and check the JSON contracts hold under load
+function benchmark_load() {
+  local CLIENTS="${1:-${DEFAULT_LOAD_CLIENTS}}"
+  local COUNT="${2:-${DEFAULT_LOAD_REQUESTS}}"
+
+  local WORK_DIR
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "${WORK_DIR}"' EXIT
+
+  log "INFO" "Sending ${COUNT} requests from each of ${CLIENTS} clients..."
+  local START END C
+  START=$(now_ns)
+  for ((C = 0; C < CLIENTS; C++)); do
+    load_client "${C}" "${COUNT}" "${WORK_DIR}/body-${C}.json" > "${WORK_DIR}/client-${C}.txt" &
+  done
+  wait
+  END=$(now_ns)
+
+  cat "${WORK_DIR}"/client-*.txt > "${WORK_DIR}/all.txt"
+  local TOTAL FAILED
+  TOTAL=$(wc -l < "${WORK_DIR}/all.txt" | tr -d ' ')
+  FAILED=$(grep -c '^fail' "${WORK_DIR}/all.txt" || true)
+  awk '$1 == "ok" { print $2 }' "${WORK_DIR}/all.txt" > "${WORK_DIR}/times.txt"
+
+  log "INFO" "$(print_percentiles "Latency" "${WORK_DIR}/times.txt")"
+  log "INFO" "Throughput: $(awk -v n="${TOTAL}" -v ns=$((END - START)) 'BEGIN { printf "%.1f", n / (ns / 1000000000) }') requests/s"
+  if [ "${FAILED}" -gt 0 ]; then
+    grep '^fail' "${WORK_DIR}/all.txt" | awk '{ print $3 }' | sort | uniq -c | while read -r N ENDPOINT; do
+      log "ERRO" "${N} failed or malformed replies from ${ENDPOINT}"
+    done
+    exit 1
+  fi
+  log "SUCCESS" "All ${TOTAL} replies kept their JSON contract."
+}
+
+# Posts a batch job, waits for it to finish and prints operations per second
+function run_batch() {
+  local LABEL="$1"
+  local BODY="$2"
+  local URL="http://${FTP_HOST}/files/batch"
+
+  local START END RESPONSE
+  START=$(now_ns)
+  RESPONSE=$(curl -s $(auth_args) -X POST -H "Content-Type: application/json" --data-binary @- "${URL}" <<< "${BODY}")
+  if [ "$(echo "${RESPONSE}" | jq -r '.status')" != "success" ]; then
+    log "ERRO" "${LABEL} batch was not accepted: $(echo "${RESPONSE}" | jq -r '.message')"
+    exit 1
+  fi
+  while RESPONSE=$(curl -s $(auth_args) "${URL}"); [ "$(echo "${RESPONSE}" | jq -r '.state')" != "done" ]; do
+    sleep 0.1
+  done
+  END=$(now_ns)
+
+  local TOTAL FAILED DEVICE_MS
+  TOTAL=$(echo "${RESPONSE}" | jq -r '.total')
+  FAILED=$(echo "${RESPONSE}" | jq -r '.failed')
+  DEVICE_MS=$(echo "${RESPONSE}" | jq -r '.elapsed_ms')
+  if [ "${FAILED}" != "0" ]; then
+    log "WARN" "${LABEL}: ${FAILED} of ${TOTAL} operations failed."
+  fi
+  log "SUCCESS" "${LABEL}: ${TOTAL} operations in $(awk -v ns=$((END - START)) 'BEGIN { printf "%.2f", ns / 1000000000 }') s ($(awk -v n="${TOTAL}" -v ms="${DEVICE_MS}" 'BEGIN { printf "%.0f", ms > 0 ? n * 1000 / ms : n }') ops/s on the device)"
+}
+
+# Creates and deletes entries with one batch job each; directories stand in for pictures
+function benchmark_batch() {
+  local COUNT="${1:-${DEFAULT_BATCH_COUNT}}"
+  local ROOT="/benchmark_batch"
+
+  local CREATE DELETE
+  CREATE=$(jq -cn --arg root "${ROOT}" --argjson n "${COUNT}" \
+    '{operations: [range($n) | {op: "mkdir", path: "\($root)/\(.)"}]}')
+  DELETE=$(jq -cn --arg root "${ROOT}" --argjson n "${COUNT}" \
+    '{operations: ([range($n) | {op: "delete", path: "\($root)/\(.)"}] + [{op: "delete", path: $root}])}')
+
+  log "INFO" "Creating ${COUNT} directories on ${FTP_HOST}..."
+  run_batch "mkdir" "${CREATE}"
+  log "INFO" "Deleting them again..."
+  run_batch "delete" "${DELETE}"
+}
+
+# Sums the ingest counters that mark a finished picture
+function ingest_finished() {
+  echo "$1" | jq -r '.converted + .skipped + .failed'
+}
+
+# Uploads a JPEG repeatedly with ingest enabled and prints images per second
+function benchmark_ingest() {
+  local FILE="$1"
+  local COUNT="${2:-${DEFAULT_INGEST_COUNT}}"
+  local ROOT="/benchmark_ingest"
+  local URL="http://${FTP_HOST}/ingest"
+  if [ -z "${FILE}" ] || [ ! -f "${FILE}" ]; then
+    log "ERRO" "JPEG not found: ${FILE}"
+    usage
+    exit 1
+  fi
+
+  local BEFORE WAS_ENABLED
+  BEFORE=$(curl -s --fail $(auth_args) "${URL}")
+  WAS_ENABLED=$(echo "${BEFORE}" | jq -r '.enabled')
+  curl -s --fail $(auth_args) -X POST -H "Content-Type: application/json" -d '{"enabled":true}' "${URL}" > /dev/null
+  trap 'curl -s $(auth_args) -X POST -H "Content-Type: application/json" -d "{\"enabled\":${WAS_ENABLED}}" "${URL}" > /dev/null' EXIT
+
+  local FINISHED_BEFORE CONVERTED_BEFORE BUSY_BEFORE
+  FINISHED_BEFORE=$(ingest_finished "${BEFORE}")
+  CONVERTED_BEFORE=$(echo "${BEFORE}" | jq -r '.converted')
+  BUSY_BEFORE=$(echo "${BEFORE}" | jq -r '.busy_ms')
+
+  run_batch "mkdir" "$(jq -cn --arg root "${ROOT}" '{operations: [{op: "mkdir", path: $root}]}')" > /dev/null
+  log "INFO" "Uploading $(basename "${FILE}") ${COUNT} times to ${FTP_HOST}${ROOT}..."
+  local START END i RESPONSE
+  START=$(now_ns)
+  for ((i = 0; i < COUNT; i++)); do
+    # --- Uploads are paced by the device; a full queue would skip pictures ---
+    while RESPONSE=$(curl -s --fail $(auth_args) "${URL}"); [ "$(echo "${RESPONSE}" | jq -r '.pending')" -ge 4 ]; do
+      sleep 0.1
+    done
+    curl -s --fail $(auth_args) -X POST -F "file=@${FILE};filename=${ROOT#/}/image_${i}.jpg" "http://${FTP_HOST}/upload" > /dev/null
+  done
+  while RESPONSE=$(curl -s --fail $(auth_args) "${URL}"); \
+    [ $(($(ingest_finished "${RESPONSE}") - FINISHED_BEFORE)) -lt "${COUNT}" ] || [ "$(echo "${RESPONSE}" | jq -r '.pending')" != "0" ]; do
+    sleep 0.2
+  done
+  END=$(now_ns)
+
+  local CONVERTED BUSY_MS
+  CONVERTED=$(($(echo "${RESPONSE}" | jq -r '.converted') - CONVERTED_BEFORE))
+  BUSY_MS=$(($(echo "${RESPONSE}" | jq -r '.busy_ms') - BUSY_BEFORE))
+  if [ "${CONVERTED}" -lt "${COUNT}" ]; then
+    log "WARN" "Only ${CONVERTED} of ${COUNT} uploads were converted; is the picture larger than the target size?"
+  fi
+  log "INFO" "Output: $(echo "${RESPONSE}" | jq -r '"\(.width)x\(.height), last picture \(.last_ms) ms"')"
+  log "SUCCESS" "${COUNT} uploads converted in $(awk -v ns=$((END - START)) 'BEGIN { printf "%.2f", ns / 1000000000 }') s: $(awk -v n="${COUNT}" -v ns=$((END - START)) 'BEGIN { printf "%.2f", n / (ns / 1000000000) }') images/s end to end, $(awk -v n="${CONVERTED}" -v ms="${BUSY_MS}" 'BEGIN { printf "%.2f", ms > 0 ? n * 1000 / ms : 0 }') images/s on the device"
+
+  local DELETE
+  DELETE=$(jq -cn --arg root "${ROOT}" --argjson n "${COUNT}" \
+    '{operations: ([range($n) | {op: "delete", path: "\($root)/image_\(.).jpg"}] + [{op: "delete", path: $root}])}')
+  run_batch "cleanup" "${DELETE}" > /dev/null
+}
+
+# Main function to orchestrate the script execution
+function main() {
+  local COMMAND="$1"
+  shift || true
+
+  check_dependencies
+  load_vars
+
+  case "${COMMAND}" in
+    msc) benchmark_msc "$@";;
+    ftp) benchmark_ftp "$@";;
+    upload) benchmark_upload "$@";;
+    http) benchmark_http "$@";;
+    load) benchmark_load "$@";;
+    batch) benchmark_batch "$@";;
+    ingest) benchmark_ingest "$@";;
+    *) usage; exit 1;;
+  esac
+}
+
+# Call main to start the script
+main "$@"
@@ -6,6 +6,9 @@
 # -------
 # This script syncs a local directory to the ESP32-S3 device via FTP.
 # It uses lftp to mirror the local directory to the remote target.
+# When the device serves a manifest, the upload and delete lists are worked
+# out locally from it and lftp only runs the transfers; otherwise it falls
+# back to a full lftp mirror, which lists every remote directory.
 #
 # Dependencies:
 #   - lftp: A sophisticated command-line FTP client.
@@ -147,6 +150,76 @@ function check_device_mode(){
   fi
 }
 
+# Build the curl authentication arguments for the web API
+function api_auth_args(){
+  if [ -n "$WEB_SERVER_USER" ]; then
+    echo "-u $WEB_SERVER_USER:$WEB_SERVER_PASSWORD"
+  fi
+}
+
+# Download the device's file manifest; waits while the device rebuilds it
+function fetch_manifest(){
+  local output="$1"
+  local attempt code
+  for attempt in 1 2 3 4 5 6 7 8 9 10; do
+    code=$(curl -s $(api_auth_args) -o "$output" -w '%{http_code}' "http://$FTP_HOST/manifest")
+    case "$code" in
+      200) return 0;;
+      503) log "INFO" "Device is rebuilding its manifest; waiting..."; sleep 3;;
+      *) return 1;;
+    esac
+  done
+  return 1
+}
+
+# Plan the sync from the manifest and run only the needed transfers.
+# Returns 1 if the manifest is unavailable and 2 if a transfer failed.
+function manifest_sync(){
+  local work_dir
+  work_dir=$(mktemp -d)
+  plan_and_transfer "$work_dir"
+  local result=$?
+  rm -rf "$work_dir"
+  return $result
+}
+
+# Fetch the manifest, diff it against LOCAL_DIR and run the lftp commands
+function plan_and_transfer(){
+  local work_dir="$1"
+
+  if ! fetch_manifest "$work_dir/manifest.tsv"; then
+    return 1
+  fi
+
+  # --- Remote paths under REMOTE_DIR, and local paths mapped onto it ---
+  local prefix="${REMOTE_DIR%/}/"
+  awk -F'\t' -v prefix="$prefix" '!/^#/ && index($1, prefix) == 1 { print $1 }' "$work_dir/manifest.tsv" | sort > "$work_dir/remote.txt"
+  (cd "$LOCAL_DIR" && find . -type f | sed "s|^\./|$prefix|") | sort > "$work_dir/local.txt"
+
+  comm -23 "$work_dir/local.txt" "$work_dir/remote.txt" > "$work_dir/upload.txt"
+  comm -13 "$work_dir/local.txt" "$work_dir/remote.txt" > "$work_dir/delete.txt"
+  log "INFO" "Manifest lists $(wc -l < "$work_dir/remote.txt" | tr -d ' ') files: $(wc -l < "$work_dir/upload.txt" | tr -d ' ') to upload, $(wc -l < "$work_dir/delete.txt" | tr -d ' ') to delete."
+
+  if [ ! -s "$work_dir/upload.txt" ] && [ ! -s "$work_dir/delete.txt" ]; then
+    return 0
+  fi
+
+  local remote
+  {
+    echo "set ftp:ssl-allow no;"
+    echo "open -u '$FTP_USER','$FTP_PASSWORD' '$FTP_HOST';"
+    while IFS= read -r remote; do
+      echo "mkdir -p -f \"$(dirname "$remote")\";"
+      echo "put \"$LOCAL_DIR/${remote#$prefix}\" -o \"$remote\";"
+    done < "$work_dir/upload.txt"
+    while IFS= read -r remote; do
+      echo "rm \"$remote\";"
+    done < "$work_dir/delete.txt"
+  } > "$work_dir/commands.lftp"
+
+  lftp -f "$work_dir/commands.lftp" || return 2
+}
+
 # --- Main Sync Logic ---
 function start_sync(){
   log "INFO" "Starting FTP sync..."
@@ -155,6 +228,13 @@ function start_sync(){
   log "INFO" "  - Local Dir: $LOCAL_DIR"
   log "INFO" "  - Remote Dir: $REMOTE_DIR"
 
+  manifest_sync
+  case $? in
+    0) return 0;;
+    1) log "WARN" "Device manifest unavailable; falling back to a full mirror.";;
+    *) log "ERRO" "Transfers failed."; exit 1;;
+  esac
+
   # Use lftp to mirror the directory.
   # -R: Reverse mirror (uploads from local to remote)
   # --delete: Deletes files on the remote that are not present locally
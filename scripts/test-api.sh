@@ -525,6 +525,140 @@ function verify_file_upload() {
   log "SUCCESS" "File upload test completed with expected status '${EXPECTED_STATUS}'."
 }
 
+function verify_file_download() {
+  log "INFO" "Verifying file download via web server..."
+
+  local DUMMY_FILENAME="test-on-device.txt"
+  local DUMMY_CONTENT="This is a test file for web upload."
+  local URL="http://${FTP_HOST}/files/${DUMMY_FILENAME}"
+
+  # Full download
+  local BODY
+  BODY=$(curl -s --fail "${URL}")
+  if [ "${BODY}" != "${DUMMY_CONTENT}" ]; then
+    log "ERRO" "Downloaded content does not match. Got: '${BODY}'"
+    exit 1
+  fi
+  log "SUCCESS" "Full download matches the uploaded file."
+
+  # Range request
+  local CODE
+  CODE=$(curl -s -o /tmp/framefi-range.txt -w '%{http_code}' -H "Range: bytes=5-8" "${URL}")
+  BODY=$(cat /tmp/framefi-range.txt)
+  rm -f /tmp/framefi-range.txt
+  if [ "${CODE}" != "206" ] || [ "${BODY}" != "${DUMMY_CONTENT:5:4}" ]; then
+    log "ERRO" "Range request failed. Code: ${CODE}, Body: '${BODY}'"
+    exit 1
+  fi
+  log "SUCCESS" "Range request returned 206 with the requested bytes."
+
+  # Conditional request
+  local ETAG
+  ETAG=$(curl -s -D - -o /dev/null "${URL}" | awk 'tolower($1) == "etag:" { print $2 }' | tr -d '\r')
+  CODE=$(curl -s -o /dev/null -w '%{http_code}' -H "If-None-Match: ${ETAG}" "${URL}")
+  if [ -z "${ETAG}" ] || [ "${CODE}" != "304" ]; then
+    log "ERRO" "Conditional request failed. ETag: '${ETAG}', Code: ${CODE}"
+    exit 1
+  fi
+  log "SUCCESS" "If-None-Match returned 304 Not Modified."
+
+  # Missing file
+  CODE=$(curl -s -o /dev/null -w '%{http_code}' "http://${FTP_HOST}/files/does-not-exist.txt")
+  if [ "${CODE}" != "404" ]; then
+    log "ERRO" "Missing file returned ${CODE} instead of 404."
+    exit 1
+  fi
+  log "SUCCESS" "File download test completed successfully."
+}
+
+function verify_file_by_hash() {
+  log "INFO" "Verifying content hash lookup via web server..."
+
+  local DUMMY_CONTENT="This is a test file for web upload."
+  local HASH
+  HASH=$(echo "${DUMMY_CONTENT}" | sha256sum | cut -d' ' -f1)
+
+  local RESPONSE
+  RESPONSE=$(curl -s "http://${FTP_HOST}/files/by-hash/${HASH}")
+  local FOUND_PATH
+  FOUND_PATH=$(echo "${RESPONSE}" | jq -r '.path')
+  if [ "${FOUND_PATH}" != "/test-on-device.txt" ]; then
+    log "ERRO" "Hash lookup did not find the uploaded file. Response: ${RESPONSE}"
+    exit 1
+  fi
+  log "SUCCESS" "Hash lookup found ${FOUND_PATH}."
+
+  local CODE
+  CODE=$(curl -s -o /dev/null -w '%{http_code}' -I "http://${FTP_HOST}/files/by-hash/$(echo "missing" | sha256sum | cut -d' ' -f1)")
+  if [ "${CODE}" != "404" ]; then
+    log "ERRO" "Unknown hash returned ${CODE} instead of 404."
+    exit 1
+  fi
+  log "SUCCESS" "Content hash lookup test completed successfully."
+}
+
+function verify_thumbnails() {
+  log "INFO" "Verifying thumbnails via web server..."
+
+  # Only JPEGs on the card have thumbnails
+  local CODE
+  for THUMB_PATH in "/test-on-device.txt" "/missing-picture.jpg"; do
+    CODE=$(curl -s -o /dev/null -w '%{http_code}' "http://${FTP_HOST}/thumbs${THUMB_PATH}")
+    if [ "${CODE}" != "404" ]; then
+      log "ERRO" "Thumbnail of ${THUMB_PATH} returned ${CODE} instead of 404."
+      exit 1
+    fi
+  done
+  log "SUCCESS" "Thumbnail test completed successfully."
+}
+
+function verify_file_batch() {
+  log "INFO" "Verifying batch file operations via web server..."
+
+  local URL="http://${FTP_HOST}/files/batch"
+  local BATCH='{"operations":[{"op":"mkdir","path":"/test-batch/a/b"},{"op":"rename","path":"/test-on-device.txt","to":"/test-batch/a/b/moved.txt"},{"op":"delete","path":"/test-batch/a/b/moved.txt"},{"op":"delete","path":"/test-batch/a/b"},{"op":"delete","path":"/test-batch/a"},{"op":"delete","path":"/test-batch"},{"op":"delete","path":"/does-not-exist.txt"}]}'
+
+  local RESPONSE
+  RESPONSE=$(curl -s -X POST -H "Content-Type: application/json" -d "${BATCH}" "${URL}")
+  local ID
+  ID=$(echo "${RESPONSE}" | jq -r '.id')
+  if [ "$(echo "${RESPONSE}" | jq -r '.status')" != "success" ] || [ "${ID}" == "null" ]; then
+    log "ERRO" "Batch was not accepted. Response: ${RESPONSE}"
+    exit 1
+  fi
+  log "SUCCESS" "Batch ${ID} accepted."
+
+  # Wait for the job to finish
+  local STATE=""
+  for _ in $(seq 1 20); do
+    RESPONSE=$(curl -s "${URL}")
+    STATE=$(echo "${RESPONSE}" | jq -r '.state')
+    [ "${STATE}" == "done" ] && break
+    sleep 0.5
+  done
+  if [ "${STATE}" != "done" ]; then
+    log "ERRO" "Batch did not finish. Response: ${RESPONSE}"
+    exit 1
+  fi
+
+  local RESULTS
+  RESULTS=$(echo "${RESPONSE}" | jq -r '[.results[].result] | join(",")')
+  if [ "${RESULTS}" != "ok,ok,ok,ok,ok,ok,not_found" ]; then
+    log "ERRO" "Unexpected batch results: ${RESULTS}"
+    exit 1
+  fi
+  log "SUCCESS" "Batch results match: ${RESULTS}"
+
+  # Invalid operations are rejected before anything runs
+  local CODE
+  CODE=$(curl -s -o /dev/null -w '%{http_code}' -X POST -H "Content-Type: application/json" -d '{"operations":[{"op":"delete","path":"/../x"}]}' "${URL}")
+  if [ "${CODE}" != "400" ]; then
+    log "ERRO" "Invalid batch returned ${CODE} instead of 400."
+    exit 1
+  fi
+  log "SUCCESS" "Batch file operations test completed successfully."
+}
+
 function run_usb_msc_tests(){
   log "INFO" "=== USB MSC MODE Tests ==="
   verify_gets
@@ -540,6 +674,10 @@ function run_ftp_tests() {
   verify_gets
   verify_posts
   verify_file_upload "success"
+  verify_file_download
+  verify_file_by_hash
+  verify_thumbnails
+  verify_file_batch
   log "INFO" "Switching back to USB MSC mode"
   request_and_verify "POST" "/mode/msc" "" ""
   sleep 10
@@ -33,6 +33,18 @@ readonly TEST_FILE_NAME
 TEST_FILE_CONTENT="This is a test file for FTP functionality."
 readonly TEST_FILE_CONTENT
 
+PARALLEL_CLIENTS=4
+readonly PARALLEL_CLIENTS
+
+PARALLEL_FILE_SIZE_KB=512
+readonly PARALLEL_FILE_SIZE_KB
+
+RESUME_FILE_NAME="test_ftp_resume.bin"
+readonly RESUME_FILE_NAME
+
+RESUME_FILE_SIZE_KB=1024
+readonly RESUME_FILE_SIZE_KB
+
 # Log function for standardized output
 function log() {
   local TYPE="$1"
@@ -195,6 +207,92 @@ function cleanup_local_file() {
   fi
 }
 
+# Function to upload and verify files from several clients at the same time
+function parallel_sessions_test() {
+  local WORK_DIR
+  WORK_DIR=$(mktemp -d)
+
+  log "INFO" "Starting ${PARALLEL_CLIENTS} simultaneous FTP clients..."
+  local PIDS=()
+  local I
+  for I in $(seq 1 "${PARALLEL_CLIENTS}"); do
+    dd if=/dev/urandom of="${WORK_DIR}/parallel_${I}.bin" bs=1024 count="${PARALLEL_FILE_SIZE_KB}" 2> /dev/null
+    lftp -c "
+    set ftp:ssl-allow no;
+    open -u "${FTP_USER}","${FTP_PASSWORD}" "${FTP_HOST}";
+    put -O / "${WORK_DIR}/parallel_${I}.bin";
+    get -o "${WORK_DIR}/parallel_${I}.out" /parallel_${I}.bin;
+    rm /parallel_${I}.bin;
+    " &
+    PIDS+=($!)
+  done
+
+  local FAILED=0
+  for I in "${!PIDS[@]}"; do
+    if ! wait "${PIDS[${I}]}"; then
+      log "ERRO" "Client $((I + 1)) failed."
+      FAILED=1
+    fi
+  done
+
+  for I in $(seq 1 "${PARALLEL_CLIENTS}"); do
+    if ! cmp -s "${WORK_DIR}/parallel_${I}.bin" "${WORK_DIR}/parallel_${I}.out"; then
+      log "ERRO" "Content mismatch for parallel_${I}.bin."
+      FAILED=1
+    fi
+  done
+  rm -rf "${WORK_DIR}"
+
+  if [ ${FAILED} -ne 0 ]; then
+    exit 1
+  fi
+  log "SUCCESS" "All ${PARALLEL_CLIENTS} simultaneous clients transferred their files intact."
+}
+
+# Function to resume an interrupted upload and download with REST
+function resume_transfer_test() {
+  local WORK_DIR
+  WORK_DIR=$(mktemp -d)
+  local HALF_KB=$((RESUME_FILE_SIZE_KB / 2))
+
+  dd if=/dev/urandom of="${WORK_DIR}/${RESUME_FILE_NAME}" bs=1024 count="${RESUME_FILE_SIZE_KB}" 2> /dev/null
+  head -c $((HALF_KB * 1024)) "${WORK_DIR}/${RESUME_FILE_NAME}" > "${WORK_DIR}/partial.bin"
+
+  # --- Leave half the file on the device, as if the upload was cut mid-stream ---
+  log "INFO" "Uploading the first ${HALF_KB} KiB of ${RESUME_FILE_NAME}..."
+  lftp -c "
+  set ftp:ssl-allow no;
+  open -u "${FTP_USER}","${FTP_PASSWORD}" "${FTP_HOST}";
+  put "${WORK_DIR}/partial.bin" -o /${RESUME_FILE_NAME};
+  "
+
+  log "INFO" "Resuming the upload..."
+  lftp -c "
+  set ftp:ssl-allow no;
+  set ftp:use-feat yes;
+  open -u "${FTP_USER}","${FTP_PASSWORD}" "${FTP_HOST}";
+  put -c "${WORK_DIR}/${RESUME_FILE_NAME}" -o /${RESUME_FILE_NAME};
+  "
+
+  # --- Same for the download: keep half locally and continue from there ---
+  log "INFO" "Resuming a download from ${HALF_KB} KiB..."
+  cp "${WORK_DIR}/partial.bin" "${WORK_DIR}/download.bin"
+  lftp -c "
+  set ftp:ssl-allow no;
+  open -u "${FTP_USER}","${FTP_PASSWORD}" "${FTP_HOST}";
+  get -c /${RESUME_FILE_NAME} -o "${WORK_DIR}/download.bin";
+  rm /${RESUME_FILE_NAME};
+  "
+
+  if ! cmp -s "${WORK_DIR}/${RESUME_FILE_NAME}" "${WORK_DIR}/download.bin"; then
+    rm -rf "${WORK_DIR}"
+    log "ERRO" "Resumed transfer does not match the original file."
+    exit 1
+  fi
+  rm -rf "${WORK_DIR}"
+  log "SUCCESS" "Interrupted upload and download resumed intact."
+}
+
 # Main function to orchestrate the script execution
 function main() {
   local START_TIME
@@ -216,6 +314,9 @@ function main() {
   delete_test_file_remote
   cleanup_local_file
 
+  parallel_sessions_test
+  resume_transfer_test
+
   local END_TIME
   END_TIME=$(date +%s)
   local DURATION=$((END_TIME - START_TIME))
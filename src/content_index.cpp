@@ -0,0 +1,308 @@
+/******************************************************************************
+ *
+ * FrameFi - Content Index
+ * ----------------
+ * Remembers the SHA-256 of uploaded files so clients can skip sending
+ * pictures the card already holds.
+ *
+ *****************************************************************************/
+
+#include "content_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upload_writer.h"
+
+ContentIndex contentIndex;
+
+static const char indexPath[] = STORAGE_FAT_DRIVE CONTENT_INDEX_PATH;
+
+ContentIndex::ContentIndex() : fileSize(0), loaded(false) {
+  line[0] = '\0';
+}
+
+/**
+ * @brief Returns the value of a hex digit, or -1.
+ */
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/**
+ * @brief Returns the RAM key of a hash: its first four bytes.
+ */
+static uint32_t hashKey(const uint8_t* sha256) {
+  return ((uint32_t)sha256[0] << 24) | ((uint32_t)sha256[1] << 16) | ((uint32_t)sha256[2] << 8) | sha256[3];
+}
+
+/**
+ * @brief Writes a hash as lowercase hex; out must hold CONTENT_HASH_HEX_SIZE bytes.
+ */
+void formatContentHash(const uint8_t* sha256, char* out) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < CONTENT_HASH_SIZE; i++) {
+    out[i * 2] = digits[sha256[i] >> 4];
+    out[i * 2 + 1] = digits[sha256[i] & 0x0F];
+  }
+  out[CONTENT_HASH_SIZE * 2] = '\0';
+}
+
+/**
+ * @brief Parses a 64 character hex hash. Returns false if it is malformed.
+ */
+bool parseContentHash(const char* hex, uint8_t* sha256) {
+  for (size_t i = 0; i < CONTENT_HASH_SIZE; i++) {
+    int high = hexValue(hex[i * 2]);
+    int low = high < 0 ? -1 : hexValue(hex[i * 2 + 1]);
+    if (low < 0) {
+      return false;
+    }
+    sha256[i] = (uint8_t)((high << 4) | low);
+  }
+  return hex[CONTENT_HASH_SIZE * 2] == '\0';
+}
+
+/**
+ * @brief Reads the index file and keeps the key and offset of every line.
+ */
+bool ContentIndex::ensureLoaded() {
+  if (loaded) {
+    return true;
+  }
+  slots.clear();
+  fileSize = 0;
+
+  FIL file;
+  FRESULT result = f_open(&file, indexPath, FA_READ);
+  if (result == FR_NO_FILE || result == FR_NO_PATH) {
+    loaded = true;
+    return true;
+  }
+  if (result != FR_OK) {
+    return false;
+  }
+
+  // --- Only the first eight hex digits of each line are needed ---
+  uint8_t chunk[512];
+  UINT count = 0;
+  uint32_t position = 0;
+  uint32_t lineStart = 0;
+  uint32_t key = 0;
+  int digits = 0;  // -1 once the line is known not to start with a hash
+  while (f_read(&file, chunk, sizeof(chunk), &count) == FR_OK && count > 0) {
+    for (UINT i = 0; i < count; i++, position++) {
+      if (chunk[i] == '\n') {
+        if (digits == 8) {
+          slots.push_back({key, lineStart});
+        }
+        digits = 0;
+        key = 0;
+        lineStart = position + 1;
+      } else if (digits >= 0 && digits < 8) {
+        int value = hexValue((char)chunk[i]);
+        digits = value < 0 ? -1 : digits + 1;
+        key = (key << 4) | (value & 0x0F);
+      }
+    }
+  }
+  f_close(&file);
+
+  // --- A line cut short by a power loss is overwritten by the next append ---
+  fileSize = lineStart;
+  loaded = true;
+  return true;
+}
+
+/**
+ * @brief Reads and parses the line at offset.
+ */
+bool ContentIndex::readEntry(FIL* file, uint32_t offset, Entry& entry) {
+  UINT count = 0;
+  if (f_lseek(file, offset) != FR_OK || f_read(file, line, sizeof(line) - 1, &count) != FR_OK) {
+    return false;
+  }
+  line[count] = '\0';
+  char* end = strchr(line, '\n');
+  if (!end || count < CONTENT_HASH_SIZE * 2 + 1 || line[CONTENT_HASH_SIZE * 2] != '\t') {
+    return false;
+  }
+  *end = '\0';
+  line[CONTENT_HASH_SIZE * 2] = '\0';
+  if (!parseContentHash(line, entry.sha256)) {
+    return false;
+  }
+
+  char* field = line + CONTENT_HASH_SIZE * 2 + 1;
+  entry.size = strtoul(field, &field, 10);
+  if (*field++ != '\t') {
+    return false;
+  }
+  entry.stamp = strtoul(field, &field, 10);
+  if (*field++ != '\t' || *field != '/') {
+    return false;
+  }
+  strncpy(entry.path, field, sizeof(entry.path) - 1);
+  entry.path[sizeof(entry.path) - 1] = '\0';
+  return true;
+}
+
+/**
+ * @brief Returns true if the entry's file is still on the card, unchanged.
+ */
+bool ContentIndex::isCurrent(const Entry& entry) {
+  char drivePath[sizeof(entry.path) + 4];
+  snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", entry.path);
+  FILINFO info;
+  return f_stat(drivePath, &info) == FR_OK && !(info.fattrib & AM_DIR) && info.fsize == entry.size &&
+         (((uint32_t)info.fdate << 16) | info.ftime) == entry.stamp;
+}
+
+/**
+ * @brief Writes a line at the end of the index file, replacing any torn line left there.
+ */
+bool ContentIndex::appendLine(const char* text, size_t length) {
+  FIL file;
+  f_mkdir(STORAGE_FAT_DRIVE STORAGE_DATA_DIR);
+  if (f_open(&file, indexPath, FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) {
+    return false;
+  }
+  UINT written = 0;
+  FRESULT result = f_lseek(&file, fileSize);
+  if (result == FR_OK) {
+    result = f_write(&file, text, length, &written);
+  }
+  if (result == FR_OK && written == length) {
+    result = f_truncate(&file);
+  }
+  FRESULT closeResult = f_close(&file);
+  return result == FR_OK && closeResult == FR_OK && written == length;
+}
+
+/**
+ * @brief Records that the file at path holds content with the given hash.
+ */
+bool ContentIndex::record(const char* path, const uint8_t* sha256) {
+  if (!ensureLoaded()) {
+    return false;
+  }
+  if (slots.size() >= CONTENT_INDEX_MAX_ENTRIES && (!compact() || slots.size() >= CONTENT_INDEX_MAX_ENTRIES)) {
+    return false;
+  }
+
+  char drivePath[FF_MAX_LFN + 8];
+  FILINFO info;
+  if (path[0] != '/' || snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", path) >= (int)sizeof(drivePath) ||
+      f_stat(drivePath, &info) != FR_OK) {
+    return false;
+  }
+
+  char hex[CONTENT_HASH_HEX_SIZE];
+  formatContentHash(sha256, hex);
+  int length = snprintf(line, sizeof(line), "%s\t%lu\t%lu\t%s\n", hex, (unsigned long)info.fsize,
+                        (unsigned long)(((uint32_t)info.fdate << 16) | info.ftime), path);
+  if (length <= 0 || length >= (int)sizeof(line) || !appendLine(line, length)) {
+    return false;
+  }
+  slots.push_back({hashKey(sha256), fileSize});
+  fileSize += length;
+  return true;
+}
+
+/**
+ * @brief Finds a file with the given content. Fills path and size and returns true on a hit.
+ */
+bool ContentIndex::find(const uint8_t* sha256, char* path, size_t pathSize, uint32_t* size) {
+  if (!ensureLoaded() || slots.empty()) {
+    return false;
+  }
+  FIL file;
+  if (f_open(&file, indexPath, FA_READ) != FR_OK) {
+    return false;
+  }
+
+  // --- Newest first, so the latest upload of the content wins ---
+  uint32_t key = hashKey(sha256);
+  bool found = false;
+  for (size_t i = slots.size(); i-- > 0 && !found;) {
+    if (slots[i].key == key && readEntry(&file, slots[i].offset, scratch) &&
+        memcmp(scratch.sha256, sha256, CONTENT_HASH_SIZE) == 0 && isCurrent(scratch)) {
+      found = true;
+    }
+  }
+  f_close(&file);
+
+  if (found) {
+    strncpy(path, scratch.path, pathSize - 1);
+    path[pathSize - 1] = '\0';
+    *size = scratch.size;
+  }
+  return found;
+}
+
+/**
+ * @brief Rewrites the index file with only the entries whose files are unchanged.
+ */
+bool ContentIndex::compact() {
+  FIL file;
+  if (f_open(&file, indexPath, FA_READ) != FR_OK) {
+    return false;
+  }
+  UploadWriter* writer = new UploadWriter();
+  bool ok = writer->begin(CONTENT_INDEX_PATH, 0) == FR_OK;
+
+  std::vector<Slot> kept;
+  uint32_t offset = 0;
+  char hex[CONTENT_HASH_HEX_SIZE];
+  for (size_t i = 0; ok && i < slots.size(); i++) {
+    if (!readEntry(&file, slots[i].offset, scratch) || !isCurrent(scratch)) {
+      continue;
+    }
+    formatContentHash(scratch.sha256, hex);
+    int length = snprintf(line, sizeof(line), "%s\t%lu\t%lu\t%s\n", hex, (unsigned long)scratch.size,
+                          (unsigned long)scratch.stamp, scratch.path);
+    if (length <= 0 || length >= (int)sizeof(line)) {
+      continue;
+    }
+    ok = writer->write((const uint8_t*)line, length) == FR_OK;
+    kept.push_back({slots[i].key, offset});
+    offset += length;
+  }
+  f_close(&file);
+
+  if (ok) {
+    ok = writer->commit() == FR_OK;
+  } else {
+    writer->abort();
+  }
+  delete writer;
+
+  if (ok) {
+    slots.swap(kept);
+    fileSize = offset;
+  } else {
+    // --- The file may or may not have been replaced; read it again next time ---
+    reset();
+  }
+  return ok;
+}
+
+/**
+ * @brief Drops what is in RAM; the file is read again on next use. Call after the host had the card.
+ */
+void ContentIndex::reset() {
+  loaded = false;
+  slots.clear();
+  slots.shrink_to_fit();
+  fileSize = 0;
+}
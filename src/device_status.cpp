@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * FrameFi - Device Status
+ * ----------------
+ * Versioned, lock-free status snapshot. Collection runs on its own task so
+ * HTTP, MQTT and the display only ever copy a finished snapshot.
+ *
+ *****************************************************************************/
+
+#include "device_status.h"
+
+#include <string.h>
+
+DeviceStatus deviceStatus;
+
+DeviceStatus::DeviceStatus()
+    : collect(nullptr), snapshot{}, sequence(0), contentVersion(0), writerMutex(nullptr),
+      task(nullptr) {}
+
+/**
+ * @brief Takes a first snapshot and starts the refresh task.
+ */
+bool DeviceStatus::begin(Collector collector) {
+  if (task) {
+    return true;
+  }
+  collect = collector;
+  if (!writerMutex) {
+    writerMutex = xSemaphoreCreateMutex();
+  }
+  if (!writerMutex || !collect) {
+    return false;
+  }
+  refresh();
+  if (xTaskCreatePinnedToCore(taskEntry, "device_status", 6144, this, 1, &task, STATUS_TASK_CORE) != pdPASS) {
+    task = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Collects and publishes a snapshot on the calling task.
+ */
+void DeviceStatus::refresh() {
+  if (!collect || !writerMutex) {
+    return;
+  }
+  // --- Zeroed so padding never makes two equal snapshots compare different ---
+  DeviceInfo fresh;
+  memset(&fresh, 0, sizeof(fresh));
+
+  xSemaphoreTake(writerMutex, portMAX_DELAY);
+  collect(fresh);
+  publish(fresh);
+  xSemaphoreGive(writerMutex);
+}
+
+/**
+ * @brief Asks the refresh task for a new snapshot without waiting for it.
+ */
+void DeviceStatus::requestRefresh() {
+  if (task) {
+    xTaskNotifyGive(task);
+  }
+}
+
+/**
+ * @brief Writes a snapshot under the sequence counter; the caller holds writerMutex.
+ */
+void DeviceStatus::publish(const DeviceInfo& info) {
+  if (memcmp(&info, &snapshot, sizeof(info)) == 0) {
+    return;
+  }
+  sequence = sequence + 1;
+  __sync_synchronize();
+  memcpy(&snapshot, &info, sizeof(info));
+  contentVersion = contentVersion + 1;
+  __sync_synchronize();
+  sequence = sequence + 1;
+}
+
+/**
+ * @brief Copies the latest snapshot and returns its version.
+ */
+uint32_t DeviceStatus::read(DeviceInfo& info) const {
+  for (;;) {
+    uint32_t before = sequence;
+    if (before & 1) {
+      taskYIELD();  // a writer is mid-copy
+      continue;
+    }
+    __sync_synchronize();
+    uint32_t version = contentVersion;
+    memcpy(&info, (const void*)&snapshot, sizeof(info));
+    __sync_synchronize();
+    if (sequence == before) {
+      return version;
+    }
+  }
+}
+
+void DeviceStatus::taskEntry(void* arg) {
+  static_cast<DeviceStatus*>(arg)->runTask();
+}
+
+/**
+ * @brief Refresh task: collects on request, or every STATUS_REFRESH_MS otherwise.
+ */
+void DeviceStatus::runTask() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STATUS_REFRESH_MS));
+    refresh();
+  }
+}
@@ -0,0 +1,290 @@
+/******************************************************************************
+ *
+ * FrameFi - File Batch
+ * ----------------
+ * Runs lists of delete, rename and mkdir operations on the storage task
+ * and keeps a result for each one.
+ *
+ *****************************************************************************/
+
+#include "file_batch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "file_index.h"
+#include "http_files.h"
+#include "storage.h"
+
+FileBatch fileBatch;
+
+FileBatch::FileBatch()
+    : state(BATCH_IDLE), completed(0), progress(0), failures(0), jobId(0), startMs(0), endMs(0),
+      deletedFiles(0), deletedBytes(0), pathsChanged(false) {
+  fullPath[0] = '\0';
+  fullTarget[0] = '\0';
+}
+
+/**
+ * @brief Drops the previous job and starts collecting a new one. Fails while a job is running.
+ */
+bool FileBatch::prepare(size_t count) {
+  if (state == BATCH_RUNNING) {
+    return false;
+  }
+  ops.clear();
+  names.clear();
+  ops.reserve(count);
+  // --- Offset 0 is the empty name used when an operation has no target ---
+  names.push_back('\0');
+  completed = 0;
+  failures = 0;
+  deletedFiles = 0;
+  deletedBytes = 0;
+  pathsChanged = false;
+  state = BATCH_PENDING;
+  return true;
+}
+
+/**
+ * @brief Returns true if a path may be changed by a batch: safe, not the root, not FrameFi's own data.
+ */
+static bool isBatchPath(const char* path) {
+  const size_t dataDirLength = sizeof(STORAGE_DATA_DIR) - 1;
+  if (!isSafePath(path) || path[1] == '\0' || strlen(path) >= FF_MAX_LFN) {
+    return false;
+  }
+  return strncmp(path, STORAGE_DATA_DIR, dataDirLength) != 0 || (path[dataDirLength] != '/' && path[dataDirLength] != '\0');
+}
+
+/**
+ * @brief Appends an operation; to is only used by renames. Returns false if a path is unsafe.
+ */
+bool FileBatch::add(BatchOpType type, const char* path, const char* to) {
+  if (state != BATCH_PENDING || ops.size() >= FILE_BATCH_MAX_OPS || !path || !isBatchPath(path)) {
+    return false;
+  }
+  if (type == BATCH_RENAME && (!to || !isBatchPath(to))) {
+    return false;
+  }
+  Op op;
+  op.type = type;
+  op.result = FR_OK;
+  op.path = addName(path);
+  op.to = type == BATCH_RENAME ? addName(to) : 0;
+  ops.push_back(op);
+  return true;
+}
+
+/**
+ * @brief Copies a name into the shared buffer and returns its offset.
+ */
+uint32_t FileBatch::addName(const char* name) {
+  uint32_t offset = names.size();
+  names.insert(names.end(), name, name + strlen(name) + 1);
+  return offset;
+}
+
+/**
+ * @brief Hands the collected operations to the storage task and returns the job id.
+ */
+uint32_t FileBatch::start() {
+  if (state != BATCH_PENDING) {
+    return 0;
+  }
+  jobId++;
+  startMs = millis();
+  endMs = startMs;
+  progress++;
+  state = ops.empty() ? BATCH_DONE : BATCH_RUNNING;
+  return jobId;
+}
+
+/**
+ * @brief Drops a job that was prepared but not started.
+ */
+void FileBatch::cancel() {
+  if (state != BATCH_PENDING) {
+    return;
+  }
+  ops.clear();
+  names.clear();
+  state = BATCH_IDLE;
+}
+
+/**
+ * @brief Returns the elapsed run time of the job in milliseconds.
+ */
+uint32_t FileBatch::elapsedMs() const {
+  return (state == BATCH_RUNNING ? millis() : endMs) - startMs;
+}
+
+/**
+ * @brief Runs the next few operations. Called by the storage task while a job is running.
+ */
+void FileBatch::runStep() {
+  if (state != BATCH_RUNNING) {
+    return;
+  }
+  uint32_t end = completed + FILE_BATCH_STEP;
+  if (end > ops.size()) {
+    end = ops.size();
+  }
+
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  for (uint32_t i = completed; i < end; i++) {
+    // --- Once the host has the card, what is left fails instead of waiting for FTP mode ---
+    ops[i].result = storage.fatOwnsCard() ? runOp(ops[i]) : FR_NOT_READY;
+    if (ops[i].result != FR_OK) {
+      failures++;
+    }
+    completed = i + 1;
+  }
+  xSemaphoreGive(fatMutex);
+
+  progress++;
+  if (completed == ops.size()) {
+    finish();
+  }
+}
+
+/**
+ * @brief Runs one operation. The caller holds the FAT lock.
+ */
+FRESULT FileBatch::runOp(const Op& op) {
+  snprintf(fullPath, sizeof(fullPath), STORAGE_FAT_DRIVE "%s", &names[op.path]);
+
+  switch (op.type) {
+    case BATCH_DELETE: {
+      FILINFO info;
+      FRESULT result = f_stat(fullPath, &info);
+      if (result == FR_OK) {
+        // --- Directories must be empty, as with FTP RMD ---
+        result = f_unlink(fullPath);
+      }
+      if (result == FR_OK) {
+        if (info.fattrib & AM_DIR) {
+          pathsChanged = true;
+        } else {
+          deletedFiles++;
+          deletedBytes += info.fsize;
+        }
+      }
+      return result;
+    }
+    case BATCH_RENAME: {
+      snprintf(fullTarget, sizeof(fullTarget), STORAGE_FAT_DRIVE "%s", &names[op.to]);
+      FRESULT result = f_rename(fullPath, fullTarget);
+      if (result == FR_OK) {
+        pathsChanged = true;
+      }
+      return result;
+    }
+    case BATCH_MKDIR:
+      return makeDirectories(fullPath);
+  }
+  return FR_INVALID_PARAMETER;
+}
+
+/**
+ * @brief Creates a directory and any missing parents, like mkdir -p.
+ */
+FRESULT FileBatch::makeDirectories(const char* path) {
+  char partial[sizeof(fullPath)];
+  size_t prefixLength = strlen(STORAGE_FAT_DRIVE) + 1;
+  for (const char* slash = strchr(path + prefixLength, '/');; slash = strchr(slash + 1, '/')) {
+    size_t length = slash ? (size_t)(slash - path) : strlen(path);
+    memcpy(partial, path, length);
+    partial[length] = '\0';
+    FRESULT result = f_mkdir(partial);
+    if (result == FR_OK) {
+      pathsChanged = true;
+    } else if (result != FR_EXIST) {
+      return result;
+    }
+    if (!slash || slash[1] == '\0') {
+      break;
+    }
+  }
+
+  // --- An existing file of the same name is not a directory ---
+  FILINFO info;
+  FRESULT result = f_stat(partial, &info);
+  if (result == FR_OK && !(info.fattrib & AM_DIR)) {
+    result = FR_EXIST;
+  }
+  return result;
+}
+
+/**
+ * @brief Applies the job's changes to the file index in one update.
+ */
+void FileBatch::finish() {
+  if (deletedFiles > 0) {
+    fileIndex.filesDeleted(deletedFiles, deletedBytes);
+  } else if (pathsChanged) {
+    fileIndex.notePathChange();
+  }
+  endMs = millis();
+  state = BATCH_DONE;
+  progress++;
+}
+
+/**
+ * @brief Looks up an operation by its API name ("delete", "rename" or "mkdir").
+ */
+bool batchOpFromName(const char* name, BatchOpType& type) {
+  if (!name) {
+    return false;
+  }
+  for (uint8_t i = BATCH_DELETE; i <= BATCH_MKDIR; i++) {
+    if (strcmp(name, batchOpName((BatchOpType)i)) == 0) {
+      type = (BatchOpType)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Returns the API name of an operation.
+ */
+const char* batchOpName(BatchOpType type) {
+  switch (type) {
+    case BATCH_DELETE: return "delete";
+    case BATCH_RENAME: return "rename";
+    case BATCH_MKDIR: return "mkdir";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Returns the API name of a job state.
+ */
+const char* batchStateName(BatchState state) {
+  switch (state) {
+    case BATCH_IDLE: return "idle";
+    case BATCH_PENDING: return "pending";
+    case BATCH_RUNNING: return "running";
+    case BATCH_DONE: return "done";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief Returns a short name for an operation's result, as used by the API.
+ */
+const char* batchResultName(FRESULT result) {
+  switch (result) {
+    case FR_OK: return "ok";
+    case FR_NO_FILE:
+    case FR_NO_PATH: return "not_found";
+    case FR_EXIST: return "exists";
+    case FR_DENIED: return "denied";
+    case FR_INVALID_NAME: return "invalid_name";
+    case FR_WRITE_PROTECTED: return "write_protected";
+    case FR_NOT_READY: return "not_ready";
+    default: return "error";
+  }
+}
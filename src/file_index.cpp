@@ -0,0 +1,272 @@
+/******************************************************************************
+ *
+ * FrameFi - File Index
+ * ----------------
+ * Cached file count and size for the card, built with FatFs and kept
+ * current by incremental updates and MSC directory-sector invalidation.
+ *
+ *****************************************************************************/
+
+#include "file_index.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "storage.h"
+
+FileIndex fileIndex;
+
+FileIndex::FileIndex()
+    : valid(false), rebuilding(false), changedDuringRebuild(false), changes(0), watchAll(false), files(0),
+      bytes(0), rangeCount(0), volume(nullptr) {}
+
+/**
+ * @brief Scans the card and rebuilds the index and the directory sector map. The caller must not hold the FAT lock.
+ */
+bool FileIndex::rebuild() {
+  uint32_t generation = changes;
+  rebuilding = true;
+  changedDuringRebuild = false;
+  valid = false;
+  files = 0;
+  bytes = 0;
+  rangeCount = 0;
+  watchAll = false;
+  volume = nullptr;
+
+  strcpy(scanPath, FILE_INDEX_DRIVE "/");
+  bool ok = scanDirectory(scanPath, strlen(scanPath), 0);
+  sortRanges();
+
+  // --- A change that raced with the scan may have been missed; stay stale ---
+  valid = ok && !changedDuringRebuild && changes == generation;
+  rebuilding = false;
+  return valid;
+}
+
+/**
+ * @brief Counts the files below path and records the sectors its entries live in.
+ */
+bool FileIndex::scanDirectory(char* path, size_t length, uint8_t depth) {
+  FF_DIR dir;
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  if (f_opendir(&dir, path) != FR_OK) {
+    xSemaphoreGive(fatMutex);
+    return false;
+  }
+
+  if (!volume) {
+    volume = dir.obj.fs;
+    // --- The host may have rewritten the sector FatFs still has cached ---
+    if (!storage.fatOwnsCard() && !volume->wflag) {
+      volume->winsect = ~(decltype(volume->winsect))0;
+    }
+  }
+
+  uint32_t lastCluster = dir.obj.sclust;
+  addCluster(lastCluster);
+
+  bool ok = true;
+  for (uint32_t count = 1;; count++) {
+    if (f_readdir(&dir, &entry) != FR_OK) {
+      ok = false;
+      break;
+    }
+    if (dir.clust != lastCluster && dir.clust != 0) {
+      lastCluster = dir.clust;
+      addCluster(lastCluster);
+    }
+    if (entry.fname[0] == '\0') {
+      break;
+    }
+
+    if (entry.fattrib & AM_DIR) {
+      if (depth == 0 && strcmp(entry.fname, STORAGE_DATA_DIR + 1) == 0) {
+        continue;
+      }
+      size_t nameLength = strlen(entry.fname);
+      if (depth + 1 >= FILE_INDEX_MAX_DEPTH || length + nameLength + 2 > sizeof(scanPath)) {
+        continue;
+      }
+      // --- Descend using the shared path buffer, then trim it back ---
+      size_t base = length;
+      if (path[base - 1] != '/') {
+        path[base++] = '/';
+      }
+      memcpy(path + base, entry.fname, nameLength + 1);
+      // --- The subdirectory takes the lock for itself ---
+      xSemaphoreGive(fatMutex);
+      bool subOk = scanDirectory(path, base + nameLength, depth + 1);
+      xSemaphoreTake(fatMutex, portMAX_DELAY);
+      path[length] = '\0';
+      if (!subOk) {
+        ok = false;
+        break;
+      }
+    } else {
+      files++;
+      bytes += entry.fsize;
+    }
+    // --- Let transfers and mode switches in between batches ---
+    if (count % FILE_INDEX_BATCH == 0) {
+      xSemaphoreGive(fatMutex);
+      vTaskDelay(1);
+      xSemaphoreTake(fatMutex, portMAX_DELAY);
+    }
+  }
+
+  f_closedir(&dir);
+  xSemaphoreGive(fatMutex);
+  return ok;
+}
+
+/**
+ * @brief Records the sectors of a directory cluster and of its FAT entry.
+ */
+void FileIndex::addCluster(uint32_t cluster) {
+  uint32_t sectorSize = volume->ssize;
+
+  if (cluster == 0) {
+    // --- FAT12/16 root directory lives in a fixed area ---
+    addRange(volume->dirbase, (volume->n_rootdir * 32 + sectorSize - 1) / sectorSize);
+    return;
+  }
+
+  addRange(volume->database + (cluster - 2) * volume->csize, volume->csize);
+
+  // --- Growing a directory links a new cluster through the FAT entry of its last one ---
+  switch (volume->fs_type) {
+  case FS_FAT32: addRange(volume->fatbase + (cluster * 4) / sectorSize, 1); break;
+  case FS_FAT16: addRange(volume->fatbase + (cluster * 2) / sectorSize, 1); break;
+  case FS_FAT12: addRange(volume->fatbase + (cluster * 3 / 2) / sectorSize, 2); break;
+  default: watchAll = true; break;
+  }
+}
+
+/**
+ * @brief Adds a sector range, merging it with the previous one when they touch.
+ */
+void FileIndex::addRange(uint32_t lba, uint32_t count) {
+  if (watchAll || count == 0) {
+    return;
+  }
+  if (rangeCount > 0) {
+    Range& last = ranges[rangeCount - 1];
+    if (lba >= last.lba && lba <= last.lba + last.count) {
+      uint32_t end = lba + count;
+      if (end > last.lba + last.count) {
+        last.count = end - last.lba;
+      }
+      return;
+    }
+  }
+  if (rangeCount == FILE_INDEX_MAX_RANGES) {
+    watchAll = true;
+    return;
+  }
+  ranges[rangeCount].lba = lba;
+  ranges[rangeCount].count = count;
+  rangeCount++;
+}
+
+/**
+ * @brief Sorts the ranges by LBA and merges any that overlap.
+ */
+void FileIndex::sortRanges() {
+  for (uint16_t i = 1; i < rangeCount; i++) {
+    Range current = ranges[i];
+    uint16_t j = i;
+    while (j > 0 && ranges[j - 1].lba > current.lba) {
+      ranges[j] = ranges[j - 1];
+      j--;
+    }
+    ranges[j] = current;
+  }
+
+  uint16_t merged = 0;
+  for (uint16_t i = 0; i < rangeCount; i++) {
+    if (merged > 0 && ranges[i].lba <= ranges[merged - 1].lba + ranges[merged - 1].count) {
+      uint32_t end = ranges[i].lba + ranges[i].count;
+      if (end > ranges[merged - 1].lba + ranges[merged - 1].count) {
+        ranges[merged - 1].count = end - ranges[merged - 1].lba;
+      }
+    } else {
+      ranges[merged++] = ranges[i];
+    }
+  }
+  rangeCount = merged;
+}
+
+/**
+ * @brief Returns true if [lba, lba + count) overlaps a directory range.
+ */
+bool FileIndex::touches(uint32_t lba, uint32_t count) const {
+  // --- Find the last range starting before the end of the write ---
+  uint16_t low = 0;
+  uint16_t high = rangeCount;
+  while (low < high) {
+    uint16_t mid = (low + high) / 2;
+    if (ranges[mid].lba < lba + count) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low > 0 && ranges[low - 1].lba + ranges[low - 1].count > lba;
+}
+
+/**
+ * @brief Invalidates the index if a raw sector write touches directory data.
+ */
+void FileIndex::noteSectorWrite(uint32_t lba, uint32_t count) {
+  if (rebuilding) {
+    changedDuringRebuild = true;
+    changes++;
+    return;
+  }
+  if (valid && (watchAll || touches(lba, count))) {
+    invalidate();
+  }
+}
+
+/**
+ * @brief Records a file that was created or rewritten.
+ */
+void FileIndex::fileStored(bool existed, uint32_t oldSize, uint32_t newSize) {
+  changes++;
+  if (!valid) {
+    return;
+  }
+  if (!existed) {
+    files++;
+  }
+  bytes = bytes - oldSize + newSize;
+}
+
+/**
+ * @brief Records a file that was deleted.
+ */
+void FileIndex::fileDeleted(uint32_t size) {
+  changes++;
+  if (!valid) {
+    return;
+  }
+  if (files > 0) {
+    files--;
+  }
+  bytes = bytes > size ? bytes - size : 0;
+}
+
+/**
+ * @brief Records several deleted files at once, such as the result of a batch job.
+ */
+void FileIndex::filesDeleted(uint32_t count, uint64_t size) {
+  changes++;
+  if (!valid) {
+    return;
+  }
+  files = files > count ? files - count : 0;
+  bytes = bytes > size ? bytes - size : 0;
+}
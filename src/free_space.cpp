@@ -0,0 +1,321 @@
+/******************************************************************************
+ *
+ * FrameFi - Free Space
+ * ----------------
+ * Free space of the card from the count FatFs keeps, recounted in the
+ * background only after the USB host changed the allocation table.
+ *
+ *****************************************************************************/
+
+#include "free_space.h"
+
+#include <string.h>
+
+#include "Arduino.h"
+#include "esp_heap_caps.h"
+#include "file_index.h"
+
+FreeSpaceTracker freeSpace;
+
+FreeSpaceTracker::FreeSpaceTracker()
+    : dev{nullptr, nullptr, nullptr}, task(nullptr), counters{0, 0}, known(false), freeClusters(0), hostWrites(0),
+      lastHostWriteMs(0), countedWrites(0), fsType(0), sectorBytes(0), clusterBytes(0), totalClusters(0),
+      tableStart(0), tableSectors(0), tableEntries(0) {}
+
+/**
+ * @brief Takes the count FatFs holds and starts the background task.
+ */
+bool FreeSpaceTracker::begin(const BlockDevice& device) {
+  if (task) {
+    return true;
+  }
+  dev = device;
+
+  // --- The volume was just mounted, so FatFs holds the FSINFO count if the card had a valid one ---
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  const FATFS* fs = storage.fatVolume();
+  if (storage.fatOwnsCard() && fs && loadGeometry(fs) && fs->free_clst <= totalClusters) {
+    freeClusters = fs->free_clst;
+    known = true;
+  }
+  xSemaphoreGive(fatMutex);
+
+  if (xTaskCreatePinnedToCore(taskEntry, "free_space", 4096, this, 1, &task, FREE_SPACE_TASK_CORE) != pdPASS) {
+    task = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Returns the size and free space of the card. Never touches the card.
+ */
+bool FreeSpaceTracker::read(uint64_t& totalBytes, uint64_t& freeBytes) {
+  // --- Only if nobody holds the lock; a transfer in progress must not hold up a status call ---
+  if (storage.fatOwnsCard() && fatMutex && xSemaphoreTake(fatMutex, 0) == pdTRUE) {
+    sample();
+    xSemaphoreGive(fatMutex);
+  }
+  if (!known) {
+    return false;
+  }
+  totalBytes = (uint64_t)totalClusters * clusterBytes;
+  freeBytes = (uint64_t)freeClusters * clusterBytes;
+  return true;
+}
+
+/**
+ * @brief Picks up the count FatFs keeps. Call with the FAT lock held.
+ */
+void FreeSpaceTracker::sample() {
+  const FATFS* fs = storage.fatVolume();
+  if (!isExact() || !storage.fatOwnsCard() || !fs || fs->fs_type != fsType) {
+    return;
+  }
+  // --- FatFs adjusts free_clst on every allocation and release while it holds a valid count ---
+  if (fs->free_clst <= totalClusters) {
+    freeClusters = fs->free_clst;
+  }
+}
+
+/**
+ * @brief Records a USB host write; writes to the allocation table make the count stale.
+ */
+void FreeSpaceTracker::noteHostWrite(uint32_t lba, uint32_t count) {
+  if (fsType == 0 || (lba < tableStart + tableSectors && lba + count > tableStart)) {
+    hostWrites++;
+    lastHostWriteMs = millis();
+  }
+}
+
+/**
+ * @brief Hands the known count to the freshly claimed volume. Call with the FAT lock held.
+ */
+void FreeSpaceTracker::volumeClaimed() {
+  // --- Opening the root makes FatFs mount the volume again now instead of on the next transfer ---
+  FF_DIR dir;
+  if (f_opendir(&dir, STORAGE_FAT_DRIVE "/") != FR_OK) {
+    return;
+  }
+  f_closedir(&dir);
+
+  FATFS* fs = storage.fatVolume();
+  if (!fs) {
+    return;
+  }
+  uint32_t start = tableStart;
+  uint32_t clusters = totalClusters;
+  if (!loadGeometry(fs) || tableStart != start || totalClusters != clusters) {
+    // --- The host formatted the card ---
+    known = false;
+  }
+  if (isExact()) {
+    // --- FatFs re-read FSINFO, which may be older than the count kept here ---
+    if (fs->free_clst != freeClusters) {
+      fs->free_clst = freeClusters;
+      fs->fsi_flag |= 1;
+    }
+  } else if (task) {
+    xTaskNotifyGive(task);
+  }
+}
+
+/**
+ * @brief Copies the geometry of a mounted volume. Returns false for a volume FatFs has not mounted.
+ */
+bool FreeSpaceTracker::loadGeometry(const FATFS* fs) {
+  if (fs->fs_type == 0 || fs->n_fatent < 3) {
+    return false;
+  }
+  fsType = fs->fs_type;
+  sectorBytes = fs->ssize;
+  clusterBytes = (uint32_t)fs->csize * fs->ssize;
+  totalClusters = fs->n_fatent - 2;
+#if FF_FS_EXFAT
+  if (fsType == FS_EXFAT) {
+    tableStart = fs->bitbase;
+    tableEntries = totalClusters;
+    tableSectors = ((tableEntries + 7) / 8 + sectorBytes - 1) / sectorBytes;
+    return true;
+  }
+#endif
+  tableStart = fs->fatbase;
+  tableEntries = fs->n_fatent;
+  tableSectors = fs->fsize;
+  return true;
+}
+
+/**
+ * @brief Counts the free entries in a run of the allocation table, starting at entry.
+ */
+uint32_t FreeSpaceTracker::countFree(const uint8_t* data, uint32_t bytes, uint32_t& entry) const {
+  uint32_t found = 0;
+  if (fsType == FS_FAT32) {
+    for (uint32_t i = 0; i + 4 <= bytes && entry < tableEntries; i += 4, entry++) {
+      uint32_t value = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+      if ((value & 0x0FFFFFFF) == 0) {
+        found++;
+      }
+    }
+  } else if (fsType == FS_FAT16) {
+    for (uint32_t i = 0; i + 2 <= bytes && entry < tableEntries; i += 2, entry++) {
+      if (data[i] == 0 && data[i + 1] == 0) {
+        found++;
+      }
+    }
+  } else {
+    // --- exFAT bitmap: one bit per cluster, set when in use ---
+    for (uint32_t i = 0; i < bytes && entry < tableEntries; i++) {
+      uint32_t bits = tableEntries - entry < 8 ? tableEntries - entry : 8;
+      uint8_t used = data[i] & (uint8_t)((1u << bits) - 1);
+      found += bits - __builtin_popcount(used);
+      entry += bits;
+    }
+  }
+  return found;
+}
+
+/**
+ * @brief Takes down what a count through the FAT layer must see unchanged. Call with the FAT lock held.
+ */
+bool FreeSpaceTracker::markVolume(VolumeMark& mark) const {
+  FATFS* fs = storage.fatVolume();
+  if (!storage.fatOwnsCard() || !fs || fs->fs_type != fsType) {
+    return false;
+  }
+  mark.fs = fs;
+  mark.mount = fs->id;
+  mark.freeClusters = fs->free_clst;
+  mark.lastCluster = fs->last_clst;
+  mark.generation = fileIndex.generation();
+  return true;
+}
+
+/**
+ * @brief Returns true if the volume still matches mark. Call with the FAT lock held.
+ */
+bool FreeSpaceTracker::volumeUnchanged(const VolumeMark& mark) const {
+  // --- FatFs moves free_clst and last_clst on every allocation; deletes and renames bump the index ---
+  const FATFS* fs = storage.fatVolume();
+  return storage.fatOwnsCard() && fs == mark.fs && fs->fs_type == fsType && fs->id == mark.mount &&
+         fs->free_clst == mark.freeClusters && fs->last_clst == mark.lastCluster &&
+         fileIndex.generation() == mark.generation;
+}
+
+/**
+ * @brief Counts the free clusters of the whole volume.
+ * fatLayer: FatFs owns the card; the FAT lock is taken for one run of sectors at a time and the
+ * count gives up if the table changed in between. Otherwise the USB host owns the card and the
+ * count gives up as soon as the host writes to the table.
+ */
+bool FreeSpaceTracker::count(bool fatLayer) {
+  uint32_t writes = hostWrites;
+  uint32_t start = millis();
+
+  if (fsType == FS_FAT12) {
+    // --- A FAT12 table is a few sectors and packs entries across them; FatFs counts it quickly ---
+    if (!fatLayer) {
+      return false;
+    }
+    DWORD clusters;
+    FATFS* fs;
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    bool ok = storage.fatOwnsCard() && f_getfree(STORAGE_FAT_DRIVE, &clusters, &fs) == FR_OK;
+    xSemaphoreGive(fatMutex);
+    if (!ok) {
+      return false;
+    }
+    freeClusters = clusters;
+  } else {
+    VolumeMark mark = {};
+    if (fatLayer) {
+      xSemaphoreTake(fatMutex, portMAX_DELAY);
+      bool ok = markVolume(mark);
+      xSemaphoreGive(fatMutex);
+      if (!ok) {
+        return false;
+      }
+    }
+    uint8_t* buffer = (uint8_t*)heap_caps_malloc(FREE_SPACE_READ_SECTORS * sectorBytes, MALLOC_CAP_DMA);
+    if (!buffer) {
+      return false;
+    }
+    uint32_t found = 0;
+    uint32_t entry = 0;
+    bool ok = true;
+    for (uint32_t sector = 0; ok && sector < tableSectors && entry < tableEntries; sector += FREE_SPACE_READ_SECTORS) {
+      uint32_t run = tableSectors - sector < FREE_SPACE_READ_SECTORS ? tableSectors - sector : FREE_SPACE_READ_SECTORS;
+      if (fatLayer) {
+        // --- Transfers and mode switches get the card between runs, as in the file index scan ---
+        xSemaphoreTake(fatMutex, portMAX_DELAY);
+        ok = volumeUnchanged(mark);
+      } else if (storage.fatOwnsCard() || hostWrites != writes) {
+        ok = false;
+      }
+      if (ok) {
+        ok = dev.read(dev.context, tableStart + sector, run, buffer);
+      }
+      if (ok && fatLayer && mark.fs->wflag && mark.fs->winsect >= tableStart + sector &&
+          mark.fs->winsect < tableStart + sector + run) {
+        // --- FatFs may hold a changed table sector it has not written yet ---
+        memcpy(buffer + (mark.fs->winsect - tableStart - sector) * sectorBytes, mark.fs->win, sectorBytes);
+      }
+      if (fatLayer) {
+        xSemaphoreGive(fatMutex);
+      }
+      if (ok) {
+        found += countFree(buffer, run * sectorBytes, entry);
+      }
+      vTaskDelay(1);
+    }
+    heap_caps_free(buffer);
+    if (!ok || (!fatLayer && hostWrites != writes)) {
+      return false;
+    }
+    if (fatLayer) {
+      // --- A write since the first run may have changed a part already counted; count again later ---
+      xSemaphoreTake(fatMutex, portMAX_DELAY);
+      ok = volumeUnchanged(mark);
+      if (ok) {
+        // --- FatFs keeps the count from here on and writes it to FSINFO with the next sync ---
+        freeClusters = found;
+        mark.fs->free_clst = found;
+        mark.fs->fsi_flag |= 1;
+      }
+      xSemaphoreGive(fatMutex);
+      if (!ok) {
+        return false;
+      }
+    } else {
+      freeClusters = found;
+    }
+  }
+
+  countedWrites = writes;
+  known = true;
+  counters.counts++;
+  counters.lastCountMs = millis() - start;
+  return true;
+}
+
+void FreeSpaceTracker::taskEntry(void* arg) {
+  static_cast<FreeSpaceTracker*>(arg)->runTask();
+}
+
+/**
+ * @brief Free space task: counts the table again once a stale count has settled.
+ */
+void FreeSpaceTracker::runTask() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FREE_SPACE_CHECK_MS));
+    if (isExact() || fsType == 0) {
+      continue;
+    }
+    if (storage.fatOwnsCard()) {
+      // --- Takes the FAT lock itself; a count cut short by a write runs again on the next check ---
+      count(true);
+    } else if (millis() - lastHostWriteMs >= FREE_SPACE_SETTLE_MS) {
+      count(false);
+    }
+  }
+}
@@ -0,0 +1,164 @@
+/******************************************************************************
+ *
+ * FrameFi - HTTP File Helpers
+ * ----------------
+ * Range parsing, ETags and content types for serving files from the card.
+ *
+ *****************************************************************************/
+
+#include "http_files.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @brief Parses a single "bytes=" Range header against a file of the given size.
+ */
+RangeResult parseRange(const char* header, uint32_t size, ByteRange& range) {
+  if (strncmp(header, "bytes=", 6) != 0) {
+    return RANGE_NONE;
+  }
+  const char* spec = header + 6;
+  // --- Multiple ranges would need a multipart reply; sending the whole file is allowed ---
+  if (strchr(spec, ',')) {
+    return RANGE_NONE;
+  }
+
+  char* end;
+  if (*spec == '-') {
+    // --- Suffix range: the last n bytes ---
+    unsigned long suffix = strtoul(spec + 1, &end, 10);
+    if (end == spec + 1 || *end != '\0') {
+      return RANGE_NONE;
+    }
+    if (suffix == 0 || size == 0) {
+      return RANGE_UNSATISFIABLE;
+    }
+    range.start = suffix < size ? size - suffix : 0;
+    range.length = size - range.start;
+    return RANGE_OK;
+  }
+
+  if (!isdigit((unsigned char)*spec)) {
+    return RANGE_NONE;
+  }
+  unsigned long first = strtoul(spec, &end, 10);
+  if (*end != '-') {
+    return RANGE_NONE;
+  }
+  const char* lastSpec = end + 1;
+  unsigned long last = size > 0 ? size - 1 : 0;
+  if (*lastSpec != '\0') {
+    last = strtoul(lastSpec, &end, 10);
+    if (*end != '\0' || last < first) {
+      return RANGE_NONE;
+    }
+  }
+  if (first >= size) {
+    return RANGE_UNSATISFIABLE;
+  }
+  if (last >= size) {
+    last = size - 1;
+  }
+  range.start = first;
+  range.length = last - first + 1;
+  return RANGE_OK;
+}
+
+/**
+ * @brief Writes a quoted ETag built from the file size and modification time.
+ */
+void formatEtag(char* out, size_t outSize, uint32_t size, time_t mtime) {
+  snprintf(out, outSize, "\"%lx-%lx\"", (unsigned long)size, (unsigned long)mtime);
+}
+
+/**
+ * @brief Returns true if an If-None-Match header matches the ETag.
+ */
+bool etagMatches(const char* header, const char* etag) {
+  // --- The header may be "*", a weak W/"..." tag, or a comma separated list ---
+  return strcmp(header, "*") == 0 || strstr(header, etag) != nullptr;
+}
+
+/**
+ * @brief Returns the MIME type for a path based on its extension.
+ */
+const char* contentTypeFor(const char* path) {
+  static const struct {
+    const char* extension;
+    const char* type;
+  } types[] = {
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"png", "image/png"},
+    {"gif", "image/gif"},
+    {"bmp", "image/bmp"},
+    {"webp", "image/webp"},
+    {"mp4", "video/mp4"},
+    {"mov", "video/quicktime"},
+    {"txt", "text/plain"},
+    {"json", "application/json"},
+    {"tsv", "text/tab-separated-values"},
+  };
+
+  const char* dot = strrchr(path, '.');
+  if (dot && !strchr(dot, '/')) {
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+      if (strcasecmp(dot + 1, types[i].extension) == 0) {
+        return types[i].type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+/**
+ * @brief Shortens a read so that it ends on an HTTP_FILES_ALIGN boundary when it can.
+ */
+size_t alignedReadLength(uint32_t position, size_t length) {
+  uint32_t end = position + length;
+  uint32_t alignedEnd = end - end % HTTP_FILES_ALIGN;
+  return alignedEnd > position ? alignedEnd - position : length;
+}
+
+/**
+ * @brief Returns true if the path is absolute and has no ".." segments.
+ */
+bool isSafePath(const char* path) {
+  if (path[0] != '/') {
+    return false;
+  }
+  for (const char* segment = path; segment; segment = strchr(segment + 1, '/')) {
+    const char* name = segment + 1;
+    if (name[0] == '.' && name[1] == '.' && (name[2] == '/' || name[2] == '\0')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Percent-encodes a path for use in a URL, keeping the slashes. Returns false if out is too small.
+ */
+bool urlEncodePath(const char* path, char* out, size_t outSize) {
+  static const char digits[] = "0123456789ABCDEF";
+  size_t length = 0;
+  for (const unsigned char* c = (const unsigned char*)path; *c; c++) {
+    bool plain = isalnum(*c) || strchr("/-._~", *c);
+    if (length + (plain ? 1 : 3) >= outSize) {
+      return false;
+    }
+    if (plain) {
+      out[length++] = *c;
+    } else {
+      out[length++] = '%';
+      out[length++] = digits[*c >> 4];
+      out[length++] = digits[*c & 0x0F];
+    }
+  }
+  out[length] = '\0';
+  return true;
+}
@@ -0,0 +1,432 @@
+/******************************************************************************
+ *
+ * FrameFi - Image Ingest
+ * ----------------
+ * Streams uploaded JPEGs through a decoder, a band-at-a-time resizer and
+ * an encoder on a background task, replacing each with a copy at the
+ * frame's resolution.
+ *
+ *****************************************************************************/
+
+#include "image_ingest.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <new>
+
+#include "Arduino.h"
+#include "content_index.h"
+#include "device_status.h"
+#include "esp_heap_caps.h"
+#include "file_index.h"
+#include "jpeg_files.h"
+
+ImageIngest imageIngest;
+
+// --- The new copy is built here and renamed over the original when it is done ---
+static const char convertedPath[] = STORAGE_DATA_DIR "/ingest.jpg";
+
+struct ImageIngest::Work {
+  JPEGDEC decoder;
+  JPEGENC encoder;
+  JPEGENCODE encodeState;
+  JpegSource source;
+  JpegTarget target;
+};
+
+ImageIngest::ImageIngest()
+    : settings{false, INGEST_DEFAULT_WIDTH, INGEST_DEFAULT_HEIGHT, INGEST_DEFAULT_QUALITY, false}, counters{},
+      task(nullptr), queue(nullptr), busy(false), work(nullptr), bands(nullptr), columnMap(nullptr), carry{},
+      sourceWidth(0), sourceHeight(0), outWidth(0), outHeight(0), paddedWidth(0), rowsDone(0), nextBand(0),
+      encodeFailed(false) {}
+
+/**
+ * @brief Starts the ingest task.
+ */
+bool ImageIngest::begin() {
+  if (task) {
+    return true;
+  }
+  if (!queue) {
+    queue = xQueueCreate(INGEST_QUEUE_LENGTH, sizeof(Job));
+  }
+  if (!queue) {
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(taskEntry, "ingest", 8192, this, 1, &task, INGEST_TASK_CORE) != pdPASS) {
+    task = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Replaces the configuration. Returns false if a value is out of range.
+ */
+bool ImageIngest::configure(const IngestConfig& newConfig) {
+  if (newConfig.width < INGEST_BAND_ROWS || newConfig.width > INGEST_MAX_DIMENSION ||
+      newConfig.height < INGEST_BAND_ROWS || newConfig.height > INGEST_MAX_DIMENSION ||
+      newConfig.quality < 1 || newConfig.quality > 100) {
+    return false;
+  }
+  settings = newConfig;
+  return true;
+}
+
+/**
+ * @brief Queues a stored upload for conversion if it is a JPEG and ingest is on. Never blocks.
+ * sha256 is the hash of the upload if it is known; it is re-recorded for the smaller copy.
+ */
+void ImageIngest::submit(const char* path, const uint8_t* sha256) {
+  const size_t dataDirLength = sizeof(STORAGE_DATA_DIR) - 1;
+  if (!settings.enabled || !queue || !path || path[0] != '/' || strlen(path) >= sizeof(Job::path) ||
+      !isJpegPath(path) || (strncmp(path, STORAGE_DATA_DIR, dataDirLength) == 0 && path[dataDirLength] == '/')) {
+    return;
+  }
+  Job job;
+  strcpy(job.path, path);
+  job.hashed = sha256 != nullptr;
+  if (sha256) {
+    memcpy(job.sha256, sha256, sizeof(job.sha256));
+  }
+  if (xQueueSend(queue, &job, 0) != pdTRUE) {
+    counters.dropped++;
+  }
+}
+
+/**
+ * @brief Returns the number of uploads waiting, including the one being converted.
+ */
+uint32_t ImageIngest::pending() const {
+  return (queue ? uxQueueMessagesWaiting(queue) : 0) + (busy ? 1 : 0);
+}
+
+/**
+ * @brief Averages two RGB565 pixels channel by channel.
+ */
+static inline uint16_t averagePixels(uint16_t a, uint16_t b) {
+  return (a & b) + (((a ^ b) & 0xF7DE) >> 1);
+}
+
+/**
+ * @brief Maps a decoded row or column to the output one whose box holds its center.
+ */
+static inline int mapToOutput(int source, int outSize, int sourceSize) {
+  return (int)(((uint32_t)(2 * source + 1) * outSize) / (2 * (uint32_t)sourceSize));
+}
+
+/**
+ * @brief Picks the output size and decoder scale for a picture. Returns false if it should be left alone.
+ */
+bool ImageIngest::setupResize(int width, int height, uint8_t orientation, int& scale) {
+  // --- Orientations 5 to 8 turn the picture on its side, so the box is matched as displayed ---
+  bool sideways = orientation >= 5 && orientation <= 8;
+  uint32_t shownWidth = sideways ? height : width;
+  uint32_t shownHeight = sideways ? width : height;
+  if (shownWidth <= settings.width && shownHeight <= settings.height) {
+    return false;
+  }
+  uint32_t fitWidth = settings.width;
+  uint32_t fitHeight = settings.height;
+  if (shownWidth * settings.height >= shownHeight * settings.width) {
+    fitHeight = (shownHeight * settings.width + shownWidth / 2) / shownWidth;
+  } else {
+    fitWidth = (shownWidth * settings.height + shownHeight / 2) / shownHeight;
+  }
+  outWidth = sideways ? fitHeight : fitWidth;
+  outHeight = sideways ? fitWidth : fitHeight;
+  if (outWidth < 1) {
+    outWidth = 1;
+  }
+  if (outHeight < 1) {
+    outHeight = 1;
+  }
+
+  // --- The decoder takes the largest power of two step that still leaves enough pixels ---
+  for (scale = 8; scale > 1; scale /= 2) {
+    if (width / scale >= outWidth && height / scale >= outHeight) {
+      break;
+    }
+  }
+  sourceWidth = width / scale;
+  sourceHeight = height / scale;
+  // --- The box filter takes at most two pixels per axis ---
+  if (sourceWidth >= 2 * outWidth || sourceHeight >= 2 * outHeight) {
+    return false;
+  }
+
+  paddedWidth = (outWidth + INGEST_BAND_ROWS - 1) & ~(INGEST_BAND_ROWS - 1);
+  return true;
+}
+
+/**
+ * @brief Allocates the band buffers and column map for the size picked by setupResize().
+ */
+bool ImageIngest::allocateBuffers() {
+  bands = (uint16_t*)allocatePixelBuffer((size_t)2 * INGEST_BAND_ROWS * paddedWidth * sizeof(uint16_t));
+  columnMap = (uint16_t*)allocatePixelBuffer((size_t)sourceWidth * sizeof(uint16_t));
+  if (!bands || !columnMap) {
+    return false;
+  }
+  for (int x = 0; x < sourceWidth; x++) {
+    columnMap[x] = mapToOutput(x, outWidth, sourceWidth);
+  }
+  rowsDone = 0;
+  nextBand = 0;
+  encodeFailed = false;
+  return true;
+}
+
+/**
+ * @brief Frees the band buffers and column map.
+ */
+void ImageIngest::releaseBuffers() {
+  heap_caps_free(bands);
+  heap_caps_free(columnMap);
+  bands = nullptr;
+  columnMap = nullptr;
+}
+
+int ImageIngest::drawCallback(JPEGDRAW* draw) {
+  ImageIngest* self = static_cast<ImageIngest*>(draw->pUser);
+  self->drawBlock(draw->pPixels, draw->x, draw->y, draw->iWidth, draw->iHeight);
+  // --- The decoder works across the picture; the block that reaches the right edge ends a row of MCUs ---
+  if (draw->x + draw->iWidth >= self->sourceWidth) {
+    return self->finishRows(draw->y + draw->iHeight) ? 1 : 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Folds a block of decoded pixels into the output rows they fall in.
+ */
+void ImageIngest::drawBlock(const uint16_t* pixels, int x, int y, int width, int height) {
+  int columns = sourceWidth - x < width ? sourceWidth - x : width;
+  if (height > INGEST_BAND_ROWS) {
+    height = INGEST_BAND_ROWS;
+  }
+  for (int r = 0; r < height && y + r < sourceHeight; r++) {
+    int sourceRow = y + r;
+    int outRow = mapToOutput(sourceRow, outHeight, sourceHeight);
+    bool firstRow = sourceRow == 0 || mapToOutput(sourceRow - 1, outHeight, sourceHeight) != outRow;
+    uint16_t* out = bands + (size_t)(((outRow / INGEST_BAND_ROWS) & 1) * INGEST_BAND_ROWS + outRow % INGEST_BAND_ROWS) * paddedWidth;
+    const uint16_t* row = pixels + (size_t)r * width;
+
+    for (int i = 0; i < columns; i++) {
+      int sourceColumn = x + i;
+      int outColumn = columnMap[sourceColumn];
+      // --- The left pixel of a pair waits for its partner, which may be in the next block ---
+      if (sourceColumn + 1 < sourceWidth && columnMap[sourceColumn + 1] == outColumn) {
+        if (i == columns - 1) {
+          carry[r] = row[i];
+        }
+        continue;
+      }
+      uint16_t pixel = row[i];
+      if (sourceColumn > 0 && columnMap[sourceColumn - 1] == outColumn) {
+        pixel = averagePixels(i > 0 ? row[i - 1] : carry[r], pixel);
+      }
+      out[outColumn] = firstRow ? pixel : averagePixels(out[outColumn], pixel);
+    }
+  }
+}
+
+/**
+ * @brief Encodes every band whose rows are complete once the decoder has passed sourceRowEnd.
+ */
+bool ImageIngest::finishRows(int sourceRowEnd) {
+  if (sourceRowEnd >= sourceHeight) {
+    rowsDone = outHeight;
+  } else if (sourceRowEnd > 0) {
+    // --- The row holding the last decoded line is only done if the next line starts a new one ---
+    int last = mapToOutput(sourceRowEnd - 1, outHeight, sourceHeight);
+    rowsDone = mapToOutput(sourceRowEnd, outHeight, sourceHeight) != last ? last + 1 : last;
+  }
+  while (!encodeFailed && nextBand * INGEST_BAND_ROWS < outHeight) {
+    int bandEnd = (nextBand + 1) * INGEST_BAND_ROWS;
+    if (rowsDone < (bandEnd < outHeight ? bandEnd : outHeight)) {
+      break;
+    }
+    encodeFailed = !encodeBand();
+  }
+  return !encodeFailed;
+}
+
+/**
+ * @brief Pads the next band out to whole MCUs and hands it to the encoder.
+ */
+bool ImageIngest::encodeBand() {
+  uint16_t* band = bands + (size_t)(nextBand & 1) * INGEST_BAND_ROWS * paddedWidth;
+  int rows = outHeight - nextBand * INGEST_BAND_ROWS;
+  if (rows > INGEST_BAND_ROWS) {
+    rows = INGEST_BAND_ROWS;
+  }
+  // --- Repeat the edge pixels into the padding so the last MCUs compress cleanly ---
+  for (int r = 0; r < INGEST_BAND_ROWS; r++) {
+    uint16_t* row = band + (size_t)r * paddedWidth;
+    if (r >= rows) {
+      memcpy(row, band + (size_t)(rows - 1) * paddedWidth, paddedWidth * sizeof(uint16_t));
+      continue;
+    }
+    for (int x = outWidth; x < paddedWidth; x++) {
+      row[x] = row[outWidth - 1];
+    }
+  }
+
+  for (int x = 0; x < paddedWidth; x += INGEST_BAND_ROWS) {
+    if (work->encoder.addMCU(&work->encodeState, (uint8_t*)(band + x), paddedWidth * sizeof(uint16_t)) != JPEGE_SUCCESS ||
+        work->target.failed) {
+      return false;
+    }
+  }
+  nextBand++;
+  return true;
+}
+
+/**
+ * @brief Swaps the converted copy in for the original, if the original has not changed meanwhile.
+ */
+bool ImageIngest::replaceOriginal(const Job& job, const FILINFO& original, uint32_t& newSize) {
+  char drivePath[FF_MAX_LFN + 8];
+  char converted[sizeof(convertedPath) + 4];
+  snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", job.path);
+  snprintf(converted, sizeof(converted), STORAGE_FAT_DRIVE "%s", convertedPath);
+
+  // --- A new upload to the same path wins; it is queued on its own ---
+  FILINFO info;
+  if (f_stat(drivePath, &info) != FR_OK || info.fsize != original.fsize || info.fdate != original.fdate ||
+      info.ftime != original.ftime || f_stat(converted, &info) != FR_OK) {
+    f_unlink(converted);
+    return false;
+  }
+  newSize = info.fsize;
+
+  FRESULT result;
+  if (settings.keepOriginals) {
+    char kept[FF_MAX_LFN + sizeof(INGEST_ORIGINALS_DIR) + 8];
+    if (snprintf(kept, sizeof(kept), STORAGE_FAT_DRIVE INGEST_ORIGINALS_DIR "%s", job.path) >= (int)sizeof(kept)) {
+      f_unlink(converted);
+      return false;
+    }
+    makeParentDirectories(kept);
+    f_unlink(kept);
+    result = f_rename(drivePath, kept);
+  } else {
+    result = f_unlink(drivePath);
+  }
+  if (result == FR_OK) {
+    result = f_rename(converted, drivePath);
+  }
+  if (result != FR_OK) {
+    f_unlink(converted);
+  }
+  return result == FR_OK;
+}
+
+/**
+ * @brief Converts one upload. The original is only touched once the copy is complete.
+ */
+ImageIngest::Outcome ImageIngest::convert(const Job& job) {
+  char drivePath[FF_MAX_LFN + 8];
+  snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", job.path);
+  FILINFO original;
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool found = storage.fatOwnsCard() && f_stat(drivePath, &original) == FR_OK && !(original.fattrib & AM_DIR);
+  xSemaphoreGive(fatMutex);
+  if (!found) {
+    return INGEST_SKIPPED;
+  }
+
+  work = new (std::nothrow) Work();
+  if (!work) {
+    return INGEST_FAILED;
+  }
+
+  // --- Anything the decoder cannot read as a baseline JPEG is left as it was ---
+  int scale = 1;
+  bool resize = false;
+  uint8_t orientation = 1;
+  if (openJpegSource(work->decoder, work->source, drivePath, drawCallback) &&
+      work->decoder.getJPEGType() == JPEG_MODE_BASELINE) {
+    int tag = work->decoder.getOrientation();
+    orientation = tag >= 1 && tag <= 8 ? tag : 1;
+    resize = setupResize(work->decoder.getWidth(), work->decoder.getHeight(), orientation, scale);
+  }
+
+  Outcome outcome = resize ? INGEST_FAILED : INGEST_SKIPPED;
+  if (resize && allocateBuffers()) {
+    bool opened = openJpegTarget(work->encoder, work->target, convertedPath, orientation);
+    bool encoded = opened;
+    if (encoded) {
+      encoded = work->encoder.encodeBegin(&work->encodeState, outWidth, outHeight, JPEGE_PIXEL_RGB565,
+                                          JPEGE_SUBSAMPLE_420, jpegEncoderQuality(settings.quality)) == JPEGE_SUCCESS;
+      if (encoded) {
+        static const int scaleOptions[] = {0, 0, JPEG_SCALE_HALF, 0, JPEG_SCALE_QUARTER, 0, 0, 0, JPEG_SCALE_EIGHTH};
+        work->decoder.setPixelType(RGB565_LITTLE_ENDIAN);
+        work->decoder.setUserPointer(this);
+        encoded = work->decoder.decode(0, 0, scaleOptions[scale]) == 1 && finishRows(sourceHeight);
+      }
+      // --- close() writes out whatever the encoder still buffers ---
+      encoded = work->encoder.close() > 0 && encoded;
+    }
+
+    uint32_t newSize = 0;
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    if (opened && finishJpegTarget(work->target, encoded)) {
+      if (replaceOriginal(job, original, newSize)) {
+        outcome = INGEST_CONVERTED;
+        // --- Whoever asks for the upload's hash is pointed at the copy that replaced it ---
+        if (job.hashed) {
+          contentIndex.record(job.path, job.sha256);
+        }
+      } else {
+        outcome = INGEST_SKIPPED;
+      }
+    }
+    xSemaphoreGive(fatMutex);
+
+    if (outcome == INGEST_CONVERTED) {
+      counters.bytesIn += original.fsize;
+      counters.bytesOut += newSize;
+      fileIndex.fileStored(true, original.fsize, newSize);
+      deviceStatus.requestRefresh();
+    }
+  }
+
+  work->decoder.close();
+  releaseBuffers();
+  delete work;
+  work = nullptr;
+  return outcome;
+}
+
+void ImageIngest::taskEntry(void* arg) {
+  static_cast<ImageIngest*>(arg)->runTask();
+}
+
+/**
+ * @brief Ingest task: converts queued uploads one at a time.
+ */
+void ImageIngest::runTask() {
+  Job job;
+  for (;;) {
+    if (xQueueReceive(queue, &job, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    busy = true;
+    uint32_t start = millis();
+    Outcome outcome = convert(job);
+    uint32_t elapsed = millis() - start;
+    switch (outcome) {
+      case INGEST_CONVERTED:
+        counters.converted++;
+        counters.busyMs += elapsed;
+        counters.lastMs = elapsed;
+        break;
+      case INGEST_SKIPPED: counters.skipped++; break;
+      case INGEST_FAILED: counters.failed++; break;
+    }
+    busy = false;
+  }
+}
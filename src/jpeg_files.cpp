@@ -0,0 +1,226 @@
+/******************************************************************************
+ *
+ * FrameFi - JPEG Files
+ * ----------------
+ * File callbacks for the JPEG decoder and encoder that share the card with
+ * transfers, holding the FAT lock one read or write at a time.
+ *
+ *****************************************************************************/
+
+#include "jpeg_files.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include "esp_heap_caps.h"
+#include "storage.h"
+
+// --- Decoder file callbacks ---
+
+static void* openSource(const char* path, int32_t* size) {
+  JpegSource* source = reinterpret_cast<JpegSource*>(const_cast<char*>(path));
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  source->open = storage.fatOwnsCard() && f_open(&source->file, source->path, FA_READ) == FR_OK;
+  if (source->open) {
+    *size = f_size(&source->file);
+  }
+  xSemaphoreGive(fatMutex);
+  return source->open ? source : nullptr;
+}
+
+static void closeSource(void* handle) {
+  JpegSource* source = (JpegSource*)handle;
+  if (!source || !source->open) {
+    return;
+  }
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  if (storage.fatOwnsCard()) {
+    f_close(&source->file);
+  }
+  source->open = false;
+  xSemaphoreGive(fatMutex);
+}
+
+static int32_t readSource(JPEGFILE* handle, uint8_t* buffer, int32_t length) {
+  JpegSource* source = (JpegSource*)handle->fHandle;
+  UINT count = 0;
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  if (!storage.fatOwnsCard() || f_read(&source->file, buffer, length, &count) != FR_OK) {
+    count = 0;
+  }
+  xSemaphoreGive(fatMutex);
+  handle->iPos += count;
+  return count;
+}
+
+static int32_t seekSource(JPEGFILE* handle, int32_t position) {
+  JpegSource* source = (JpegSource*)handle->fHandle;
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool ok = storage.fatOwnsCard() && f_lseek(&source->file, position) == FR_OK;
+  xSemaphoreGive(fatMutex);
+  if (!ok) {
+    return -1;
+  }
+  handle->iPos = position;
+  return position;
+}
+
+// --- Encoder file callbacks; output goes through the target's upload writer ---
+
+static void* openTarget(const char* path) {
+  return reinterpret_cast<JpegTarget*>(const_cast<char*>(path));
+}
+
+static void closeTarget(JPEGE_FILE* handle) {}
+
+static int32_t readTarget(JPEGE_FILE* handle, uint8_t* buffer, int32_t length) {
+  return 0;
+}
+
+static int32_t seekTarget(JPEGE_FILE* handle, int32_t position) {
+  return -1;
+}
+
+/**
+ * @brief Appends bytes to the target. Returns false if the card refused them.
+ */
+static bool writeTargetBytes(JpegTarget* target, const uint8_t* data, size_t length) {
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool ok = storage.fatOwnsCard() && target->writer.write(data, length) == FR_OK;
+  xSemaphoreGive(fatMutex);
+  return ok;
+}
+
+static int32_t writeTarget(JPEGE_FILE* handle, uint8_t* buffer, int32_t length) {
+  JpegTarget* target = (JpegTarget*)handle->fHandle;
+  if (target->failed) {
+    return 0;
+  }
+  int32_t head = 0;
+  if (!target->started) {
+    target->started = true;
+    // --- A minimal EXIF block after SOI and the JFIF APP0 segment, holding only the orientation ---
+    if (target->orientation > 1 && length >= 6) {
+      head = 2;
+      if (buffer[2] == 0xFF && buffer[3] == 0xE0) {
+        head += 2 + ((buffer[4] << 8) | buffer[5]);
+      }
+      if (head > length) {
+        head = length;
+      }
+      const uint8_t exif[] = {
+        0xFF, 0xE1, 0x00, 0x22, 'E', 'x', 'i', 'f', 0x00, 0x00,
+        'M', 'M', 0x00, 0x2A, 0x00, 0x00, 0x00, 0x08,  // Big-endian TIFF header, IFD at 8
+        0x00, 0x01,                                    // One entry
+        0x01, 0x12, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01,  // Orientation, SHORT, count 1
+        0x00, target->orientation, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00,                        // No next IFD
+      };
+      target->failed = !writeTargetBytes(target, buffer, head) || !writeTargetBytes(target, exif, sizeof(exif));
+    }
+  }
+  if (!target->failed && length > head) {
+    target->failed = !writeTargetBytes(target, buffer + head, length - head);
+  }
+  return target->failed ? 0 : length;
+}
+
+/**
+ * @brief Returns true for paths ending in .jpg or .jpeg.
+ */
+bool isJpegPath(const char* path) {
+  const char* dot = strrchr(path, '.');
+  return dot && !strchr(dot, '/') && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+/**
+ * @brief Opens the JPEG at drivePath for decoding. Returns false if it cannot be read.
+ */
+bool openJpegSource(JPEGDEC& decoder, JpegSource& source, const char* drivePath, JPEG_DRAW_CALLBACK* draw) {
+  if (strlen(drivePath) >= sizeof(source.path)) {
+    return false;
+  }
+  strcpy(source.path, drivePath);
+  source.open = false;
+  return decoder.open(source.path, openSource, closeSource, readSource, seekSource, draw) != 0;
+}
+
+/**
+ * @brief Starts a new file at path and opens the encoder on it. Returns false if the card refused it.
+ */
+bool openJpegTarget(JPEGENC& encoder, JpegTarget& target, const char* path, uint8_t orientation) {
+  if (strlen(path) >= sizeof(target.path)) {
+    return false;
+  }
+  strcpy(target.path, path);
+  target.orientation = orientation;
+  target.started = false;
+  target.failed = false;
+
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool opened = storage.fatOwnsCard() && target.writer.begin(target.path, 0) == FR_OK;
+  xSemaphoreGive(fatMutex);
+  if (!opened) {
+    return false;
+  }
+  if (encoder.open(target.path, openTarget, closeTarget, readTarget, writeTarget, seekTarget) != JPEGE_SUCCESS) {
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    if (storage.fatOwnsCard()) {
+      target.writer.abort();
+    }
+    xSemaphoreGive(fatMutex);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Renames a complete target over its path, or deletes it. Call with the FAT lock held.
+ */
+bool finishJpegTarget(JpegTarget& target, bool complete) {
+  if (!target.writer.isOpen() || !storage.fatOwnsCard()) {
+    return false;
+  }
+  if (!complete || target.failed) {
+    target.writer.abort();
+    return false;
+  }
+  // --- commit() removes the partial file itself if it fails ---
+  return target.writer.commit() == FR_OK;
+}
+
+/**
+ * @brief Creates every missing parent directory of drivePath, a path that includes the drive.
+ */
+void makeParentDirectories(char* drivePath) {
+  char* start = drivePath + strlen(STORAGE_FAT_DRIVE) + 1;
+  for (char* slash = strchr(start, '/'); slash; slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    f_mkdir(drivePath);
+    *slash = '/';
+  }
+}
+
+/**
+ * @brief Maps a 1-100 quality onto the encoder's four levels.
+ */
+uint8_t jpegEncoderQuality(uint8_t quality) {
+  if (quality >= 90) {
+    return JPEGE_Q_BEST;
+  }
+  if (quality >= 75) {
+    return JPEGE_Q_HIGH;
+  }
+  if (quality >= 50) {
+    return JPEGE_Q_MED;
+  }
+  return JPEGE_Q_LOW;
+}
+
+/**
+ * @brief Allocates a pixel buffer, from PSRAM when the board has it.
+ */
+void* allocatePixelBuffer(size_t size) {
+  void* buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+  return buffer ? buffer : heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
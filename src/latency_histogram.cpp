@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ * FrameFi - Latency Histogram
+ * ----------------
+ * Power-of-two latency buckets for the diagnostics endpoint.
+ *
+ *****************************************************************************/
+
+#include "latency_histogram.h"
+
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram() : buckets{}, samples(0), longest(0) {}
+
+/**
+ * @brief Adds one sample.
+ */
+void LatencyHistogram::record(uint32_t micros) {
+  uint8_t bucket = 0;
+  uint32_t limit = LATENCY_FIRST_BUCKET_US;
+  while (bucket < LATENCY_BUCKETS - 1 && micros >= limit) {
+    bucket++;
+    limit <<= 1;
+  }
+  buckets[bucket]++;
+  samples++;
+  if (micros > longest) {
+    longest = micros;
+  }
+}
+
+/**
+ * @brief Clears all samples.
+ */
+void LatencyHistogram::reset() {
+  memset(buckets, 0, sizeof(buckets));
+  samples = 0;
+  longest = 0;
+}
+
+/**
+ * @brief Returns the exclusive upper bound of a bucket, or 0 for the open-ended last one.
+ */
+uint32_t LatencyHistogram::bucketLimit(uint8_t bucket) {
+  if (bucket >= LATENCY_BUCKETS - 1) {
+    return 0;
+  }
+  return (uint32_t)LATENCY_FIRST_BUCKET_US << bucket;
+}
+
+/**
+ * @brief Returns the upper bound of the bucket holding the given percentile.
+ */
+uint32_t LatencyHistogram::percentile(uint8_t percent) const {
+  if (samples == 0) {
+    return 0;
+  }
+  uint32_t target = ((uint64_t)samples * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= target) {
+      uint32_t limit = bucketLimit(i);
+      return limit == 0 || limit > longest ? longest : limit;
+    }
+  }
+  return longest;
+}
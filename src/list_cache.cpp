@@ -0,0 +1,236 @@
+/******************************************************************************
+ *
+ * FrameFi - List Cache
+ * ----------------
+ * Stored LIST and MLSD output of large directories, served again while
+ * nothing on the card has changed.
+ *
+ *****************************************************************************/
+
+#include "list_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "file_index.h"
+
+ListCache listCache;
+
+ListCache::ListCache() : table{}, sessions{}, useCounter(0), counters{0, 0, 0, 0} {
+  for (uint8_t i = 0; i < FTP_MAX_SESSIONS; i++) {
+    sessions[i].entry = -1;
+  }
+}
+
+/**
+ * @brief Writes the drive path of an entry's file.
+ */
+void ListCache::filePath(int8_t entry, char* out, size_t size) const {
+  snprintf(out, size, STORAGE_FAT_DRIVE LIST_CACHE_DIR "/%d.lst", entry);
+}
+
+/**
+ * @brief Returns the entry holding a listing of path, or -1.
+ */
+int8_t ListCache::find(char kind, const char* path) const {
+  for (uint8_t i = 0; i < LIST_CACHE_ENTRIES; i++) {
+    if (table[i].state != ENTRY_EMPTY && table[i].kind == kind && strcmp(table[i].path, path) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Picks an entry to store a listing of path in: its old copy, a free one or the least recently used.
+ */
+int8_t ListCache::claim(char kind, const char* path) {
+  int8_t chosen = find(kind, path);
+  if (chosen >= 0 && (table[chosen].state == ENTRY_WRITING || table[chosen].readers > 0)) {
+    // --- Another session is storing or sending this directory ---
+    return -1;
+  }
+  for (uint8_t i = 0; chosen < 0 && i < LIST_CACHE_ENTRIES; i++) {
+    if (table[i].state == ENTRY_EMPTY) {
+      chosen = i;
+    }
+  }
+  if (chosen < 0) {
+    for (uint8_t i = 0; i < LIST_CACHE_ENTRIES; i++) {
+      if (table[i].state == ENTRY_VALID && table[i].readers == 0 &&
+          (chosen < 0 || table[i].lastUsed < table[chosen].lastUsed)) {
+        chosen = i;
+      }
+    }
+    if (chosen < 0) {
+      return -1;
+    }
+    counters.evictions++;
+  }
+  Entry& entry = table[chosen];
+  entry.state = ENTRY_WRITING;
+  entry.kind = kind;
+  entry.readers = 0;
+  entry.entries = 0;
+  entry.lastUsed = ++useCounter;
+  strcpy(entry.path, path);
+  return chosen;
+}
+
+/**
+ * @brief Closes whatever a session has open and forgets its listing.
+ */
+void ListCache::release(uint8_t session) {
+  Session& state = sessions[session];
+  if (state.file) {
+    f_close(state.file);
+    delete state.file;
+    state.file = nullptr;
+  }
+  if (state.entry >= 0) {
+    Entry& entry = table[state.entry];
+    if (state.reading && entry.readers > 0) {
+      entry.readers--;
+    } else if (state.writing && entry.state == ENTRY_WRITING) {
+      // --- A copy that was not finished is never served ---
+      entry.state = ENTRY_EMPTY;
+    }
+  }
+  state.entry = -1;
+  state.reading = false;
+  state.writing = false;
+  state.failed = false;
+}
+
+/**
+ * @brief Starts a listing. Returns true if a stored copy is current and will be read.
+ */
+bool ListCache::open(uint8_t session, char kind, const char* path, uint16_t* entries) {
+  if (session >= FTP_MAX_SESSIONS) {
+    return false;
+  }
+  release(session);
+  if (!storage.fatOwnsCard()) {
+    return false;
+  }
+  Session& state = sessions[session];
+  uint32_t generation = fileIndex.generation();
+
+  int8_t found = find(kind, path);
+  if (found >= 0 && table[found].state == ENTRY_VALID) {
+    Entry& entry = table[found];
+    if (entry.generation == generation) {
+      char drivePath[48];
+      filePath(found, drivePath, sizeof(drivePath));
+      state.file = new FIL;
+      if (f_open(state.file, drivePath, FA_READ) == FR_OK) {
+        entry.readers++;
+        entry.lastUsed = ++useCounter;
+        state.entry = found;
+        state.reading = true;
+        *entries = entry.entries;
+        counters.hits++;
+        return true;
+      }
+      delete state.file;
+      state.file = nullptr;
+    }
+    // --- Out of date or unreadable; the walk below replaces it ---
+    if (entry.readers == 0) {
+      entry.state = ENTRY_EMPTY;
+    }
+  }
+
+  // --- The file is only created once the walk shows the directory is worth storing ---
+  counters.misses++;
+  state.writing = true;
+  state.kind = kind;
+  state.generation = generation;
+  strncpy(state.path, path, sizeof(state.path) - 1);
+  state.path[sizeof(state.path) - 1] = '\0';
+  return false;
+}
+
+/**
+ * @brief Reads the next part of a stored listing. Returns 0 at its end and -1 on an error.
+ */
+int32_t ListCache::read(uint8_t session, uint8_t* buf, uint32_t size) {
+  if (session >= FTP_MAX_SESSIONS || !sessions[session].reading || !sessions[session].file) {
+    return -1;
+  }
+  UINT read = 0;
+  if (!storage.fatOwnsCard() || f_read(sessions[session].file, buf, size, &read) != FR_OK) {
+    return -1;
+  }
+  return read;
+}
+
+/**
+ * @brief Stores the next part of a listing that is being walked.
+ */
+void ListCache::append(uint8_t session, const uint8_t* data, uint32_t size, uint16_t entries) {
+  if (session >= FTP_MAX_SESSIONS) {
+    return;
+  }
+  Session& state = sessions[session];
+  if (!state.writing || state.failed) {
+    return;
+  }
+  // --- Anything changed on the card makes this walk out of date before it is stored ---
+  if (fileIndex.generation() != state.generation || !storage.fatOwnsCard()) {
+    state.failed = true;
+    return;
+  }
+
+  if (state.entry < 0) {
+    // --- The first part is a full buffer, or the whole listing of a small directory ---
+    if (entries < LIST_CACHE_MIN_ENTRIES) {
+      state.failed = true;
+      return;
+    }
+    state.entry = claim(state.kind, state.path);
+    if (state.entry < 0) {
+      state.failed = true;
+      return;
+    }
+    char drivePath[48];
+    filePath(state.entry, drivePath, sizeof(drivePath));
+    f_mkdir(STORAGE_FAT_DRIVE STORAGE_DATA_DIR);
+    f_mkdir(STORAGE_FAT_DRIVE LIST_CACHE_DIR);
+    state.file = new FIL;
+    if (f_open(state.file, drivePath, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+      delete state.file;
+      state.file = nullptr;
+      state.failed = true;
+      return;
+    }
+  }
+
+  UINT written = 0;
+  if (f_write(state.file, data, size, &written) != FR_OK || written != size) {
+    state.failed = true;
+  }
+}
+
+/**
+ * @brief Ends a listing; a complete walk becomes the stored copy.
+ */
+void ListCache::close(uint8_t session, bool complete, uint16_t entries) {
+  if (session >= FTP_MAX_SESSIONS) {
+    return;
+  }
+  Session& state = sessions[session];
+  if (state.writing && state.entry >= 0 && state.file) {
+    bool closed = f_close(state.file) == FR_OK;
+    delete state.file;
+    state.file = nullptr;
+    Entry& entry = table[state.entry];
+    if (closed && complete && !state.failed && fileIndex.generation() == state.generation) {
+      entry.state = ENTRY_VALID;
+      entry.entries = entries;
+      entry.generation = state.generation;
+      counters.stored++;
+    }
+  }
+  release(session);
+}
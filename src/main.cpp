@@ -12,12 +12,11 @@
 #include "Arduino.h"
 #include <WiFi.h>
 #include <WiFiManager.h> // https://github.com/tzapu/WiFiManager
-#include <WebServer.h>
+#include <ESPAsyncWebServer.h> // https://github.com/ESP32Async/ESPAsyncWebServer
 #undef FF_MAX_LFN
 #include <SimpleFTPServer.h>
 #include <SPI.h>
 #include <SD.h>
-#include <SD_MMC.h>
 #include "USB.h"
 #include "USBMSC.h"
 #include "driver/sdmmc_host.h"
@@ -29,6 +28,25 @@
 // --- Personal header files ---
 #include "secrets.h" // Import sensitive data
 #include "catppuccin_colors.h" // Include our custom color palette
+#include "sector_cache.h" // Write-back cache for the MSC path
+#include "read_ahead.h" // Sequential prefetch for the MSC path
+#include "mqtt_publisher.h" // Change-only MQTT status attributes
+#include "ui_output.h" // LED and display output off the hot path
+#include "transfer_tracker.h" // Progress and throughput of running transfers
+#include "list_cache.h" // Stored FTP listings of large directories
+#include "file_index.h" // Cached file count for status calls
+#include "storage.h" // Shared card initialization and FAT mount
+#include "device_status.h" // Shared status snapshot
+#include "latency_histogram.h" // Response time diagnostics
+#include "http_files.h" // Range and ETag handling for file downloads
+#include "upload_writer.h" // Preallocated, block-buffered uploads
+#include "manifest.h" // File listing for sync clients
+#include "file_batch.h" // Batch delete, rename and mkdir jobs
+#include "content_index.h" // SHA-256 lookup of uploaded files
+#include "image_ingest.h" // Downscaling of uploaded JPEGs
+#include "thumbnail_cache.h" // Gallery thumbnails built in the background
+#include "free_space.h" // Free space without FAT walks
+#include "status_screen.h" // Mode screen redrawn a widget at a time
 
 // --- External libraries ---
 #include <OneButton.h> // https://github.com/ck Conrad/esp32-onebutton
@@ -38,35 +56,6 @@
 #include "TFT_eSPI.h" // https://github.com/Bodmer/TFT_eSPI
 #include <Preferences.h> // https://github.com/vshymanskyy/Preferences
 
-// --- Data Structure for Device Information ---
-struct DeviceInfo {
-  // Mode and Display
-  const char* modeString;
-  bool isInMscMode;
-  const char* displayStatus;
-  bool isDisplayOn;
-  int displayOrientation;
-
-  // Network
-  char ipAddress[16];
-  char macAddress[18];
-
-  // SD Card
-  int fileCount;
-  uint64_t totalSize;
-  uint64_t usedSize;
-  uint64_t freeSize;
-
-  // MQTT
-  int mqttState;
-  bool mqttConnected;
-  bool isMqttEnabled;
-
-  // LED
-  const char* ledColor;
-  int ledBrightness;
-};
-
 // --- FTP Configuration ---
 struct FtpConfig {
   char user[32];
@@ -98,19 +87,18 @@ namespace Mode {
 }
  
 // --- Create objects ---
-WebServer server(80);
+AsyncWebServer server(80);
 OneButton button(BTN_PIN, true); // true for active low
 FtpServer ftpServer;
 CRGB leds[NUM_LEDS];
 USBMSC MSC;
 USBCDC USBSerial;
-File uploadFile;
 TFT_eSPI tft = TFT_eSPI();
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
 
 #define HWSerial    Serial0
-#define MOUNT_POINT "/sdcard"
+#define MOUNT_POINT STORAGE_MOUNT_POINT
  sdmmc_card_t *card;
 
 bool shouldSaveConfig = false;
@@ -122,12 +110,51 @@ FtpConfig ftpConfig;
 WebServerConfig webServerConfig;
 MqttConfig mqttConfig;
 
-// --- Mode Switching Flags ---
-volatile bool pendingModeSwitch = false;
-volatile bool targetMscMode = false;
+// --- Tasks ---
+#ifndef NETWORK_TASK_CORE
+  #define NETWORK_TASK_CORE 1 // HTTP, FTP and MQTT
+#endif
+#ifndef STORAGE_TASK_CORE
+  #define STORAGE_TASK_CORE 0 // Mode switches and MSC cache write-back
+#endif
+#ifndef UI_TASK_CORE
+  #define UI_TASK_CORE 0 // Button and display
+#endif
+#ifndef STORAGE_TASK_POLL_MS
+  #define STORAGE_TASK_POLL_MS 100
+#endif
+#ifndef UI_TASK_PERIOD_MS
+  #define UI_TASK_PERIOD_MS 10
+#endif
+
+// --- Requests posted to the storage task ---
+enum StorageCommand : uint8_t {
+  STORAGE_ENTER_MSC,
+  STORAGE_ENTER_FTP,
+  STORAGE_TOGGLE_MODE,
+  STORAGE_RUN_BATCH,
+};
+
+// --- Screens drawn by the UI output task ---
+enum UiCommand : uint8_t {
+  UI_SHOW_ENTERING_FTP,
+  UI_SHOW_RESETTING_WIFI,
+  UI_SHOW_STATUS,  // The mode screen again, e.g. after a switch that failed
+};
+
+QueueHandle_t storageQueue = NULL;
+TaskHandle_t networkTaskHandle = NULL;
+TaskHandle_t storageTaskHandle = NULL;
+TaskHandle_t uiTaskHandle = NULL;
+
+// --- Diagnostics ---
+LatencyHistogram httpLatency;        // Time spent answering each HTTP request
+LatencyHistogram networkLoopLatency; // Time of one pass of the network task
+LatencyHistogram displayRenderLatency; // Time to bring the mode screen up to date
 
 // --- A flag to track the current mode ---
 bool isInMscMode = true;
+uint32_t modeSwitchMs = 0; // How long the last mode switch took
 bool isDisplayOn = true; // A flag to track the display status
 #if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
 bool isMqttEnabled = true; // A flag to track the MQTT status
@@ -135,21 +162,39 @@ bool isMqttEnabled = true; // A flag to track the MQTT status
 bool isMqttEnabled = false;
 #endif
 
+// --- Last FTP store, handed to the ingest stage by the file callback ---
+bool ftpUploadComplete = false;
+int8_t ftpTransferSlots[FTP_MAX_SESSIONS]; // Transfer tracker slot of each FTP session, or -1
+bool ftpSessionUploading[FTP_MAX_SESSIONS];  // Whether the running transfer of each FTP session is a store
+char ftpHashedPath[FF_MAX_LFN + 1] = "";
+uint8_t ftpHashedSha256[CONTENT_HASH_SIZE];
+
 // --- MSC screen refresh tracking ---
 volatile bool msc_disk_dirty = false;
 volatile unsigned long last_msc_write_time = 0;
 const unsigned long MSC_REFRESH_DEBOUNCE_MS = 2000; // 2 seconds
 
+// --- MSC sector cache ---
+SectorCache mscCache;
+SemaphoreHandle_t mscCacheMutex = NULL;
+uint8_t* mscCacheSlots = NULL;
+uint8_t* mscCacheStaging = NULL;
+uint16_t mscCacheSlotCount = 0;
+
+// --- MSC read-ahead ---
+ReadAhead mscReadAhead;
+uint8_t* mscReadAheadBuffers = NULL;
+uint8_t mscReadAheadBufferCount = 0;
+
 // --- MQTT Topics ---
+// --- Status attributes are published by mqttPublisher under MQTT_TOPIC_PREFIX ---
 namespace MqttTopics {
-  const char* STATE = "frame-fi/state";
-  const char* DISPLAY_STATUS = "frame-fi/display/status";
   const char* DISPLAY_SET = "frame-fi/display/set";
+  const char* BATCH_PROGRESS = "frame-fi/batch/progress";
+  const char* TRANSFER = "frame-fi/transfer";
 }
 
 // --- Timers ---
-unsigned long lastMqttPublish = 0;
-const long mqttPublishInterval = 300000; // 5 minutes
 // Timer variables for non-blocking reconnection
 unsigned long lastReconnectAttempt = 0;
 const long reconnectInterval = 5000; // Interval to wait between retries (5 seconds)
@@ -172,49 +217,74 @@ void setupApiRoutes();
 void setupSerial();
 void enterMscMode();
 bool enterFtpMode();
-void handleStatus();
-void handleRestart();
-void handleDisplayAction(const char* action);
+void handleStatus(AsyncWebServerRequest* request);
+void handleRestart(AsyncWebServerRequest* request);
+void handleDisplayAction(AsyncWebServerRequest* request, const char* action);
 void setDisplayState(bool on);
-void handleWifiReset();
-void handleMqttAction(const char* action);
+void handleWifiReset(AsyncWebServerRequest* request);
+void handleMqttAction(AsyncWebServerRequest* request, const char* action);
 void manageMqttState(const char* state);
-void sendJsonResponse(const char* status, const char* message);
-void handleLedStatus();
-void handleLedAction(const char* action);
-void handleLedBrightness();
+void sendJsonResponse(AsyncWebServerRequest* request, const char* status, const char* message);
+void handleLedStatus(AsyncWebServerRequest* request);
+void handleLedAction(AsyncWebServerRequest* request, const char* action);
+void handleLedBrightness(AsyncWebServerRequest* request);
 void setLedState(const char* state);
-void handleUpload();
-void handleUploadData();
-void handleGetMode();
-void handleDisplayStatus();
-void handleMqttStatus();
-void handleLedBrightnessGet();
+void handleUpload(AsyncWebServerRequest* request);
+void handleUploadData(AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data, size_t len, bool final);
+void finishUploadFile(AsyncWebServerRequest* request, bool complete);
+void handleFileDownload(AsyncWebServerRequest* request);
+void sendCardFile(AsyncWebServerRequest* request, const String& path, const char* cacheControl = "no-cache");
+void handleManifest(AsyncWebServerRequest* request);
+void handleThumbnail(AsyncWebServerRequest* request);
+void handleFileBatch(AsyncWebServerRequest* request);
+void handleFileBatchBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total);
+void handleFileBatchStatus(AsyncWebServerRequest* request);
+void handleTransfers(AsyncWebServerRequest* request);
+void handleFileByHash(AsyncWebServerRequest* request);
+void handleIngestStatus(AsyncWebServerRequest* request);
+void handleIngestConfig(AsyncWebServerRequest* request);
+void handleIngestConfigBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total);
+void handleLedBrightnessBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total);
+void handleGetMode(AsyncWebServerRequest* request);
+void handleDisplayStatus(AsyncWebServerRequest* request);
+void handleMqttStatus(AsyncWebServerRequest* request);
+void handleLedBrightnessGet(AsyncWebServerRequest* request);
 void toggleMode();
 void resetWifiSettings();
 void mscInit();
+void mscCacheInit();
+void mscCacheFlush();
 void sdInit();
-void handleSwitchToMsc();
-void handleSwitchToFtp();
-void ftpTransferCallback(FtpTransferOperation ftpOperation, const char* name, unsigned int transferredSize);
+void handleSwitchToMsc(AsyncWebServerRequest* request);
+void handleSwitchToFtp(AsyncWebServerRequest* request);
+void ftpTransferCallback(uint8_t session, FtpTransferOperation ftpOperation, uint32_t transferredSize, uint32_t size);
 static int32_t onWrite(uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize);
 static int32_t onRead(uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize);
 static bool onStartStop(uint8_t power_condition, bool start, bool load_eject);
+static bool readAllocationSectors(void* context, uint32_t lba, uint32_t count, uint8_t* dst);
 static void usbEventCallback(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 void drawHeader(const char* title, uint16_t bannerColor);
-void drawStorageInfo(int files, int totalSizeMB, float freeSizeMB);
 void drawInfoScreen(const char* title, const char* message, const char* version, uint16_t headerColor);
 void drawApModeScreen(const char* ap_ssid, const char* ap_ip);
-void drawModeScreen(const char* mode, uint16_t headerColor, const char* ip, const char* mac, int files, int totalSizeMB, float freeSizeMB, bool mqttConnected);
-void drawUsbMscModeScreen(const char* ip, const char* mac, int files, int totalSizeMB, float freeSizeMB, bool mqttConnected);
-void drawFtpModeScreen(const char* ip, const char* mac, int files, int totalSizeMB, float freeSizeMB, bool mqttConnected);
-void drawMqttStatusIcon(bool mqttConnected, int x, int y);
-int countFiles(File dir);
-int countFilesInPath(const char *path);
+uint32_t getIndexedFileCount();
+void ftpFileCallback(FtpFileOperation fileOperation, const char* path, uint32_t oldSize, uint32_t newSize);
+void ftpStoreHashCallback(const char* path, const uint8_t* sha256);
 void updateAndDrawMscScreen();
 void updateDisplayAndMqtt();
+void drawStatusChanges();
+void publishStatusChanges();
+void publishBatchProgress();
+void publishTransferProgress();
+void addTransferJson(JsonObject target, const TransferStatus& transfer);
+void startTasks();
+void networkTask(void* arg);
+void storageTask(void* arg);
+void uiTask(void* arg);
+void showUiScreen(uint8_t screen);
+void requestModeSwitch(StorageCommand command);
+void handleDiagnostics(AsyncWebServerRequest* request);
 void setupMqtt();
-void publishMqttStatus();
+bool sendMqttMessage(const char* topic, const char* payload, bool retain);
 void callback(char *topic, byte *payload, unsigned int length);
 void reconnect();
 void saveConfigCallback();
@@ -243,15 +313,25 @@ void setup() {
     saveConfig();
   }
 
-  setupWebServer();
-  
 #if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
   setupMqtt();
   reconnect(); // Attempt initial MQTT connection
 #endif
 
+  // --- No transfers yet ---
+  transferTracker.begin();
+  memset(ftpTransferSlots, -1, sizeof(ftpTransferSlots));
+
   // --- Start in initial mode ---
   startInitialMode();
+
+  // --- Start refreshing the status snapshot in the background ---
+  deviceStatus.begin(getDeviceInfo);
+
+  // --- The async server answers at once, so only start it once storage and status are ready ---
+  setupWebServer();
+
+  startTasks();
 }
 
 /**
@@ -314,8 +394,6 @@ void initializeConfigs() {
  * @brief Initializes the LED.
  */
 void setupLed() {
-  // --- Initialize the LED pin as an output ---
-  FastLED.addLeds<APA102, LED_DI_PIN, LED_CI_PIN, BGR>(leds, NUM_LEDS);
 #if defined(LED_BRIGHTNESS)
   ledBrightness = LED_BRIGHTNESS;
 #else
@@ -324,7 +402,9 @@ void setupLed() {
   FastLED.setBrightness(ledBrightness);
   // --- Turn the LED on ---
   leds[0] = CRGB::Yellow;
-  FastLED.show();
+  // --- From here on the LED is only driven by the UI output task ---
+  uiOutput.begin(leds, NUM_LEDS);
+  showLeds();
 }
 
 /**
@@ -347,6 +427,9 @@ void setupDisplay() {
   tft.init();
   tft.setRotation(DISPLAY_ORIENTATION); // Adjust rotation as needed
   tft.fillScreen(CATPPUCCIN_BASE);
+  if (!statusScreen.begin(tft)) {
+    HWSerial.println("❌ Not enough memory for the status screen.");
+  }
   setDisplayState(isDisplayOn);
 #else
   digitalWrite(TFT_LEDA, HIGH);
@@ -385,7 +468,9 @@ void startInitialMode() {
   if (card) {
     // --- Turn the LED on ---
     leds[0] = CRGB::Green;
-    FastLED.show();
+    showLeds();
+    // --- USB MSC stays up for the whole uptime; mode switches only toggle media presence ---
+    storage.releaseToHost();
     USB.onEvent(usbEventCallback);
     mscInit();
     USBSerial.begin();
@@ -403,25 +488,125 @@ void startInitialMode() {
 
 
 /**
- * @brief Main loop that runs repeatedly.
+ * @brief Main loop. Unused; the work is split across the tasks started by setup().
  */
 void loop() {
-  server.handleClient();
-  handleButton();
-
-  // --- Handle pending mode switch from API calls ---
-  if (pendingModeSwitch) {
-    pendingModeSwitch = false; // Reset the flag immediately
-    if (targetMscMode) {
-      enterMscMode();
-    } else {
-      enterFtpMode();
+  vTaskDelete(NULL);
+}
+
+// --- Tasks ---
+
+/**
+ * @brief Creates the queues and the network, storage and UI tasks.
+ */
+void startTasks() {
+  storageQueue = xQueueCreate(4, sizeof(StorageCommand));
+
+  xTaskCreatePinnedToCore(networkTask, "network", 8192, NULL, 2, &networkTaskHandle, NETWORK_TASK_CORE);
+  xTaskCreatePinnedToCore(storageTask, "storage", 6144, NULL, 3, &storageTaskHandle, STORAGE_TASK_CORE);
+  xTaskCreatePinnedToCore(uiTask, "ui", 4096, NULL, 1, &uiTaskHandle, UI_TASK_CORE);
+  // --- Setup is done drawing; the display now belongs to the UI output task ---
+  uiOutput.attachScreen(showUiScreen, drawStatusChanges);
+  manifest.begin();
+#if IMAGE_INGEST_ENABLED
+  imageIngest.begin();
+#endif
+#if THUMBNAILS_ENABLED
+  thumbnailCache.begin();
+#endif
+  HWSerial.println("Tasks started.");
+}
+
+/**
+ * @brief Network task: FTP and MQTT. HTTP is served by the async server's own task.
+ */
+void networkTask(void* arg) {
+  for (;;) {
+    uint32_t start = micros();
+
+    // --- FTP uses the FAT layer, which the storage task may be handing over ---
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    handleFtp();
+    xSemaphoreGive(fatMutex);
+
+    handleMqtt();
+    publishStatusChanges();
+    publishBatchProgress();
+    publishTransferProgress();
+
+    networkLoopLatency.record(micros() - start);
+    vTaskDelay(1);
+  }
+}
+
+/**
+ * @brief Storage task: mode switches, batch file jobs and MSC cache write-back.
+ */
+void storageTask(void* arg) {
+  StorageCommand command;
+  for (;;) {
+    // --- While a batch runs, wait one tick between steps so lower priority tasks on this core get a turn ---
+    TickType_t wait = fileBatch.isRunning() ? 1 : pdMS_TO_TICKS(STORAGE_TASK_POLL_MS);
+    if (xQueueReceive(storageQueue, &command, wait) == pdTRUE && command != STORAGE_RUN_BATCH) {
+      bool toMsc = command == STORAGE_ENTER_MSC || (command == STORAGE_TOGGLE_MODE && !isInMscMode);
+      xSemaphoreTake(fatMutex, portMAX_DELAY);
+      if (toMsc) {
+        enterMscMode();
+      } else {
+        enterFtpMode();
+      }
+      xSemaphoreGive(fatMutex);
+    }
+    if (fileBatch.isRunning()) {
+      fileBatch.runStep();
+      if (!fileBatch.isRunning()) {
+        deviceStatus.requestRefresh();
+      }
     }
+    handleMsc();
+  }
+}
+
+/**
+ * @brief UI task: polls the button. Drawing is left to the UI output task.
+ */
+void uiTask(void* arg) {
+  for (;;) {
+    handleButton();
+    vTaskDelay(pdMS_TO_TICKS(UI_TASK_PERIOD_MS));
+  }
+}
+
+// --- Set when the mode screen must be redrawn although the status did not change; UI task only ---
+bool statusScreenStale = false;
+
+/**
+ * @brief Draws a screen posted with uiOutput.showScreen(). Runs on the UI output task.
+ */
+void showUiScreen(uint8_t screen) {
+#if defined(LCD_ENABLED) && LCD_ENABLED == 1
+  switch (screen) {
+    case UI_SHOW_ENTERING_FTP:
+      drawInfoScreen("FrameFi", "Entering FTP Mode...", "", CATPPUCCIN_PEACH);
+      break;
+    case UI_SHOW_RESETTING_WIFI:
+      drawInfoScreen("FrameFi", "Resetting Wi-Fi...", "Restarting...", CATPPUCCIN_RED);
+      break;
+    case UI_SHOW_STATUS:
+      statusScreenStale = true;
+      drawStatusChanges();
+      break;
   }
+#endif
+}
 
-  handleMqtt();
-  handleFtp();
-  handleMsc();
+/**
+ * @brief Queues a mode switch for the storage task.
+ */
+void requestModeSwitch(StorageCommand command) {
+  if (storageQueue) {
+    xQueueSend(storageQueue, &command, 0);
+  }
 }
 
 /**
@@ -453,12 +638,6 @@ void handleMqtt() {
   } else {
     mqttClient.loop();
   }
-
-  unsigned long currentMillis = millis();
-  if (currentMillis - lastMqttPublish >= mqttPublishInterval) {
-    lastMqttPublish = currentMillis;
-    publishMqttStatus();
-  }
 #endif
 }
 
@@ -471,10 +650,138 @@ void handleFtp() {
   }
 }
 
+/**
+ * @brief Redraws the mode screen whenever the status snapshot changes. Runs on the UI task.
+ */
+void drawStatusChanges() {
+#if defined(LCD_ENABLED) && LCD_ENABLED == 1
+  static uint32_t shownVersion = 0;
+  static uint32_t shownTransfers = 0;
+  if (!statusScreenStale && deviceStatus.version() == shownVersion && transferTracker.version() == shownTransfers) {
+    return;
+  }
+  statusScreenStale = false;
+
+  DeviceInfo info;
+  shownVersion = deviceStatus.read(info);
+  shownTransfers = transferTracker.version();
+  StatusView view;
+  view.mode = info.isInMscMode ? "USB MSC" : "FTP";
+  view.headerColor = info.isInMscMode ? CATPPUCCIN_MAUVE : CATPPUCCIN_GREEN;
+  view.ip = info.ipAddress;
+  view.mac = info.macAddress;
+  view.files = info.fileCount;
+  view.totalSizeMB = info.totalSize / (1024 * 1024);
+  view.freeSizeMB = info.freeSize / (1024.0 * 1024.0);
+  view.mqttShown = isMqttEnabled;
+  view.mqttConnected = info.mqttConnected;
+  // --- The capacity bar shows the first running transfer instead ---
+  TransferStatus transfer;
+  view.transferActive = transferTracker.active(&transfer, 1) > 0;
+  view.transferPercent = view.transferActive ? transfer.percent : -1;
+  view.transferBytes = view.transferActive ? transfer.bytes : 0;
+
+  // --- Only the widgets that changed reach the panel ---
+  uint32_t start = micros();
+  statusScreen.render(view);
+  displayRenderLatency.record(micros() - start);
+#endif
+}
+
+/**
+ * @brief Publishes the attributes that changed in the status snapshot. Runs on the network task.
+ */
+void publishStatusChanges() {
+#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
+  if (isMqttEnabled) {
+    mqttPublisher.poll(millis());
+  }
+#endif
+}
+
+/**
+ * @brief Publishes the progress of a running batch job to MQTT. Runs on the network task.
+ */
+void publishBatchProgress() {
+#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
+  static uint32_t publishedVersion = 0;
+  static unsigned long lastPublish = 0;
+  uint32_t version = fileBatch.version();
+  if (version == publishedVersion || !mqttClient.connected()) {
+    return;
+  }
+  // --- Every step bumps the version; only the last one of a job is always sent ---
+  BatchState state = fileBatch.currentState();
+  if (state == BATCH_RUNNING && millis() - lastPublish < FILE_BATCH_PROGRESS_MS) {
+    return;
+  }
+  publishedVersion = version;
+  lastPublish = millis();
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(6)> progress;
+  progress["id"] = fileBatch.id();
+  progress["state"] = batchStateName(state);
+  progress["total"] = fileBatch.total();
+  progress["done"] = fileBatch.done();
+  progress["failed"] = fileBatch.failed();
+  progress["elapsed_ms"] = fileBatch.elapsedMs();
+  char output[160];
+  serializeJson(progress, output, sizeof(output));
+  mqttClient.publish(MqttTopics::BATCH_PROGRESS, output);
+#endif
+}
+
+/**
+ * @brief Publishes the progress of running transfers to MQTT at a bounded rate. Runs on the network task.
+ */
+void publishTransferProgress() {
+#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
+  static uint32_t publishedVersion = 0;
+  static uint32_t publishedFinished = 0;
+  static unsigned long lastPublish = 0;
+  uint32_t version = transferTracker.version();
+  if (version == publishedVersion || !mqttClient.connected()) {
+    return;
+  }
+  // --- Every sample bumps the version; a finished transfer is always sent ---
+  uint32_t finished = transferTracker.finishedCount();
+  if (finished == publishedFinished && millis() - lastPublish < TRANSFER_PUBLISH_MS) {
+    return;
+  }
+  publishedVersion = version;
+  lastPublish = millis();
+
+  TransferStatus transfer;
+  uint8_t running = transferTracker.active(&transfer, 1);
+  if (finished != publishedFinished || !running) {
+    publishedFinished = finished;
+    // --- Report the end of the last transfer before the next one's progress ---
+    if (!transferTracker.recent(&transfer, 1)) {
+      return;
+    }
+  }
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(12)> progress;
+  addTransferJson(progress.to<JsonObject>(), transfer);
+  progress["active"] = running;
+  char output[320];
+  serializeJson(progress, output, sizeof(output));
+  mqttClient.publish(MqttTopics::TRANSFER, output);
+#endif
+}
+
 /**
  * @brief Handles MSC screen refresh logic.
  */
 void handleMsc() {
+  // --- Write back cached sectors once the host goes quiet ---
+  if (isInMscMode && mscCache.isDirty() && mscCacheMutex) {
+    if (xSemaphoreTake(mscCacheMutex, 0) == pdTRUE) {
+      mscCache.flushIfIdle(millis(), MSC_CACHE_FLUSH_MS);
+      xSemaphoreGive(mscCacheMutex);
+    }
+  }
+
   if (isInMscMode && msc_disk_dirty && (millis() - last_msc_write_time > MSC_REFRESH_DEBOUNCE_MS)) {
     msc_disk_dirty = false; // Reset flag
     updateAndDrawMscScreen();
@@ -514,6 +821,16 @@ void loadConfig() {
 
   ledBrightness = prefs.getInt("led_brightness", ledBrightness);
 
+#if IMAGE_INGEST_ENABLED
+  IngestConfig ingest = imageIngest.config();
+  ingest.enabled = prefs.getBool("ingest_on", ingest.enabled);
+  ingest.width = prefs.getUShort("ingest_w", ingest.width);
+  ingest.height = prefs.getUShort("ingest_h", ingest.height);
+  ingest.quality = prefs.getUChar("ingest_q", ingest.quality);
+  ingest.keepOriginals = prefs.getBool("ingest_keep", ingest.keepOriginals);
+  imageIngest.configure(ingest);
+#endif
+
   prefs.end();
   HWSerial.println("Configuration loaded from prefs.");
 }
@@ -541,6 +858,15 @@ void saveConfig() {
 
   prefs.putInt("led_brightness", ledBrightness);
 
+#if IMAGE_INGEST_ENABLED
+  const IngestConfig& ingest = imageIngest.config();
+  prefs.putBool("ingest_on", ingest.enabled);
+  prefs.putUShort("ingest_w", ingest.width);
+  prefs.putUShort("ingest_h", ingest.height);
+  prefs.putUChar("ingest_q", ingest.quality);
+  prefs.putBool("ingest_keep", ingest.keepOriginals);
+#endif
+
   prefs.end();
   HWSerial.println("Configuration saved to prefs.");
 }
@@ -569,31 +895,23 @@ void getDeviceInfo(DeviceInfo& info) {
   info.modeString = info.isInMscMode ? Mode::MSC : Mode::FTP;
   info.displayStatus = info.isDisplayOn ? "on" : "off";
   info.displayOrientation = tft.getRotation();
-  strncpy(info.ipAddress, WiFi.localIP().toString().c_str(), sizeof(info.ipAddress));
-  info.ipAddress[sizeof(info.ipAddress) - 1] = '\0';
-  strncpy(info.macAddress, WiFi.macAddress().c_str(), sizeof(info.macAddress));
-  info.macAddress[sizeof(info.macAddress) - 1] = '\0';
+  // --- Format in place; no String temporaries ---
+  IPAddress ip = WiFi.localIP();
+  snprintf(info.ipAddress, sizeof(info.ipAddress), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  snprintf(info.macAddress, sizeof(info.macAddress), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
   info.mqttState = mqttClient.state();
   info.mqttConnected = mqttClient.connected();
   info.isMqttEnabled = ::isMqttEnabled;
   info.ledColor = getLedColorString(leds[0]);
   info.ledBrightness = ::ledBrightness;
 
-  if (info.isInMscMode) {
-    if(card) {
-      info.fileCount = countFilesInPath(MOUNT_POINT);
-      FATFS *fs;
-      DWORD fre_clust;
-      if (f_getfree(MOUNT_POINT, &fre_clust, &fs) == FR_OK) {
-        info.totalSize = (uint64_t)(fs->n_fatent - 2) * fs->csize * fs->ssize;
-        info.freeSize = (uint64_t)fre_clust * fs->csize * fs->ssize;
-        info.usedSize = info.totalSize - info.freeSize;
-      } else {
-        info.fileCount = 0;
-        info.totalSize = 0;
-        info.usedSize = 0;
-        info.freeSize = 0;
-      }
+  // --- Free space is kept by the tracker in both modes; a status call never walks the FAT ---
+  if (card) {
+    info.fileCount = getIndexedFileCount();
+    if (freeSpace.read(info.totalSize, info.freeSize)) {
+      info.usedSize = info.totalSize - info.freeSize;
     } else {
       info.fileCount = 0;
       info.totalSize = 0;
@@ -601,16 +919,10 @@ void getDeviceInfo(DeviceInfo& info) {
       info.freeSize = 0;
     }
   } else {
-    File root = SD_MMC.open("/");
-    if (root) {
-      info.fileCount = countFiles(root);
-      root.close();
-    } else {
-      info.fileCount = 0;
-    }
-    info.totalSize = SD_MMC.cardSize();
-    info.usedSize = SD_MMC.usedBytes();
-    info.freeSize = info.totalSize - info.usedSize;
+    info.fileCount = 0;
+    info.totalSize = 0;
+    info.usedSize = 0;
+    info.freeSize = 0;
   }
 }
 
@@ -639,46 +951,7 @@ void setupSerial() {
  * @brief Initializes the SD card.
  */
 void sdInit(void) {
-  esp_err_t ret;
-  const char mount_point[] = MOUNT_POINT;
-  esp_vfs_fat_sdmmc_mount_config_t mount_config = {.format_if_mount_failed = false, .max_files = 5, .allocation_unit_size = 16 * 1024};
-
-  sdmmc_host_t host = {
-      .flags = SDMMC_HOST_FLAG_4BIT | SDMMC_HOST_FLAG_DDR,
-      .slot = SDMMC_HOST_SLOT_1,
-      .max_freq_khz = SDMMC_FREQ_DEFAULT,
-      .io_voltage = 3.3f,
-      .init = &sdmmc_host_init,
-      .set_bus_width = &sdmmc_host_set_bus_width,
-      .get_bus_width = &sdmmc_host_get_slot_width,
-      .set_bus_ddr_mode = &sdmmc_host_set_bus_ddr_mode,
-      .set_card_clk = &sdmmc_host_set_card_clk,
-      .do_transaction = &sdmmc_host_do_transaction,
-      .deinit = &sdmmc_host_deinit,
-      .io_int_enable = sdmmc_host_io_int_enable,
-      .io_int_wait = sdmmc_host_io_int_wait,
-      .command_timeout_ms = 0,
-  };
-  sdmmc_slot_config_t slot_config = {
-      .clk = (gpio_num_t)SD_MMC_CLK_PIN,
-      .cmd = (gpio_num_t)SD_MMC_CMD_PIN,
-      .d0 = (gpio_num_t)SD_MMC_D0_PIN,
-      .d1 = (gpio_num_t)SD_MMC_D1_PIN,
-      .d2 = (gpio_num_t)SD_MMC_D2_PIN,
-      .d3 = (gpio_num_t)SD_MMC_D3_PIN,
-      .cd = SDMMC_SLOT_NO_CD,
-      .wp = SDMMC_SLOT_NO_WP,
-      .width = 4, // SDMMC_SLOT_WIDTH_DEFAULT,
-      .flags = SDMMC_SLOT_FLAG_INTERNAL_PULLUP,
-  };
-
-  gpio_set_pull_mode((gpio_num_t)SD_MMC_CMD_PIN, GPIO_PULLUP_ONLY); // CMD, needed in 4- and 1- line modes
-  gpio_set_pull_mode((gpio_num_t)SD_MMC_D0_PIN, GPIO_PULLUP_ONLY);  // D0, needed in 4- and 1-line modes
-  gpio_set_pull_mode((gpio_num_t)SD_MMC_D1_PIN, GPIO_PULLUP_ONLY);  // D1, needed in 4-line mode only
-  gpio_set_pull_mode((gpio_num_t)SD_MMC_D2_PIN, GPIO_PULLUP_ONLY);  // D2, needed in 4-line mode only
-  gpio_set_pull_mode((gpio_num_t)SD_MMC_D3_PIN, GPIO_PULLUP_ONLY);  // D3, needed in 4- and 1-line modes
-
-  ret = esp_vfs_fat_sdmmc_mount(mount_point, &host, &slot_config, &mount_config, &card);
+  esp_err_t ret = storage.begin();
 
   if (ret != ESP_OK) {
     if (ret == ESP_FAIL) {
@@ -691,6 +964,9 @@ void sdInit(void) {
     }
     return;
   }
+  card = storage.sdCard();
+  fileIndex.invalidate();
+  freeSpace.begin({card, readAllocationSectors, nullptr});
 }
 
 /**
@@ -698,14 +974,29 @@ void sdInit(void) {
  */
 static int32_t onWrite(uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize) {
   // HWSerial.printf("MSC WRITE: lba: %u, offset: %u, bufsize: %u\n", lba, offset, bufsize);
+  // --- The FAT layer owns the card in FTP mode ---
+  if (storage.fatOwnsCard()) {
+    return -1;
+  }
   uint32_t count = (bufsize / card->csd.sector_size);
-  sdmmc_write_sectors(card, buffer + offset, lba, count);
+  bool ok;
+  if (mscCache.isAttached()) {
+    xSemaphoreTake(mscCacheMutex, portMAX_DELAY);
+    ok = mscCache.write(lba, count, buffer + offset, millis());
+    xSemaphoreGive(mscCacheMutex);
+  } else {
+    ok = sdmmc_write_sectors(card, buffer + offset, lba, count) == ESP_OK;
+  }
+  // --- A failed write may still have reached some sectors ---
+  fileIndex.noteSectorWrite(lba, count);
+  freeSpace.noteHostWrite(lba, count);
 
   // --- Track that a write has occurred ---
   msc_disk_dirty = true;
   last_msc_write_time = millis();
 
-  return bufsize;
+  // --- A negative result makes the host see a medium error instead of lost data ---
+  return ok ? (int32_t)bufsize : -1;
 }
 
 /**
@@ -713,9 +1004,19 @@ static int32_t onWrite(uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t
  */
 static int32_t onRead(uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize) {
   // HWSerial.printf("MSC READ: lba: %u, offset: %u, bufsize: %u\n", lba, offset, bufsize);
+  if (storage.fatOwnsCard()) {
+    return -1;
+  }
   uint32_t count = (bufsize / card->csd.sector_size);
-  sdmmc_read_sectors(card, (uint8_t*)buffer + offset, lba, count);
-  return bufsize;
+  bool ok;
+  if (mscCache.isAttached()) {
+    xSemaphoreTake(mscCacheMutex, portMAX_DELAY);
+    ok = mscCache.read(lba, count, (uint8_t*)buffer + offset);
+    xSemaphoreGive(mscCacheMutex);
+  } else {
+    ok = sdmmc_read_sectors(card, (uint8_t*)buffer + offset, lba, count) == ESP_OK;
+  }
+  return ok ? (int32_t)bufsize : -1;
 }
 
 /**
@@ -724,8 +1025,14 @@ static int32_t onRead(uint32_t lba, uint32_t offset, void *buffer, uint32_t bufs
 static bool onStartStop(uint8_t power_condition, bool start, bool load_eject) {
   HWSerial.printf("MSC START/STOP: power: %u, start: %u, eject: %u\n", power_condition, start, load_eject);
   if (load_eject) {
+    // --- Make sure everything the host wrote is on the card ---
+    mscCacheFlush();
     // --- The host has ejected the device, a good time to refresh the screen ---
     updateAndDrawMscScreen();
+#if THUMBNAILS_ENABLED
+    // --- The host may have added pictures; walk the card once it is back with the FAT layer ---
+    thumbnailCache.rescan();
+#endif
   }
   return true;
 }
@@ -746,6 +1053,108 @@ static void usbEventCallback(void *arg, esp_event_base_t event_base, int32_t eve
   }
 }
 
+/**
+ * @brief Reads sectors straight from the SD card for the sector cache.
+ */
+static bool sdReadSectors(void* context, uint32_t lba, uint32_t count, uint8_t* dst) {
+  return sdmmc_read_sectors((sdmmc_card_t*)context, dst, lba, count) == ESP_OK;
+}
+
+/**
+ * @brief Reads allocation table sectors for the free space tracker.
+ */
+static bool readAllocationSectors(void* context, uint32_t lba, uint32_t count, uint8_t* dst) {
+  // --- While the host owns the card, its latest writes may still be in the sector cache ---
+  if (mscCacheMutex && !storage.fatOwnsCard()) {
+    xSemaphoreTake(mscCacheMutex, portMAX_DELAY);
+    bool ok = mscCache.isAttached() ? mscCache.read(lba, count, dst) : sdReadSectors(context, lba, count, dst);
+    xSemaphoreGive(mscCacheMutex);
+    return ok;
+  }
+  return sdReadSectors(context, lba, count, dst);
+}
+
+/**
+ * @brief Writes sectors straight to the SD card for the sector cache.
+ */
+static bool sdWriteSectors(void* context, uint32_t lba, uint32_t count, const uint8_t* src) {
+  return sdmmc_write_sectors((sdmmc_card_t*)context, src, lba, count) == ESP_OK;
+}
+
+/**
+ * @brief Attaches the read-ahead and sector cache to the current card, allocating their buffers once.
+ */
+void mscCacheInit() {
+  if (!card) return;
+
+  if (!mscCacheMutex) {
+    mscCacheMutex = xSemaphoreCreateMutex();
+  }
+
+  // --- Cache slots are only memcpy'd, so PSRAM is fine; shrink until it fits ---
+  if (!mscCacheSlots) {
+    for (uint16_t slots = MSC_CACHE_SECTORS; slots >= MSC_CACHE_MAX_RUN_SECTORS; slots /= 2) {
+      size_t bytes = (size_t)slots * card->csd.sector_size;
+      mscCacheSlots = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+      if (!mscCacheSlots) {
+        mscCacheSlots = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      }
+      if (mscCacheSlots) {
+        mscCacheSlotCount = slots;
+        break;
+      }
+    }
+  }
+
+  // --- The staging buffer is handed to the SDMMC driver, so it must be DMA-capable ---
+  if (!mscCacheStaging) {
+    mscCacheStaging = (uint8_t*)heap_caps_malloc(MSC_CACHE_MAX_RUN_SECTORS * card->csd.sector_size, MALLOC_CAP_DMA);
+  }
+
+  if (!mscCacheSlots || !mscCacheStaging) {
+    HWSerial.println("⚠️ MSC cache disabled, not enough memory.");
+    return;
+  }
+
+  // --- Prefetch buffers are filled by the SDMMC driver, so they must be DMA-capable too ---
+  if (!mscReadAheadBuffers) {
+    for (uint8_t count = READ_AHEAD_BUFFERS; count > 0; count--) {
+      mscReadAheadBuffers = (uint8_t*)heap_caps_malloc((size_t)count * READ_AHEAD_BUFFER_SECTORS * card->csd.sector_size, MALLOC_CAP_DMA);
+      if (mscReadAheadBuffers) {
+        mscReadAheadBufferCount = count;
+        break;
+      }
+    }
+  }
+
+  BlockDevice device = {card, sdReadSectors, sdWriteSectors};
+  if (mscReadAheadBuffers && mscReadAhead.begin(device, card->csd.sector_size, card->csd.capacity, mscReadAheadBuffers, mscReadAheadBufferCount, READ_AHEAD_BUFFER_SECTORS)) {
+    device = mscReadAhead.asBlockDevice();
+    HWSerial.printf("MSC read-ahead enabled: %u x %u sectors.\n", mscReadAheadBufferCount, READ_AHEAD_BUFFER_SECTORS);
+  } else {
+    HWSerial.println("⚠️ MSC read-ahead disabled.");
+  }
+
+  xSemaphoreTake(mscCacheMutex, portMAX_DELAY);
+  bool ok = mscCache.begin(device, card->csd.sector_size, mscCacheSlotCount, mscCacheSlots, mscCacheStaging, MSC_CACHE_MAX_RUN_SECTORS);
+  xSemaphoreGive(mscCacheMutex);
+  if (ok) {
+    HWSerial.printf("MSC cache enabled: %u sectors.\n", mscCacheSlotCount);
+  }
+}
+
+/**
+ * @brief Writes any cached sectors back to the SD card.
+ */
+void mscCacheFlush() {
+  if (!mscCache.isAttached()) return;
+  xSemaphoreTake(mscCacheMutex, portMAX_DELAY);
+  if (!mscCache.flush()) {
+    HWSerial.println("❌ MSC cache flush failed.");
+  }
+  xSemaphoreGive(mscCacheMutex);
+}
+
 /**
  * @brief Initializes the USB MSC device.
  */
@@ -756,6 +1165,7 @@ void mscInit(void) {
   MSC.onStartStop(onStartStop);
   MSC.onRead(onRead);
   MSC.onWrite(onWrite);
+  mscCacheInit();
   MSC.mediaPresent(true);
   MSC.begin(card->csd.capacity, card->csd.sector_size);
 }
@@ -852,7 +1262,7 @@ void connectToWiFi() {
     HWSerial.println(WiFi.softAPIP());
     HWSerial.println(myWiFiManager->getConfigPortalSSID());
     leds[0] = CRGB::Blue; // Solid blue for captive portal
-    FastLED.show();
+    showLeds();
 #if defined(LCD_ENABLED) && LCD_ENABLED == 1
     drawApModeScreen(myWiFiManager->getConfigPortalSSID().c_str(), WiFi.softAPIP().toString().c_str());
 #endif
@@ -863,10 +1273,10 @@ void connectToWiFi() {
   bool connecting = true;
   while (connecting && (millis() - startConnecting < 180000)) { // 3-minute timeout
     leds[0] = CRGB::Blue;
-    FastLED.show();
+    showLeds();
     delay(100);
     leds[0] = CRGB::Black;
-    FastLED.show();
+    showLeds();
     delay(400);
     if (wm.autoConnect(ap_ssid, ap_password)) {
       connecting = false;
@@ -903,9 +1313,7 @@ void connectToWiFi() {
  * @brief Resets WiFi settings if the button is held for 3 seconds.
  */
 void resetWifiSettings() {
-#if defined(LCD_ENABLED) && LCD_ENABLED == 1
-  drawInfoScreen("FrameFi", "Resetting Wi-Fi...", "Restarting...", CATPPUCCIN_RED);
-#endif
+  uiOutput.showScreen(UI_SHOW_RESETTING_WIFI);
   HWSerial.println("Button held for 3 seconds. Resetting WiFi settings...");
   WiFiManager wm;
   wm.resetSettings();
@@ -916,6 +1324,8 @@ void resetWifiSettings() {
   prefs.clear();
   
   HWSerial.println("WiFi settings reset. Restarting...");
+  // --- Give the output task a moment to put the reset screen up ---
+  uiOutput.waitIdle(1000);
   ESP.restart();
 }
 
@@ -924,93 +1334,99 @@ void resetWifiSettings() {
  */
 void toggleMode() {
   HWSerial.println("Button clicked! Toggling mode...");
-  if (isInMscMode) {
-    enterFtpMode();
-  } else {
-    enterMscMode();
-  }
-#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
-  publishMqttStatus();
-#endif
+  requestModeSwitch(STORAGE_TOGGLE_MODE);
 }
 
 // --- Web Server ---
 
+/**
+ * @brief Wraps a route handler so its run time lands in the HTTP latency histogram.
+ */
+ArRequestHandlerFunction timed(ArRequestHandlerFunction handler) {
+  return [handler](AsyncWebServerRequest* request) {
+    uint32_t start = micros();
+    handler(request);
+    httpLatency.record(micros() - start);
+  };
+}
+
 /**
  * @brief Defines the web server API endpoints.
  */
 void setupApiRoutes() {
-  server.on("/", HTTP_GET, handleStatus);
-  server.on("/mode/msc", HTTP_POST, handleSwitchToMsc);
-  server.on("/mode/msc", HTTP_GET, handleGetMode);
-  server.on("/mode/ftp", HTTP_POST, handleSwitchToFtp);
-  server.on("/mode/ftp", HTTP_GET, handleGetMode);
-  server.on("/device/restart", HTTP_POST, handleRestart);
-  server.on("/display/toggle", HTTP_POST, [](){ handleDisplayAction("toggle"); });
-  server.on("/display/on", HTTP_POST, [](){ handleDisplayAction("on"); });
-  server.on("/display/off", HTTP_POST, [](){ handleDisplayAction("off"); });
-  server.on("/display/status", HTTP_GET, handleDisplayStatus);
-  server.on("/wifi/reset", HTTP_POST, handleWifiReset);
-  server.on("/mqtt/enable", HTTP_POST, [](){ handleMqttAction("enable"); });
-  server.on("/mqtt/disable", HTTP_POST, [](){ handleMqttAction("disable"); });
-  server.on("/mqtt/toggle", HTTP_POST, [](){ handleMqttAction("toggle"); });
-  server.on("/mqtt/status", HTTP_GET, handleMqttStatus);
-  server.on("/led/status", HTTP_GET, handleLedStatus);
-  server.on("/led/toggle", HTTP_POST, [](){ handleLedAction("toggle"); });
-  server.on("/led/on", HTTP_POST, [](){ handleLedAction("on"); });
-  server.on("/led/off", HTTP_POST, [](){ handleLedAction("off"); });
-  server.on("/led/brightness", HTTP_GET, handleLedBrightnessGet);
-  server.on("/led/brightness", HTTP_POST, handleLedBrightness);
-  server.on("/upload", HTTP_POST, handleUpload, handleUploadData);
+  server.on("/", HTTP_GET, timed(handleStatus));
+  server.on("/mode/msc", HTTP_POST, timed(handleSwitchToMsc));
+  server.on("/mode/msc", HTTP_GET, timed(handleGetMode));
+  server.on("/mode/ftp", HTTP_POST, timed(handleSwitchToFtp));
+  server.on("/mode/ftp", HTTP_GET, timed(handleGetMode));
+  server.on("/device/restart", HTTP_POST, timed(handleRestart));
+  server.on("/display/toggle", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleDisplayAction(request, "toggle"); }));
+  server.on("/display/on", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleDisplayAction(request, "on"); }));
+  server.on("/display/off", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleDisplayAction(request, "off"); }));
+  server.on("/display/status", HTTP_GET, timed(handleDisplayStatus));
+  server.on("/wifi/reset", HTTP_POST, timed(handleWifiReset));
+  server.on("/mqtt/enable", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleMqttAction(request, "enable"); }));
+  server.on("/mqtt/disable", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleMqttAction(request, "disable"); }));
+  server.on("/mqtt/toggle", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleMqttAction(request, "toggle"); }));
+  server.on("/mqtt/status", HTTP_GET, timed(handleMqttStatus));
+  server.on("/led/status", HTTP_GET, timed(handleLedStatus));
+  server.on("/led/toggle", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleLedAction(request, "toggle"); }));
+  server.on("/led/on", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleLedAction(request, "on"); }));
+  server.on("/led/off", HTTP_POST, timed([](AsyncWebServerRequest* request){ handleLedAction(request, "off"); }));
+  server.on("/led/brightness", HTTP_GET, timed(handleLedBrightnessGet));
+  server.on("/led/brightness", HTTP_POST, timed(handleLedBrightness), nullptr, handleLedBrightnessBody);
+  server.on("/diagnostics", HTTP_GET, handleDiagnostics);
+  server.on("/upload", HTTP_POST, timed(handleUpload), handleUploadData);
+  // --- Before "/files/*" so the wildcard does not take the batch routes ---
+  server.on("/files/batch", HTTP_POST, timed(handleFileBatch), nullptr, handleFileBatchBody);
+  server.on("/files/batch", HTTP_GET, timed(handleFileBatchStatus));
+  server.on("/transfers", HTTP_GET, timed(handleTransfers));
+  server.on("/files/by-hash/*", HTTP_GET | HTTP_HEAD, timed(handleFileByHash));
+  server.on("/files/*", HTTP_GET, timed(handleFileDownload));
+  server.on("/manifest", HTTP_GET, timed(handleManifest));
+#if THUMBNAILS_ENABLED
+  server.on("/thumbs/*", HTTP_GET, timed(handleThumbnail));
+#endif
+#if IMAGE_INGEST_ENABLED
+  server.on("/ingest", HTTP_GET, timed(handleIngestStatus));
+  server.on("/ingest", HTTP_POST, timed(handleIngestConfig), nullptr, handleIngestConfigBody);
+#endif
 }
 
 void updateDisplayAndMqtt() {
-#if defined(LCD_ENABLED) && LCD_ENABLED == 1
-  DeviceInfo info;
-  getDeviceInfo(info);
-  if (isInMscMode) {
-    drawUsbMscModeScreen(info.ipAddress, info.macAddress, info.fileCount, info.totalSize / (1024 * 1024), info.freeSize / (1024.0 * 1024.0), info.mqttConnected);
-  } else {
-    drawFtpModeScreen(info.ipAddress, info.macAddress, info.fileCount, info.totalSize / (1024 * 1024), info.freeSize / (1024.0 * 1024.0), info.mqttConnected);
-  }
-#endif
-#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
-  publishMqttStatus();
-#endif
+  // --- The status task takes the snapshot; a stale file index is rebuilt there, never on the caller's task ---
+  deviceStatus.requestRefresh();
 }
 
 /**
- * @brief Stops FTP, unmounts SD, and enables USB MSC mode.
+ * @brief Stops FTP and hands the card to the USB host.
  */
 void enterMscMode() {
   if (isInMscMode) return; // Already in this mode
   
   HWSerial.println("\n--- Entering MSC Mode ---");
+  uint32_t switchStart = millis();
 
   // --- Turn the LED on ---
   leds[0] = CRGB::Green;
-  FastLED.show();
+  showLeds();
     
-  // --- Stop FTP Server ---
+  // --- Stop FTP Server; this closes every file it had open ---
   ftpServer.end();
   HWSerial.println("FTP Server stopped.");
 
-  // --- Unmount SD_MMC ---
-  SD_MMC.end();
-  HWSerial.println("SD Card unmounted from SD_MMC.");
-
-  // --- Initialize SD for MSC ---
-  sdInit();
-  HWSerial.println("SD Card initialized for MSC.");
-
-  // --- Initialize USB MSC ---
+  // --- Hand the blocks to the host ---
   if (card) {
-    USB.onEvent(usbEventCallback);
-    mscInit();
-    USBSerial.begin();
-    USB.begin();
-    HWSerial.println("\n✅ Switched to MSC mode. Connect USB to a computer.");
+    freeSpace.sample();
+    // --- HTTP uploads still open lose their temp files; their next chunk gets a 503 ---
+    UploadWriter::abortAll();
+    storage.releaseToHost();
+    mscCacheInit();
+    MSC.mediaPresent(true);
     isInMscMode = true;
+    // --- The host can use the card from here; the status snapshot follows on its own task ---
+    modeSwitchMs = millis() - switchStart;
+    HWSerial.printf("\n✅ Switched to MSC mode in %u ms. Connect USB to a computer.\n", modeSwitchMs);
 
     // --- Update display and MQTT ---
     updateDisplayAndMqtt();
@@ -1020,48 +1436,73 @@ void enterMscMode() {
 }
 
 /**
- * @brief Mounts SD card and starts the FTP server.
+ * @brief Takes the card back from the USB host and starts the FTP server.
  * @return true if successful, false otherwise.
  */
 bool enterFtpMode() {
   if (!isInMscMode) return true; // Already in this mode
 
   HWSerial.println("\n--- Entering Application (FTP) Mode ---");
+  uint32_t switchStart = millis();
 
-#if defined(LCD_ENABLED) && LCD_ENABLED == 1
-  drawInfoScreen("FrameFi", "Entering FTP Mode...", "", CATPPUCCIN_PEACH);
-#endif
+  // --- The UI output task owns the display ---
+  uiOutput.showScreen(UI_SHOW_ENTERING_FTP);
 
   // --- Turn the LED on ---
   leds[0] = CRGB::Purple;
-  FastLED.show();
+  showLeds();
   
-  // --- Stop USB MSC ---
-  MSC.end();
-  USBSerial.end();
-  HWSerial.println("USB MSC stopped.");
-
-  // --- Unmount SD from VFS ---
-  if (card) {
-    esp_vfs_fat_sdcard_unmount(MOUNT_POINT, card);
-    HWSerial.println("SD Card unmounted from VFS.");
+  // --- Tell the host the media is gone; from here on MSC requests are refused ---
+  MSC.mediaPresent(false);
+  HWSerial.println("USB MSC media removed.");
+
+  // --- Write back and detach the sector cache before the FAT layer takes over ---
+  if (mscCache.isAttached()) {
+    xSemaphoreTake(mscCacheMutex, portMAX_DELAY);
+    if (!mscCache.end()) {
+      HWSerial.println("❌ MSC cache flush failed.");
+    }
+    xSemaphoreGive(mscCacheMutex);
   }
+  mscReadAhead.end();
 
-  // --- Initialize SD_MMC ---
-  SD_MMC.setPins(SD_MMC_CLK_PIN, SD_MMC_CMD_PIN, SD_MMC_D0_PIN, SD_MMC_D1_PIN, SD_MMC_D2_PIN, SD_MMC_D3_PIN);
-  if (!SD_MMC.begin(MOUNT_POINT, true)) {
+  // --- The host may have changed anything, so FatFs starts from the card again ---
+  if (!storage.claimForFat()) {
     HWSerial.println("Card Mount Failed");
+    // --- Stay in MSC mode: the host gets the card back with the cache in front of it ---
+    mscCacheInit();
+    MSC.mediaPresent(true);
+    leds[0] = CRGB::Green;
+    showLeds();
+    uiOutput.showScreen(UI_SHOW_STATUS);
     return false;
   }
-  HWSerial.println("SD Card mounted with SD_MMC.");
+  fileIndex.invalidate();
+  contentIndex.reset();
+  freeSpace.volumeClaimed();
 
   // --- Start FTP Server ---
   ftpServer.begin(ftpConfig.user, ftpConfig.pass);
-  ftpServer.setTransferCallback(ftpTransferCallback);
+  // --- Transfers cut off by the last switch to MSC never reported their end ---
+  for (uint8_t i = 0; i < FTP_MAX_SESSIONS; i++) {
+    transferTracker.finish(ftpTransferSlots[i], false);
+    ftpTransferSlots[i] = -1;
+    ftpSessionUploading[i] = false;
+  }
+  ftpServer.setTransferProgressCallback(ftpTransferCallback);
+  ftpServer.setFileCallback(ftpFileCallback);
+#if LIST_CACHE_ENABLED
+  ftpServer.setListCache(&listCache);
+#endif
+#if CONTENT_INDEX_ENABLED
+  ftpServer.setStoreHashCallback(ftpStoreHashCallback);
+#endif
   HWSerial.println("FTP Server started.");
 
-  HWSerial.println("\n✅ Application mode active.");
   isInMscMode = false;
+  // --- FTP and HTTP can use the card from here; the file index is rebuilt on the status task ---
+  modeSwitchMs = millis() - switchStart;
+  HWSerial.printf("\n✅ Application mode active after %u ms.\n", modeSwitchMs);
 
   // --- Update display and MQTT ---
   updateDisplayAndMqtt();
@@ -1073,16 +1514,17 @@ bool enterFtpMode() {
 /**
  * @brief Handles requests to the root URL ("/"). Sends a JSON status object.
  */
-void handleStatus() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleStatus(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DeviceInfo info;
-  getDeviceInfo(info);
+  deviceStatus.read(info);
 
-  const int JSON_STATUS_SIZE = JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(3);
+  const int JSON_STATUS_SIZE = JSON_OBJECT_SIZE(7) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(2);
   DynamicJsonDocument jsonResponse(JSON_STATUS_SIZE);
   jsonResponse["mode"] = info.modeString;
+  jsonResponse["mode_switch_ms"] = modeSwitchMs;
   JsonObject display = jsonResponse.createNestedObject("display");
   display["status"] = info.displayStatus;
   display["orientation"] = info.displayOrientation;
@@ -1099,18 +1541,148 @@ void handleStatus() {
   led["color"] = info.ledColor;
   led["state"] = (leds[0] == CRGB::Black) ? "off" : "on";
   led["brightness"] = info.ledBrightness;
+  JsonObject msc = jsonResponse.createNestedObject("msc");
+  msc["cache_enabled"] = mscCache.isAttached();
+  JsonObject readAhead = msc.createNestedObject("read_ahead");
+  readAhead["hit_rate"] = mscReadAhead.hitRate();
+  readAhead["window_sectors"] = mscReadAhead.windowSectors();
+
+  String output;
+  serializeJson(jsonResponse, output);
+  request->send(200, "application/json", output);
+}
+
+/**
+ * @brief Adds the figures of one transfer to a JSON object.
+ */
+void addTransferJson(JsonObject target, const TransferStatus& transfer) {
+  target["name"] = (const char*)transfer.name;
+  target["source"] = transferSourceName(transfer.source);
+  target["direction"] = transferDirectionName(transfer.direction);
+  target["state"] = transferStateName(transfer.state);
+  target["bytes"] = transfer.bytes;
+  target["total"] = transfer.total;
+  target["percent"] = transfer.percent;
+  target["elapsed_ms"] = transfer.elapsedMs;
+  target["rate_bps"] = transfer.rateBps;
+  target["average_bps"] = transfer.averageBps;
+  target["eta_s"] = transfer.etaS;
+}
+
+/**
+ * @brief Handles GET /transfers. Reports the running transfers and the last few that finished.
+ */
+void handleTransfers(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  TransferStatus running[TRANSFER_SLOTS];
+  TransferStatus finished[TRANSFER_RECENT];
+  uint8_t runningCount = transferTracker.active(running, TRANSFER_SLOTS);
+  uint8_t finishedCount = transferTracker.recent(finished, TRANSFER_RECENT);
+
+  const int JSON_TRANSFER_SIZE = JSON_OBJECT_SIZE(11);
+  DynamicJsonDocument jsonResponse(JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(TRANSFER_SLOTS) + JSON_ARRAY_SIZE(TRANSFER_RECENT) +
+                                   (TRANSFER_SLOTS + TRANSFER_RECENT) * JSON_TRANSFER_SIZE);
+  jsonResponse["status"] = "success";
+  JsonArray active = jsonResponse.createNestedArray("active");
+  for (uint8_t i = 0; i < runningCount; i++) {
+    addTransferJson(active.createNestedObject(), running[i]);
+  }
+  JsonArray recent = jsonResponse.createNestedArray("recent");
+  for (uint8_t i = 0; i < finishedCount; i++) {
+    addTransferJson(recent.createNestedObject(), finished[i]);
+  }
+
+  String output;
+  serializeJson(jsonResponse, output);
+  request->send(200, "application/json", output);
+}
+
+/**
+ * @brief Adds a latency histogram to a diagnostics JSON object.
+ */
+void addLatencyJson(JsonObject target, const LatencyHistogram& histogram) {
+  target["count"] = histogram.count();
+  target["p50"] = histogram.percentile(50);
+  target["p99"] = histogram.percentile(99);
+  target["max"] = histogram.max();
+  JsonArray buckets = target.createNestedArray("buckets");
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+    JsonObject bucket = buckets.createNestedObject();
+    uint32_t limit = LatencyHistogram::bucketLimit(i);
+    if (limit) {
+      bucket["le"] = limit;
+    } else {
+      bucket["le"] = "+Inf";
+    }
+    bucket["count"] = histogram.bucketCount(i);
+  }
+}
+
+/**
+ * @brief Handles GET /diagnostics. Sends latency histograms and task stack headroom.
+ */
+void handleDiagnostics(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+
+  const int JSON_HISTOGRAM_SIZE = JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(LATENCY_BUCKETS) + LATENCY_BUCKETS * JSON_OBJECT_SIZE(2);
+  const int JSON_DIAGNOSTICS_SIZE = JSON_OBJECT_SIZE(10) + 3 * JSON_HISTOGRAM_SIZE + 3 * JSON_OBJECT_SIZE(4) + 2 * JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(5);
+  DynamicJsonDocument jsonResponse(JSON_DIAGNOSTICS_SIZE);
+  jsonResponse["uptime_ms"] = millis();
+  addLatencyJson(jsonResponse.createNestedObject("http_latency_us"), httpLatency);
+  addLatencyJson(jsonResponse.createNestedObject("network_loop_us"), networkLoopLatency);
+  addLatencyJson(jsonResponse.createNestedObject("display_render_us"), displayRenderLatency);
+  JsonObject stacks = jsonResponse.createNestedObject("stack_free_bytes");
+  stacks["network"] = uxTaskGetStackHighWaterMark(networkTaskHandle);
+  stacks["storage"] = uxTaskGetStackHighWaterMark(storageTaskHandle);
+  stacks["ui"] = uxTaskGetStackHighWaterMark(uiTaskHandle);
+  stacks["ui_output"] = uxTaskGetStackHighWaterMark(uiOutput.taskHandle());
+  JsonObject space = jsonResponse.createNestedObject("free_space");
+  space["exact"] = freeSpace.isExact();
+  space["counts"] = freeSpace.stats().counts;
+  space["last_count_ms"] = freeSpace.stats().lastCountMs;
+  // --- Share of the uptime the UI output task spent sending LED frames and drawing ---
+  const UiOutputStats& uiStats = uiOutput.stats();
+  JsonObject ui = jsonResponse.createNestedObject("ui_output");
+  ui["busy_ms"] = uiStats.busyUs / 1000;
+  ui["cpu_share_pct"] = (float)uiStats.busyUs / ((float)millis() * 10.0f);
+  ui["led_frames"] = uiStats.ledFrames;
+  ui["screens"] = uiStats.screens;
+  ui["dropped"] = uiStats.dropped;
+  const MqttPublisherStats& mqttStats = mqttPublisher.stats();
+  JsonObject mqtt = jsonResponse.createNestedObject("mqtt_publish");
+  mqtt["flushes"] = mqttStats.flushes;
+  mqtt["messages"] = mqttStats.messages;
+  mqtt["bytes"] = mqttStats.bytes;
+  // --- Internal RAM only; without PSRAM every String and buffer comes from here ---
+  uint32_t heapFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  uint32_t heapLargest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  JsonObject heap = jsonResponse.createNestedObject("heap");
+  heap["free_bytes"] = heapFree;
+  heap["min_free_bytes"] = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  heap["largest_block_bytes"] = heapLargest;
+  heap["fragmentation_pct"] = heapFree ? (uint8_t)(100 - (uint64_t)heapLargest * 100 / heapFree) : 0;
+  const ListCacheStats& listStats = listCache.stats();
+  JsonObject lists = jsonResponse.createNestedObject("ftp_list_cache");
+  lists["hits"] = listStats.hits;
+  lists["misses"] = listStats.misses;
+  lists["stored"] = listStats.stored;
+  lists["evictions"] = listStats.evictions;
 
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
 }
 
 /**
  * @brief Handles the POST request to switch to MSC mode.
  */
-void handleSwitchToMsc() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleSwitchToMsc(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   if (isInMscMode) {
     DynamicJsonDocument jsonResponse(256);
@@ -1118,25 +1690,24 @@ void handleSwitchToMsc() {
     jsonResponse["message"] = "Already in MSC mode.";
     String output;
     serializeJson(jsonResponse, output);
-    server.send(200, "application/json", output);
+    request->send(200, "application/json", output);
   } else {
     DynamicJsonDocument jsonResponse(256);
     jsonResponse["status"] = "success";
     jsonResponse["message"] = "Attempting to switch to MSC mode.";
     String output;
     serializeJson(jsonResponse, output);
-    server.send(200, "application/json", output);
-    pendingModeSwitch = true;
-    targetMscMode = true;
+    request->send(200, "application/json", output);
+    requestModeSwitch(STORAGE_ENTER_MSC);
   }  
 }
  
 /**
  * @brief Handles the POST request to switch back to Application (FTP) mode.
  */
-void handleSwitchToFtp() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleSwitchToFtp(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   if (isInMscMode) {
     DynamicJsonDocument jsonResponse(256);
@@ -1144,9 +1715,8 @@ void handleSwitchToFtp() {
     jsonResponse["message"] = "Attempting to switch to Application (FTP) mode.";
     String output;
     serializeJson(jsonResponse, output);
-    server.send(200, "application/json", output);
-    pendingModeSwitch = true;
-    targetMscMode = false;
+    request->send(200, "application/json", output);
+    requestModeSwitch(STORAGE_ENTER_FTP);
   }
   else {
     DynamicJsonDocument jsonResponse(256);
@@ -1154,25 +1724,25 @@ void handleSwitchToFtp() {
     jsonResponse["message"] = "Already in Application (FTP) mode.";
     String output;
     serializeJson(jsonResponse, output);
-    server.send(200, "application/json", output);
+    request->send(200, "application/json", output);
   }
 }
 
 /**
  * @brief Handles the POST request to restart the device.
  */
-void handleRestart() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleRestart(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = "success";
   jsonResponse["message"] = "Restarting device...";
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
-  delay(100);
-  ESP.restart();
+  // --- Restart once the response has gone out instead of sleeping in the server task ---
+  request->onDisconnect([]() { ESP.restart(); });
+  request->send(200, "application/json", output);
 }
 
 /**
@@ -1182,18 +1752,16 @@ void setDisplayState(bool on) {
 #if defined(LCD_ENABLED) && LCD_ENABLED == 1
   digitalWrite(TFT_LEDA, on ? LOW : HIGH);
   isDisplayOn = on;
-#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
-  publishMqttStatus();
-#endif
+  deviceStatus.requestRefresh();
 #endif
 }
 
 /**
  * @brief Handles the POST request for display actions (on/off/toggle).
  */
-void handleDisplayAction(const char* action) {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleDisplayAction(AsyncWebServerRequest* request, const char* action) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
 #if defined(LCD_ENABLED) && LCD_ENABLED == 1
   String message;
@@ -1207,34 +1775,33 @@ void handleDisplayAction(const char* action) {
     setDisplayState(!isDisplayOn);
     message = isDisplayOn ? "Display toggled on." : "Display toggled off.";
   }
-  sendJsonResponse("success", message.c_str());
+  sendJsonResponse(request, "success", message.c_str());
 #else
-  sendJsonResponse("no_change", "Display is disabled in firmware.");
+  sendJsonResponse(request, "no_change", "Display is disabled in firmware.");
 #endif
 }
 
 /**
  * @brief Handles the POST request to reset WiFi settings.
  */
-void handleWifiReset() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleWifiReset(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
-  sendJsonResponse("success", "Resetting WiFi and restarting...");
-  delay(200);
-  resetWifiSettings();
+  request->onDisconnect([]() { resetWifiSettings(); });
+  sendJsonResponse(request, "success", "Resetting WiFi and restarting...");
 }
 
 /**
  * @brief Sends a standardized JSON response.
  */
-void sendJsonResponse(const char* status, const char* message) {
+void sendJsonResponse(AsyncWebServerRequest* request, const char* status, const char* message) {
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = status;
   jsonResponse["message"] = message;
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
 }
 
 /**
@@ -1242,20 +1809,15 @@ void sendJsonResponse(const char* status, const char* message) {
  */
 void manageMqttState(const char* state) {
 #if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
+  // --- The network task connects or disconnects on its next pass ---
   if (strcmp(state, "enable") == 0) {
     isMqttEnabled = true;
-    reconnect();
   } else if (strcmp(state, "disable") == 0) {
     isMqttEnabled = false;
-    mqttClient.disconnect();
   } else if (strcmp(state, "toggle") == 0) {
     isMqttEnabled = !isMqttEnabled;
-    if (isMqttEnabled) {
-      reconnect();
-    } else {
-      mqttClient.disconnect();
-    }
   }
+  lastReconnectAttempt = millis() - reconnectInterval - 1;
   saveConfig();
   updateDisplayAndMqtt();
 #endif
@@ -1264,13 +1826,13 @@ void manageMqttState(const char* state) {
 /**
  * @brief Handles the POST request for MQTT actions (enable/disable/toggle).
  */
-void handleMqttAction(const char* action) {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleMqttAction(AsyncWebServerRequest* request, const char* action) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   manageMqttState(action);
   String message = "MQTT " + String(action) + "d.";
-  sendJsonResponse("success", message.c_str());
+  sendJsonResponse(request, "success", message.c_str());
 }
 
 /**
@@ -1296,30 +1858,31 @@ void setLedState(const char* state) {
       leds[0] = CRGB::Black;
     }
   }
-  FastLED.show();
+  showLeds();
+  deviceStatus.requestRefresh();
 }
 
 /**
  * @brief Handles the POST request for LED actions (on/off/toggle).
  */
-void handleLedAction(const char* action) {
-    if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-        return server.requestAuthentication();
+void handleLedAction(AsyncWebServerRequest* request, const char* action) {
+    if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+        return request->requestAuthentication();
     }
     setLedState(action);
     String message = "LED turned " + String(action) + ".";
     if (strcmp(action, "toggle") == 0) {
         message = "LED toggled.";
     }
-    sendJsonResponse("success", message.c_str());
+    sendJsonResponse(request, "success", message.c_str());
 }
 
 /**
  * @brief Handles the GET request to return the LED color and state.
  */
-void handleLedStatus() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleLedStatus(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = "success";
@@ -1328,107 +1891,655 @@ void handleLedStatus() {
   jsonResponse["brightness"] = ledBrightness;
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
+}
+
+/**
+ * @brief Collects the plain text body of POST /led/brightness into the request's _tempObject.
+ */
+void handleLedBrightnessBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+  // --- A valid value is at most three digits; longer bodies are left empty and rejected ---
+  if (index == 0 && total <= 8) {
+    request->_tempObject = calloc(total + 1, 1);
+  }
+  if (request->_tempObject && index + len <= total) {
+    memcpy((char*)request->_tempObject + index, data, len);
+  }
 }
 
 /**
  * @brief Handles the POST request to set the LED brightness.
  */
-void handleLedBrightness() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleLedBrightness(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
 
-  String brightnessStr = server.arg("plain");
+  String brightnessStr = request->_tempObject ? (const char*)request->_tempObject : "";
   int newBrightness = brightnessStr.toInt();
 
   // Check for conversion errors and valid range
   if ((newBrightness == 0 && brightnessStr != "0") || newBrightness < 0 || newBrightness > 255) {
-    sendJsonResponse("error", "Invalid brightness value. Body must be a plain text integer between 0 and 255.");
+    sendJsonResponse(request, "error", "Invalid brightness value. Body must be a plain text integer between 0 and 255.");
   } else {
     ledBrightness = newBrightness;
     FastLED.setBrightness(ledBrightness);
-    FastLED.show();
+    showLeds();
+    deviceStatus.requestRefresh();
     saveConfig();
     String message = "LED brightness set to " + String(ledBrightness) + ".";
-    sendJsonResponse("success", message.c_str());
+    sendJsonResponse(request, "success", message.c_str());
   }
 }
 
 /**
- * @brief Handles file uploads.
+ * @brief Per-request upload state, kept in the request's _tempObject.
  */
-void handleUpload() {
-  if (uploadFile) {
-    uploadFile.close();
+struct UploadState {
+  int error;             // HTTP status to answer with, or 0
+  UploadWriter* writer;  // File being written, or nullptr
+  int8_t transfer;       // Slot of the file in transferTracker, or -1
+  char sha256[CONTENT_HASH_HEX_SIZE];  // Hash of the last file stored, or empty
+  char duplicateOf[FF_MAX_LFN + 1];    // Another file with the same content, or empty
+};
+
+/**
+ * @brief Commits the file being uploaded, or discards it if the upload did not finish.
+ */
+void finishUploadFile(AsyncWebServerRequest* request, bool complete) {
+  UploadState* state = (UploadState*)request->_tempObject;
+  if (!state || !state->writer) {
+    return;
+  }
+  UploadWriter* writer = state->writer;
+  state->writer = nullptr;
+  int8_t transfer = state->transfer;
+  state->transfer = -1;
+
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool stored = false;
+  // --- A switch to MSC aborts open uploads; one that was cut off that way is reported as such ---
+  bool interrupted = !storage.fatOwnsCard() || !writer->isOpen();
+  if (!storage.fatOwnsCard()) {
+    // --- The USB host has the card; FatFs must not touch it ---
+    writer->discard();
+  } else if (complete) {
+    stored = writer->commit() == FR_OK;
+  } else {
+    writer->abort();
+  }
+  if (stored && writer->digest()) {
+    // --- Look for an earlier copy before this upload becomes the newest entry ---
+    uint32_t duplicateSize;
+    formatContentHash(writer->digest(), state->sha256);
+    if (!contentIndex.find(writer->digest(), state->duplicateOf, sizeof(state->duplicateOf), &duplicateSize) ||
+        strcmp(state->duplicateOf, writer->targetPath()) == 0) {
+      state->duplicateOf[0] = '\0';
+    }
+    contentIndex.record(writer->targetPath(), writer->digest());
   }
-  sendJsonResponse("success", "File uploaded successfully.");
+  xSemaphoreGive(fatMutex);
+
+  if (stored) {
+    fileIndex.fileStored(writer->targetExisted(), writer->targetOldSize(), writer->size());
+    deviceStatus.requestRefresh();
+#if IMAGE_INGEST_ENABLED
+    imageIngest.submit(writer->targetPath(), writer->digest());
+#endif
+#if THUMBNAILS_ENABLED
+    thumbnailCache.submit(writer->targetPath());
+#endif
+  } else if (complete) {
+    state->error = interrupted ? 503 : 500;
+  }
+  transferTracker.finish(transfer, stored);
+  delete writer;
 }
 
-void handleUploadData() {
-  HTTPUpload& upload = server.upload();
-  if (upload.status == UPLOAD_FILE_START) {
-    if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-      return server.requestAuthentication();
+/**
+ * @brief Handles file uploads. Runs once the whole body has been received.
+ */
+void handleUpload(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  finishUploadFile(request, true);
+  UploadState* state = (UploadState*)request->_tempObject;
+  if (state && state->error == 400) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot upload in MSC mode.\"}");
+  } else if (state && state->error == 507) {
+    request->send(507, "application/json", "{\"status\":\"error\",\"message\":\"Not enough space on the SD card.\"}");
+  } else if (state && state->error == 500) {
+    request->send(500, "application/json", "{\"status\":\"error\",\"message\":\"Failed to open file for writing.\"}");
+  } else if (state && state->error == 503) {
+    request->send(503, "application/json", "{\"status\":\"error\",\"message\":\"Upload interrupted by the switch to MSC mode.\"}");
+  } else if (state && state->sha256[0]) {
+    DynamicJsonDocument jsonResponse(JSON_OBJECT_SIZE(4));
+    jsonResponse["status"] = "success";
+    jsonResponse["message"] = "File uploaded successfully.";
+    jsonResponse["sha256"] = (const char*)state->sha256;
+    if (state->duplicateOf[0]) {
+      jsonResponse["duplicate_of"] = (const char*)state->duplicateOf;
     }
-    if (isInMscMode) {
-      server.send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot upload in MSC mode.\"}");
+    String output;
+    serializeJson(jsonResponse, output);
+    request->send(200, "application/json", output);
+  } else {
+    sendJsonResponse(request, "success", "File uploaded successfully.");
+  }
+}
+
+/**
+ * @brief Writes each chunk of an upload as it arrives.
+ */
+void handleUploadData(AsyncWebServerRequest* request, const String& filename, size_t index, uint8_t* data, size_t len, bool final) {
+  if (index == 0) {
+    bool firstFile = !request->_tempObject;
+    if (firstFile) {
+      request->_tempObject = calloc(1, sizeof(UploadState));
+      if (!request->_tempObject) {
+        return;
+      }
+      ((UploadState*)request->_tempObject)->transfer = -1;
+      // --- A dropped connection must not leave a temp file behind ---
+      request->onDisconnect([request]() { finishUploadFile(request, false); });
+    }
+    finishUploadFile(request, true);
+    UploadState* state = (UploadState*)request->_tempObject;
+    if (state->error) {
       return;
     }
+    if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+      state->error = 401;
+      return;
+    }
+
     String path = "/";
-    if (upload.filename.startsWith("/")) {
-      path += upload.filename;
+    if (filename.startsWith("/")) {
+      path += filename;
     } else {
-      path += upload.filename;
+      path += filename;
     }
-    uploadFile = SD_MMC.open(path, FILE_WRITE);
-    if (!uploadFile) {
-      server.send(500, "application/json", "{\"status\":\"error\",\"message\":\"Failed to open file for writing.\"}");
+    // --- The body length bounds the first file's size; commit() trims the rest ---
+    uint32_t expectedSize = firstFile ? request->contentLength() : 0;
+    UploadWriter* writer = new UploadWriter();
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    bool owned = storage.fatOwnsCard();
+    FRESULT result = isInMscMode || !owned ? FR_DENIED : writer->begin(path.c_str(), expectedSize, CONTENT_INDEX_ENABLED);
+    xSemaphoreGive(fatMutex);
+    if (isInMscMode) {
+      state->error = 400;
+    } else if (!owned) {
+      state->error = 503;
+    } else if (result == FR_DENIED) {
+      state->error = 507;
+    } else if (result != FR_OK) {
+      state->error = 500;
     }
-  } else if (upload.status == UPLOAD_FILE_WRITE) {
-    if (uploadFile) {
-      uploadFile.write(upload.buf, upload.currentSize);
-      yield();
+    if (state->error) {
+      delete writer;
+      return;
     }
+    state->writer = writer;
+    state->transfer = transferTracker.start(TRANSFER_HTTP, TRANSFER_UPLOAD, path.c_str(), expectedSize);
   }
+
+  UploadState* state = (UploadState*)request->_tempObject;
+  if (state && state->writer && len) {
+#if THUMBNAILS_ENABLED
+    thumbnailCache.noteTransfer();
+#endif
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    // --- The switch to MSC may have aborted this upload between chunks ---
+    bool owned = storage.fatOwnsCard() && state->writer->isOpen();
+    FRESULT result = owned ? state->writer->write(data, len) : FR_NOT_READY;
+    xSemaphoreGive(fatMutex);
+    transferTracker.progress(state->transfer, state->writer->size());
+    if (!owned) {
+      state->error = 503;
+      finishUploadFile(request, false);
+    } else if (result != FR_OK) {
+      state->error = result == FR_DENIED ? 507 : 500;
+      finishUploadFile(request, false);
+    }
+  }
+  if (final) {
+    finishUploadFile(request, true);
+  }
+}
+
+/**
+ * @brief Handles GET /files/<path>. Streams a file from the card with Range and ETag support.
+ */
+void handleFileDownload(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  if (isInMscMode) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot download in MSC mode.\"}");
+    return;
+  }
+
+  String path = request->url().substring(strlen("/files"));
+  if (!isSafePath(path.c_str())) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid path.\"}");
+    return;
+  }
+  sendCardFile(request, path);
+}
+
+/**
+ * @brief Sends a file from the card, answering Range, If-Range and If-None-Match.
+ */
+void sendCardFile(AsyncWebServerRequest* request, const String& path, const char* cacheControl) {
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  File file = sdFs.open(path);
+  bool found = file && !file.isDirectory();
+  uint32_t size = found ? file.size() : 0;
+  time_t mtime = found ? file.getLastWrite() : 0;
+  xSemaphoreGive(fatMutex);
+  if (!found) {
+    request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"File not found.\"}");
+    return;
+  }
+
+  char etag[HTTP_FILES_ETAG_SIZE];
+  formatEtag(etag, sizeof(etag), size, mtime);
+  if (request->hasHeader("If-None-Match") && etagMatches(request->header("If-None-Match").c_str(), etag)) {
+    AsyncWebServerResponse* response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+    return;
+  }
+
+  // --- A Range only applies if If-Range, when present, names the current version ---
+  ByteRange range = {0, size};
+  RangeResult rangeResult = RANGE_NONE;
+  if (request->hasHeader("Range") && (!request->hasHeader("If-Range") || request->header("If-Range") == etag)) {
+    rangeResult = parseRange(request->header("Range").c_str(), size, range);
+  }
+  char contentRange[48];
+  if (rangeResult == RANGE_UNSATISFIABLE) {
+    snprintf(contentRange, sizeof(contentRange), "bytes */%lu", (unsigned long)size);
+    AsyncWebServerResponse* response = request->beginResponse(416);
+    response->addHeader("Content-Range", contentRange);
+    request->send(response);
+    return;
+  }
+
+  // --- Fill the socket's send buffer straight from the card, a sector-aligned run at a time ---
+  AsyncWebServerResponse* response = request->beginResponse(contentTypeFor(path.c_str()), range.length,
+    [file, range](uint8_t* buffer, size_t maxLen, size_t index) mutable -> size_t {
+      if (index >= range.length) {
+        return 0;
+      }
+      uint32_t position = range.start + index;
+      size_t length = alignedReadLength(position, min(maxLen, (size_t)(range.length - index)));
+      size_t read = 0;
+      xSemaphoreTake(fatMutex, portMAX_DELAY);
+      // --- The card may have been handed to the USB host since the last chunk ---
+      if (!isInMscMode && (file.position() == position || file.seek(position))) {
+        read = file.read(buffer, length);
+      }
+      xSemaphoreGive(fatMutex);
+      return read;
+    });
+  response->addHeader("Accept-Ranges", "bytes");
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", cacheControl);
+  if (rangeResult == RANGE_OK) {
+    snprintf(contentRange, sizeof(contentRange), "bytes %lu-%lu/%lu", (unsigned long)range.start,
+             (unsigned long)(range.start + range.length - 1), (unsigned long)size);
+    response->setCode(206);
+    response->addHeader("Content-Range", contentRange);
+  }
+  request->send(response);
+}
+
+/**
+ * @brief Handles GET /manifest. Sends the listing of every file, or 503 while it is being rebuilt.
+ */
+void handleManifest(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  if (isInMscMode) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot read the manifest in MSC mode.\"}");
+    return;
+  }
+  if (!manifest.isCurrent()) {
+    manifest.requestRebuild();
+    AsyncWebServerResponse* response = request->beginResponse(503, "application/json", "{\"status\":\"error\",\"message\":\"Manifest is being rebuilt.\"}");
+    response->addHeader("Retry-After", String(MANIFEST_RETRY_AFTER_S));
+    request->send(response);
+    return;
+  }
+  sendCardFile(request, MANIFEST_PATH);
+}
+
+/**
+ * @brief Handles GET /thumbs/<path>. Sends a picture's thumbnail, or 503 while it is being built.
+ */
+void handleThumbnail(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  if (isInMscMode) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot read thumbnails in MSC mode.\"}");
+    return;
+  }
+
+  String path = request->url().substring(strlen("/thumbs"));
+  if (!isSafePath(path.c_str())) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid path.\"}");
+    return;
+  }
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  ThumbnailState state = thumbnailCache.lookup(path.c_str());
+  xSemaphoreGive(fatMutex);
+
+  if (state == THUMB_PENDING) {
+    AsyncWebServerResponse* response = request->beginResponse(503, "application/json", "{\"status\":\"error\",\"message\":\"Thumbnail is being built.\"}");
+    response->addHeader("Retry-After", String(THUMB_RETRY_AFTER_S));
+    request->send(response);
+    return;
+  }
+  if (state == THUMB_FAILED) {
+    request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"No thumbnail can be built for this file.\"}");
+    return;
+  }
+  char thumbPath[FF_MAX_LFN + 8];
+  if (state != THUMB_READY || !thumbnailCache.thumbnailPath(path.c_str(), thumbPath, sizeof(thumbPath))) {
+    request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"File not found.\"}");
+    return;
+  }
+  // --- A thumbnail only changes with its picture; the gallery adds the mtime to the URL to see a new one ---
+  String cacheControl = "public, max-age=" + String(THUMB_CACHE_MAX_AGE_S);
+  sendCardFile(request, thumbPath, cacheControl.c_str());
+}
+
+/**
+ * @brief Handles GET and HEAD /files/by-hash/<sha256>. Tells a client whether the card already holds a file.
+ */
+void handleFileByHash(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  if (isInMscMode) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot look up files in MSC mode.\"}");
+    return;
+  }
+  String hex = request->url().substring(strlen("/files/by-hash/"));
+  hex.toLowerCase();
+  uint8_t sha256[CONTENT_HASH_SIZE];
+  if (!parseContentHash(hex.c_str(), sha256)) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid SHA-256.\"}");
+    return;
+  }
+
+  char path[FF_MAX_LFN + 1];
+  uint32_t size = 0;
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool found = storage.fatOwnsCard() && contentIndex.find(sha256, path, sizeof(path), &size);
+  xSemaphoreGive(fatMutex);
+  if (!found) {
+    request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"No file with this content.\"}");
+    return;
+  }
+
+  AsyncWebServerResponse* response;
+  if (request->method() == HTTP_HEAD) {
+    response = request->beginResponse(200);
+  } else {
+    DynamicJsonDocument jsonResponse(JSON_OBJECT_SIZE(4));
+    jsonResponse["status"] = "success";
+    jsonResponse["sha256"] = hex.c_str();
+    jsonResponse["path"] = (const char*)path;
+    jsonResponse["size"] = size;
+    String output;
+    serializeJson(jsonResponse, output);
+    response = request->beginResponse(200, "application/json", output);
+  }
+  // --- Where the file can be downloaded, for clients that only send HEAD ---
+  char location[sizeof(path) * 3 + 8];
+  strcpy(location, "/files");
+  if (urlEncodePath(path, location + 6, sizeof(location) - 6)) {
+    response->addHeader("Content-Location", location);
+  }
+  response->addHeader("X-File-Size", String(size));
+  request->send(response);
+}
+
+/**
+ * @brief Handles GET /ingest. Sends the ingest settings and how many pictures it has converted.
+ */
+void handleIngestStatus(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  const IngestConfig& config = imageIngest.config();
+  const IngestStats& stats = imageIngest.stats();
+  StaticJsonDocument<JSON_OBJECT_SIZE(16)> jsonResponse;
+  jsonResponse["status"] = "success";
+  jsonResponse["enabled"] = config.enabled;
+  jsonResponse["width"] = config.width;
+  jsonResponse["height"] = config.height;
+  jsonResponse["quality"] = config.quality;
+  jsonResponse["keep_originals"] = config.keepOriginals;
+  jsonResponse["pending"] = imageIngest.pending();
+  jsonResponse["converted"] = stats.converted;
+  jsonResponse["skipped"] = stats.skipped;
+  jsonResponse["failed"] = stats.failed;
+  jsonResponse["dropped"] = stats.dropped;
+  jsonResponse["bytes_in"] = stats.bytesIn;
+  jsonResponse["bytes_out"] = stats.bytesOut;
+  jsonResponse["busy_ms"] = stats.busyMs;
+  jsonResponse["last_ms"] = stats.lastMs;
+  String output;
+  serializeJson(jsonResponse, output);
+  request->send(200, "application/json", output);
+}
+
+/**
+ * @brief Collects the JSON body of POST /ingest into the request's _tempObject.
+ */
+void handleIngestConfigBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+  // --- The settings fit in a few hundred bytes; longer bodies are left empty and rejected ---
+  if (index == 0 && total <= 512) {
+    request->_tempObject = calloc(total + 1, 1);
+  }
+  if (request->_tempObject && index + len <= total) {
+    memcpy((char*)request->_tempObject + index, data, len);
+  }
+}
+
+/**
+ * @brief Handles POST /ingest. Changes the settings given in the body and keeps the rest.
+ */
+void handleIngestConfig(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  StaticJsonDocument<JSON_OBJECT_SIZE(5)> jsonRequest;
+  const char* body = (const char*)request->_tempObject;
+  if (!body || deserializeJson(jsonRequest, body) || !jsonRequest.is<JsonObject>()) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Body must be a JSON object.\"}");
+    return;
+  }
+
+  IngestConfig config = imageIngest.config();
+  config.enabled = jsonRequest["enabled"] | config.enabled;
+  config.width = jsonRequest["width"] | config.width;
+  config.height = jsonRequest["height"] | config.height;
+  config.quality = jsonRequest["quality"] | config.quality;
+  config.keepOriginals = jsonRequest["keep_originals"] | config.keepOriginals;
+  if (!imageIngest.configure(config)) {
+    char message[128];
+    snprintf(message, sizeof(message), "{\"status\":\"error\",\"message\":\"Width and height must be %d to %d, quality 1 to 100.\"}",
+             INGEST_BAND_ROWS, INGEST_MAX_DIMENSION);
+    request->send(400, "application/json", message);
+    return;
+  }
+  saveConfig();
+  sendJsonResponse(request, "success", "Ingest settings saved.");
+}
+
+/**
+ * @brief Collects the JSON body of POST /files/batch into the request's _tempObject.
+ */
+void handleFileBatchBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+  // --- Bodies over the limit are left empty and rejected with 413 ---
+  if (index == 0 && total <= FILE_BATCH_MAX_BODY) {
+    request->_tempObject = calloc(total + 1, 1);
+  }
+  if (request->_tempObject && index + len <= total) {
+    memcpy((char*)request->_tempObject + index, data, len);
+  }
+}
+
+/**
+ * @brief Handles POST /files/batch. Queues the operations as one job for the storage task.
+ */
+void handleFileBatch(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  if (isInMscMode) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Cannot change files in MSC mode.\"}");
+    return;
+  }
+  if (request->contentLength() > FILE_BATCH_MAX_BODY) {
+    request->send(413, "application/json", "{\"status\":\"error\",\"message\":\"Batch is too large.\"}");
+    return;
+  }
+  if (fileBatch.isRunning()) {
+    request->send(409, "application/json", "{\"status\":\"error\",\"message\":\"A batch job is already running.\"}");
+    return;
+  }
+
+  char* body = (char*)request->_tempObject;
+  // --- Every operation is an object, so counting braces bounds the size of the document ---
+  size_t objects = 0;
+  for (const char* c = body; c && *c; c++) {
+    if (*c == '{') {
+      objects++;
+    }
+  }
+  if (objects > FILE_BATCH_MAX_OPS + 1) {
+    request->send(413, "application/json", "{\"status\":\"error\",\"message\":\"Batch is too large.\"}");
+    return;
+  }
+  DynamicJsonDocument jsonRequest(JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(objects) + objects * JSON_OBJECT_SIZE(3));
+  if (!body || deserializeJson(jsonRequest, body) || !jsonRequest["operations"].is<JsonArray>()) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Body must be a JSON object with an operations array.\"}");
+    return;
+  }
+
+  JsonArray operations = jsonRequest["operations"];
+  fileBatch.prepare(operations.size());
+  size_t index = 0;
+  for (JsonObject operation : operations) {
+    BatchOpType type;
+    if (!batchOpFromName(operation["op"].as<const char*>(), type) ||
+        !fileBatch.add(type, operation["path"].as<const char*>(), operation["to"].as<const char*>())) {
+      fileBatch.cancel();
+      char message[96];
+      snprintf(message, sizeof(message), "{\"status\":\"error\",\"message\":\"Invalid operation at index %u.\"}", (unsigned)index);
+      request->send(400, "application/json", message);
+      return;
+    }
+    index++;
+  }
+
+  uint32_t id = fileBatch.start();
+  // --- Wakes the storage task now instead of at its next poll ---
+  if (storageQueue) {
+    StorageCommand command = STORAGE_RUN_BATCH;
+    xQueueSend(storageQueue, &command, 0);
+  }
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(3)> jsonResponse;
+  jsonResponse["status"] = "success";
+  jsonResponse["id"] = id;
+  jsonResponse["total"] = fileBatch.total();
+  String output;
+  serializeJson(jsonResponse, output);
+  request->send(202, "application/json", output);
+}
+
+/**
+ * @brief Handles GET /files/batch. Reports the progress of the latest job and the result of each finished operation.
+ */
+void handleFileBatchStatus(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
+  }
+  BatchState state = fileBatch.currentState();
+  if (state == BATCH_IDLE || state == BATCH_PENDING) {
+    request->send(404, "application/json", "{\"status\":\"error\",\"message\":\"No batch job.\"}");
+    return;
+  }
+
+  // --- Results are streamed one at a time so a long job never needs one large document ---
+  uint32_t done = fileBatch.done();
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->printf("{\"status\":\"success\",\"id\":%lu,\"state\":\"%s\",\"total\":%lu,\"done\":%lu,\"failed\":%lu,\"elapsed_ms\":%lu,\"results\":[",
+                   (unsigned long)fileBatch.id(), batchStateName(state), (unsigned long)fileBatch.total(),
+                   (unsigned long)done, (unsigned long)fileBatch.failed(), (unsigned long)fileBatch.elapsedMs());
+  StaticJsonDocument<JSON_OBJECT_SIZE(4)> result;
+  for (uint32_t i = 0; i < done; i++) {
+    result.clear();
+    result["op"] = batchOpName(fileBatch.opType(i));
+    result["path"] = fileBatch.opPath(i);
+    if (fileBatch.opType(i) == BATCH_RENAME) {
+      result["to"] = fileBatch.opTarget(i);
+    }
+    result["result"] = batchResultName(fileBatch.opResult(i));
+    if (i > 0) {
+      response->print(',');
+    }
+    serializeJson(result, *response);
+  }
+  response->print("]}");
+  request->send(response);
 }
 
 /**
  * @brief Handles the GET request to return the current mode (MSC or FTP).
  */
-void handleGetMode() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleGetMode(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = "success";
   jsonResponse["mode"] = isInMscMode ? "USB MSC" : "Application (FTP Server)";
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
 }
 
 /**
  * @brief Handles the GET request to return the display status.
  */
-void handleDisplayStatus() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleDisplayStatus(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = "success";
   jsonResponse["display_status"] = isDisplayOn ? "on" : "off";
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
 }
 
 /**
  * @brief Handles the GET request to return the MQTT status.
  */
-void handleMqttStatus() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleMqttStatus(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = "success";
@@ -1437,22 +2548,22 @@ void handleMqttStatus() {
   jsonResponse["mqtt_state"] = mqttClient.state();
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
 }
 
 /**
  * @brief Handles the GET request to return the LED brightness.
  */
-void handleLedBrightnessGet() {
-  if (strlen(webServerConfig.user) > 0 && !server.authenticate(webServerConfig.user, webServerConfig.pass)) {
-    return server.requestAuthentication();
+void handleLedBrightnessGet(AsyncWebServerRequest* request) {
+  if (strlen(webServerConfig.user) > 0 && !request->authenticate(webServerConfig.user, webServerConfig.pass)) {
+    return request->requestAuthentication();
   }
   DynamicJsonDocument jsonResponse(256);
   jsonResponse["status"] = "success";
   jsonResponse["brightness"] = ledBrightness;
   String output;
   serializeJson(jsonResponse, output);
-  server.send(200, "application/json", output);
+  request->send(200, "application/json", output);
 }
 
 
@@ -1461,81 +2572,96 @@ void handleLedBrightnessGet() {
 
 
 /**
- * @brief Callback function for FTP transfers.
+ * @brief Callback function for FTP transfers. Called for every chunk, so it only takes integers.
  */
-void ftpTransferCallback(FtpTransferOperation ftpOperation, const char* name, unsigned int transferredSize) {
-  if (ftpOperation == FTP_UPLOAD || ftpOperation == FTP_DOWNLOAD) {
-    // --- Blink LED by turning it OFF briefly, then back ON ---
-    // --- This leaves the LED in the ON state after the pulse ---
-    leds[0] = CRGB::Black;
-    FastLED.show();
-    delay(50);
-    leds[0] = CRGB::Purple;
-    FastLED.show();
-  } else if (ftpOperation == FTP_UPLOAD_STOP || ftpOperation == FTP_DOWNLOAD_STOP || ftpOperation == FTP_TRANSFER_ERROR) {
-    // --- Ensure LED is solid orange after any transfer completion or error ---
-    leds[0] = CRGB::Purple;
-    FastLED.show();
-    
-    // --- Update storage info on the screen ---
-    DeviceInfo info;
-    getDeviceInfo(info);
-#if defined(LCD_ENABLED) && LCD_ENABLED == 1
-    drawFtpModeScreen(info.ipAddress, info.macAddress, info.fileCount, info.totalSize / (1024 * 1024), info.freeSize / (1024.0 * 1024.0), info.mqttConnected);
-#endif
-#if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
-    publishMqttStatus();
+void ftpTransferCallback(uint8_t session, FtpTransferOperation ftpOperation, uint32_t transferredSize, uint32_t size) {
+  if (session >= FTP_MAX_SESSIONS) {
+    return;
+  }
+  int8_t& slot = ftpTransferSlots[session];
+  // --- Only uploads that ran to the end are handed to the ingest stage ---
+  if (ftpOperation == FTP_UPLOAD_START || ftpOperation == FTP_DOWNLOAD_START) {
+    ftpSessionUploading[session] = ftpOperation == FTP_UPLOAD_START;
+    ftpUploadComplete = false;
+  } else if (ftpOperation == FTP_TRANSFER_STOP || ftpOperation == FTP_TRANSFER_ERROR) {
+    // --- The library reports every stop with the same value; the session knows which way it ran ---
+    ftpUploadComplete = ftpOperation == FTP_TRANSFER_STOP && ftpSessionUploading[session];
+    ftpSessionUploading[session] = false;
+  }
+  if (ftpOperation == FTP_UPLOAD_START || ftpOperation == FTP_DOWNLOAD_START) {
+    // --- The path is looked up once per transfer, not per chunk ---
+    transferTracker.finish(slot, false);
+    TransferDirection direction = ftpOperation == FTP_UPLOAD_START ? TRANSFER_UPLOAD : TRANSFER_DOWNLOAD;
+    slot = transferTracker.start(TRANSFER_FTP, direction, ftpServer.transferPath(session), size);
+  } else if (ftpOperation == FTP_UPLOAD || ftpOperation == FTP_DOWNLOAD) {
+    transferTracker.progress(slot, transferredSize);
+    // --- Hand the blink off to the UI output task; never wait on the LED here ---
+    uiOutput.blink();
+#if THUMBNAILS_ENABLED
+    thumbnailCache.noteTransfer();
 #endif
+  } else if (ftpOperation == FTP_UPLOAD_STOP || ftpOperation == FTP_DOWNLOAD_STOP || ftpOperation == FTP_TRANSFER_ERROR) {
+    transferTracker.progress(slot, transferredSize);
+    transferTracker.finish(slot, ftpOperation != FTP_TRANSFER_ERROR);
+    slot = -1;
+    // --- Defer the storage scan and redraw to the main loop ---
+    deviceStatus.requestRefresh();
   }
 }
 
 // --- File System ---
 
 /**
- * @brief Counts the number of files in a directory recursively using VFS.
- */
-int countFilesInPath(const char *path) {
-  DIR *dir = opendir(path);
-  if (!dir) {
-    HWSerial.printf("Error opening directory: %s\n", path);
-    return 0;
-  }
-  int count = 0;
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != NULL) {
-    if (entry->d_type == DT_REG) {
-      count++;
-    } else if (entry->d_type == DT_DIR) {
-      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-        char subpath[512];
-        snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
-        count += countFilesInPath(subpath);
-      }
+ * @brief Returns the file count from the index, rebuilding it first if it is stale.
+ */
+uint32_t getIndexedFileCount() {
+  if (!fileIndex.isValid()) {
+    // --- FatFs reads the card directly, so cached MSC writes must land first ---
+    if (isInMscMode) {
+      mscCacheFlush();
+    }
+    unsigned long start = millis();
+    if (fileIndex.rebuild()) {
+      HWSerial.printf("File index rebuilt: %u files in %lu ms.\n", fileIndex.fileCount(), millis() - start);
     }
   }
-  closedir(dir);
-  return count;
+  return fileIndex.fileCount();
 }
 
 /**
- * @brief Counts the number of files in a directory recursively.
+ * @brief Keeps the file index current as FTP commands change the card.
  */
-int countFiles(File dir) {
-  int count = 0;
-  while (true) {
-    File entry = dir.openNextFile();
-    if (!entry) {
-      // --- no more files ---
-      break;
-    }
-    if (entry.isDirectory()) {
-      count += countFiles(entry);
-    } else {
-      count++;
-    }
-    entry.close();
+void ftpFileCallback(FtpFileOperation fileOperation, const char* path, uint32_t oldSize, uint32_t newSize) {
+  switch (fileOperation) {
+  case FTP_FILE_CREATED: fileIndex.fileStored(false, 0, newSize); break;
+  case FTP_FILE_CHANGED: fileIndex.fileStored(true, oldSize, newSize); break;
+  case FTP_FILE_DELETED: fileIndex.fileDeleted(oldSize); break;
+  default: fileIndex.notePathChange(); break;
+  }
+#if IMAGE_INGEST_ENABLED
+  if ((fileOperation == FTP_FILE_CREATED || fileOperation == FTP_FILE_CHANGED) && ftpUploadComplete) {
+    imageIngest.submit(path, strcmp(path, ftpHashedPath) == 0 ? ftpHashedSha256 : nullptr);
+  }
+#endif
+#if THUMBNAILS_ENABLED
+  if ((fileOperation == FTP_FILE_CREATED || fileOperation == FTP_FILE_CHANGED) && ftpUploadComplete) {
+    thumbnailCache.submit(path);
   }
-  return count;
+#endif
+  ftpUploadComplete = false;
+  ftpHashedPath[0] = '\0';
+  deviceStatus.requestRefresh();
+}
+
+/**
+ * @brief Adds files stored over FTP to the content index. Runs with the FAT lock held.
+ */
+void ftpStoreHashCallback(const char* path, const uint8_t* sha256) {
+  contentIndex.record(path, sha256);
+  // --- The file callback for the same store follows at once ---
+  strncpy(ftpHashedPath, path, sizeof(ftpHashedPath) - 1);
+  ftpHashedPath[sizeof(ftpHashedPath) - 1] = '\0';
+  memcpy(ftpHashedSha256, sha256, sizeof(ftpHashedSha256));
 }
 
 // --- MQTT ---
@@ -1547,41 +2673,21 @@ void setupMqtt() {
   // Save the custom parameters to FS
   mqttClient.setServer(mqttConfig.host, String(mqttConfig.port).toInt());
   mqttClient.setCallback(callback);
+  mqttPublisher.begin(sendMqttMessage);
   HWSerial.println("MQTT client setup complete.");
 }
 
 /**
- * @brief Publishes the current status to the MQTT state topic.
+ * @brief Sends one MQTT message for mqttPublisher; fails while the client is not connected.
  */
-void publishMqttStatus() {
+bool sendMqttMessage(const char* topic, const char* payload, bool retain) {
 #if defined(MQTT_ENABLED) && MQTT_ENABLED == 1
   if (!mqttClient.connected()) {
-    return; // Don't publish if not connected
+    return false;
   }
-
-  DeviceInfo info;
-  getDeviceInfo(info);
-
-  const int JSON_STATUS_SIZE = JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(2);
-  DynamicJsonDocument jsonResponse(JSON_STATUS_SIZE);
-  jsonResponse["mode"] = info.modeString;
-  JsonObject display = jsonResponse.createNestedObject("display");
-  display["status"] = info.displayStatus;
-  display["orientation"] = info.displayOrientation;
-  JsonObject sd_card = jsonResponse.createNestedObject("sd_card");
-  sd_card["total_size"] = info.totalSize;
-  sd_card["used_size"] = info.usedSize;
-  sd_card["free_size"] = info.freeSize;
-  sd_card["file_count"] = info.fileCount;
-
-  String output;
-  serializeJson(jsonResponse, output);
-
-  const char* displayStatusMqtt = info.isDisplayOn ? "ON" : "OFF";
-
-  mqttClient.publish(MqttTopics::STATE, output.c_str(), true); // Retain message
-  mqttClient.publish(MqttTopics::DISPLAY_STATUS, displayStatusMqtt, true); // Retain message
-  HWSerial.println("Published MQTT status.");
+  return mqttClient.publish(topic, payload, retain);
+#else
+  return false;
 #endif
 }
 
@@ -1623,8 +2729,8 @@ void reconnect() {
     HWSerial.println("connected");
     // Subscribe
     mqttClient.subscribe(MqttTopics::DISPLAY_SET);
-    // Publish initial status
-    publishMqttStatus();
+    // --- Send every attribute once; the device may have changed while offline ---
+    mqttPublisher.resync();
   } else {
     HWSerial.print("failed, rc=");
     HWSerial.print(mqttClient.state());
@@ -1637,25 +2743,11 @@ void reconnect() {
 // --- Display ---
 
 /**
- * @brief Fetches the latest storage stats and redraws the MSC mode screen.
+ * @brief Asks for fresh storage stats; the MSC screen is redrawn once they change. Safe from any task.
  */
 void updateAndDrawMscScreen() {
   if (!card) return;
-
-  DeviceInfo info;
-  getDeviceInfo(info);
-
-#if defined(LCD_ENABLED) && LCD_ENABLED == 1
-  drawUsbMscModeScreen(
-    info.ipAddress,
-    info.macAddress,
-    info.fileCount,
-    info.totalSize / (1024 * 1024),
-    info.freeSize / (1024.0 * 1024.0),
-    info.mqttConnected
-  );
-#endif
-  HWSerial.println("MSC screen refreshed.");
+  deviceStatus.requestRefresh();
 }
 
 /**
@@ -1669,111 +2761,11 @@ void drawHeader(const char* title, uint16_t bannerColor) {
   tft.setTextSize(1);
 }
 
-/**
- * @brief Draws the storage statistics, adapting to the current orientation.
- */
-void drawStorageInfo(int files, int totalSizeMB, float freeSizeMB) {
-  uint8_t rotation = tft.getRotation();
-  bool isLandscape = (rotation == 1 || rotation == 3);
-
-  // --- Calculate usage ---
-  float usedSizeMB = totalSizeMB - freeSizeMB;
-  float usedPercentage = (totalSizeMB > 0) ? (usedSizeMB / totalSizeMB) * 100 : 0;
-  float totalSizeGB = totalSizeMB / 1024.0;
-  float usedSizeGB = usedSizeMB / 1024.0;
-
-  if (isLandscape) {
-    int y_pos = 53;
-    int x_pos = 5;
-
-    // --- Draw storage text info ---
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("Size:  ");
-    tft.setTextColor(CATPPUCCIN_PEACH);
-    tft.print(totalSizeGB, 2);
-    tft.print("GB");
-
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print(" Files: ");
-    tft.setTextColor(CATPPUCCIN_PEACH);
-    tft.print(files);
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("Used:  ");
-    tft.setTextColor(CATPPUCCIN_PEACH);
-    tft.print(usedSizeGB, 2);
-    tft.print("GB (");
-    tft.print((int)usedPercentage);
-    tft.print(" %)");
-    y_pos += 12;
-
-    // --- Draw capacity bar ---
-    int bar_x = x_pos;
-    int bar_height = 3;
-    int bar_y = tft.height() - bar_height;
-    int bar_width = TFT_HEIGHT - (2 * x_pos); // Bar width spans the screen with padding
-    int filled_width = (bar_width * usedPercentage) / 100;
-
-    tft.drawRect(bar_x, bar_y, bar_width, bar_height, CATPPUCCIN_BASE);
-    tft.fillRect(bar_x, bar_y, filled_width, bar_height, CATPPUCCIN_GREEN);
-  } else { // Portrait
-    int y_pos = 90;
-    int x_pos = 5;
-
-    // --- Draw storage text info ---
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("Files:");
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_PEACH);
-    tft.print(files);
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("Size:");
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_PEACH);
-    tft.print(totalSizeGB, 2);
-    tft.print("GB");
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("Used:");
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_PEACH);
-    tft.print(usedSizeGB, 2);
-    tft.print("GB (");
-    tft.print((int)usedPercentage);
-    tft.print(" %)");
-    y_pos += 12;
-
-    // --- Draw capacity bar ---
-    int bar_x = 0;
-    int bar_y = 12;
-    int bar_width = x_pos - 2;
-    int bar_height = tft.height() - 12;
-    int filled_height = (bar_height * usedPercentage) / 100;
-
-    tft.drawRect(bar_x, bar_y, bar_width, bar_height, CATPPUCCIN_BASE);
-    tft.fillRect(bar_x, y_pos - filled_height, bar_width, filled_height, CATPPUCCIN_GREEN);
-  }
-}
-
 /**
  * @brief Displays a generic information screen.
  */
 void drawInfoScreen(const char* title, const char* message, const char* version, uint16_t headerColor) {
+  statusScreen.invalidate();
   tft.fillScreen(CATPPUCCIN_BASE);
   drawHeader(title, headerColor);
 
@@ -1794,6 +2786,7 @@ void drawInfoScreen(const char* title, const char* message, const char* version,
  * @brief Displays the AP mode screen, adapting to the current orientation.
  */
 void drawApModeScreen(const char* ap_ssid, const char* ap_ip) {
+  statusScreen.invalidate();
   tft.fillScreen(CATPPUCCIN_BASE);
   drawHeader("FrameFi Setup", CATPPUCCIN_YELLOW);
 
@@ -1854,101 +2847,3 @@ void drawApModeScreen(const char* ap_ssid, const char* ap_ip) {
     tft.print(ap_ssid);
   }
 }
-
-/**
- * @brief Draws the MQTT connection status icon.
- */
-void drawMqttStatusIcon(bool mqttConnected, int x, int y) {
-  uint16_t color = mqttConnected ? CATPPUCCIN_GREEN : CATPPUCCIN_RED;
-  tft.fillCircle(x, y, 3, color); // Draw a small circle
-}
-
-/**
- * @brief Displays the main screen for a given mode (FTP or MSC).
- */
-void drawModeScreen(const char* mode, uint16_t headerColor, const char* ip, const char* mac, int files, int totalSizeMB, float freeSizeMB, bool mqttConnected) {
-  tft.fillScreen(CATPPUCCIN_BASE);
-  drawHeader("FrameFi", headerColor);
-
-  uint8_t rotation = tft.getRotation();
-  bool isLandscape = (rotation == 1 || rotation == 3);
-
-  int y_pos = 17;
-  int x_pos = 5;
-
-  // --- Draw Network Info ---
-  tft.setCursor(x_pos, y_pos);
-  tft.setTextColor(CATPPUCCIN_MAUVE);
-  if (isLandscape) {
-    tft.print("Mode:  ");
-    tft.setTextColor(CATPPUCCIN_GREEN);
-    tft.print(mode);
-    // --- Draw MQTT status icon ---
-    if (isMqttEnabled) {
-      drawMqttStatusIcon(mqttConnected, tft.getCursorX() + 8, y_pos + 3);
-    }
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("IP:    ");
-    tft.setTextColor(CATPPUCCIN_YELLOW);
-    tft.print(ip);
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("MAC:   ");
-    tft.setTextColor(CATPPUCCIN_YELLOW);
-    tft.print(mac);
-  } else { // Portrait
-    tft.print("Mode:");
-    y_pos += 12;
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_GREEN);
-    tft.print(mode);
-    // --- Draw MQTT status icon ---
-    if (isMqttEnabled) {
-      drawMqttStatusIcon(mqttConnected, tft.getCursorX() + 8, y_pos + 3);
-    }
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("IP:");
-    y_pos += 12;
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_YELLOW);
-    String ipStr = String(ip);
-    ipStr.replace(".", "");
-    tft.print(ipStr);
-    y_pos += 12;
-
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_MAUVE);
-    tft.print("MAC:");
-    y_pos += 12;
-    tft.setCursor(x_pos, y_pos);
-    tft.setTextColor(CATPPUCCIN_YELLOW);
-    String macStr = String(mac);
-    macStr.replace(":", "");
-    tft.print(macStr);
-  }
-
-  // --- Draw Storage Info ---
-  drawStorageInfo(files, totalSizeMB, freeSizeMB);
-}
-
-/**
- * @brief Displays the FTP mode screen.
- */
-void drawFtpModeScreen(const char* ip, const char* mac, int files, int totalSizeMB, float freeSizeMB, bool mqttConnected) {
-  drawModeScreen("FTP", CATPPUCCIN_GREEN, ip, mac, files, totalSizeMB, freeSizeMB, mqttConnected);
-}
-
-/**
- * @brief Displays the USB MSC mode screen.
- */
-void drawUsbMscModeScreen(const char* ip, const char* mac, int files, int totalSizeMB, float freeSizeMB, bool mqttConnected) {
-  drawModeScreen("USB MSC", CATPPUCCIN_MAUVE, ip, mac, files, totalSizeMB, freeSizeMB, mqttConnected);
-}
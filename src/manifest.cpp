@@ -0,0 +1,191 @@
+/******************************************************************************
+ *
+ * FrameFi - Manifest
+ * ----------------
+ * Background-built listing of every file on the card with size and mtime,
+ * served over HTTP so sync clients can compute deltas in one round trip.
+ *
+ *****************************************************************************/
+
+#include "manifest.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "file_index.h"
+#include "upload_writer.h"
+
+Manifest manifest;
+
+Manifest::Manifest() : task(nullptr), built(false), builtGeneration(0) {}
+
+/**
+ * @brief Starts the background task that keeps the manifest current.
+ */
+bool Manifest::begin() {
+  if (task) {
+    return true;
+  }
+  if (xTaskCreatePinnedToCore(taskEntry, "manifest", 6144, this, 1, &task, MANIFEST_TASK_CORE) != pdPASS) {
+    task = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Wakes the task to check for changes now. Safe from any task.
+ */
+void Manifest::requestRebuild() {
+  if (task) {
+    xTaskNotifyGive(task);
+  }
+}
+
+/**
+ * @brief Returns true if the manifest file matches the card.
+ */
+bool Manifest::isCurrent() const {
+  return built && builtGeneration == fileIndex.generation();
+}
+
+/**
+ * @brief Converts a FAT date and time to seconds since the epoch, as the VFS layer does.
+ */
+static uint32_t fatTimeToEpoch(WORD date, WORD time) {
+  struct tm local = {};
+  local.tm_year = ((date >> 9) & 0x7F) + 80;
+  local.tm_mon = ((date >> 5) & 0x0F) - 1;
+  local.tm_mday = date & 0x1F;
+  local.tm_hour = (time >> 11) & 0x1F;
+  local.tm_min = (time >> 5) & 0x3F;
+  local.tm_sec = (time & 0x1F) * 2;
+  local.tm_isdst = -1;
+  return (uint32_t)mktime(&local);
+}
+
+/**
+ * @brief Returns true for entries that do not belong in the listing.
+ */
+static bool isHidden(const std::string& directory, const char* name) {
+  if (directory == "/" && strcmp(name, STORAGE_DATA_DIR + 1) == 0) {
+    return true;
+  }
+  size_t length = strlen(name);
+  size_t suffixLength = strlen(UPLOAD_PART_SUFFIX);
+  return length > suffixLength && strcmp(name + length - suffixLength, UPLOAD_PART_SUFFIX) == 0;
+}
+
+/**
+ * @brief Scans the card and replaces the manifest file. Gives up if the card changes hands.
+ */
+bool Manifest::rebuild() {
+  uint32_t generation = fileIndex.generation();
+  UploadWriter* writer = new UploadWriter();
+  static const char header[] = "# path\tsize\tmtime\n";
+
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool ok = storage.fatOwnsCard();
+  if (ok) {
+    f_mkdir(STORAGE_FAT_DRIVE STORAGE_DATA_DIR);
+    ok = writer->begin(MANIFEST_PATH, 0) == FR_OK && writer->write((const uint8_t*)header, sizeof(header) - 1) == FR_OK;
+  }
+  xSemaphoreGive(fatMutex);
+
+  // --- Directories still to list, each with a trailing slash ---
+  std::vector<std::string> pending;
+  pending.push_back("/");
+  FF_DIR dir;
+  FILINFO entry;
+  char line[FF_MAX_LFN * 2 + 48];
+
+  while (ok && !pending.empty()) {
+    std::string directory = pending.back();
+    pending.pop_back();
+    std::string drivePath = STORAGE_FAT_DRIVE + directory;
+
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    bool opened = storage.fatOwnsCard() && f_opendir(&dir, drivePath.c_str()) == FR_OK;
+    ok = opened;
+    for (uint32_t count = 1; ok; count++) {
+      if (f_readdir(&dir, &entry) != FR_OK) {
+        ok = false;
+        break;
+      }
+      if (entry.fname[0] == '\0') {
+        break;
+      }
+      if (!isHidden(directory, entry.fname)) {
+        if (entry.fattrib & AM_DIR) {
+          pending.push_back(directory + entry.fname + "/");
+        } else {
+          int length = snprintf(line, sizeof(line), "%s%s\t%lu\t%lu\n", directory.c_str(), entry.fname,
+                                (unsigned long)entry.fsize, (unsigned long)fatTimeToEpoch(entry.fdate, entry.ftime));
+          if (length > 0 && length < (int)sizeof(line)) {
+            ok = writer->write((const uint8_t*)line, length) == FR_OK;
+          }
+        }
+      }
+      // --- Let transfers and mode switches in between batches ---
+      if (count % MANIFEST_BATCH == 0) {
+        xSemaphoreGive(fatMutex);
+        vTaskDelay(1);
+        xSemaphoreTake(fatMutex, portMAX_DELAY);
+        ok = ok && storage.fatOwnsCard();
+      }
+    }
+    if (opened) {
+      f_closedir(&dir);
+    }
+    xSemaphoreGive(fatMutex);
+  }
+
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  if (ok && storage.fatOwnsCard()) {
+    ok = writer->commit() == FR_OK;
+  } else {
+    ok = false;
+    if (storage.fatOwnsCard()) {
+      writer->abort();
+    }
+  }
+  xSemaphoreGive(fatMutex);
+  delete writer;
+
+  if (ok) {
+    builtGeneration = generation;
+    built = true;
+  }
+  return ok;
+}
+
+void Manifest::taskEntry(void* arg) {
+  static_cast<Manifest*>(arg)->runTask();
+}
+
+/**
+ * @brief Manifest task: rebuilds once the file index generation has settled.
+ */
+void Manifest::runTask() {
+  uint32_t seenGeneration = fileIndex.generation();
+  uint32_t lastChangeMs = millis();
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MANIFEST_CHECK_MS));
+    uint32_t generation = fileIndex.generation();
+    if (generation != seenGeneration) {
+      seenGeneration = generation;
+      lastChangeMs = millis();
+    }
+    if (!isCurrent() && storage.fatOwnsCard() && millis() - lastChangeMs >= MANIFEST_SETTLE_MS) {
+      if (!rebuild()) {
+        // --- Back off for another settle period instead of rescanning every check ---
+        lastChangeMs = millis();
+      }
+    }
+  }
+}
@@ -0,0 +1,195 @@
+/******************************************************************************
+ *
+ * FrameFi - MQTT Publisher
+ * ----------------
+ * Change-driven MQTT publishing: bursts of status changes are coalesced
+ * and only the attributes that changed are sent, each to its own retained
+ * topic.
+ *
+ *****************************************************************************/
+
+#include "mqtt_publisher.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <ArduinoJson.h>
+
+MqttPublisher mqttPublisher;
+
+// --- Attribute topics below MQTT_TOPIC_PREFIX, in Attribute order ---
+static const char* const ATTRIBUTE_TOPICS[] = {
+  "mode",
+  "display/status",
+  "display/orientation",
+  "ip_address",
+  "sd_card/file_count",
+  "sd_card/total_size",
+  "sd_card/used_size",
+  "sd_card/free_size",
+  "led/color",
+  "led/brightness",
+};
+
+MqttPublisher::MqttPublisher()
+    : sender(nullptr), seenVersion(0), firstChangeMs(0), lastChangeMs(0), pending(false), flushNow(false),
+      stateStale(false), known(0), sent{}, counters{0, 0, 0} {}
+
+/**
+ * @brief Sets the function that sends a message. Call once at setup.
+ */
+void MqttPublisher::begin(Sender send) {
+  sender = send;
+}
+
+/**
+ * @brief Sends every attribute on the next poll; call after connecting to the broker.
+ */
+void MqttPublisher::resync() {
+  known = 0;
+  stateStale = MQTT_STATE_JSON_ENABLED;
+  pending = true;
+  // --- No reason to wait; the broker has nothing newer ---
+  flushNow = true;
+}
+
+/**
+ * @brief Writes the payload of an attribute.
+ */
+void MqttPublisher::format(Attribute attribute, const DeviceInfo& info, char* out) const {
+  switch (attribute) {
+    case ATTR_MODE:
+      // --- msc/ftp, as frame-fi/mode/set takes them; the long name stays in frame-fi/state ---
+      snprintf(out, MQTT_VALUE_SIZE, "%s", info.isInMscMode ? "msc" : "ftp");
+      break;
+    case ATTR_DISPLAY_STATUS:
+      // --- ON/OFF, as frame-fi/display/set takes them ---
+      snprintf(out, MQTT_VALUE_SIZE, "%s", info.isDisplayOn ? "ON" : "OFF");
+      break;
+    case ATTR_DISPLAY_ORIENTATION:
+      snprintf(out, MQTT_VALUE_SIZE, "%d", info.displayOrientation);
+      break;
+    case ATTR_IP_ADDRESS:
+      snprintf(out, MQTT_VALUE_SIZE, "%s", info.ipAddress);
+      break;
+    case ATTR_FILE_COUNT:
+      snprintf(out, MQTT_VALUE_SIZE, "%d", info.fileCount);
+      break;
+    case ATTR_TOTAL_SIZE:
+      snprintf(out, MQTT_VALUE_SIZE, "%" PRIu64, info.totalSize);
+      break;
+    case ATTR_USED_SIZE:
+      snprintf(out, MQTT_VALUE_SIZE, "%" PRIu64, info.usedSize);
+      break;
+    case ATTR_FREE_SIZE:
+      snprintf(out, MQTT_VALUE_SIZE, "%" PRIu64, info.freeSize);
+      break;
+    case ATTR_LED_COLOR:
+      snprintf(out, MQTT_VALUE_SIZE, "%s", info.ledColor ? info.ledColor : "");
+      break;
+    default:
+      snprintf(out, MQTT_VALUE_SIZE, "%d", info.ledBrightness);
+      break;
+  }
+  // --- An empty retained message would clear the topic on the broker ---
+  if (out[0] == '\0') {
+    snprintf(out, MQTT_VALUE_SIZE, "unknown");
+  }
+}
+
+/**
+ * @brief Sends one retained message and counts it.
+ */
+bool MqttPublisher::send(const char* topic, const char* payload) {
+  if (!sender(topic, payload, true)) {
+    return false;
+  }
+  counters.messages++;
+  counters.bytes += strlen(payload);
+  return true;
+}
+
+/**
+ * @brief Sends the combined frame-fi/state JSON.
+ */
+bool MqttPublisher::sendState(const DeviceInfo& info) {
+  StaticJsonDocument<JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(4)> state;
+  state["mode"] = info.modeString;
+  JsonObject display = state.createNestedObject("display");
+  display["status"] = info.displayStatus;
+  display["orientation"] = info.displayOrientation;
+  JsonObject sdCard = state.createNestedObject("sd_card");
+  sdCard["total_size"] = info.totalSize;
+  sdCard["used_size"] = info.usedSize;
+  sdCard["free_size"] = info.freeSize;
+  sdCard["file_count"] = info.fileCount;
+  char output[192];
+  serializeJson(state, output, sizeof(output));
+  return send(MQTT_TOPIC_PREFIX "state", output);
+}
+
+/**
+ * @brief Sends the attributes that changed once a burst of changes has settled. Runs on the network task.
+ */
+void MqttPublisher::poll(uint32_t now) {
+  if (!sender) {
+    return;
+  }
+  uint32_t version = deviceStatus.version();
+  if (version != seenVersion) {
+    if (!pending) {
+      firstChangeMs = now;
+    }
+    seenVersion = version;
+    lastChangeMs = now;
+    pending = true;
+  }
+  // --- Wait for the burst to settle, but not forever while changes keep coming ---
+  if (!pending) {
+    return;
+  }
+  if (!flushNow && now - lastChangeMs < MQTT_DEBOUNCE_MS && now - firstChangeMs < MQTT_DEBOUNCE_MAX_MS) {
+    return;
+  }
+  flushNow = false;
+
+  DeviceInfo info;
+  deviceStatus.read(info);
+  bool ok = true;
+  uint8_t changed = 0;
+  char value[MQTT_VALUE_SIZE];
+  char topic[48];
+  for (uint8_t i = 0; ok && i < ATTR_COUNT; i++) {
+    Attribute attribute = (Attribute)i;
+    format(attribute, info, value);
+    if ((known & (1 << i)) && strcmp(value, sent[i]) == 0) {
+      continue;
+    }
+    snprintf(topic, sizeof(topic), MQTT_TOPIC_PREFIX "%s", ATTRIBUTE_TOPICS[i]);
+    ok = send(topic, value);
+    if (ok) {
+      strcpy(sent[i], value);
+      known |= 1 << i;
+      changed++;
+      // --- frame-fi/state carries everything but the network and LED attributes ---
+      if (MQTT_STATE_JSON_ENABLED && attribute != ATTR_IP_ADDRESS && attribute != ATTR_LED_COLOR && attribute != ATTR_LED_BRIGHTNESS) {
+        stateStale = true;
+      }
+    }
+  }
+  if (ok && stateStale) {
+    ok = sendState(info);
+    stateStale = !ok;
+  }
+
+  if (changed) {
+    counters.flushes++;
+  }
+  if (ok) {
+    pending = false;
+  } else {
+    // --- Not connected; what was not sent is tried again after the next quiet period ---
+    firstChangeMs = lastChangeMs = now;
+  }
+}
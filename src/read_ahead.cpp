@@ -0,0 +1,346 @@
+/******************************************************************************
+ *
+ * FrameFi - Read-Ahead
+ * ----------------
+ * Sequential read-ahead for the USB MSC path. A small ring of DMA-capable
+ * buffers is filled by a task on the other core while the host consumes
+ * the previous one.
+ *
+ *****************************************************************************/
+
+#include "read_ahead.h"
+
+#include <string.h>
+
+ReadAhead::ReadAhead()
+    : dev{nullptr, nullptr, nullptr}, sectorBytes(0), totalSectors(0), bufferCount(0),
+      bufferSectors(0), buffers{}, attached(false), streamEnd(0), streamRun(0), window(0),
+      stateMutex(nullptr), deviceMutex(nullptr), task(nullptr), counters{} {}
+
+/**
+ * @brief Attaches to a device using caller-owned, DMA-capable buffer memory.
+ */
+bool ReadAhead::begin(const BlockDevice& device, uint16_t sectorSize, uint32_t sectorCount,
+                      uint8_t* bufferMemory, uint8_t count, uint16_t sectorsPerBuffer) {
+  end();
+  if (!device.read || !device.write || !bufferMemory || sectorSize == 0 || count == 0 ||
+      sectorsPerBuffer == 0) {
+    return false;
+  }
+  if (count > READ_AHEAD_BUFFERS) {
+    count = READ_AHEAD_BUFFERS;
+  }
+
+  // --- The task and locks outlive a detach so a later begin() can reuse them ---
+  if (!stateMutex) {
+    stateMutex = xSemaphoreCreateMutex();
+  }
+  if (!deviceMutex) {
+    deviceMutex = xSemaphoreCreateMutex();
+  }
+  if (!stateMutex || !deviceMutex) {
+    return false;
+  }
+  if (!task && xTaskCreatePinnedToCore(taskEntry, "read_ahead", 3072, this, 2, &task,
+                                       READ_AHEAD_CORE) != pdPASS) {
+    task = nullptr;
+    return false;
+  }
+
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  dev = device;
+  sectorBytes = sectorSize;
+  totalSectors = sectorCount;
+  bufferCount = count;
+  bufferSectors = sectorsPerBuffer;
+  for (uint8_t i = 0; i < bufferCount; i++) {
+    buffers[i].data = bufferMemory + (size_t)i * bufferSectors * sectorBytes;
+    buffers[i].state = EMPTY;
+    buffers[i].stale = false;
+  }
+  streamEnd = 0;
+  streamRun = 0;
+  window = 0;
+  memset(&counters, 0, sizeof(counters));
+  attached = true;
+  xSemaphoreGive(stateMutex);
+  return true;
+}
+
+/**
+ * @brief Waits for any prefetch in flight and detaches from the device.
+ */
+void ReadAhead::end() {
+  if (!attached) {
+    return;
+  }
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  attached = false;
+  xSemaphoreGive(stateMutex);
+
+  // --- Once the device lock is ours, nothing else can be touching the card ---
+  xSemaphoreTake(deviceMutex, portMAX_DELAY);
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  for (uint8_t i = 0; i < bufferCount; i++) {
+    buffers[i].state = EMPTY;
+  }
+  window = 0;
+  xSemaphoreGive(stateMutex);
+  xSemaphoreGive(deviceMutex);
+}
+
+/**
+ * @brief Returns the buffer holding an LBA, or -1 if none does.
+ */
+int ReadAhead::findBuffer(uint32_t lba) const {
+  for (uint8_t i = 0; i < bufferCount; i++) {
+    const Buffer& buffer = buffers[i];
+    if (buffer.state != EMPTY && lba >= buffer.lba && lba < buffer.lba + buffer.count) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Returns a buffer to the pool, counting unread prefetched data.
+ */
+void ReadAhead::release(Buffer& buffer) {
+  if (buffer.state == READY) {
+    counters.dropped += buffer.count;
+  }
+  buffer.state = EMPTY;
+}
+
+/**
+ * @brief Queues buffers so that `window` buffers stay ahead of nextLba.
+ */
+void ReadAhead::schedule(uint32_t nextLba) {
+  // --- Reclaim anything the stream has already moved past ---
+  for (uint8_t i = 0; i < bufferCount; i++) {
+    Buffer& buffer = buffers[i];
+    if (buffer.state != EMPTY && buffer.state != LOADING && buffer.lba + buffer.count <= nextLba) {
+      release(buffer);
+    }
+  }
+
+  // --- Skip over data that is already buffered or on its way ---
+  uint32_t next = nextLba;
+  uint8_t ahead = 0;
+  int index;
+  while ((index = findBuffer(next)) >= 0) {
+    next = buffers[index].lba + buffers[index].count;
+    ahead++;
+  }
+
+  while (ahead < window && next < totalSectors) {
+    Buffer* slot = nullptr;
+    for (uint8_t i = 0; i < bufferCount; i++) {
+      if (buffers[i].state == EMPTY) {
+        slot = &buffers[i];
+        break;
+      }
+    }
+    if (!slot) {
+      break;
+    }
+    uint32_t remaining = totalSectors - next;
+    slot->lba = next;
+    slot->count = remaining < bufferSectors ? remaining : bufferSectors;
+    slot->stale = false;
+    slot->state = QUEUED;
+    next += slot->count;
+    ahead++;
+  }
+}
+
+/**
+ * @brief Reads sectors, serving prefetched data where available.
+ */
+bool ReadAhead::read(uint32_t lba, uint32_t count, uint8_t* dst) {
+  if (!attached) {
+    return false;
+  }
+
+  // --- Track the stream; a request landing in a prefetched buffer counts as sequential ---
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  if (lba == streamEnd || findBuffer(lba) >= 0) {
+    streamRun++;
+  } else {
+    streamRun = 0;
+    window /= 2;
+  }
+  streamEnd = lba + count;
+  xSemaphoreGive(stateMutex);
+
+  uint32_t i = 0;
+  while (i < count) {
+    uint32_t sector = lba + i;
+    xSemaphoreTake(stateMutex, portMAX_DELAY);
+    int index = findBuffer(sector);
+
+    if (index >= 0 && buffers[index].state == READY) {
+      Buffer& buffer = buffers[index];
+      uint32_t bufferEnd = buffer.lba + buffer.count;
+      uint32_t run = bufferEnd - sector;
+      if (run > count - i) {
+        run = count - i;
+      }
+      memcpy(dst + i * sectorBytes, buffer.data + (sector - buffer.lba) * sectorBytes,
+             run * sectorBytes);
+      counters.hits += run;
+      i += run;
+      if (sector + run >= bufferEnd) {
+        buffer.state = EMPTY;  // fully consumed
+      }
+      xSemaphoreGive(stateMutex);
+      continue;
+    }
+
+    if (index >= 0 && buffers[index].state == LOADING) {
+      // --- The prefetch task holds the device lock until the load lands ---
+      xSemaphoreGive(stateMutex);
+      xSemaphoreTake(deviceMutex, portMAX_DELAY);
+      xSemaphoreGive(deviceMutex);
+      continue;
+    }
+
+    if (index >= 0) {
+      buffers[index].state = EMPTY;  // queued but not started; read it now instead
+    }
+
+    // --- Read on demand up to the next buffered sector ---
+    uint32_t run = count - i;
+    for (uint8_t b = 0; b < bufferCount; b++) {
+      const Buffer& buffer = buffers[b];
+      if (buffer.state != EMPTY && buffer.lba > sector && buffer.lba - sector < run) {
+        run = buffer.lba - sector;
+      }
+    }
+    xSemaphoreGive(stateMutex);
+
+    xSemaphoreTake(deviceMutex, portMAX_DELAY);
+    bool ok = dev.read(dev.context, sector, run, dst + i * sectorBytes);
+    xSemaphoreGive(deviceMutex);
+    if (!ok) {
+      return false;
+    }
+    counters.misses += run;
+    i += run;
+  }
+
+  // --- Keep a sustained stream fed, widening the window as it continues ---
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  bool queued = false;
+  if (streamRun >= READ_AHEAD_TRIGGER) {
+    if (window < bufferCount) {
+      window++;
+    }
+    schedule(lba + count);
+    queued = true;
+  }
+  xSemaphoreGive(stateMutex);
+  if (queued) {
+    xTaskNotifyGive(task);
+  }
+  return true;
+}
+
+/**
+ * @brief Writes sectors through to the device, dropping stale prefetches.
+ */
+bool ReadAhead::write(uint32_t lba, uint32_t count, const uint8_t* src) {
+  if (!attached) {
+    return false;
+  }
+
+  xSemaphoreTake(stateMutex, portMAX_DELAY);
+  for (uint8_t i = 0; i < bufferCount; i++) {
+    Buffer& buffer = buffers[i];
+    if (buffer.state == EMPTY || buffer.lba >= lba + count || buffer.lba + buffer.count <= lba) {
+      continue;
+    }
+    if (buffer.state == LOADING) {
+      buffer.stale = true;
+    } else {
+      release(buffer);
+    }
+  }
+  xSemaphoreGive(stateMutex);
+
+  xSemaphoreTake(deviceMutex, portMAX_DELAY);
+  bool ok = dev.write(dev.context, lba, count, src);
+  xSemaphoreGive(deviceMutex);
+  return ok;
+}
+
+/**
+ * @brief Returns the percentage of sectors served from prefetch buffers.
+ */
+float ReadAhead::hitRate() const {
+  uint32_t total = counters.hits + counters.misses;
+  return total == 0 ? 0.0f : (counters.hits * 100.0f) / total;
+}
+
+/**
+ * @brief Returns a BlockDevice that routes through this read-ahead.
+ */
+BlockDevice ReadAhead::asBlockDevice() {
+  BlockDevice device = {this, deviceRead, deviceWrite};
+  return device;
+}
+
+bool ReadAhead::deviceRead(void* context, uint32_t lba, uint32_t count, uint8_t* dst) {
+  return static_cast<ReadAhead*>(context)->read(lba, count, dst);
+}
+
+bool ReadAhead::deviceWrite(void* context, uint32_t lba, uint32_t count, const uint8_t* src) {
+  return static_cast<ReadAhead*>(context)->write(lba, count, src);
+}
+
+void ReadAhead::taskEntry(void* arg) {
+  static_cast<ReadAhead*>(arg)->runTask();
+}
+
+/**
+ * @brief Prefetch task: loads queued buffers in LBA order.
+ */
+void ReadAhead::runTask() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    for (;;) {
+      xSemaphoreTake(deviceMutex, portMAX_DELAY);
+      xSemaphoreTake(stateMutex, portMAX_DELAY);
+      Buffer* next = nullptr;
+      if (attached) {
+        for (uint8_t i = 0; i < bufferCount; i++) {
+          if (buffers[i].state == QUEUED && (!next || buffers[i].lba < next->lba)) {
+            next = &buffers[i];
+          }
+        }
+      }
+      if (!next) {
+        xSemaphoreGive(stateMutex);
+        xSemaphoreGive(deviceMutex);
+        break;
+      }
+      next->state = LOADING;
+      xSemaphoreGive(stateMutex);
+
+      // --- Hold the device lock across the load so readers can wait on it ---
+      bool ok = dev.read(dev.context, next->lba, next->count, next->data);
+
+      xSemaphoreTake(stateMutex, portMAX_DELAY);
+      if (ok && !next->stale && attached) {
+        next->state = READY;
+        counters.prefetched += next->count;
+      } else {
+        next->state = EMPTY;
+      }
+      xSemaphoreGive(stateMutex);
+      xSemaphoreGive(deviceMutex);
+      taskYIELD();
+    }
+  }
+}
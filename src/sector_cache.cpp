@@ -0,0 +1,286 @@
+/******************************************************************************
+ *
+ * FrameFi - Sector Cache
+ * ----------------
+ * Write-back sector cache for the USB MSC path. Sectors are kept in an
+ * array sorted by LBA so lookups are a binary search and a flush can walk
+ * the dirty sectors in order, merging neighbours into multi-block writes.
+ *
+ *****************************************************************************/
+
+#include "sector_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+SectorCache::SectorCache()
+    : dev{nullptr, nullptr, nullptr}, sectorBytes(0), capacity(0), used(0), dirtyCount(0),
+      stagingCapacity(0), slots(nullptr), staging(nullptr), slotLba(nullptr), slotDirty(nullptr),
+      order(nullptr), freeList(nullptr), freeCount(0), lastWriteMs(0), counters{} {}
+
+/**
+ * @brief Attaches the cache to a device using caller-owned memory.
+ */
+bool SectorCache::begin(const BlockDevice& device, uint16_t sectorSize, uint16_t slotCount,
+                        uint8_t* slotMemory, uint8_t* stagingBuffer, uint16_t stagingSectors) {
+  if (isAttached()) {
+    end();
+  }
+  if (!device.read || !device.write || !slotMemory || !stagingBuffer || sectorSize == 0 ||
+      slotCount == 0 || stagingSectors == 0) {
+    return false;
+  }
+
+  // --- Bookkeeping is small, so it always lives on the regular heap ---
+  slotLba = (uint32_t*)malloc(slotCount * sizeof(uint32_t));
+  slotDirty = (bool*)malloc(slotCount * sizeof(bool));
+  order = (uint16_t*)malloc(slotCount * sizeof(uint16_t));
+  freeList = (uint16_t*)malloc(slotCount * sizeof(uint16_t));
+  if (!slotLba || !slotDirty || !order || !freeList) {
+    free(slotLba);
+    free(slotDirty);
+    free(order);
+    free(freeList);
+    slotLba = nullptr;
+    slotDirty = nullptr;
+    order = nullptr;
+    freeList = nullptr;
+    return false;
+  }
+
+  dev = device;
+  sectorBytes = sectorSize;
+  capacity = slotCount;
+  slots = slotMemory;
+  staging = stagingBuffer;
+  stagingCapacity = stagingSectors;
+  memset(&counters, 0, sizeof(counters));
+  invalidate();
+  return true;
+}
+
+/**
+ * @brief Flushes and detaches the cache.
+ */
+bool SectorCache::end() {
+  if (!isAttached()) {
+    return true;
+  }
+  bool ok = flush();
+  free(slotLba);
+  free(slotDirty);
+  free(order);
+  free(freeList);
+  slotLba = nullptr;
+  slotDirty = nullptr;
+  order = nullptr;
+  freeList = nullptr;
+  slots = nullptr;
+  staging = nullptr;
+  capacity = 0;
+  used = 0;
+  dirtyCount = 0;
+  freeCount = 0;
+  return ok;
+}
+
+/**
+ * @brief Drops every cached sector without writing it back.
+ */
+void SectorCache::invalidate() {
+  used = 0;
+  dirtyCount = 0;
+  freeCount = capacity;
+  for (uint16_t i = 0; i < capacity; i++) {
+    slotDirty[i] = false;
+    freeList[i] = capacity - 1 - i;
+  }
+}
+
+/**
+ * @brief Finds the slot holding an LBA; position receives its sorted index.
+ */
+int SectorCache::findSlot(uint32_t lba, uint16_t* position) const {
+  uint16_t low = 0;
+  uint16_t high = used;
+  while (low < high) {
+    uint16_t mid = (low + high) / 2;
+    if (slotLba[order[mid]] < lba) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  *position = low;
+  if (low < used && slotLba[order[low]] == lba) {
+    return order[low];
+  }
+  return -1;
+}
+
+/**
+ * @brief Takes a free slot for an LBA and records it at a sorted position.
+ */
+int SectorCache::insertSlot(uint32_t lba, uint16_t position) {
+  uint16_t slot = freeList[--freeCount];
+  memmove(&order[position + 1], &order[position], (used - position) * sizeof(uint16_t));
+  order[position] = slot;
+  slotLba[slot] = lba;
+  slotDirty[slot] = false;
+  used++;
+  return slot;
+}
+
+/**
+ * @brief Releases the slot at a sorted position.
+ */
+void SectorCache::removeAt(uint16_t position) {
+  uint16_t slot = order[position];
+  if (slotDirty[slot]) {
+    slotDirty[slot] = false;
+    dirtyCount--;
+  }
+  memmove(&order[position], &order[position + 1], (used - position - 1) * sizeof(uint16_t));
+  freeList[freeCount++] = slot;
+  used--;
+}
+
+/**
+ * @brief Reads sectors, serving cached copies where present.
+ */
+bool SectorCache::read(uint32_t lba, uint32_t count, uint8_t* dst) {
+  uint32_t i = 0;
+  while (i < count) {
+    uint16_t position;
+    int slot = findSlot(lba + i, &position);
+    if (slot >= 0) {
+      memcpy(dst + i * sectorBytes, slots + slot * sectorBytes, sectorBytes);
+      counters.readHits++;
+      i++;
+      continue;
+    }
+
+    // --- Read the whole gap up to the next cached sector in one command ---
+    uint32_t run = count - i;
+    if (position < used) {
+      uint32_t gap = slotLba[order[position]] - (lba + i);
+      if (gap < run) {
+        run = gap;
+      }
+    }
+    if (!dev.read(dev.context, lba + i, run, dst + i * sectorBytes)) {
+      return false;
+    }
+    counters.readMisses += run;
+    i += run;
+  }
+  return true;
+}
+
+/**
+ * @brief Writes sectors into the cache, flushing when it fills up.
+ */
+bool SectorCache::write(uint32_t lba, uint32_t count, const uint8_t* src, uint32_t nowMs) {
+  lastWriteMs = nowMs;
+
+  if (count >= MSC_CACHE_BYPASS_SECTORS || count > capacity) {
+    // --- Bulk data gains nothing from caching; drop superseded copies and write through ---
+    uint16_t position;
+    findSlot(lba, &position);
+    while (position < used && slotLba[order[position]] < lba + count) {
+      removeAt(position);
+    }
+    counters.writesBypassed += count;
+    return dev.write(dev.context, lba, count, src);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t position;
+    int slot = findSlot(lba + i, &position);
+    if (slot < 0) {
+      if (freeCount == 0) {
+        // --- Cache is full: write everything back and start over ---
+        if (!flush()) {
+          return false;
+        }
+        invalidate();
+        position = 0;
+      }
+      slot = insertSlot(lba + i, position);
+    }
+    memcpy(slots + slot * sectorBytes, src + i * sectorBytes, sectorBytes);
+    if (!slotDirty[slot]) {
+      slotDirty[slot] = true;
+      dirtyCount++;
+    }
+    counters.writesAbsorbed++;
+  }
+  return true;
+}
+
+/**
+ * @brief Gathers a run of consecutive sectors into the staging buffer and writes it.
+ */
+bool SectorCache::writeRun(uint16_t first, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    memcpy(staging + i * sectorBytes, slots + order[first + i] * sectorBytes, sectorBytes);
+  }
+  if (!dev.write(dev.context, slotLba[order[first]], length, staging)) {
+    return false;
+  }
+  for (uint16_t i = 0; i < length; i++) {
+    uint16_t slot = order[first + i];
+    if (slotDirty[slot]) {
+      slotDirty[slot] = false;
+      dirtyCount--;
+    }
+  }
+  counters.deviceWrites++;
+  counters.sectorsFlushed += length;
+  return true;
+}
+
+/**
+ * @brief Writes all dirty sectors back to the device.
+ */
+bool SectorCache::flush() {
+  if (dirtyCount == 0) {
+    return true;
+  }
+  counters.flushes++;
+
+  uint16_t position = 0;
+  while (position < used && dirtyCount > 0) {
+    if (!slotDirty[order[position]]) {
+      position++;
+      continue;
+    }
+
+    // --- Extend over neighbouring LBAs; clean ones are rewritten to avoid splitting the command ---
+    uint16_t length = 1;
+    uint16_t lastDirty = 1;
+    while (position + length < used && length < stagingCapacity &&
+           slotLba[order[position + length]] == slotLba[order[position]] + length) {
+      length++;
+      if (slotDirty[order[position + length - 1]]) {
+        lastDirty = length;
+      }
+    }
+
+    if (!writeRun(position, lastDirty)) {
+      return false;
+    }
+    position += lastDirty;
+  }
+  return true;
+}
+
+/**
+ * @brief Flushes if dirty data has been idle for at least idleMs.
+ */
+bool SectorCache::flushIfIdle(uint32_t nowMs, uint32_t idleMs) {
+  if (dirtyCount == 0 || (uint32_t)(nowMs - lastWriteMs) < idleMs) {
+    return true;
+  }
+  return flush();
+}
@@ -0,0 +1,318 @@
+/******************************************************************************
+ *
+ * FrameFi - Status Screen
+ * ----------------
+ * Retained mode screen: widgets are compared with what the panel shows and
+ * only the changed ones are drawn off-screen and pushed.
+ *
+ *****************************************************************************/
+
+#include "status_screen.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "catppuccin_colors.h"
+
+StatusScreen statusScreen;
+
+StatusScreen::StatusScreen()
+    : tft(nullptr), lines{nullptr, nullptr}, bar(nullptr), nextLine(0), landscape(true), dma(false), valid(false),
+      barStart(0), barFilled(0), barColor(CATPPUCCIN_GREEN), regions{}, shown{}, counters{0, 0, 0} {}
+
+/**
+ * @brief Sets up the sprites and DMA for the panel's current rotation.
+ */
+bool StatusScreen::begin(TFT_eSPI& display) {
+  if (tft) {
+    return true;
+  }
+  tft = &display;
+  uint8_t rotation = tft->getRotation();
+  landscape = (rotation == 1 || rotation == 3);
+  layout();
+
+#ifdef ESP32_DMA
+  dma = tft->initDMA();
+#endif
+
+  // --- A line each; DMA only reads internal RAM, so they stay out of PSRAM when it is used ---
+  int lineHeight = landscape ? STATUS_LINE_HEIGHT : 2 * STATUS_LINE_HEIGHT;
+  for (uint8_t i = 0; i < 2; i++) {
+    lines[i] = new TFT_eSprite(tft);
+    if (dma) {
+      lines[i]->setAttribute(PSRAM_ENABLE, false);
+    }
+    lines[i]->setColorDepth(16);
+    if (!lines[i]->createSprite(tft->width(), lineHeight)) {
+      return false;
+    }
+  }
+  bar = new TFT_eSprite(tft);
+  if (dma) {
+    bar->setAttribute(PSRAM_ENABLE, false);
+  }
+  bar->setColorDepth(16);
+  if (!bar->createSprite(regions[WIDGET_BAR].w, regions[WIDGET_BAR].h)) {
+    return false;
+  }
+  valid = false;
+  return true;
+}
+
+/**
+ * @brief Places the widgets; the same positions the screen has always used.
+ */
+void StatusScreen::layout() {
+  int16_t width = tft->width();
+  int16_t height = tft->height();
+  regions[WIDGET_HEADER] = {0, 0, width, 12};
+  if (landscape) {
+    regions[WIDGET_MODE] = {0, 17, width, STATUS_LINE_HEIGHT};
+    regions[WIDGET_IP] = {0, 29, width, STATUS_LINE_HEIGHT};
+    regions[WIDGET_MAC] = {0, 41, width, STATUS_LINE_HEIGHT};
+    regions[WIDGET_FILES] = {0, 0, 0, 0};  // Shares the size line
+    regions[WIDGET_SIZE] = {0, 53, width, STATUS_LINE_HEIGHT};
+    regions[WIDGET_USED] = {0, 65, width, STATUS_LINE_HEIGHT};
+    regions[WIDGET_BAR] = {5, (int16_t)(height - 3), (int16_t)(width - 10), 3};
+  } else {
+    // --- Label and value on two lines; the bar runs down the left edge ---
+    regions[WIDGET_MODE] = {0, 17, width, 2 * STATUS_LINE_HEIGHT};
+    regions[WIDGET_IP] = {0, 41, width, 2 * STATUS_LINE_HEIGHT};
+    regions[WIDGET_MAC] = {0, 65, width, 2 * STATUS_LINE_HEIGHT};
+    regions[WIDGET_FILES] = {0, 90, width, 2 * STATUS_LINE_HEIGHT};
+    regions[WIDGET_SIZE] = {0, 114, width, 2 * STATUS_LINE_HEIGHT};
+    regions[WIDGET_USED] = {0, 138, width, (int16_t)(height - 138)};
+    regions[WIDGET_BAR] = {0, 12, 3, (int16_t)(height - 12)};
+  }
+}
+
+/**
+ * @brief Works out the filled part of the bar: the card's capacity, or the progress of a transfer.
+ */
+void StatusScreen::barFill(const StatusView& view) {
+  int length = landscape ? regions[WIDGET_BAR].w : regions[WIDGET_BAR].h;
+  barStart = 0;
+  if (!view.transferActive) {
+    float usedPercentage = (view.totalSizeMB > 0) ? ((view.totalSizeMB - view.freeSizeMB) / view.totalSizeMB) * 100 : 0;
+    barFilled = (length * usedPercentage) / 100;
+    barColor = CATPPUCCIN_GREEN;
+    return;
+  }
+  barColor = CATPPUCCIN_BLUE;
+  if (view.transferPercent >= 0) {
+    barFilled = length * view.transferPercent / 100;
+  } else {
+    // --- Size unknown: a quarter of the bar moves along as data arrives ---
+    barFilled = length / 4;
+    barStart = (view.transferBytes >> STATUS_TRANSFER_STEP_SHIFT) % (length - barFilled + 1);
+  }
+}
+
+/**
+ * @brief Writes what a widget shows; the widget is redrawn when this changes.
+ */
+void StatusScreen::describe(Widget widget, const StatusView& view, char* out, size_t size) const {
+  float usedSizeMB = view.totalSizeMB - view.freeSizeMB;
+  float usedPercentage = (view.totalSizeMB > 0) ? (usedSizeMB / view.totalSizeMB) * 100 : 0;
+  switch (widget) {
+    case WIDGET_HEADER:
+      snprintf(out, size, "%04x", view.headerColor);
+      break;
+    case WIDGET_MODE:
+      snprintf(out, size, "%s %d %d", view.mode, view.mqttShown, view.mqttConnected);
+      break;
+    case WIDGET_IP:
+      snprintf(out, size, "%s", view.ip);
+      break;
+    case WIDGET_MAC:
+      snprintf(out, size, "%s", view.mac);
+      break;
+    case WIDGET_FILES:
+      snprintf(out, size, "%d", view.files);
+      break;
+    case WIDGET_SIZE:
+      snprintf(out, size, "%.2f %d", view.totalSizeMB / 1024.0, landscape ? view.files : 0);
+      break;
+    case WIDGET_USED:
+      snprintf(out, size, "%.2f %d", usedSizeMB / 1024.0, (int)usedPercentage);
+      break;
+    default:
+      snprintf(out, size, "%d %d %04x", barStart, barFilled, barColor);
+      break;
+  }
+}
+
+/**
+ * @brief Prints a value with some characters left out, as the narrow portrait lines need.
+ */
+static void printWithout(TFT_eSprite& sprite, const char* text, char skip) {
+  for (; *text; text++) {
+    if (*text != skip) {
+      sprite.print(*text);
+    }
+  }
+}
+
+/**
+ * @brief Draws a label and its value, side by side in landscape and one above the other in portrait.
+ */
+static void drawLabel(TFT_eSprite& sprite, bool landscape, const char* landscapeLabel, const char* portraitLabel, uint16_t valueColor) {
+  sprite.setCursor(5, 0);
+  sprite.setTextColor(CATPPUCCIN_MAUVE);
+  if (landscape) {
+    sprite.print(landscapeLabel);
+  } else {
+    sprite.print(portraitLabel);
+    sprite.setCursor(5, STATUS_LINE_HEIGHT);
+  }
+  sprite.setTextColor(valueColor);
+}
+
+/**
+ * @brief Draws one widget into a sprite, at the sprite's origin.
+ */
+void StatusScreen::draw(Widget widget, const StatusView& view, TFT_eSprite& sprite) {
+  sprite.fillSprite(CATPPUCCIN_BASE);
+  sprite.setTextSize(1);
+  float usedSizeMB = view.totalSizeMB - view.freeSizeMB;
+  float usedPercentage = (view.totalSizeMB > 0) ? (usedSizeMB / view.totalSizeMB) * 100 : 0;
+
+  switch (widget) {
+    case WIDGET_HEADER:
+      sprite.fillRect(0, 0, regions[WIDGET_HEADER].w, 12, view.headerColor);
+      sprite.setTextColor(CATPPUCCIN_CRUST);
+      sprite.drawCentreString("FrameFi", regions[WIDGET_HEADER].w / 2, 2, 1);
+      return;
+    case WIDGET_MODE:
+      drawLabel(sprite, landscape, "Mode:  ", "Mode:", CATPPUCCIN_GREEN);
+      sprite.print(view.mode);
+      if (view.mqttShown) {
+        sprite.fillCircle(sprite.getCursorX() + 8, sprite.getCursorY() + 3, 3, view.mqttConnected ? CATPPUCCIN_GREEN : CATPPUCCIN_RED);
+      }
+      break;
+    case WIDGET_IP:
+      drawLabel(sprite, landscape, "IP:    ", "IP:", CATPPUCCIN_YELLOW);
+      printWithout(sprite, view.ip, landscape ? '\0' : '.');
+      break;
+    case WIDGET_MAC:
+      drawLabel(sprite, landscape, "MAC:   ", "MAC:", CATPPUCCIN_YELLOW);
+      printWithout(sprite, view.mac, landscape ? '\0' : ':');
+      break;
+    case WIDGET_FILES:
+      drawLabel(sprite, landscape, "", "Files:", CATPPUCCIN_PEACH);
+      sprite.print(view.files);
+      break;
+    case WIDGET_SIZE:
+      drawLabel(sprite, landscape, "Size:  ", "Size:", CATPPUCCIN_PEACH);
+      sprite.print(view.totalSizeMB / 1024.0, 2);
+      sprite.print("GB");
+      if (landscape) {
+        sprite.setTextColor(CATPPUCCIN_MAUVE);
+        sprite.print(" Files: ");
+        sprite.setTextColor(CATPPUCCIN_PEACH);
+        sprite.print(view.files);
+      }
+      break;
+    case WIDGET_USED:
+      drawLabel(sprite, landscape, "Used:  ", "Used:", CATPPUCCIN_PEACH);
+      sprite.print(usedSizeMB / 1024.0, 2);
+      sprite.print("GB (");
+      sprite.print((int)usedPercentage);
+      sprite.print(" %)");
+      break;
+    default:
+      if (landscape) {
+        sprite.fillRect(barStart, 0, barFilled, regions[WIDGET_BAR].h, barColor);
+      } else {
+        sprite.fillRect(0, regions[WIDGET_BAR].h - barStart - barFilled, regions[WIDGET_BAR].w, barFilled, barColor);
+      }
+      return;
+  }
+
+  // --- In portrait the lines cross the bar, so each carries its own piece of it ---
+  if (!landscape) {
+    drawBarSlice(sprite, regions[widget].y, regions[widget].h);
+  }
+}
+
+/**
+ * @brief Draws the part of the portrait bar between panel rows top and top + height.
+ */
+void StatusScreen::drawBarSlice(TFT_eSprite& sprite, int top, int height) {
+  const Region& region = regions[WIDGET_BAR];
+  int filledBottom = region.y + region.h - barStart;
+  int filledTop = filledBottom - barFilled;
+  int start = filledTop > top ? filledTop : top;
+  int end = filledBottom < top + height ? filledBottom : top + height;
+  if (start < end) {
+    sprite.fillRect(region.x, start - top, region.w, end - start, barColor);
+  }
+}
+
+/**
+ * @brief Sends a drawn widget to the panel. With DMA this returns as soon as the transfer is queued.
+ */
+void StatusScreen::push(TFT_eSprite& sprite, const Region& region) {
+  uint16_t* pixels = (uint16_t*)sprite.getPointer();
+#ifdef ESP32_DMA
+  if (dma) {
+    tft->pushImageDMA(region.x, region.y, region.w, region.h, pixels);
+    return;
+  }
+#endif
+  tft->pushImage(region.x, region.y, region.w, region.h, pixels);
+}
+
+/**
+ * @brief Redraws the widgets that differ from what the panel shows. Returns the number pushed.
+ */
+uint8_t StatusScreen::render(const StatusView& view) {
+  if (!bar) {
+    return 0;
+  }
+  bool full = !valid;
+  barFill(view);
+
+  uint8_t pushed = 0;
+  tft->startWrite();
+  if (full) {
+    // --- Something else was drawn; the gaps between widgets need clearing too ---
+    tft->fillScreen(CATPPUCCIN_BASE);
+  }
+  for (uint8_t i = 0; i < WIDGET_COUNT; i++) {
+    Widget widget = (Widget)i;
+    const Region& region = regions[widget];
+    if (region.h <= 0) {
+      continue;
+    }
+    char text[sizeof(shown[0])];
+    describe(widget, view, text, sizeof(text));
+    if (!full && strcmp(text, shown[widget]) == 0) {
+      continue;
+    }
+    // --- Queuing a push waits for the one before, so the other line sprite is free to draw into ---
+    TFT_eSprite& sprite = widget == WIDGET_BAR ? *bar : *lines[nextLine];
+    if (widget != WIDGET_BAR) {
+      nextLine ^= 1;
+    }
+    draw(widget, view, sprite);
+    push(sprite, region);
+    strcpy(shown[widget], text);
+    pushed++;
+    counters.pixels += region.w * region.h;
+  }
+#ifdef ESP32_DMA
+  if (dma) {
+    tft->dmaWait();
+  }
+#endif
+  tft->endWrite();
+
+  valid = true;
+  if (pushed) {
+    counters.frames++;
+    counters.widgets += pushed;
+  }
+  return pushed;
+}
@@ -0,0 +1,116 @@
+/******************************************************************************
+ *
+ * FrameFi - Storage
+ * ----------------
+ * One SD card initialization and one FAT mount for the whole uptime.
+ * Switching between MSC and FTP mode hands block ownership back and forth
+ * instead of tearing the storage stack down.
+ *
+ *****************************************************************************/
+
+#include "storage.h"
+
+#include <memory>
+
+#include "driver/sdmmc_host.h"
+#include "esp_vfs_fat.h"
+#include "vfs_api.h"
+
+StorageManager storage;
+
+// --- The VFS implementation must exist before sdFs is constructed below ---
+static std::shared_ptr<VFSImpl> sdVfs = std::make_shared<VFSImpl>();
+fs::FS sdFs(sdVfs);
+
+SemaphoreHandle_t fatMutex = NULL;
+
+StorageManager::StorageManager() : card(nullptr), volume(nullptr), fatOwned(false) {}
+
+/**
+ * @brief Initializes the card and mounts the FAT volume. Only the first call does any work.
+ */
+esp_err_t StorageManager::begin() {
+  if (card) {
+    return ESP_OK;
+  }
+  if (!fatMutex) {
+    fatMutex = xSemaphoreCreateMutex();
+  }
+
+  esp_vfs_fat_sdmmc_mount_config_t mount_config = {.format_if_mount_failed = false, .max_files = STORAGE_MAX_FILES, .allocation_unit_size = 16 * 1024};
+
+  sdmmc_host_t host = {
+      .flags = SDMMC_HOST_FLAG_4BIT | SDMMC_HOST_FLAG_DDR,
+      .slot = SDMMC_HOST_SLOT_1,
+      .max_freq_khz = SDMMC_FREQ_DEFAULT,
+      .io_voltage = 3.3f,
+      .init = &sdmmc_host_init,
+      .set_bus_width = &sdmmc_host_set_bus_width,
+      .get_bus_width = &sdmmc_host_get_slot_width,
+      .set_bus_ddr_mode = &sdmmc_host_set_bus_ddr_mode,
+      .set_card_clk = &sdmmc_host_set_card_clk,
+      .do_transaction = &sdmmc_host_do_transaction,
+      .deinit = &sdmmc_host_deinit,
+      .io_int_enable = sdmmc_host_io_int_enable,
+      .io_int_wait = sdmmc_host_io_int_wait,
+      .command_timeout_ms = 0,
+  };
+  sdmmc_slot_config_t slot_config = {
+      .clk = (gpio_num_t)SD_MMC_CLK_PIN,
+      .cmd = (gpio_num_t)SD_MMC_CMD_PIN,
+      .d0 = (gpio_num_t)SD_MMC_D0_PIN,
+      .d1 = (gpio_num_t)SD_MMC_D1_PIN,
+      .d2 = (gpio_num_t)SD_MMC_D2_PIN,
+      .d3 = (gpio_num_t)SD_MMC_D3_PIN,
+      .cd = SDMMC_SLOT_NO_CD,
+      .wp = SDMMC_SLOT_NO_WP,
+      .width = 4, // SDMMC_SLOT_WIDTH_DEFAULT,
+      .flags = SDMMC_SLOT_FLAG_INTERNAL_PULLUP,
+  };
+
+  gpio_set_pull_mode((gpio_num_t)SD_MMC_CMD_PIN, GPIO_PULLUP_ONLY); // CMD, needed in 4- and 1- line modes
+  gpio_set_pull_mode((gpio_num_t)SD_MMC_D0_PIN, GPIO_PULLUP_ONLY);  // D0, needed in 4- and 1-line modes
+  gpio_set_pull_mode((gpio_num_t)SD_MMC_D1_PIN, GPIO_PULLUP_ONLY);  // D1, needed in 4-line mode only
+  gpio_set_pull_mode((gpio_num_t)SD_MMC_D2_PIN, GPIO_PULLUP_ONLY);  // D2, needed in 4-line mode only
+  gpio_set_pull_mode((gpio_num_t)SD_MMC_D3_PIN, GPIO_PULLUP_ONLY);  // D3, needed in 4- and 1-line modes
+
+  sdmmc_card_t* mounted = nullptr;
+  esp_err_t ret = esp_vfs_fat_sdmmc_mount(STORAGE_MOUNT_POINT, &host, &slot_config, &mount_config, &mounted);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  // --- Keep hold of the FatFs object so the volume can be re-read later ---
+  DWORD freeClusters;
+  if (f_getfree(STORAGE_FAT_DRIVE, &freeClusters, &volume) != FR_OK) {
+    volume = nullptr;
+  }
+
+  sdVfs->mountpoint(STORAGE_MOUNT_POINT);
+  card = mounted;
+  fatOwned = true;
+  return ESP_OK;
+}
+
+/**
+ * @brief Hands the blocks to the USB host; the FAT layer must have no open files.
+ */
+void StorageManager::releaseToHost() {
+  fatOwned = false;
+}
+
+/**
+ * @brief Takes the blocks back for the FAT layer, discarding stale FatFs state.
+ */
+bool StorageManager::claimForFat() {
+  if (!card) {
+    return false;
+  }
+
+  // --- Re-registering the volume makes FatFs re-read it on next access; the card is not re-identified ---
+  if (volume && f_mount(volume, STORAGE_FAT_DRIVE, 0) != FR_OK) {
+    return false;
+  }
+  fatOwned = true;
+  return true;
+}
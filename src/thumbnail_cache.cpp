@@ -0,0 +1,611 @@
+/******************************************************************************
+ *
+ * FrameFi - Thumbnail Cache
+ * ----------------
+ * Builds small previews of the pictures on the card in the background, a
+ * row of MCUs at a time, for the web gallery.
+ *
+ *****************************************************************************/
+
+#include "thumbnail_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "esp_heap_caps.h"
+#include "image_ingest.h"
+#include "jpeg_files.h"
+
+ThumbnailCache thumbnailCache;
+
+// --- The sums are 16 bits and green has six, so a box may hold this many decoded pixels ---
+static const uint32_t maxBoxPixels = 0xFFFF / 0x3F;
+
+struct ThumbnailCache::Work {
+  JPEGDEC decoder;
+  JPEGENC encoder;
+  JPEGENCODE encodeState;
+  JpegSource source;
+  JpegTarget target;
+};
+
+ThumbnailCache::ThumbnailCache()
+    : counters{}, task(nullptr), queue(nullptr), scanRequested(false), busy(false), lastTransferMs(0), failedKeys{},
+      nextFailedSlot(0), work(nullptr), band(nullptr), sums(nullptr), columnSpan(nullptr), sourceWidth(0),
+      sourceHeight(0), outWidth(0), outHeight(0), paddedWidth(0), rowsDone(0), rowsOpen(0), lastDrawY(-1) {}
+
+/**
+ * @brief Starts the thumbnail task and walks the card once.
+ */
+bool ThumbnailCache::begin() {
+  if (task) {
+    return true;
+  }
+  if (!queue) {
+    queue = xQueueCreate(THUMB_QUEUE_LENGTH, sizeof(Job));
+  }
+  if (!queue) {
+    return false;
+  }
+  scanRequested = true;
+  if (xTaskCreatePinnedToCore(taskEntry, "thumbs", 8192, this, tskIDLE_PRIORITY, &task, THUMB_TASK_CORE) != pdPASS) {
+    task = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Queues a stored upload for a thumbnail. Never blocks.
+ */
+void ThumbnailCache::submit(const char* path) {
+  char thumbPath[FF_MAX_LFN + 8];
+  if (!queue || !path || strlen(path) >= sizeof(Job::path) || !thumbnailPath(path, thumbPath, sizeof(thumbPath))) {
+    return;
+  }
+  Job job;
+  strcpy(job.path, path);
+  // --- A full queue is caught up by a walk of the card ---
+  if (xQueueSend(queue, &job, 0) != pdTRUE) {
+    scanRequested = true;
+  }
+  if (task) {
+    xTaskNotifyGive(task);
+  }
+}
+
+/**
+ * @brief Walks the whole card at the next quiet moment. Call after the USB host had it.
+ */
+void ThumbnailCache::rescan() {
+  scanRequested = true;
+  if (task) {
+    xTaskNotifyGive(task);
+  }
+}
+
+/**
+ * @brief Marks the card busy with a transfer; the task waits until it has been quiet for a moment.
+ */
+void ThumbnailCache::noteTransfer() {
+  lastTransferMs = millis();
+}
+
+/**
+ * @brief Writes the thumbnail path of a picture, relative to the card root. Returns false if it has none.
+ */
+bool ThumbnailCache::thumbnailPath(const char* path, char* out, size_t size) const {
+  const size_t dataDirLength = sizeof(STORAGE_DATA_DIR) - 1;
+  if (!path || path[0] != '/' || !isJpegPath(path) ||
+      (strncmp(path, STORAGE_DATA_DIR, dataDirLength) == 0 && path[dataDirLength] == '/')) {
+    return false;
+  }
+  int length = snprintf(out, size, THUMB_DIR "%s", path);
+  return length > 0 && length < (int)size;
+}
+
+/**
+ * @brief Returns true if the thumbnail at thumbDrivePath was built from the picture as it is now.
+ */
+bool ThumbnailCache::isCurrent(const FILINFO& picture, const char* thumbDrivePath) {
+  FILINFO thumb;
+  return f_stat(thumbDrivePath, &thumb) == FR_OK && !(thumb.fattrib & AM_DIR) && thumb.fdate == picture.fdate &&
+         thumb.ftime == picture.ftime;
+}
+
+/**
+ * @brief Returns the FNV-1a hash of a path, the key a failure is remembered by.
+ */
+static uint32_t pathKey(const char* path) {
+  uint32_t hash = 2166136261u;
+  for (; *path; path++) {
+    hash = (hash ^ (uint8_t)*path) * 16777619u;
+  }
+  return hash ? hash : 1;
+}
+
+/**
+ * @brief Remembers that a picture could not be converted.
+ */
+void ThumbnailCache::rememberFailure(const char* path) {
+  failedKeys[nextFailedSlot] = pathKey(path);
+  nextFailedSlot = (nextFailedSlot + 1) % THUMB_FAILED_SLOTS;
+}
+
+/**
+ * @brief Returns true if a picture could not be converted lately.
+ */
+bool ThumbnailCache::hasFailed(const char* path) const {
+  uint32_t key = pathKey(path);
+  for (uint32_t i = 0; i < THUMB_FAILED_SLOTS; i++) {
+    if (failedKeys[i] == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Returns the state of a picture's thumbnail, queueing it first in line if it is out of date.
+ * Call with the FAT lock held.
+ */
+ThumbnailState ThumbnailCache::lookup(const char* path) {
+  char thumbPath[FF_MAX_LFN + 8];
+  char drivePath[FF_MAX_LFN + 8];
+  FILINFO picture;
+  if (!thumbnailPath(path, thumbPath, sizeof(thumbPath)) ||
+      snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", path) >= (int)sizeof(drivePath) ||
+      f_stat(drivePath, &picture) != FR_OK || (picture.fattrib & AM_DIR)) {
+    return THUMB_MISSING;
+  }
+  snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", thumbPath);
+  if (isCurrent(picture, drivePath)) {
+    return THUMB_READY;
+  }
+  if (hasFailed(path) || !task) {
+    return THUMB_FAILED;
+  }
+
+  // --- Someone is looking at the gallery; this one goes ahead of uploads and the walk ---
+  Job job;
+  strncpy(job.path, path, sizeof(job.path) - 1);
+  job.path[sizeof(job.path) - 1] = '\0';
+  if (xQueueSendToFront(queue, &job, 0) != pdTRUE) {
+    scanRequested = true;
+  }
+  xTaskNotifyGive(task);
+  return THUMB_PENDING;
+}
+
+/**
+ * @brief Returns the number of pictures queued, including the one being built.
+ */
+uint32_t ThumbnailCache::pending() const {
+  return (queue ? uxQueueMessagesWaiting(queue) : 0) + (busy ? 1 : 0);
+}
+
+/**
+ * @brief Waits until transfers have been quiet for a moment and, if asked, the ingest stage is idle.
+ * Returns false if the card went to the USB host.
+ */
+bool ThumbnailCache::waitForQuiet(bool forIngest) {
+  for (;;) {
+    if (!storage.fatOwnsCard()) {
+      return false;
+    }
+    bool quiet = millis() - lastTransferMs >= THUMB_QUIET_MS;
+#if IMAGE_INGEST_ENABLED
+    // --- The ingest stage replaces pictures, so their thumbnails wait for it ---
+    quiet = quiet && (!forIngest || imageIngest.pending() == 0);
+#endif
+    if (quiet) {
+      return true;
+    }
+    vTaskDelay(pdMS_TO_TICKS(THUMB_CHECK_MS));
+  }
+}
+
+/**
+ * @brief Picks the thumbnail size and decoder scale for a picture. Returns false if it cannot be shrunk.
+ */
+bool ThumbnailCache::setupResize(int width, int height, int& scale) {
+  if (width < 1 || height < 1) {
+    return false;
+  }
+  // --- A square box fits either way up, so the EXIF orientation does not matter here ---
+  if (width >= height) {
+    outWidth = width < THUMB_SIZE ? width : THUMB_SIZE;
+    outHeight = (int)(((uint32_t)height * outWidth + width / 2) / width);
+  } else {
+    outHeight = height < THUMB_SIZE ? height : THUMB_SIZE;
+    outWidth = (int)(((uint32_t)width * outHeight + height / 2) / height);
+  }
+  if (outWidth < 1) {
+    outWidth = 1;
+  }
+  if (outHeight < 1) {
+    outHeight = 1;
+  }
+
+  // --- The decoder takes the largest power of two step that still leaves enough pixels ---
+  for (scale = 8; scale > 1; scale /= 2) {
+    if (width / scale >= outWidth && height / scale >= outHeight) {
+      break;
+    }
+  }
+  sourceWidth = width / scale;
+  sourceHeight = height / scale;
+  uint32_t spanX = (sourceWidth + outWidth - 1) / outWidth;
+  uint32_t spanY = (sourceHeight + outHeight - 1) / outHeight;
+  if (spanX > 0xFF || spanX * spanY > maxBoxPixels) {
+    return false;
+  }
+  paddedWidth = (outWidth + THUMB_BAND_ROWS - 1) & ~(THUMB_BAND_ROWS - 1);
+  return true;
+}
+
+/**
+ * @brief Returns the first decoded row or column that falls in output row or column index.
+ */
+static inline int boxStart(int index, int outSize, int sourceSize) {
+  return (int)(((uint32_t)index * sourceSize + outSize - 1) / outSize);
+}
+
+/**
+ * @brief Allocates the band, the sums and the column spans for the size picked by setupResize().
+ */
+bool ThumbnailCache::allocateBuffers() {
+  band = (uint16_t*)allocatePixelBuffer((size_t)THUMB_BAND_ROWS * paddedWidth * sizeof(uint16_t));
+  sums = (uint16_t*)allocatePixelBuffer((size_t)THUMB_BAND_ROWS * outWidth * 3 * sizeof(uint16_t));
+  columnSpan = (uint8_t*)allocatePixelBuffer(outWidth);
+  if (!band || !sums || !columnSpan) {
+    return false;
+  }
+  for (int x = 0; x < outWidth; x++) {
+    columnSpan[x] = boxStart(x + 1, outWidth, sourceWidth) - boxStart(x, outWidth, sourceWidth);
+  }
+  rowsDone = 0;
+  rowsOpen = 0;
+  lastDrawY = -1;
+  return true;
+}
+
+/**
+ * @brief Frees the band, the sums and the column spans.
+ */
+void ThumbnailCache::releaseBuffers() {
+  heap_caps_free(band);
+  heap_caps_free(sums);
+  heap_caps_free(columnSpan);
+  band = nullptr;
+  sums = nullptr;
+  columnSpan = nullptr;
+}
+
+int ThumbnailCache::drawCallback(JPEGDRAW* draw) {
+  ThumbnailCache* self = static_cast<ThumbnailCache*>(draw->pUser);
+  // --- The first block of a row of MCUs closes every output row above it ---
+  if (draw->y != self->lastDrawY) {
+    self->lastDrawY = draw->y;
+    int top = draw->y < self->sourceHeight ? draw->y : self->sourceHeight;
+    if (!self->finishRows((int)(((uint32_t)top * self->outHeight) / self->sourceHeight))) {
+      return 0;
+    }
+    // --- Give way to a transfer that started meanwhile; carry on once it has stopped ---
+    if (!self->waitForQuiet(false)) {
+      return 0;
+    }
+  }
+  return self->addBlock(draw->pPixels, draw->x, draw->y, draw->iWidth, draw->iHeight) ? 1 : 0;
+}
+
+/**
+ * @brief Adds a block of decoded pixels to the sums of the output rows it falls in.
+ */
+bool ThumbnailCache::addBlock(const uint16_t* pixels, int x, int y, int width, int height) {
+  int columns = sourceWidth - x < width ? sourceWidth - x : width;
+  for (int r = 0; r < height && y + r < sourceHeight; r++) {
+    int outRow = (int)(((uint32_t)(y + r) * outHeight) / sourceHeight);
+    if (outRow - rowsDone >= THUMB_BAND_ROWS) {
+      return false;
+    }
+    for (; rowsOpen <= outRow; rowsOpen++) {
+      memset(sums + (size_t)(rowsOpen % THUMB_BAND_ROWS) * outWidth * 3, 0, outWidth * 3 * sizeof(uint16_t));
+    }
+    uint16_t* rowSums = sums + (size_t)(outRow % THUMB_BAND_ROWS) * outWidth * 3;
+    const uint16_t* row = pixels + (size_t)r * width;
+    for (int i = 0; i < columns; i++) {
+      uint16_t pixel = row[i];
+      uint16_t* sum = rowSums + (size_t)(((uint32_t)(x + i) * outWidth) / sourceWidth) * 3;
+      sum[0] += pixel >> 11;
+      sum[1] += (pixel >> 5) & 0x3F;
+      sum[2] += pixel & 0x1F;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Averages every output row before outRowEnd into the band, encoding each band that fills up.
+ */
+bool ThumbnailCache::finishRows(int outRowEnd) {
+  if (outRowEnd > outHeight) {
+    outRowEnd = outHeight;
+  }
+  for (; rowsDone < outRowEnd; rowsDone++) {
+    for (; rowsOpen <= rowsDone; rowsOpen++) {
+      memset(sums + (size_t)(rowsOpen % THUMB_BAND_ROWS) * outWidth * 3, 0, outWidth * 3 * sizeof(uint16_t));
+    }
+    uint32_t rowSpan = boxStart(rowsDone + 1, outHeight, sourceHeight) - boxStart(rowsDone, outHeight, sourceHeight);
+    const uint16_t* sum = sums + (size_t)(rowsDone % THUMB_BAND_ROWS) * outWidth * 3;
+    uint16_t* out = band + (size_t)(rowsDone % THUMB_BAND_ROWS) * paddedWidth;
+    for (int x = 0; x < outWidth; x++, sum += 3) {
+      uint32_t count = columnSpan[x] * rowSpan;
+      out[x] = (uint16_t)((((sum[0] + count / 2) / count) << 11) | (((sum[1] + count / 2) / count) << 5) |
+                          ((sum[2] + count / 2) / count));
+    }
+    if ((rowsDone + 1) % THUMB_BAND_ROWS == 0 || rowsDone + 1 == outHeight) {
+      if (!encodeBand(rowsDone % THUMB_BAND_ROWS + 1)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Pads the band out to whole MCUs and hands it to the encoder.
+ */
+bool ThumbnailCache::encodeBand(int rows) {
+  // --- Repeat the edge pixels into the padding so the last MCUs compress cleanly ---
+  for (int r = 0; r < THUMB_BAND_ROWS; r++) {
+    uint16_t* row = band + (size_t)r * paddedWidth;
+    if (r >= rows) {
+      memcpy(row, band + (size_t)(rows - 1) * paddedWidth, paddedWidth * sizeof(uint16_t));
+      continue;
+    }
+    for (int x = outWidth; x < paddedWidth; x++) {
+      row[x] = row[outWidth - 1];
+    }
+  }
+
+  for (int x = 0; x < paddedWidth; x += THUMB_BAND_ROWS) {
+    if (work->encoder.addMCU(&work->encodeState, (uint8_t*)(band + x), paddedWidth * sizeof(uint16_t)) != JPEGE_SUCCESS ||
+        work->target.failed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Builds the thumbnail of one picture unless it is current.
+ */
+ThumbnailCache::Outcome ThumbnailCache::build(const char* path) {
+  char thumbPath[FF_MAX_LFN + 8];
+  char drivePath[FF_MAX_LFN + 8];
+  char thumbDrivePath[FF_MAX_LFN + 16];
+  if (!thumbnailPath(path, thumbPath, sizeof(thumbPath)) ||
+      snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", path) >= (int)sizeof(drivePath)) {
+    return THUMB_UNREADABLE;
+  }
+  snprintf(thumbDrivePath, sizeof(thumbDrivePath), STORAGE_FAT_DRIVE "%s", thumbPath);
+
+  FILINFO picture;
+  xSemaphoreTake(fatMutex, portMAX_DELAY);
+  bool found = storage.fatOwnsCard() && f_stat(drivePath, &picture) == FR_OK && !(picture.fattrib & AM_DIR);
+  bool current = found && isCurrent(picture, thumbDrivePath);
+  if (found && !current) {
+    makeParentDirectories(thumbDrivePath);
+  }
+  xSemaphoreGive(fatMutex);
+  if (!found || current) {
+    return THUMB_CURRENT;
+  }
+
+  work = new (std::nothrow) Work();
+  if (!work) {
+    return THUMB_INTERRUPTED;
+  }
+
+  int scale = 1;
+  uint8_t orientation = 1;
+  bool readable = openJpegSource(work->decoder, work->source, drivePath, drawCallback) &&
+                  work->decoder.getJPEGType() == JPEG_MODE_BASELINE;
+  if (readable) {
+    int tag = work->decoder.getOrientation();
+    orientation = tag >= 1 && tag <= 8 ? tag : 1;
+    readable = setupResize(work->decoder.getWidth(), work->decoder.getHeight(), scale);
+  }
+
+  Outcome outcome = readable ? THUMB_INTERRUPTED : THUMB_UNREADABLE;
+  if (readable && allocateBuffers()) {
+    bool opened = openJpegTarget(work->encoder, work->target, thumbPath, orientation);
+    bool encoded = opened && work->encoder.encodeBegin(&work->encodeState, outWidth, outHeight, JPEGE_PIXEL_RGB565,
+                                                       JPEGE_SUBSAMPLE_420, jpegEncoderQuality(THUMB_QUALITY)) == JPEGE_SUCCESS;
+    if (encoded) {
+      static const int scaleOptions[] = {0, 0, JPEG_SCALE_HALF, 0, JPEG_SCALE_QUARTER, 0, 0, 0, JPEG_SCALE_EIGHTH};
+      work->decoder.setPixelType(RGB565_LITTLE_ENDIAN);
+      work->decoder.setUserPointer(this);
+      encoded = work->decoder.decode(0, 0, scaleOptions[scale]) == 1 && finishRows(outHeight);
+    }
+    if (opened) {
+      // --- close() writes out whatever the encoder still buffers ---
+      encoded = work->encoder.close() > 0 && encoded;
+    }
+
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    FILINFO now;
+    bool unchanged = storage.fatOwnsCard() && f_stat(drivePath, &now) == FR_OK && now.fsize == picture.fsize &&
+                     now.fdate == picture.fdate && now.ftime == picture.ftime;
+    // --- Only a picture that changed or a card that changed hands is worth another try ---
+    bool interrupted = !storage.fatOwnsCard() || !unchanged;
+    if (opened && finishJpegTarget(work->target, encoded && unchanged)) {
+      // --- The picture's timestamp is what marks the thumbnail current ---
+      if (f_utime(thumbDrivePath, &picture) == FR_OK) {
+        outcome = THUMB_BUILT;
+      } else {
+        f_unlink(thumbDrivePath);
+      }
+    } else if (!interrupted) {
+      outcome = THUMB_UNREADABLE;
+    }
+    xSemaphoreGive(fatMutex);
+  }
+
+  work->decoder.close();
+  releaseBuffers();
+  delete work;
+  work = nullptr;
+  return outcome;
+}
+
+/**
+ * @brief Builds one thumbnail and counts the outcome.
+ */
+void ThumbnailCache::process(const char* path) {
+  busy = true;
+  uint32_t start = millis();
+  switch (build(path)) {
+    case THUMB_BUILT:
+      counters.built++;
+      counters.busyMs += millis() - start;
+      break;
+    case THUMB_UNREADABLE:
+      counters.failed++;
+      rememberFailure(path);
+      break;
+    case THUMB_INTERRUPTED:
+      // --- The next walk picks it up again ---
+      scanRequested = true;
+      break;
+    case THUMB_CURRENT: break;
+  }
+  busy = false;
+}
+
+/**
+ * @brief Builds the thumbnails queued by uploads and the gallery.
+ */
+void ThumbnailCache::drainQueue() {
+  Job job;
+  while (uxQueueMessagesWaiting(queue) > 0 && waitForQuiet(true)) {
+    if (xQueueReceive(queue, &job, 0) != pdTRUE) {
+      return;
+    }
+    process(job.path);
+  }
+}
+
+/**
+ * @brief Walks the tree under root: builds missing thumbnails, or with pruning removes those of deleted pictures.
+ * Returns false if the walk did not finish.
+ */
+bool ThumbnailCache::walk(const char* root, bool pruning) {
+  const size_t thumbDirLength = sizeof(THUMB_DIR) - 1;
+  std::vector<std::string> pending;
+  pending.push_back(std::string(root) + (root[1] ? "/" : ""));
+  FF_DIR dir;
+  FILINFO entry;
+  char drivePath[FF_MAX_LFN + 16];
+
+  while (!pending.empty()) {
+    std::string directory = pending.back();
+    pending.pop_back();
+    std::string driveDirectory = STORAGE_FAT_DRIVE + directory;
+
+    xSemaphoreTake(fatMutex, portMAX_DELAY);
+    FRESULT result = storage.fatOwnsCard() ? f_opendir(&dir, driveDirectory.c_str()) : FR_NOT_READY;
+    if (result != FR_OK) {
+      xSemaphoreGive(fatMutex);
+      // --- Nothing to prune before the first thumbnail, and a directory may vanish mid-walk ---
+      if (result == FR_NO_PATH || result == FR_NO_FILE) {
+        continue;
+      }
+      return false;
+    }
+
+    bool ok = true;
+    for (uint32_t count = 1; ok; count++) {
+      if (f_readdir(&dir, &entry) != FR_OK) {
+        ok = false;
+        break;
+      }
+      if (entry.fname[0] == '\0') {
+        break;
+      }
+      if (!pruning && directory == "/" && strcmp(entry.fname, STORAGE_DATA_DIR + 1) == 0) {
+        continue;
+      }
+      std::string path = directory + entry.fname;
+      if (entry.fattrib & AM_DIR) {
+        pending.push_back(path + "/");
+      } else if (pruning) {
+        // --- A thumbnail, or a build cut short, whose picture is gone goes with it ---
+        FILINFO picture;
+        snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", path.c_str() + thumbDirLength);
+        if (f_stat(drivePath, &picture) != FR_OK || (picture.fattrib & AM_DIR) || !isJpegPath(drivePath)) {
+          snprintf(drivePath, sizeof(drivePath), STORAGE_FAT_DRIVE "%s", path.c_str());
+          if (f_unlink(drivePath) == FR_OK) {
+            counters.removed++;
+          }
+        }
+      } else if (thumbnailPath(path.c_str(), drivePath + strlen(STORAGE_FAT_DRIVE), sizeof(drivePath) - strlen(STORAGE_FAT_DRIVE))) {
+        memcpy(drivePath, STORAGE_FAT_DRIVE, strlen(STORAGE_FAT_DRIVE));
+        if (!isCurrent(entry, drivePath) && !hasFailed(path.c_str())) {
+          // --- The directory stays open; the lock is only held per call while the picture is built ---
+          xSemaphoreGive(fatMutex);
+          drainQueue();
+          bool ours = waitForQuiet(true);
+          if (ours) {
+            process(path.c_str());
+          }
+          xSemaphoreTake(fatMutex, portMAX_DELAY);
+          ok = ours && storage.fatOwnsCard();
+        }
+      }
+      // --- Let transfers and mode switches in between batches ---
+      if (ok && count % THUMB_WALK_BATCH == 0) {
+        xSemaphoreGive(fatMutex);
+        vTaskDelay(1);
+        xSemaphoreTake(fatMutex, portMAX_DELAY);
+        ok = storage.fatOwnsCard();
+      }
+    }
+    if (storage.fatOwnsCard()) {
+      f_closedir(&dir);
+    }
+    xSemaphoreGive(fatMutex);
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ThumbnailCache::taskEntry(void* arg) {
+  static_cast<ThumbnailCache*>(arg)->runTask();
+}
+
+/**
+ * @brief Thumbnail task: builds queued thumbnails, then walks the card when a walk is due.
+ */
+void ThumbnailCache::runTask() {
+  for (;;) {
+    // --- A walk that is due is retried at a calm pace, e.g. until the USB host hands the card back ---
+    ulTaskNotifyTake(pdTRUE, scanRequested ? pdMS_TO_TICKS(THUMB_QUIET_MS) : portMAX_DELAY);
+    drainQueue();
+    if (scanRequested && waitForQuiet(true)) {
+      scanRequested = false;
+      // --- Missing thumbnails first, then those whose pictures are gone ---
+      if (!walk("/", false) || !walk(THUMB_DIR, true)) {
+        scanRequested = true;
+      }
+    }
+  }
+}
@@ -0,0 +1,204 @@
+/******************************************************************************
+ *
+ * FrameFi - Transfer Tracker
+ * ----------------
+ * Progress and throughput of FTP and HTTP transfers, sampled at a fixed
+ * rate so the per-chunk cost is a store and a compare.
+ *
+ *****************************************************************************/
+
+#include "transfer_tracker.h"
+
+#include <string.h>
+
+#include "Arduino.h"
+
+TransferTracker transferTracker;
+
+TransferTracker::TransferTracker()
+    : slots{}, done{}, doneCount(0), doneNext(0), mutex(nullptr), changes(0), finished(0) {}
+
+/**
+ * @brief Creates the lock. Call once before the first transfer.
+ */
+bool TransferTracker::begin() {
+  if (!mutex) {
+    mutex = xSemaphoreCreateMutex();
+  }
+  return mutex != nullptr;
+}
+
+/**
+ * @brief Starts tracking a transfer. Returns its slot, or -1 if every slot is taken.
+ */
+int8_t TransferTracker::start(TransferSource source, TransferDirection direction, const char* name, uint32_t total) {
+  if (!mutex) {
+    return -1;
+  }
+  uint32_t now = millis();
+  int8_t found = -1;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for (uint8_t i = 0; i < TRANSFER_SLOTS; i++) {
+    if (slots[i].used) {
+      continue;
+    }
+    Slot& slot = slots[i];
+    memset(&slot.status, 0, sizeof(slot.status));
+    // --- Keep the end of a long path; the file name is the part worth showing ---
+    size_t length = strlen(name);
+    const char* tail = length >= TRANSFER_NAME_SIZE ? name + length - (TRANSFER_NAME_SIZE - 1) : name;
+    strcpy(slot.status.name, tail);
+    slot.status.source = source;
+    slot.status.direction = direction;
+    slot.status.state = TRANSFER_RUNNING;
+    slot.status.total = total;
+    slot.status.etaS = -1;
+    slot.status.percent = total ? 0 : -1;
+    slot.startMs = slot.sampleMs = now;
+    slot.sampleBytes = 0;
+    slot.bytes = 0;
+    slot.used = true;
+    found = i;
+    changes = changes + 1;
+    break;
+  }
+  xSemaphoreGive(mutex);
+  return found;
+}
+
+/**
+ * @brief Works out the figures of a transfer from its byte count. Call with the lock held.
+ */
+void TransferTracker::update(Slot& slot, uint32_t now) {
+  TransferStatus& status = slot.status;
+  uint32_t bytes = slot.bytes;
+  uint32_t window = now - slot.sampleMs;
+  if (window > 0) {
+    status.rateBps = (uint64_t)(bytes - slot.sampleBytes) * 1000 / window;
+  }
+  slot.sampleMs = now;
+  slot.sampleBytes = bytes;
+
+  status.bytes = bytes;
+  status.elapsedMs = now - slot.startMs;
+  status.averageBps = status.elapsedMs ? (uint64_t)bytes * 1000 / status.elapsedMs : 0;
+  if (status.total) {
+    uint32_t left = bytes < status.total ? status.total - bytes : 0;
+    uint32_t rate = status.rateBps ? status.rateBps : status.averageBps;
+    status.percent = (uint64_t)(bytes < status.total ? bytes : status.total) * 100 / status.total;
+    status.etaS = rate ? (left + rate - 1) / rate : -1;
+  }
+}
+
+/**
+ * @brief Records the bytes a transfer has moved so far. Cheap enough to call for every chunk.
+ */
+void TransferTracker::progress(int8_t index, uint32_t bytes) {
+  if (index < 0 || index >= TRANSFER_SLOTS) {
+    return;
+  }
+  Slot& slot = slots[index];
+  slot.bytes = bytes;
+  // --- Everything but the byte count waits for the next sample ---
+  uint32_t now = millis();
+  if (now - slot.sampleMs < TRANSFER_SAMPLE_MS) {
+    return;
+  }
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  if (slot.used) {
+    update(slot, now);
+    changes = changes + 1;
+  }
+  xSemaphoreGive(mutex);
+}
+
+/**
+ * @brief Ends a transfer and keeps it with the recent ones.
+ */
+void TransferTracker::finish(int8_t index, bool ok) {
+  if (index < 0 || index >= TRANSFER_SLOTS) {
+    return;
+  }
+  Slot& slot = slots[index];
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  if (slot.used) {
+    uint32_t now = millis();
+    // --- The rate of a finished transfer is its average; the last window may be a few bytes ---
+    update(slot, now);
+    slot.status.rateBps = slot.status.averageBps;
+    slot.status.state = ok ? TRANSFER_DONE : TRANSFER_FAILED;
+    slot.status.etaS = ok && slot.status.total ? 0 : -1;
+    if (ok && slot.status.total) {
+      slot.status.percent = 100;
+    }
+    done[doneNext] = slot.status;
+    doneNext = (doneNext + 1) % TRANSFER_RECENT;
+    if (doneCount < TRANSFER_RECENT) {
+      doneCount++;
+    }
+    slot.used = false;
+    changes = changes + 1;
+    finished = finished + 1;
+  }
+  xSemaphoreGive(mutex);
+}
+
+/**
+ * @brief Copies the running transfers into out. Returns how many were copied.
+ */
+uint8_t TransferTracker::active(TransferStatus* out, uint8_t max) {
+  if (!mutex) {
+    return 0;
+  }
+  uint8_t count = 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for (uint8_t i = 0; i < TRANSFER_SLOTS && count < max; i++) {
+    if (slots[i].used) {
+      out[count++] = slots[i].status;
+    }
+  }
+  xSemaphoreGive(mutex);
+  return count;
+}
+
+/**
+ * @brief Copies the finished transfers into out, newest first. Returns how many were copied.
+ */
+uint8_t TransferTracker::recent(TransferStatus* out, uint8_t max) {
+  if (!mutex) {
+    return 0;
+  }
+  uint8_t count = 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for (; count < doneCount && count < max; count++) {
+    out[count] = done[(doneNext + TRANSFER_RECENT - 1 - count) % TRANSFER_RECENT];
+  }
+  xSemaphoreGive(mutex);
+  return count;
+}
+
+/**
+ * @brief Returns the API name of a transfer source.
+ */
+const char* transferSourceName(TransferSource source) {
+  return source == TRANSFER_FTP ? "ftp" : "http";
+}
+
+/**
+ * @brief Returns the API name of a transfer direction.
+ */
+const char* transferDirectionName(TransferDirection direction) {
+  return direction == TRANSFER_UPLOAD ? "upload" : "download";
+}
+
+/**
+ * @brief Returns the API name of a transfer state.
+ */
+const char* transferStateName(TransferState state) {
+  switch (state) {
+    case TRANSFER_RUNNING: return "running";
+    case TRANSFER_DONE: return "done";
+    case TRANSFER_FAILED: return "failed";
+  }
+  return "unknown";
+}
@@ -0,0 +1,268 @@
+/******************************************************************************
+ *
+ * FrameFi - UI Output
+ * ----------------
+ * Queue-driven LED and display output on a low priority task; the APA102
+ * frame goes out as an SPI DMA transaction.
+ *
+ *****************************************************************************/
+
+#include "ui_output.h"
+
+#include <string.h>
+
+#include "Arduino.h"
+#include "esp_heap_caps.h"
+
+UiOutput uiOutput;
+
+/**
+ * @brief Queues the LED buffer for the output task; safe to call from any task.
+ */
+void showLeds() {
+  uiOutput.showLeds();
+}
+
+UiOutput::UiOutput()
+    : leds(nullptr), ledCount(0), queue(NULL), task(NULL), showHandler(nullptr), pollHandler(nullptr),
+      ledsQueued(false), working(false), lastBlinkMs(0), counters{0, 0, 0, 0}, ledDevice(nullptr),
+      ledTransaction{}, ledFrame(nullptr), ledFrameBytes(0), ledPending(false) {}
+
+/**
+ * @brief Sets up the LED bus and starts the output task.
+ */
+bool UiOutput::begin(const CRGB* ledBuffer, uint8_t count) {
+  if (task) {
+    return true;
+  }
+  leds = ledBuffer;
+  ledCount = count;
+  if (!beginSpi()) {
+    // --- Without a bus of its own the LED is bit-banged, still only from the output task ---
+    FastLED.addLeds<APA102, LED_DI_PIN, LED_CI_PIN, BGR>(const_cast<CRGB*>(leds), ledCount);
+  }
+
+  queue = xQueueCreate(UI_OUTPUT_QUEUE_LENGTH, sizeof(UiOutputMessage));
+  if (!queue) {
+    return false;
+  }
+  if (xTaskCreatePinnedToCore(taskEntry, "ui_output", 4096, this, 1, &task, UI_OUTPUT_TASK_CORE) != pdPASS) {
+    vQueueDelete(queue);
+    queue = NULL;
+    task = NULL;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Claims an SPI bus for the LED. Returns false if it is not available.
+ */
+bool UiOutput::beginSpi() {
+  // --- Start frame, one frame per LED and at least half a clock per LED to push the data through ---
+  uint16_t endBytes = 4 * (ledCount / 64 + 1);
+  ledFrameBytes = 4 + 4 * ledCount + endBytes;
+  ledFrame = (uint8_t*)heap_caps_malloc(ledFrameBytes, MALLOC_CAP_DMA);
+  if (!ledFrame) {
+    return false;
+  }
+
+  spi_bus_config_t bus = {};
+  bus.mosi_io_num = LED_DI_PIN;
+  bus.miso_io_num = -1;
+  bus.sclk_io_num = LED_CI_PIN;
+  bus.quadwp_io_num = -1;
+  bus.quadhd_io_num = -1;
+  bus.max_transfer_sz = ledFrameBytes;
+  if (spi_bus_initialize(UI_LED_SPI_HOST, &bus, SPI_DMA_CH_AUTO) != ESP_OK) {
+    heap_caps_free(ledFrame);
+    ledFrame = nullptr;
+    return false;
+  }
+
+  spi_device_interface_config_t device = {};
+  device.mode = 0;
+  device.clock_speed_hz = UI_LED_SPI_HZ;
+  device.spics_io_num = -1;
+  device.queue_size = 1;
+  if (spi_bus_add_device(UI_LED_SPI_HOST, &device, &ledDevice) != ESP_OK) {
+    spi_bus_free(UI_LED_SPI_HOST);
+    heap_caps_free(ledFrame);
+    ledFrame = nullptr;
+    ledDevice = nullptr;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Hands the display to the output task; call once the display is set up.
+ */
+void UiOutput::attachScreen(UiScreenHandler show, UiPollHandler poll) {
+  showHandler = show;
+  pollHandler = poll;
+}
+
+/**
+ * @brief Posts a message without blocking.
+ */
+void UiOutput::post(UiOutputKind kind, uint8_t screen) {
+  if (!queue) {
+    return;
+  }
+  UiOutputMessage message = {kind, screen};
+  if (xQueueSend(queue, &message, 0) != pdTRUE) {
+    counters.dropped++;
+    if (kind == UI_OUTPUT_LEDS) {
+      ledsQueued = false;
+    }
+  }
+}
+
+/**
+ * @brief Queues the LED buffer for sending. Never blocks.
+ */
+void UiOutput::showLeds() {
+  // --- The task reads the buffer when it sends, so one waiting message covers every change ---
+  if (ledsQueued) {
+    return;
+  }
+  ledsQueued = true;
+  post(UI_OUTPUT_LEDS, 0);
+}
+
+/**
+ * @brief Queues an activity blink. Never blocks; blinks closer than the interval are dropped.
+ */
+void UiOutput::blink() {
+  // --- Cheap rate limit so busy transfers don't even touch the queue ---
+  uint32_t now = millis();
+  if (now - lastBlinkMs < ACTIVITY_BLINK_INTERVAL_MS) {
+    return;
+  }
+  lastBlinkMs = now;
+  post(UI_OUTPUT_BLINK, 0);
+}
+
+/**
+ * @brief Queues an application screen for drawing. Never blocks.
+ */
+void UiOutput::showScreen(uint8_t screen) {
+  post(UI_OUTPUT_SCREEN, screen);
+}
+
+/**
+ * @brief Waits up to timeoutMs for every queued message to be handled.
+ */
+bool UiOutput::waitIdle(uint32_t timeoutMs) {
+  uint32_t start = millis();
+  while (queue && (uxQueueMessagesWaiting(queue) > 0 || working)) {
+    if (millis() - start >= timeoutMs) {
+      return false;
+    }
+    vTaskDelay(1);
+  }
+  return true;
+}
+
+/**
+ * @brief Sends the LED buffer, or all LEDs dark, scaled to the global brightness.
+ */
+void UiOutput::pushLeds(bool dark) {
+  if (!ledDevice) {
+    if (dark) {
+      FastLED.showColor(CRGB::Black);
+    } else {
+      FastLED.show();
+    }
+    counters.ledFrames++;
+    return;
+  }
+
+  // --- The frame buffer is only rewritten once the last transaction is done with it ---
+  if (ledPending) {
+    spi_transaction_t* done;
+    spi_device_get_trans_result(ledDevice, &done, portMAX_DELAY);
+    ledPending = false;
+  }
+
+  uint8_t brightness = FastLED.getBrightness();
+  uint8_t* out = ledFrame;
+  memset(out, 0x00, 4);
+  out += 4;
+  for (uint8_t i = 0; i < ledCount; i++) {
+    CRGB color = dark ? CRGB(CRGB::Black) : leds[i];
+    *out++ = 0xFF;  // Full global brightness; the colour is scaled instead
+    *out++ = scale8_video(color.b, brightness);
+    *out++ = scale8_video(color.g, brightness);
+    *out++ = scale8_video(color.r, brightness);
+  }
+  memset(out, 0xFF, ledFrame + ledFrameBytes - out);
+
+  memset(&ledTransaction, 0, sizeof(ledTransaction));
+  ledTransaction.length = ledFrameBytes * 8;
+  ledTransaction.tx_buffer = ledFrame;
+  if (spi_device_queue_trans(ledDevice, &ledTransaction, 0) == ESP_OK) {
+    ledPending = true;
+    counters.ledFrames++;
+  }
+}
+
+void UiOutput::taskEntry(void* arg) {
+  static_cast<UiOutput*>(arg)->runTask();
+}
+
+/**
+ * @brief Output task: sends LED frames, times blinks and keeps the display up to date.
+ */
+void UiOutput::runTask() {
+  bool blinking = false;
+  uint32_t blinkEndMs = 0;
+  uint32_t lastPollMs = 0;
+  UiOutputMessage message;
+  for (;;) {
+    TickType_t wait = pdMS_TO_TICKS(UI_OUTPUT_POLL_MS);
+    if (blinking) {
+      int32_t left = (int32_t)(blinkEndMs - millis());
+      wait = left > 0 ? pdMS_TO_TICKS(left) : 0;
+    }
+    bool received = xQueueReceive(queue, &message, wait) == pdTRUE;
+    working = true;
+    uint32_t start = micros();
+
+    if (received) {
+      switch (message.kind) {
+        case UI_OUTPUT_LEDS:
+          ledsQueued = false;
+          // --- A running blink shows the new colour when it ends ---
+          if (!blinking) {
+            pushLeds(false);
+          }
+          break;
+        case UI_OUTPUT_BLINK:
+          // --- Blink dark without touching the LED buffer, so the reported LED state stays intact ---
+          pushLeds(true);
+          blinking = true;
+          blinkEndMs = millis() + ACTIVITY_BLINK_OFF_MS;
+          break;
+        case UI_OUTPUT_SCREEN:
+          if (showHandler) {
+            showHandler(message.screen);
+            counters.screens++;
+          }
+          break;
+      }
+    }
+    if (blinking && (int32_t)(millis() - blinkEndMs) >= 0) {
+      blinking = false;
+      pushLeds(false);
+    }
+    if (pollHandler && millis() - lastPollMs >= UI_OUTPUT_POLL_MS) {
+      lastPollMs = millis();
+      pollHandler();
+    }
+
+    counters.busyUs += micros() - start;
+    working = false;
+  }
+}
@@ -0,0 +1,248 @@
+/******************************************************************************
+ *
+ * FrameFi - Upload Writer
+ * ----------------
+ * Writes HTTP uploads to a preallocated temp file in whole-cluster blocks
+ * and renames it into place once the upload is complete.
+ *
+ *****************************************************************************/
+
+#include "upload_writer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_heap_caps.h>
+
+#include "storage.h"
+
+UploadWriter* UploadWriter::first = nullptr;
+
+UploadWriter::UploadWriter()
+    : next(nullptr), open(false), existed(false), oldSize(0), block(nullptr), blockSize(0), fill(0), written(0),
+      hashing(false), hashed(false) {
+  path[0] = '\0';
+  partPath[0] = '\0';
+  mbedtls_sha256_init(&hash);
+}
+
+UploadWriter::~UploadWriter() {
+  abort();
+  if (block) {
+    heap_caps_free(block);
+  }
+  mbedtls_sha256_free(&hash);
+}
+
+/**
+ * @brief Creates the temp file next to path and preallocates expectedSize bytes if non-zero.
+ */
+FRESULT UploadWriter::begin(const char* target, uint32_t expectedSize, bool hashContent) {
+  if (open) {
+    return FR_DENIED;
+  }
+  if (snprintf(path, sizeof(path), STORAGE_FAT_DRIVE "%s", target) >= (int)sizeof(path)) {
+    return FR_INVALID_NAME;
+  }
+  snprintf(partPath, sizeof(partPath), "%s" UPLOAD_PART_SUFFIX, path);
+
+  FILINFO info;
+  existed = f_stat(path, &info) == FR_OK;
+  oldSize = existed ? info.fsize : 0;
+  fill = 0;
+  written = 0;
+  hashed = false;
+  hashing = hashContent && mbedtls_sha256_starts_ret(&hash, 0) == 0;
+
+  FRESULT result = f_open(&file, partPath, FA_CREATE_ALWAYS | FA_WRITE);
+  if (result != FR_OK) {
+    return result;
+  }
+  open = true;
+  link();
+
+  // --- Whole clusters per block so each write lands on cluster boundaries ---
+  if (!block) {
+    size_t clusterSize = (size_t)file.obj.fs->csize * file.obj.fs->ssize;
+    blockSize = UPLOAD_BLOCK_SIZE - UPLOAD_BLOCK_SIZE % clusterSize;
+    if (blockSize == 0) {
+      blockSize = clusterSize;
+    }
+    // --- Card DMA goes straight into internal RAM; PSRAM only if that is exhausted ---
+    block = (uint8_t*)heap_caps_aligned_alloc(4, blockSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA);
+    if (!block) {
+      block = (uint8_t*)heap_caps_aligned_alloc(4, blockSize, MALLOC_CAP_SPIRAM);
+    }
+    if (!block) {
+      abort();
+      return FR_NOT_ENOUGH_CORE;
+    }
+  }
+
+  if (expectedSize > 0) {
+    // --- Seeking past the end allocates the whole chain now; it stops short if the card is full ---
+    result = f_lseek(&file, expectedSize);
+    if (result == FR_OK && f_tell(&file) != expectedSize) {
+      result = FR_DENIED;
+    }
+    if (result == FR_OK) {
+      result = f_lseek(&file, 0);
+    }
+    if (result != FR_OK) {
+      abort();
+      return result;
+    }
+  }
+  return FR_OK;
+}
+
+/**
+ * @brief Returns the path being written, relative to the card root.
+ */
+const char* UploadWriter::targetPath() const {
+  return path[0] ? path + strlen(STORAGE_FAT_DRIVE) : path;
+}
+
+/**
+ * @brief Buffers data and writes every full block to the card.
+ */
+FRESULT UploadWriter::write(const uint8_t* data, size_t length) {
+  if (!open) {
+    return FR_INVALID_OBJECT;
+  }
+  if (hashing && mbedtls_sha256_update_ret(&hash, data, length) != 0) {
+    hashing = false;
+  }
+  while (length > 0) {
+    size_t chunk = blockSize - fill;
+    if (chunk > length) {
+      chunk = length;
+    }
+    memcpy(block + fill, data, chunk);
+    fill += chunk;
+    data += chunk;
+    length -= chunk;
+    if (fill == blockSize) {
+      FRESULT result = flush();
+      if (result != FR_OK) {
+        return result;
+      }
+    }
+  }
+  return FR_OK;
+}
+
+/**
+ * @brief Writes the buffered bytes to the card.
+ */
+FRESULT UploadWriter::flush() {
+  if (fill == 0) {
+    return FR_OK;
+  }
+  UINT bytesWritten = 0;
+  FRESULT result = f_write(&file, block, fill, &bytesWritten);
+  written += bytesWritten;
+  fill = 0;
+  if (result == FR_OK && bytesWritten == 0) {
+    result = FR_DENIED;
+  }
+  return result;
+}
+
+/**
+ * @brief Writes what is left, trims the file and renames it over the target.
+ */
+FRESULT UploadWriter::commit() {
+  if (!open) {
+    return FR_INVALID_OBJECT;
+  }
+  if (!storage.fatOwnsCard()) {
+    discard();
+    return FR_NOT_READY;
+  }
+  // --- Drop the preallocated clusters past the last byte written ---
+  FRESULT result = flush();
+  if (result == FR_OK) {
+    result = f_truncate(&file);
+  }
+  FRESULT closeResult = f_close(&file);
+  open = false;
+  unlink();
+  if (result == FR_OK) {
+    result = closeResult;
+  }
+  if (result != FR_OK) {
+    f_unlink(partPath);
+    return result;
+  }
+  // --- FAT has no rename-over; the old file goes first and the complete one takes its name ---
+  if (existed) {
+    result = f_unlink(path);
+  }
+  if (result == FR_OK) {
+    result = f_rename(partPath, path);
+  }
+  if (result == FR_OK && hashing) {
+    hashed = mbedtls_sha256_finish_ret(&hash, sha256) == 0;
+  }
+  hashing = false;
+  return result;
+}
+
+/**
+ * @brief Closes and deletes the temp file.
+ */
+void UploadWriter::abort() {
+  if (!open) {
+    return;
+  }
+  if (!storage.fatOwnsCard()) {
+    discard();
+    return;
+  }
+  f_close(&file);
+  f_unlink(partPath);
+  open = false;
+  fill = 0;
+  unlink();
+}
+
+/**
+ * @brief Forgets the temp file without touching the card. For when FatFs no longer owns it.
+ */
+void UploadWriter::discard() {
+  open = false;
+  fill = 0;
+  hashing = false;
+  unlink();
+}
+
+/**
+ * @brief Aborts every open upload. Call before the card is handed to the USB host.
+ */
+void UploadWriter::abortAll() {
+  while (first) {
+    first->abort();
+  }
+}
+
+/**
+ * @brief Adds this writer to the list of open uploads. A writer is listed exactly while it is open.
+ */
+void UploadWriter::link() {
+  next = first;
+  first = this;
+}
+
+/**
+ * @brief Removes this writer from the list of open uploads.
+ */
+void UploadWriter::unlink() {
+  for (UploadWriter** entry = &first; *entry; entry = &(*entry)->next) {
+    if (*entry == this) {
+      *entry = next;
+      break;
+    }
+  }
+  next = nullptr;
+}
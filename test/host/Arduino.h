@@ -0,0 +1,19 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+
+// =========================================================================
+// == Host Arduino
+// == The few Arduino calls the storage and transfer modules make, for
+// == native tests. millis() is a clock the test moves by hand.
+// =========================================================================
+
+inline uint32_t& hostMillis() {
+  static uint32_t now = 0;
+  return now;
+}
+
+inline unsigned long millis() { return hostMillis(); }
+
+#endif // HOST_ARDUINO_H
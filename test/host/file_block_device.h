@@ -0,0 +1,123 @@
+#ifndef FILE_BLOCK_DEVICE_H
+#define FILE_BLOCK_DEVICE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+
+#include "sector_cache.h"
+
+// =========================================================================
+// == File Block Device
+// == A BlockDevice backed by a temporary file, standing in for the card
+// == in native tests. It counts the commands it is given so tests can
+// == check how the cache and read-ahead batch their I/O, and can be told
+// == to fail to exercise error paths.
+// =========================================================================
+
+class FileBlockDevice {
+public:
+  FileBlockDevice(uint16_t sectorSize, uint32_t sectorCount)
+      : sectorBytes(sectorSize), sectors(sectorCount), file(tmpfile()), failing(false),
+        reads(0), writes(0), sectorsRead(0), sectorsWritten(0) {
+    // --- Start from a known pattern so unwritten sectors can be checked too ---
+    uint8_t* sector = new uint8_t[sectorBytes];
+    for (uint32_t lba = 0; file && lba < sectors; lba++) {
+      fill(lba, 0, sector);
+      fwrite(sector, 1, sectorBytes, file);
+    }
+    delete[] sector;
+  }
+
+  ~FileBlockDevice() {
+    if (file) {
+      fclose(file);
+    }
+  }
+
+  /**
+   * @brief Returns the BlockDevice that reads and writes this file.
+   */
+  BlockDevice device() {
+    BlockDevice block = {this, readBlocks, writeBlocks};
+    return block;
+  }
+
+  /**
+   * @brief Writes the pattern for an LBA and generation into a sector buffer.
+   */
+  void fill(uint32_t lba, uint8_t generation, uint8_t* dst) const {
+    for (uint16_t i = 0; i < sectorBytes; i++) {
+      dst[i] = (uint8_t)(lba * 31 + generation * 7 + i);
+    }
+  }
+
+  /**
+   * @brief Reads sectors straight from the file, bypassing the counters.
+   */
+  bool peek(uint32_t lba, uint32_t count, uint8_t* dst) {
+    std::lock_guard<std::mutex> guard(lock);
+    return transfer(lba, count, dst, false);
+  }
+
+  /**
+   * @brief Makes every following command fail, or succeed again.
+   */
+  void setFailing(bool fail) { failing = fail; }
+
+  /**
+   * @brief Clears the command counters.
+   */
+  void resetCounters() {
+    std::lock_guard<std::mutex> guard(lock);
+    reads = writes = sectorsRead = sectorsWritten = 0;
+  }
+
+  uint32_t readCommands() const { return reads; }
+  uint32_t writeCommands() const { return writes; }
+  uint32_t readSectors() const { return sectorsRead; }
+  uint32_t writtenSectors() const { return sectorsWritten; }
+  uint32_t sectorCount() const { return sectors; }
+
+private:
+  static bool readBlocks(void* context, uint32_t lba, uint32_t count, uint8_t* dst) {
+    FileBlockDevice* self = static_cast<FileBlockDevice*>(context);
+    std::lock_guard<std::mutex> guard(self->lock);
+    self->reads++;
+    self->sectorsRead += count;
+    return !self->failing && self->transfer(lba, count, dst, false);
+  }
+
+  static bool writeBlocks(void* context, uint32_t lba, uint32_t count, const uint8_t* src) {
+    FileBlockDevice* self = static_cast<FileBlockDevice*>(context);
+    std::lock_guard<std::mutex> guard(self->lock);
+    self->writes++;
+    self->sectorsWritten += count;
+    return !self->failing && self->transfer(lba, count, const_cast<uint8_t*>(src), true);
+  }
+
+  bool transfer(uint32_t lba, uint32_t count, uint8_t* data, bool toFile) {
+    if (!file || count == 0 || lba >= sectors || count > sectors - lba) {
+      return false;
+    }
+    if (fseek(file, (long)lba * sectorBytes, SEEK_SET) != 0) {
+      return false;
+    }
+    size_t bytes = (size_t)count * sectorBytes;
+    size_t done = toFile ? fwrite(data, 1, bytes, file) : fread(data, 1, bytes, file);
+    return done == bytes;
+  }
+
+  uint16_t sectorBytes;
+  uint32_t sectors;
+  FILE* file;
+  std::mutex lock;  // the read-ahead task and the test thread both issue commands
+  volatile bool failing;
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t sectorsRead;
+  uint32_t sectorsWritten;
+};
+
+#endif // FILE_BLOCK_DEVICE_H
@@ -0,0 +1,23 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <stdint.h>
+
+// =========================================================================
+// == Host FreeRTOS
+// == Just enough of the FreeRTOS API for the storage modules to run in
+// == native tests: mutexes are std::mutex and tasks are std::thread.
+// == Only found on the include path of the native test environment.
+// =========================================================================
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,26 @@
+#ifndef HOST_SEMPHR_H
+#define HOST_SEMPHR_H
+
+#include <mutex>
+
+#include "freertos/FreeRTOS.h"
+
+typedef std::mutex* SemaphoreHandle_t;
+
+// --- Mutexes live as long as the process, like the firmware's ---
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::mutex(); }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t wait) {
+  if (wait == portMAX_DELAY) {
+    mutex->lock();
+    return pdTRUE;
+  }
+  return mutex->try_lock() ? pdTRUE : pdFALSE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+  mutex->unlock();
+  return pdTRUE;
+}
+
+#endif // HOST_SEMPHR_H
@@ -0,0 +1,68 @@
+#ifndef HOST_TASK_H
+#define HOST_TASK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "freertos/FreeRTOS.h"
+
+struct HostTask {
+  std::mutex lock;
+  std::condition_variable wake;
+  uint32_t notifications = 0;
+};
+
+typedef HostTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+// --- The task the calling thread runs, for the notify calls ---
+inline HostTask*& hostCurrentTask() {
+  static thread_local HostTask* current = nullptr;
+  return current;
+}
+
+// --- Tasks never end, so their state is never freed ---
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t entry, const char* name, uint32_t stackDepth, void* arg,
+                                          BaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  HostTask* task = new HostTask();
+  if (handle) {
+    *handle = task;
+  }
+  std::thread([task, entry, arg]() {
+    hostCurrentTask() = task;
+    entry(arg);
+  }).detach();
+  return pdPASS;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  {
+    std::lock_guard<std::mutex> guard(task->lock);
+    task->notifications++;
+  }
+  task->wake.notify_one();
+  return pdPASS;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait) {
+  HostTask* task = hostCurrentTask();
+  std::unique_lock<std::mutex> guard(task->lock);
+  if (wait == portMAX_DELAY) {
+    task->wake.wait(guard, [task]() { return task->notifications > 0; });
+  } else {
+    task->wake.wait_for(guard, std::chrono::milliseconds(wait), [task]() { return task->notifications > 0; });
+  }
+  uint32_t count = task->notifications;
+  if (count > 0) {
+    task->notifications = clearOnExit ? 0 : count - 1;
+  }
+  return count;
+}
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+
+#define taskYIELD() std::this_thread::yield()
+
+#endif // HOST_TASK_H
@@ -0,0 +1,411 @@
+/******************************************************************************
+ *
+ * FrameFi - MSC Cache Tests
+ * ----------------
+ * Runs the sector cache and the read-ahead against a file-backed block
+ * device on the host: pio test -e native
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <unity.h>
+
+#include "file_block_device.h"
+#include "read_ahead.h"
+#include "sector_cache.h"
+
+#define SECTOR 512
+#define DISK_SECTORS 256
+#define CACHE_SLOTS 16
+#define STAGING_SECTORS 8
+#define RA_BUFFERS 3
+#define RA_SECTORS 8
+
+// --- The read-ahead task never ends, so the object it runs on must outlive every test ---
+static ReadAhead readAhead;
+
+static uint8_t slotMemory[CACHE_SLOTS * SECTOR];
+static uint8_t stagingMemory[STAGING_SECTORS * SECTOR];
+static uint8_t readAheadMemory[RA_BUFFERS * RA_SECTORS * SECTOR];
+
+void setUp() {}
+
+void tearDown() {
+  readAhead.end();
+}
+
+/**
+ * @brief Attaches a cache with the test's slot and staging memory.
+ */
+static void beginCache(SectorCache& cache, const BlockDevice& device) {
+  TEST_ASSERT_TRUE(cache.begin(device, SECTOR, CACHE_SLOTS, slotMemory, stagingMemory, STAGING_SECTORS));
+}
+
+/**
+ * @brief Fills count sectors starting at lba with one generation of the device's pattern.
+ */
+static void pattern(FileBlockDevice& disk, uint32_t lba, uint32_t count, uint8_t generation, uint8_t* dst) {
+  for (uint32_t i = 0; i < count; i++) {
+    disk.fill(lba + i, generation, dst + i * SECTOR);
+  }
+}
+
+/**
+ * @brief Waits for the read-ahead task to have prefetched at least sectors in total.
+ */
+static bool waitForPrefetch(uint32_t sectors) {
+  for (int i = 0; i < 1000; i++) {
+    if (readAhead.stats().prefetched >= sectors) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+/**
+ * @brief Compares the whole device with the expected contents.
+ */
+static void assertDisk(FileBlockDevice& disk, const std::vector<uint8_t>& expected) {
+  std::vector<uint8_t> actual(expected.size());
+  TEST_ASSERT_TRUE(disk.peek(0, DISK_SECTORS, actual.data()));
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), actual.data(), expected.size());
+}
+
+// --- Sector Cache ---
+
+void test_cache_serves_its_own_writes() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t written[SECTOR], read[SECTOR];
+  disk.fill(10, 1, written);
+  TEST_ASSERT_TRUE(cache.write(10, 1, written, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, disk.writeCommands());
+  TEST_ASSERT_TRUE(cache.isDirty());
+
+  TEST_ASSERT_TRUE(cache.read(10, 1, read));
+  TEST_ASSERT_EQUAL_MEMORY(written, read, SECTOR);
+  TEST_ASSERT_EQUAL_UINT32(1, cache.stats().readHits);
+  TEST_ASSERT_EQUAL_UINT32(0, disk.readCommands());
+  cache.end();
+}
+
+void test_cache_reads_gaps_in_one_command() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t sector[SECTOR];
+  disk.fill(25, 1, sector);
+  TEST_ASSERT_TRUE(cache.write(25, 1, sector, 0));
+
+  // --- 20..24 from the card, 25 from the cache, 26..29 from the card ---
+  uint8_t read[10 * SECTOR], expected[10 * SECTOR];
+  pattern(disk, 20, 10, 0, expected);
+  disk.fill(25, 1, expected + 5 * SECTOR);
+  TEST_ASSERT_TRUE(cache.read(20, 10, read));
+  TEST_ASSERT_EQUAL_MEMORY(expected, read, sizeof(read));
+  TEST_ASSERT_EQUAL_UINT32(2, disk.readCommands());
+  TEST_ASSERT_EQUAL_UINT32(9, cache.stats().readMisses);
+  cache.end();
+}
+
+void test_cache_flush_coalesces_neighbours() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  // --- Out of order single-sector writes, as a host updating a FAT ---
+  static const uint32_t order[] = {27, 20, 23, 21, 26, 22, 25, 24, 60, 62};
+  uint8_t sector[SECTOR];
+  for (uint32_t lba : order) {
+    disk.fill(lba, 2, sector);
+    TEST_ASSERT_TRUE(cache.write(lba, 1, sector, 0));
+  }
+  TEST_ASSERT_TRUE(cache.flush());
+  TEST_ASSERT_FALSE(cache.isDirty());
+
+  // --- 20..27 in one command, then 60 and 62 on their own ---
+  TEST_ASSERT_EQUAL_UINT32(3, disk.writeCommands());
+  TEST_ASSERT_EQUAL_UINT32(10, disk.writtenSectors());
+  TEST_ASSERT_EQUAL_UINT32(3, cache.stats().deviceWrites);
+
+  uint8_t expected[8 * SECTOR], actual[8 * SECTOR];
+  pattern(disk, 20, 8, 2, expected);
+  TEST_ASSERT_TRUE(disk.peek(20, 8, actual));
+  TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(actual));
+  cache.end();
+}
+
+void test_cache_flush_runs_respect_staging_size() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t data[12 * SECTOR];
+  pattern(disk, 100, 12, 3, data);
+  TEST_ASSERT_TRUE(cache.write(100, 12, data, 0));
+  TEST_ASSERT_TRUE(cache.flush());
+  TEST_ASSERT_EQUAL_UINT32(2, disk.writeCommands());
+  TEST_ASSERT_EQUAL_UINT32(12, disk.writtenSectors());
+  cache.end();
+}
+
+void test_cache_bypass_drops_stale_copies() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t sector[SECTOR];
+  disk.fill(100, 1, sector);
+  TEST_ASSERT_TRUE(cache.write(100, 1, sector, 0));
+
+  std::vector<uint8_t> bulk(MSC_CACHE_BYPASS_SECTORS * SECTOR);
+  pattern(disk, 90, MSC_CACHE_BYPASS_SECTORS, 2, bulk.data());
+  TEST_ASSERT_TRUE(cache.write(90, MSC_CACHE_BYPASS_SECTORS, bulk.data(), 0));
+  TEST_ASSERT_EQUAL_UINT32(MSC_CACHE_BYPASS_SECTORS, cache.stats().writesBypassed);
+  TEST_ASSERT_FALSE(cache.isDirty());
+
+  // --- The older cached copy must neither be served nor written back over the bulk data ---
+  uint8_t read[SECTOR];
+  TEST_ASSERT_TRUE(cache.read(100, 1, read));
+  TEST_ASSERT_EQUAL_MEMORY(bulk.data() + 10 * SECTOR, read, SECTOR);
+  TEST_ASSERT_TRUE(cache.end());
+  TEST_ASSERT_TRUE(disk.peek(100, 1, read));
+  TEST_ASSERT_EQUAL_MEMORY(bulk.data() + 10 * SECTOR, read, SECTOR);
+}
+
+void test_cache_flushes_when_full() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t sector[SECTOR];
+  for (uint32_t i = 0; i <= CACHE_SLOTS; i++) {
+    disk.fill(i * 3, 4, sector);
+    TEST_ASSERT_TRUE(cache.write(i * 3, 1, sector, 0));
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, cache.stats().flushes);
+  TEST_ASSERT_EQUAL_UINT32(CACHE_SLOTS, disk.writtenSectors());
+  TEST_ASSERT_TRUE(cache.end());
+
+  uint8_t read[SECTOR];
+  for (uint32_t i = 0; i <= CACHE_SLOTS; i++) {
+    disk.fill(i * 3, 4, sector);
+    TEST_ASSERT_TRUE(disk.peek(i * 3, 1, read));
+    TEST_ASSERT_EQUAL_MEMORY(sector, read, SECTOR);
+  }
+}
+
+void test_cache_flushes_only_when_idle() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t sector[SECTOR];
+  disk.fill(7, 1, sector);
+  TEST_ASSERT_TRUE(cache.write(7, 1, sector, 1000));
+  TEST_ASSERT_TRUE(cache.flushIfIdle(1000 + MSC_CACHE_FLUSH_MS - 1, MSC_CACHE_FLUSH_MS));
+  TEST_ASSERT_TRUE(cache.isDirty());
+  TEST_ASSERT_TRUE(cache.flushIfIdle(1000 + MSC_CACHE_FLUSH_MS, MSC_CACHE_FLUSH_MS));
+  TEST_ASSERT_FALSE(cache.isDirty());
+  TEST_ASSERT_EQUAL_UINT32(1, disk.writeCommands());
+  cache.end();
+}
+
+void test_cache_keeps_dirty_data_when_the_card_fails() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  uint8_t sector[SECTOR], read[SECTOR];
+  disk.fill(5, 6, sector);
+  TEST_ASSERT_TRUE(cache.write(5, 1, sector, 0));
+  disk.setFailing(true);
+  TEST_ASSERT_FALSE(cache.flush());
+  TEST_ASSERT_TRUE(cache.isDirty());
+
+  disk.setFailing(false);
+  TEST_ASSERT_TRUE(cache.flush());
+  TEST_ASSERT_TRUE(disk.peek(5, 1, read));
+  TEST_ASSERT_EQUAL_MEMORY(sector, read, SECTOR);
+  cache.end();
+}
+
+void test_cache_matches_a_plain_disk() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  SectorCache cache;
+  beginCache(cache, disk.device());
+
+  std::vector<uint8_t> model(DISK_SECTORS * SECTOR);
+  TEST_ASSERT_TRUE(disk.peek(0, DISK_SECTORS, model.data()));
+  std::vector<uint8_t> buffer(80 * SECTOR);
+  srand(1);
+  for (int step = 0; step < 3000; step++) {
+    uint32_t count = rand() % 4 == 0 ? 1 + rand() % 80 : 1 + rand() % 4;
+    uint32_t lba = rand() % (DISK_SECTORS - count + 1);
+    if (rand() % 2) {
+      pattern(disk, lba, count, (uint8_t)step, buffer.data());
+      TEST_ASSERT_TRUE(cache.write(lba, count, buffer.data(), step));
+      memcpy(model.data() + lba * SECTOR, buffer.data(), count * SECTOR);
+    } else {
+      TEST_ASSERT_TRUE(cache.read(lba, count, buffer.data()));
+      TEST_ASSERT_EQUAL_MEMORY(model.data() + lba * SECTOR, buffer.data(), count * SECTOR);
+    }
+    if (step % 500 == 499) {
+      TEST_ASSERT_TRUE(cache.flushIfIdle(step, 0));
+    }
+  }
+  TEST_ASSERT_TRUE(cache.end());
+  assertDisk(disk, model);
+}
+
+// --- Read-Ahead ---
+
+void test_read_ahead_prefetches_a_sequential_stream() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  TEST_ASSERT_TRUE(readAhead.begin(disk.device(), SECTOR, DISK_SECTORS, readAheadMemory, RA_BUFFERS, RA_SECTORS));
+
+  uint8_t read[RA_SECTORS * SECTOR], expected[RA_SECTORS * SECTOR];
+  TEST_ASSERT_TRUE(readAhead.read(0, RA_SECTORS, read));
+  TEST_ASSERT_TRUE(readAhead.read(RA_SECTORS, RA_SECTORS, read));
+  TEST_ASSERT_TRUE(waitForPrefetch(RA_SECTORS));
+
+  // --- The third request of the stream comes from RAM ---
+  uint32_t commands = disk.readCommands();
+  TEST_ASSERT_TRUE(readAhead.read(2 * RA_SECTORS, RA_SECTORS, read));
+  pattern(disk, 2 * RA_SECTORS, RA_SECTORS, 0, expected);
+  TEST_ASSERT_EQUAL_MEMORY(expected, read, sizeof(read));
+  TEST_ASSERT_EQUAL_UINT32(RA_SECTORS, readAhead.stats().hits);
+  TEST_ASSERT_TRUE(waitForPrefetch(3 * RA_SECTORS));
+  TEST_ASSERT_EQUAL_UINT32(commands + 2, disk.readCommands());
+  TEST_ASSERT_EQUAL_UINT32(2 * RA_SECTORS, readAhead.windowSectors());
+
+  // --- The window keeps growing while the stream lasts ---
+  for (uint32_t lba = 3 * RA_SECTORS; lba < 12 * RA_SECTORS; lba += RA_SECTORS) {
+    TEST_ASSERT_TRUE(readAhead.read(lba, RA_SECTORS, read));
+    pattern(disk, lba, RA_SECTORS, 0, expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, read, sizeof(read));
+  }
+  TEST_ASSERT_EQUAL_UINT32(RA_BUFFERS * RA_SECTORS, readAhead.windowSectors());
+  TEST_ASSERT_TRUE(readAhead.hitRate() > 0.0f);
+}
+
+void test_read_ahead_stays_idle_for_random_reads() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  TEST_ASSERT_TRUE(readAhead.begin(disk.device(), SECTOR, DISK_SECTORS, readAheadMemory, RA_BUFFERS, RA_SECTORS));
+
+  static const uint32_t seeks[] = {100, 5, 60, 30, 200, 17};
+  uint8_t read[4 * SECTOR], expected[4 * SECTOR];
+  for (uint32_t lba : seeks) {
+    TEST_ASSERT_TRUE(readAhead.read(lba, 4, read));
+    pattern(disk, lba, 4, 0, expected);
+    TEST_ASSERT_EQUAL_MEMORY(expected, read, sizeof(read));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  TEST_ASSERT_EQUAL_UINT32(0, readAhead.stats().prefetched);
+  TEST_ASSERT_EQUAL_UINT32(0, readAhead.windowSectors());
+  TEST_ASSERT_EQUAL_UINT32(6, disk.readCommands());
+}
+
+void test_read_ahead_write_drops_prefetched_data() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  TEST_ASSERT_TRUE(readAhead.begin(disk.device(), SECTOR, DISK_SECTORS, readAheadMemory, RA_BUFFERS, RA_SECTORS));
+
+  uint8_t read[RA_SECTORS * SECTOR], expected[RA_SECTORS * SECTOR];
+  TEST_ASSERT_TRUE(readAhead.read(0, RA_SECTORS, read));
+  TEST_ASSERT_TRUE(readAhead.read(RA_SECTORS, RA_SECTORS, read));
+  TEST_ASSERT_TRUE(waitForPrefetch(RA_SECTORS));
+
+  // --- Overwrite one sector of the buffer waiting for the stream ---
+  uint32_t lba = 2 * RA_SECTORS + 3;
+  uint8_t sector[SECTOR];
+  disk.fill(lba, 5, sector);
+  TEST_ASSERT_TRUE(readAhead.write(lba, 1, sector));
+  TEST_ASSERT_EQUAL_UINT32(RA_SECTORS, readAhead.stats().dropped);
+
+  TEST_ASSERT_TRUE(readAhead.read(2 * RA_SECTORS, RA_SECTORS, read));
+  pattern(disk, 2 * RA_SECTORS, RA_SECTORS, 0, expected);
+  memcpy(expected + 3 * SECTOR, sector, SECTOR);
+  TEST_ASSERT_EQUAL_MEMORY(expected, read, sizeof(read));
+}
+
+void test_read_ahead_rejects_use_after_end() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  TEST_ASSERT_TRUE(readAhead.begin(disk.device(), SECTOR, DISK_SECTORS, readAheadMemory, RA_BUFFERS, RA_SECTORS));
+  readAhead.end();
+  TEST_ASSERT_FALSE(readAhead.isAttached());
+
+  uint8_t read[SECTOR];
+  TEST_ASSERT_FALSE(readAhead.read(0, 1, read));
+  TEST_ASSERT_FALSE(readAhead.write(0, 1, read));
+}
+
+void test_cache_over_read_ahead_matches_a_plain_disk() {
+  FileBlockDevice disk(SECTOR, DISK_SECTORS);
+  TEST_ASSERT_TRUE(readAhead.begin(disk.device(), SECTOR, DISK_SECTORS, readAheadMemory, RA_BUFFERS, RA_SECTORS));
+  SectorCache cache;
+  beginCache(cache, readAhead.asBlockDevice());
+
+  std::vector<uint8_t> model(DISK_SECTORS * SECTOR);
+  TEST_ASSERT_TRUE(disk.peek(0, DISK_SECTORS, model.data()));
+  std::vector<uint8_t> buffer(80 * SECTOR);
+  srand(2);
+  uint32_t streamLba = 0;
+  for (int step = 0; step < 3000; step++) {
+    uint32_t count;
+    uint32_t lba;
+    int kind = rand() % 4;
+    if (kind == 0) {
+      // --- Sequential reads, as the host copying a file off the card ---
+      count = RA_SECTORS;
+      if (streamLba + count > DISK_SECTORS) {
+        streamLba = 0;
+      }
+      lba = streamLba;
+      streamLba += count;
+    } else {
+      count = 1 + rand() % (kind == 1 ? 80 : 4);
+      lba = rand() % (DISK_SECTORS - count + 1);
+    }
+    if (kind == 3) {
+      pattern(disk, lba, count, (uint8_t)step, buffer.data());
+      TEST_ASSERT_TRUE(cache.write(lba, count, buffer.data(), step));
+      memcpy(model.data() + lba * SECTOR, buffer.data(), count * SECTOR);
+    } else {
+      TEST_ASSERT_TRUE(cache.read(lba, count, buffer.data()));
+      TEST_ASSERT_EQUAL_MEMORY(model.data() + lba * SECTOR, buffer.data(), count * SECTOR);
+    }
+  }
+  TEST_ASSERT_TRUE(cache.end());
+  readAhead.end();
+  assertDisk(disk, model);
+  TEST_ASSERT_TRUE(readAhead.stats().prefetched > 0);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_cache_serves_its_own_writes);
+  RUN_TEST(test_cache_reads_gaps_in_one_command);
+  RUN_TEST(test_cache_flush_coalesces_neighbours);
+  RUN_TEST(test_cache_flush_runs_respect_staging_size);
+  RUN_TEST(test_cache_bypass_drops_stale_copies);
+  RUN_TEST(test_cache_flushes_when_full);
+  RUN_TEST(test_cache_flushes_only_when_idle);
+  RUN_TEST(test_cache_keeps_dirty_data_when_the_card_fails);
+  RUN_TEST(test_cache_matches_a_plain_disk);
+  RUN_TEST(test_read_ahead_prefetches_a_sequential_stream);
+  RUN_TEST(test_read_ahead_stays_idle_for_random_reads);
+  RUN_TEST(test_read_ahead_write_drops_prefetched_data);
+  RUN_TEST(test_read_ahead_rejects_use_after_end);
+  RUN_TEST(test_cache_over_read_ahead_matches_a_plain_disk);
+  return UNITY_END();
+}
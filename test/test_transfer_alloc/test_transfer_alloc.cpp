@@ -0,0 +1,211 @@
+/******************************************************************************
+ *
+ * FrameFi - Transfer Allocation Tests
+ * ----------------
+ * Counts heap allocations on the per-chunk transfer path: every chunk of
+ * an FTP or HTTP transfer reports its progress to the transfer tracker,
+ * which must not touch the heap to do so: pio test -e native
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include <unity.h>
+
+#include "Arduino.h"
+#include "transfer_tracker.h"
+
+#define CHUNK 1024
+#define MEGABYTE (1024 * 1024)
+
+// --- Heap calls made while counting is on ---
+static volatile bool counting = false;
+static volatile uint32_t allocations = 0;
+static volatile int32_t outstanding = 0;
+
+void* operator new(size_t size) {
+  if (counting) {
+    allocations++;
+    outstanding++;
+  }
+  void* block = malloc(size ? size : 1);
+  if (!block) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void operator delete(void* block) noexcept {
+  if (counting && block) {
+    outstanding--;
+  }
+  free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+  operator delete(block);
+}
+
+#if defined(__GLIBC__)
+// --- Plain C allocations too, which is what an Arduino String makes ---
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_realloc(void* block, size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void __libc_free(void* block);
+
+extern "C" void* malloc(size_t size) {
+  if (counting) {
+    allocations++;
+    outstanding++;
+  }
+  return __libc_malloc(size);
+}
+
+extern "C" void* realloc(void* block, size_t size) {
+  if (counting) {
+    allocations++;
+    if (!block) {
+      outstanding++;
+    }
+  }
+  return __libc_realloc(block, size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+  if (counting) {
+    allocations++;
+    outstanding++;
+  }
+  return __libc_calloc(count, size);
+}
+
+extern "C" void free(void* block) {
+  if (counting && block) {
+    outstanding--;
+  }
+  __libc_free(block);
+}
+#endif
+
+/**
+ * @brief Starts counting heap calls from zero.
+ */
+static void startCounting() {
+  allocations = 0;
+  outstanding = 0;
+  counting = true;
+}
+
+/**
+ * @brief Moves one transfer of size bytes through the tracker in chunks, as a session does.
+ */
+static bool runTransfer(TransferDirection direction, const char* name, uint32_t size, uint32_t total) {
+  int8_t slot = transferTracker.start(TRANSFER_FTP, direction, name, total);
+  if (slot < 0) {
+    return false;
+  }
+  for (uint32_t sent = CHUNK; sent <= size; sent += CHUNK) {
+    // --- About 10 MB/s, so the tracker samples every few dozen chunks ---
+    if (sent % (100 * CHUNK) == 0) {
+      hostMillis() += 10;
+    }
+    transferTracker.progress(slot, sent);
+  }
+  transferTracker.finish(slot, true);
+  return true;
+}
+
+void setUp() {
+  TEST_ASSERT_TRUE(transferTracker.begin());
+}
+
+void tearDown() {
+  counting = false;
+}
+
+void test_chunks_do_not_allocate() {
+  startCounting();
+  TEST_ASSERT_TRUE(runTransfer(TRANSFER_UPLOAD, "/2025/holiday/IMG_0001.JPG", 8 * MEGABYTE, 0));
+  TEST_ASSERT_TRUE(runTransfer(TRANSFER_DOWNLOAD, "/2025/holiday/IMG_0001.JPG", 8 * MEGABYTE, 8 * MEGABYTE));
+  counting = false;
+
+  // --- 16 MB in 1 KB chunks: 16384 progress reports and not one heap call ---
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+}
+
+void test_long_names_are_not_copied_to_the_heap() {
+  char name[600];
+  memset(name, 'a', sizeof(name) - 10);
+  strcpy(name + sizeof(name) - 10, "/last.jpg");
+
+  startCounting();
+  int8_t slot = transferTracker.start(TRANSFER_HTTP, TRANSFER_UPLOAD, name, 0);
+  TEST_ASSERT_TRUE(slot >= 0);
+  transferTracker.progress(slot, CHUNK);
+  transferTracker.finish(slot, true);
+  counting = false;
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+
+  // --- The stored name keeps the end of the path ---
+  TransferStatus last;
+  TEST_ASSERT_EQUAL_UINT32(1, transferTracker.recent(&last, 1));
+  TEST_ASSERT_EQUAL_UINT32(TRANSFER_NAME_SIZE - 1, strlen(last.name));
+  TEST_ASSERT_EQUAL_UINT32(0, strcmp(last.name + strlen(last.name) - 9, "/last.jpg"));
+}
+
+void test_many_transfers_leave_the_heap_as_they_found_it() {
+  startCounting();
+  // --- Several sessions at once, started and finished out of order ---
+  for (uint32_t round = 0; round < 200; round++) {
+    int8_t slots[TRANSFER_SLOTS];
+    for (uint8_t i = 0; i < TRANSFER_SLOTS; i++) {
+      slots[i] = transferTracker.start(TRANSFER_FTP, i % 2 ? TRANSFER_DOWNLOAD : TRANSFER_UPLOAD, "/a.jpg", 64 * CHUNK);
+      TEST_ASSERT_TRUE(slots[i] >= 0);
+    }
+    TEST_ASSERT_EQUAL_INT8(-1, transferTracker.start(TRANSFER_HTTP, TRANSFER_UPLOAD, "/full.jpg", 0));
+    for (uint32_t sent = CHUNK; sent <= 64 * CHUNK; sent += CHUNK) {
+      hostMillis() += 1;
+      for (uint8_t i = 0; i < TRANSFER_SLOTS; i++) {
+        transferTracker.progress(slots[i], sent);
+      }
+    }
+    for (uint8_t i = TRANSFER_SLOTS; i > 0; i--) {
+      transferTracker.finish(slots[i - 1], i % 2);
+    }
+  }
+  counting = false;
+
+  // --- Nothing allocated means nothing left behind to fragment the heap ---
+  TEST_ASSERT_EQUAL_UINT32(0, allocations);
+  TEST_ASSERT_EQUAL_INT32(0, outstanding);
+}
+
+void test_progress_is_sampled_while_it_runs() {
+  int8_t slot = transferTracker.start(TRANSFER_FTP, TRANSFER_DOWNLOAD, "/b.jpg", MEGABYTE);
+  TEST_ASSERT_TRUE(slot >= 0);
+  uint32_t version = transferTracker.version();
+  transferTracker.progress(slot, MEGABYTE / 4);
+  TEST_ASSERT_EQUAL_UINT32(version, transferTracker.version());
+
+  hostMillis() += TRANSFER_SAMPLE_MS;
+  transferTracker.progress(slot, MEGABYTE / 2);
+  TEST_ASSERT_TRUE(transferTracker.version() != version);
+
+  TransferStatus running;
+  TEST_ASSERT_EQUAL_UINT32(1, transferTracker.active(&running, 1));
+  TEST_ASSERT_EQUAL_UINT32(MEGABYTE / 2, running.bytes);
+  TEST_ASSERT_EQUAL_INT8(50, running.percent);
+  transferTracker.finish(slot, true);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_chunks_do_not_allocate);
+  RUN_TEST(test_long_names_are_not_copied_to_the_heap);
+  RUN_TEST(test_many_transfers_leave_the_heap_as_they_found_it);
+  RUN_TEST(test_progress_is_sampled_while_it_runs);
+  return UNITY_END();
+}